@@ -0,0 +1,331 @@
+/*
+* asyncwrite.c
+* Luabins Lua-less asynchronous write of saved data to file
+* See copyright notice in luabins.h
+*/
+
+#ifndef _POSIX_C_SOURCE
+  #define _POSIX_C_SOURCE 200809L /* fsync() */
+#endif
+
+#include <string.h> /* strlen() */
+
+#include "luaheaders.h"
+
+#include "asyncwrite.h"
+
+#ifndef LUABINS_NOASYNC
+  #include <errno.h>
+  #include <fcntl.h>
+  #include <unistd.h>
+#endif
+
+#if 0
+  #define SPAM(a) printf a
+#else
+  #define SPAM(a) (void)0
+#endif
+
+void lbs_asyncwriterInit(
+    lbs_AsyncWriter * w,
+    lua_Alloc alloc_fn,
+    void * alloc_ud
+  )
+{
+  lbsSB_init(&w->sb, alloc_fn, alloc_ud);
+  lbsSB_init(&w->path, alloc_fn, alloc_ud);
+  w->fd = -1;
+
+  w->state = LUABINS_ASYNCIDLE;
+  w->result = LUABINS_ESUCCESS;
+  w->error = 0;
+  w->failed = NULL;
+
+#if !defined(LUABINS_NOASYNC) && !defined(LUABINS_NOTHREADS)
+  w->done = 0;
+  w->detached = 0;
+#endif
+}
+
+lbs_AsyncWriter * lbs_asyncwriterNew(lua_Alloc alloc_fn, void * alloc_ud)
+{
+  lbs_AsyncWriter * w = (lbs_AsyncWriter *)alloc_fn(
+      alloc_ud,
+      NULL,
+      0,
+      sizeof(lbs_AsyncWriter)
+    );
+  if (w != NULL)
+  {
+    lbs_asyncwriterInit(w, alloc_fn, alloc_ud);
+  }
+
+  return w;
+}
+
+/* Destroys writer made with lbs_asyncwriterNew() and frees it */
+static void lbsA_free(lbs_AsyncWriter * w)
+{
+  lua_Alloc alloc_fn = w->sb.alloc_fn;
+  void * alloc_ud = w->sb.alloc_ud;
+
+  lbs_asyncwriterDestroy(w);
+  alloc_fn(alloc_ud, w, sizeof(lbs_AsyncWriter), 0);
+}
+
+#ifndef LUABINS_NOASYNC
+
+/* Remembers failed call */
+static void lbsA_fail(lbs_AsyncWriter * w, const char * failed)
+{
+  if (w->result == LUABINS_ESUCCESS)
+  {
+    SPAM(("asyncwrite: %s failed, errno %d\n", failed, errno));
+
+    w->result = LUABINS_EWRITE;
+    w->error = errno;
+    w->failed = failed;
+  }
+}
+
+/* Does all the work, in worker or calling thread */
+static void lbsA_write(lbs_AsyncWriter * w)
+{
+  size_t len = 0;
+  const unsigned char * buf = lbsSB_buffer(&w->sb, &len);
+  int fd = w->fd;
+
+  if (lbsSB_length(&w->path) > 0)
+  {
+    fd = open(
+        (const char *)w->path.buffer,
+        O_WRONLY | O_CREAT | O_TRUNC,
+        0666
+      );
+    if (fd < 0)
+    {
+      lbsA_fail(w, "open");
+      return;
+    }
+  }
+
+  while (len > 0)
+  {
+    ssize_t written = write(fd, buf, len);
+    if (written < 0)
+    {
+      if (errno == EINTR)
+      {
+        continue;
+      }
+
+      lbsA_fail(w, "write");
+      break;
+    }
+
+    buf += written;
+    len -= (size_t)written;
+  }
+
+  /* Pipes and sockets can't be synced, and need not be */
+  if (w->result == LUABINS_ESUCCESS && fsync(fd) != 0 && errno != EINVAL)
+  {
+    lbsA_fail(w, "fsync");
+  }
+
+  if (lbsSB_length(&w->path) > 0 && close(fd) != 0)
+  {
+    lbsA_fail(w, "close");
+  }
+}
+
+#ifndef LUABINS_NOTHREADS
+
+/* Number of running workers, see LUABINS_MAXASYNCWRITES */
+static int g_num_workers = 0;
+static pthread_mutex_t g_num_workers_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void * lbsA_worker(void * arg)
+{
+  lbs_AsyncWriter * w = (lbs_AsyncWriter *)arg;
+  int detached = 0;
+
+  lbsA_write(w);
+
+  pthread_mutex_lock(&g_num_workers_lock);
+  --g_num_workers;
+  pthread_mutex_unlock(&g_num_workers_lock);
+
+  pthread_mutex_lock(&w->lock);
+  w->done = 1;
+  detached = w->detached;
+  pthread_mutex_unlock(&w->lock);
+
+  /* Writer is closed, nobody joins this thread */
+  if (detached)
+  {
+    SPAM(("asyncwrite: detached worker is done\n"));
+
+    pthread_mutex_destroy(&w->lock);
+    w->state = LUABINS_ASYNCFINISHED;
+    lbsA_free(w);
+  }
+
+  return NULL;
+}
+
+#endif /* LUABINS_NOTHREADS */
+
+int lbs_asyncwriterStart(lbs_AsyncWriter * w, const char * path, int fd)
+{
+  w->fd = fd;
+  w->result = LUABINS_ESUCCESS;
+  w->error = 0;
+  w->failed = NULL;
+
+  lbsSB_reset(&w->path);
+  if (path != NULL)
+  {
+    int result = lbsSB_write(
+        &w->path,
+        (const unsigned char *)path,
+        strlen(path) + 1
+      );
+    if (result != LUABINS_ESUCCESS)
+    {
+      return result;
+    }
+  }
+
+#ifndef LUABINS_NOTHREADS
+  pthread_mutex_lock(&g_num_workers_lock);
+  if (g_num_workers >= LUABINS_MAXASYNCWRITES)
+  {
+    pthread_mutex_unlock(&g_num_workers_lock);
+
+    SPAM(("asyncwrite: too many writes running\n"));
+    return LUABINS_EFULL;
+  }
+  ++g_num_workers;
+  pthread_mutex_unlock(&g_num_workers_lock);
+
+  w->state = LUABINS_ASYNCRUNNING;
+  w->done = 0;
+  w->detached = 0;
+
+  if (pthread_mutex_init(&w->lock, NULL) == 0)
+  {
+    if (pthread_create(&w->thread, NULL, lbsA_worker, w) == 0)
+    {
+      return LUABINS_ESUCCESS;
+    }
+
+    pthread_mutex_destroy(&w->lock);
+  }
+
+  pthread_mutex_lock(&g_num_workers_lock);
+  --g_num_workers;
+  pthread_mutex_unlock(&g_num_workers_lock);
+
+  SPAM(("asyncwrite: no worker thread, writing in place\n"));
+#endif /* LUABINS_NOTHREADS */
+
+  lbsA_write(w);
+  w->state = LUABINS_ASYNCFINISHED;
+
+  return LUABINS_ESUCCESS;
+}
+
+int lbs_asyncwriterFinish(lbs_AsyncWriter * w, int block)
+{
+  if (w->state == LUABINS_ASYNCIDLE || w->state == LUABINS_ASYNCFINISHED)
+  {
+    return 1;
+  }
+
+#ifndef LUABINS_NOTHREADS
+  if (!block)
+  {
+    int done = 0;
+
+    pthread_mutex_lock(&w->lock);
+    done = w->done;
+    pthread_mutex_unlock(&w->lock);
+
+    if (!done)
+    {
+      return 0;
+    }
+  }
+
+  pthread_join(w->thread, NULL);
+  pthread_mutex_destroy(&w->lock);
+#else
+  (void)block;
+#endif /* LUABINS_NOTHREADS */
+
+  w->state = LUABINS_ASYNCFINISHED;
+
+  return 1;
+}
+
+#else /* LUABINS_NOASYNC */
+
+int lbs_asyncwriterStart(lbs_AsyncWriter * w, const char * path, int fd)
+{
+  (void)path;
+
+  w->fd = fd;
+  w->state = LUABINS_ASYNCFINISHED;
+  w->result = LUABINS_EWRITE;
+  w->error = 0;
+  w->failed = "asynchronous write"; /* Is not supported */
+
+  return LUABINS_ESUCCESS;
+}
+
+int lbs_asyncwriterFinish(lbs_AsyncWriter * w, int block)
+{
+  (void)w;
+  (void)block;
+
+  return 1;
+}
+
+#endif /* LUABINS_NOASYNC */
+
+void lbs_asyncwriterDestroy(lbs_AsyncWriter * w)
+{
+  lbs_asyncwriterFinish(w, 1);
+
+  lbsSB_destroy(&w->path);
+  lbsSB_destroy(&w->sb);
+}
+
+void lbs_asyncwriterClose(lbs_AsyncWriter * w)
+{
+#if !defined(LUABINS_NOASYNC) && !defined(LUABINS_NOTHREADS)
+  if (w->state == LUABINS_ASYNCRUNNING)
+  {
+    int detached = 0;
+
+    pthread_mutex_lock(&w->lock);
+    if (!w->done)
+    {
+      SPAM(("asyncwrite: closed while running, detaching worker\n"));
+
+      pthread_detach(w->thread);
+      w->detached = 1;
+      detached = 1;
+    }
+    pthread_mutex_unlock(&w->lock);
+
+    if (detached)
+    {
+      return; /* Worker frees the writer */
+    }
+  }
+#endif
+
+  lbsA_free(w); /* Worker is done, if any, join does not block */
+}
@@ -0,0 +1,106 @@
+/*
+* asyncwrite.h
+* Luabins Lua-less asynchronous write of saved data to file
+* See copyright notice in luabins.h
+*/
+
+#ifndef LUABINS_ASYNCWRITE_H_INCLUDED_
+#define LUABINS_ASYNCWRITE_H_INCLUDED_
+
+#include "saveload.h"
+#include "savebuffer.h"
+
+/*
+* Asynchronous writes need POSIX file API.
+* Define LUABINS_NOASYNC to build without them, lbs_asyncwriterStart()
+* fails then.
+*/
+#if !defined(LUABINS_NOASYNC) && \
+  !(defined(__unix__) || (defined(__APPLE__) && defined(__MACH__)))
+  #define LUABINS_NOASYNC
+#endif
+
+#if !defined(LUABINS_NOASYNC) && !defined(LUABINS_NOTHREADS)
+  #include <pthread.h>
+#endif
+
+/* Maximum number of writes running in worker threads at once */
+#ifndef LUABINS_MAXASYNCWRITES
+  #define LUABINS_MAXASYNCWRITES (16)
+#endif
+
+/* Writer states */
+#define LUABINS_ASYNCIDLE (0) /* Not started yet */
+#define LUABINS_ASYNCRUNNING (1) /* Writing in worker thread */
+#define LUABINS_ASYNCFINISHED (2) /* Result is ready */
+
+/*
+* Writer hands data in its buffer to a worker thread, which writes it
+* to a file (opened by path, or given as descriptor) and flushes it
+* to disk with fsync(). Calling thread never blocks on storage,
+* it polls the writer for the result. Worker does not allocate,
+* so buffer allocator is used only by the calling thread.
+*
+* If luabins is built with LUABINS_NOTHREADS (or if thread fails
+* to start), data is written by lbs_asyncwriterStart() itself.
+*/
+typedef struct lbs_AsyncWriter
+{
+  luabins_SaveBuffer sb; /* Data to write, filled by the caller */
+  luabins_SaveBuffer path; /* Zero-terminated, empty if fd is given */
+  int fd;
+
+  int state; /* LUABINS_ASYNC*, changed by calling thread only */
+  int result; /* LUABINS_ESUCCESS or LUABINS_EWRITE when finished */
+  int error; /* errno value of failed call, 0 if writes are not supported */
+  const char * failed; /* Name of failed call */
+
+#if !defined(LUABINS_NOASYNC) && !defined(LUABINS_NOTHREADS)
+  pthread_t thread;
+  pthread_mutex_t lock;
+  int done; /* Worker is done, not joined yet, guarded by lock */
+  int detached; /* Worker frees writer, guarded by lock */
+#endif
+} lbs_AsyncWriter;
+
+void lbs_asyncwriterInit(
+    lbs_AsyncWriter * w,
+    lua_Alloc alloc_fn,
+    void * alloc_ud
+  );
+
+/*
+* Allocates writer with alloc_fn and initializes it.
+* Free it with lbs_asyncwriterClose(). Allocator must be usable from
+* any thread (see lbs_simplealloc()), worker may free the writer.
+* Returns NULL if there is not enough memory.
+*/
+lbs_AsyncWriter * lbs_asyncwriterNew(lua_Alloc alloc_fn, void * alloc_ud);
+
+/*
+* Starts writing buffered data. If path is not NULL, file at path is
+* created or truncated, written and closed. Otherwise data is written
+* to fd, which must stay open until writer is finished.
+* Buffer must not be changed until writer is finished.
+* Returns LUABINS_EFULL if LUABINS_MAXASYNCWRITES writes are running,
+* other non-zero if there is not enough memory, writer is not started.
+*/
+int lbs_asyncwriterStart(lbs_AsyncWriter * w, const char * path, int fd);
+
+/*
+* If block is non-zero, waits for writer to finish.
+* Returns non-zero when writer is finished (or was never started),
+* result is set. Returns 0 if data is still being written.
+*/
+int lbs_asyncwriterFinish(lbs_AsyncWriter * w, int block);
+
+/* Waits for writer to finish, frees buffers */
+void lbs_asyncwriterDestroy(lbs_AsyncWriter * w);
+
+/*
+* Frees writer made with lbs_asyncwriterNew(). Does not wait:
+* if data is still being written, worker frees writer when done.
+*/
+void lbs_asyncwriterClose(lbs_AsyncWriter * w);
+
+#endif /* LUABINS_ASYNCWRITE_H_INCLUDED_ */
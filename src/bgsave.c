@@ -0,0 +1,386 @@
+/*
+* bgsave.c
+* Luabins Lua-less background save in forked process
+* See copyright notice in luabins.h
+*/
+
+#ifndef _POSIX_C_SOURCE
+  #define _POSIX_C_SOURCE 200809L /* fork(), fsync(), waitpid() */
+#endif
+
+#include <stdlib.h> /* malloc() */
+#include <string.h>
+
+#include "bgsave.h"
+
+#ifndef LUABINS_NOFORK
+  #include <errno.h>
+  #include <fcntl.h>
+  #include <stdio.h> /* rename(), sprintf() */
+  #include <unistd.h>
+  #include <sys/types.h>
+  #include <sys/wait.h>
+#endif
+
+#if 0
+  #define SPAM(a) printf a
+#else
+  #define SPAM(a) (void)0
+#endif
+
+/* Sets error to what, followed by reason if it is not NULL */
+static void lbsB_error(char * error, const char * what, const char * reason)
+{
+  size_t len = strlen(what);
+
+  if (len > LUABINS_BGSAVEMAXERROR - 1)
+  {
+    len = LUABINS_BGSAVEMAXERROR - 1;
+  }
+  memcpy(error, what, len);
+
+  if (reason != NULL && len + 2 < LUABINS_BGSAVEMAXERROR - 1)
+  {
+    size_t reason_len = strlen(reason);
+
+    error[len++] = ':';
+    error[len++] = ' ';
+    if (reason_len > LUABINS_BGSAVEMAXERROR - 1 - len)
+    {
+      reason_len = LUABINS_BGSAVEMAXERROR - 1 - len;
+    }
+    memcpy(error + len, reason, reason_len);
+    len += reason_len;
+  }
+
+  error[len] = '\0';
+}
+
+#ifndef LUABINS_NOFORK
+
+/* Flushes directory entry of path to disk, failure is not fatal */
+static void lbsB_syncdir(const char * path)
+{
+  const char * slash = strrchr(path, '/');
+  char * dir = NULL;
+  int fd = -1;
+
+  if (slash == NULL)
+  {
+    fd = open(".", O_RDONLY);
+  }
+  else
+  {
+    dir = (char *)malloc(slash - path + 2);
+    if (dir == NULL)
+    {
+      return;
+    }
+
+    /* Keep root slash */
+    memcpy(dir, path, slash - path + 1);
+    dir[(slash == path) ? 1 : slash - path] = '\0';
+
+    fd = open(dir, O_RDONLY);
+    free(dir);
+  }
+
+  if (fd >= 0)
+  {
+    fsync(fd);
+    close(fd);
+  }
+}
+
+/* Runs in child process, writes file and exits */
+static void lbsB_child(
+    const char * path,
+    lbs_BgSaveFn fn,
+    void * ud,
+    int error_fd
+  )
+{
+  char error[LUABINS_BGSAVEMAXERROR];
+  char * tmp_path = (char *)malloc(strlen(path) + 32);
+  int result = LUABINS_ESUCCESS;
+  int fd = -1;
+
+  error[0] = '\0';
+
+  if (tmp_path == NULL)
+  {
+    lbsB_error(error, "can't bgsave: not enough memory", NULL);
+    result = LUABINS_EFAILURE;
+  }
+  else
+  {
+    sprintf(tmp_path, "%s.%ld.tmp", path, (long)getpid());
+
+    fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (fd < 0)
+    {
+      lbsB_error(error, "can't bgsave: can't open file", strerror(errno));
+      result = LUABINS_EFAILURE;
+    }
+  }
+
+  if (result == LUABINS_ESUCCESS)
+  {
+    result = fn(ud, fd, error);
+
+    if (result == LUABINS_ESUCCESS && fsync(fd) != 0)
+    {
+      lbsB_error(error, "can't bgsave: fsync failed", strerror(errno));
+      result = LUABINS_EFAILURE;
+    }
+
+    if (close(fd) != 0 && result == LUABINS_ESUCCESS)
+    {
+      lbsB_error(error, "can't bgsave: close failed", strerror(errno));
+      result = LUABINS_EFAILURE;
+    }
+
+    if (result == LUABINS_ESUCCESS && rename(tmp_path, path) != 0)
+    {
+      lbsB_error(error, "can't bgsave: rename failed", strerror(errno));
+      result = LUABINS_EFAILURE;
+    }
+
+    if (result == LUABINS_ESUCCESS)
+    {
+      lbsB_syncdir(path);
+    }
+    else
+    {
+      unlink(tmp_path);
+    }
+  }
+
+  if (result != LUABINS_ESUCCESS)
+  {
+    /* Message is shorter than pipe buffer, so this does not block */
+    if (error[0] == '\0')
+    {
+      lbsB_error(error, "can't bgsave: save failed", NULL);
+    }
+    lbs_bgsaveWrite(error_fd, (const unsigned char *)error, strlen(error));
+  }
+
+  /* Parent stdio buffers and atexit() handlers are not ours to run */
+  _exit(result == LUABINS_ESUCCESS ? 0 : 1);
+}
+
+int lbs_bgsaveStart(
+    lbs_BgSave * job,
+    const char * path,
+    lbs_BgSaveFn fn,
+    void * ud
+  )
+{
+  int fds[2];
+  pid_t pid = 0;
+
+  job->pid = 0;
+  job->fd = -1;
+  job->result = LUABINS_ESUCCESS;
+  job->error[0] = '\0';
+
+  if (pipe(fds) != 0)
+  {
+    lbsB_error(job->error, "can't bgsave: pipe failed", strerror(errno));
+    job->result = LUABINS_EFAILURE;
+    return job->result;
+  }
+
+  pid = fork();
+  if (pid < 0)
+  {
+    lbsB_error(job->error, "can't bgsave: fork failed", strerror(errno));
+    job->result = LUABINS_EFAILURE;
+
+    close(fds[0]);
+    close(fds[1]);
+
+    return job->result;
+  }
+
+  if (pid == 0)
+  {
+    close(fds[0]);
+    lbsB_child(path, fn, ud, fds[1]); /* Does not return */
+  }
+
+  SPAM(("bgsave: started child %ld\n", (long)pid));
+
+  /* Children of later forks need not keep the pipe open */
+  fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+  close(fds[1]);
+
+  job->pid = (long)pid;
+  job->fd = fds[0];
+
+  return LUABINS_ESUCCESS;
+}
+
+int lbs_bgsaveWrite(int fd, const unsigned char * buf, size_t len)
+{
+  while (len > 0)
+  {
+    ssize_t written = write(fd, buf, len);
+    if (written < 0)
+    {
+      if (errno == EINTR)
+      {
+        continue;
+      }
+
+      SPAM(("bgsave: write failed, errno %d\n", errno));
+      return LUABINS_EWRITE;
+    }
+
+    buf += written;
+    len -= (size_t)written;
+  }
+
+  return LUABINS_ESUCCESS;
+}
+
+/* Reads error message of exited child, if any */
+static void lbsB_readError(lbs_BgSave * job)
+{
+  size_t len = 0;
+
+  while (len < LUABINS_BGSAVEMAXERROR - 1)
+  {
+    ssize_t count = read(
+        job->fd,
+        job->error + len,
+        LUABINS_BGSAVEMAXERROR - 1 - len
+      );
+    if (count < 0 && errno == EINTR)
+    {
+      continue;
+    }
+    if (count <= 0)
+    {
+      break;
+    }
+
+    len += (size_t)count;
+  }
+
+  job->error[len] = '\0';
+}
+
+int lbs_bgsaveFinish(lbs_BgSave * job, int block)
+{
+  pid_t pid = 0;
+  int status = 0;
+
+  if (job->pid == 0)
+  {
+    return 1;
+  }
+
+  do
+  {
+    pid = waitpid((pid_t)job->pid, &status, block ? 0 : WNOHANG);
+  }
+  while (pid < 0 && errno == EINTR);
+
+  if (pid == 0)
+  {
+    return 0; /* Still running */
+  }
+
+  if (pid < 0)
+  {
+    lbsB_error(job->error, "can't bgsave: waitpid failed", strerror(errno));
+    job->result = LUABINS_EFAILURE;
+  }
+  else if (WIFEXITED(status) && WEXITSTATUS(status) == 0)
+  {
+    job->result = LUABINS_ESUCCESS;
+  }
+  else
+  {
+    job->result = LUABINS_EFAILURE;
+
+    lbsB_readError(job);
+    if (job->error[0] == '\0')
+    {
+      lbsB_error(
+          job->error,
+          WIFSIGNALED(status)
+            ? "can't bgsave: child process killed"
+            : "can't bgsave: child process failed",
+          NULL
+        );
+    }
+  }
+
+  SPAM(("bgsave: child %ld finished: %d\n", job->pid, job->result));
+
+  close(job->fd);
+  job->fd = -1;
+  job->pid = 0;
+
+  return 1;
+}
+
+void lbs_bgsaveDetach(lbs_BgSave * job)
+{
+  if (job->pid != 0)
+  {
+    SPAM(("bgsave: detached child %ld\n", job->pid));
+
+    close(job->fd);
+    job->fd = -1;
+    job->pid = 0;
+  }
+}
+
+#else /* LUABINS_NOFORK */
+
+int lbs_bgsaveStart(
+    lbs_BgSave * job,
+    const char * path,
+    lbs_BgSaveFn fn,
+    void * ud
+  )
+{
+  (void)path;
+  (void)fn;
+  (void)ud;
+
+  job->pid = 0;
+  job->fd = -1;
+  job->result = LUABINS_EFAILURE;
+  lbsB_error(job->error, "can't bgsave: not supported on this platform", NULL);
+
+  return job->result;
+}
+
+int lbs_bgsaveWrite(int fd, const unsigned char * buf, size_t len)
+{
+  (void)fd;
+  (void)buf;
+  (void)len;
+
+  return LUABINS_EWRITE;
+}
+
+int lbs_bgsaveFinish(lbs_BgSave * job, int block)
+{
+  (void)job;
+  (void)block;
+
+  return 1;
+}
+
+void lbs_bgsaveDetach(lbs_BgSave * job)
+{
+  (void)job;
+}
+
+#endif /* LUABINS_NOFORK */
@@ -0,0 +1,83 @@
+/*
+* bgsave.h
+* Luabins Lua-less background save in forked process
+* See copyright notice in luabins.h
+*/
+
+#ifndef LUABINS_BGSAVE_H_INCLUDED_
+#define LUABINS_BGSAVE_H_INCLUDED_
+
+#include <stddef.h> /* size_t */
+
+#include "saveload.h"
+
+/*
+* Background save needs fork(), it is available on POSIX systems.
+* Define LUABINS_NOFORK to build without it, lbs_bgsaveStart() fails then.
+*/
+#if !defined(LUABINS_NOFORK) && \
+  !(defined(__unix__) || (defined(__APPLE__) && defined(__MACH__)))
+  #define LUABINS_NOFORK
+#endif
+
+/* Longest error message passed from child process, with terminator */
+#define LUABINS_BGSAVEMAXERROR (256)
+
+/*
+* Background save job. Child process reports failure by writing error
+* message to the pipe before it exits, parent reads it when child
+* is reaped.
+*/
+typedef struct lbs_BgSave
+{
+  long pid; /* Child process, 0 when finished */
+  int fd; /* Read end of error pipe, -1 when finished */
+  int result; /* LUABINS_ESUCCESS or LUABINS_EFAILURE when finished */
+  char error[LUABINS_BGSAVEMAXERROR]; /* Error message when failed */
+} lbs_BgSave;
+
+/*
+* Writes data to file descriptor fd in child process.
+* Returns 0 on success.
+* Returns non-zero on failure, copies error message to error
+* (of LUABINS_BGSAVEMAXERROR bytes).
+*/
+typedef int (*lbs_BgSaveFn)(void * ud, int fd, char * error);
+
+/*
+* Forks. Child process calls fn to write data to temporary file
+* next to path, flushes it to disk with fsync() and renames it to path,
+* so file at path is either old or complete. Child exits after that,
+* and never returns from the call.
+* Returns 0 in parent, job is started.
+* Returns non-zero on failure, job is finished with the error.
+*/
+int lbs_bgsaveStart(
+    lbs_BgSave * job,
+    const char * path,
+    lbs_BgSaveFn fn,
+    void * ud
+  );
+
+/*
+* Writes len bytes to fd, handles partial writes and interrupts.
+* Returns non-zero (LUABINS_EWRITE) if write failed.
+*/
+int lbs_bgsaveWrite(int fd, const unsigned char * buf, size_t len);
+
+/*
+* Reaps child process of the job if it has exited.
+* If block is non-zero, waits for it to exit.
+* Returns non-zero when the job is finished, result and error are set.
+* Returns 0 if child is still running.
+* Child must not be reaped by other means (such as SIGCHLD handler).
+*/
+int lbs_bgsaveFinish(lbs_BgSave * job, int block);
+
+/*
+* Gives up on running job without waiting for it. Child exits on its own,
+* but stays a zombie until parent exits, unless SIGCHLD is ignored.
+*/
+void lbs_bgsaveDetach(lbs_BgSave * job);
+
+#endif /* LUABINS_BGSAVE_H_INCLUDED_ */
@@ -0,0 +1,128 @@
+/*
+* byteorder.c
+* Luabins Lua-less byte order conversion
+* See copyright notice in luabins.h
+*/
+
+#include "luaheaders.h"
+
+#include "byteorder.h"
+
+/* Integers wider than stored ones are not supported */
+luabins_static_assert(sizeof(lua_Integer) <= LUABINS_LINTEGER);
+
+void lbs_copySwapped(void * dst, const void * src, size_t width)
+{
+  unsigned char * out = (unsigned char *)dst;
+  const unsigned char * in = (const unsigned char *)src;
+  size_t i = 0;
+
+  for (i = 0; i < width; ++i)
+  {
+    out[i] = in[width - 1 - i];
+  }
+}
+
+/*
+* Loops are kept trivial on purpose, so compiler is able to recognize
+* byte swaps and vectorize them.
+*/
+void lbs_swapBytes(unsigned char * data, size_t width, size_t count)
+{
+  size_t i = 0;
+
+  switch (width)
+  {
+  case 2:
+    for (i = 0; i < count; ++i)
+    {
+      unsigned char * p = data + i * 2;
+      unsigned char t = p[0];
+      p[0] = p[1];
+      p[1] = t;
+    }
+    break;
+
+  case 4:
+    for (i = 0; i < count; ++i)
+    {
+      unsigned char * p = data + i * 4;
+      unsigned char t0 = p[0];
+      unsigned char t1 = p[1];
+      p[0] = p[3];
+      p[1] = p[2];
+      p[2] = t1;
+      p[3] = t0;
+    }
+    break;
+
+  case 8:
+    for (i = 0; i < count; ++i)
+    {
+      unsigned char * p = data + i * 8;
+      unsigned char t0 = p[0];
+      unsigned char t1 = p[1];
+      unsigned char t2 = p[2];
+      unsigned char t3 = p[3];
+      p[0] = p[7];
+      p[1] = p[6];
+      p[2] = p[5];
+      p[3] = p[4];
+      p[4] = t3;
+      p[5] = t2;
+      p[6] = t1;
+      p[7] = t0;
+    }
+    break;
+
+  default: /* Single bytes need no swap */
+    break;
+  }
+}
+
+void lbs_putSize(unsigned char * out, size_t value)
+{
+  size_t i = 0;
+  for (i = 0; i < LUABINS_LSIZET; ++i)
+  {
+    out[i] = (unsigned char)(value & 0xFF);
+    value >>= 8;
+  }
+}
+
+size_t lbs_getSize(const unsigned char * in)
+{
+  size_t value = 0;
+  size_t i = LUABINS_LSIZET;
+  while (i > 0)
+  {
+    --i;
+    value = (value << 8) | in[i];
+  }
+  return value;
+}
+
+void lbs_putInteger(unsigned char * out, lua_Integer value)
+{
+  /* Narrower integers are sign-extended */
+  memset(out, (value < 0) ? 0xFF : 0x00, LUABINS_LINTEGER);
+  lbs_storeLE(out, value, sizeof(lua_Integer));
+}
+
+int lbs_getInteger(const unsigned char * in, lua_Integer * value)
+{
+  const size_t width = sizeof(lua_Integer);
+  const unsigned char fill = (in[width - 1] & 0x80) ? 0xFF : 0x00;
+  size_t i = 0;
+
+  for (i = width; i < LUABINS_LINTEGER; ++i)
+  {
+    if (in[i] != fill)
+    {
+      return 0;
+    }
+  }
+
+  lbs_loadLE(*value, in, width);
+  return 1;
+}
@@ -0,0 +1,96 @@
+/*
+* byteorder.h
+* Luabins Lua-less byte order conversion
+* See copyright notice in luabins.h
+*/
+
+#ifndef LUABINS_BYTEORDER_H_INCLUDED_
+#define LUABINS_BYTEORDER_H_INCLUDED_
+
+#include <string.h> /* memcpy() */
+
+#include "saveload.h"
+
+/*
+* All multibyte values in data are little-endian (see LUABINS_BIGENDIAN
+* in saveload.h). Macros below convert between data and host variables.
+* On little-endian hosts they are plain copies, and there is no swapping
+* code at all.
+*
+* Var must be an lvalue of exactly width bytes, except for size macros,
+* which take size_t and store it in LUABINS_LSIZET bytes.
+*/
+
+#if LUABINS_BIGENDIAN
+
+#define lbs_storeLE(out, var, width) \
+  lbs_copySwapped((out), &(var), (width))
+
+#define lbs_loadLE(var, in, width) \
+  lbs_copySwapped(&(var), (in), (width))
+
+#define lbs_storeSize(out, var) \
+  lbs_putSize((out), (var))
+
+#define lbs_loadSize(var, in) \
+  ((var) = lbs_getSize(in))
+
+/* Converts count elements of width bytes between data and host order */
+#define lbs_fixByteOrder(data, width, count) \
+  lbs_swapBytes((data), (width), (count))
+
+#else /* LUABINS_BIGENDIAN */
+
+#define lbs_storeLE(out, var, width) \
+  memcpy((out), &(var), (width))
+
+#define lbs_loadLE(var, in, width) \
+  memcpy(&(var), (in), (width))
+
+#define lbs_storeSize(out, var) \
+  memcpy((out), &(var), LUABINS_LSIZET)
+
+#define lbs_loadSize(var, in) \
+  ((var) = 0, memcpy(&(var), (in), LUABINS_LSIZET))
+
+#define lbs_fixByteOrder(data, width, count) \
+  ((void)0)
+
+#endif /* LUABINS_BIGENDIAN */
+
+/*
+* Functions below are used by big-endian hosts only,
+* but are always available.
+*/
+
+/* Copies width bytes from src to dst in reverse order */
+void lbs_copySwapped(void * dst, const void * src, size_t width);
+
+/*
+* Reverses byte order of each of count elements of width bytes in place.
+* Width must be 2, 4 or 8, other widths are left as is.
+*/
+void lbs_swapBytes(unsigned char * data, size_t width, size_t count);
+
+/* Stores size as LUABINS_LSIZET little-endian bytes, truncated */
+void lbs_putSize(unsigned char * out, size_t value);
+
+/* Loads size from LUABINS_LSIZET little-endian bytes */
+size_t lbs_getSize(const unsigned char * in);
+
+/*
+* Integer functions below are used on all hosts, since lua_Integer
+* may be narrower than LUABINS_LINTEGER bytes. Include Lua headers
+* (or lualess.h) before this file to use them.
+*/
+
+/* Stores integer as LUABINS_LINTEGER little-endian bytes */
+void lbs_putInteger(unsigned char * out, lua_Integer value);
+
+/*
+* Loads integer from LUABINS_LINTEGER little-endian bytes.
+* Returns zero if it does not fit lua_Integer, value is unchanged then.
+*/
+int lbs_getInteger(const unsigned char * in, lua_Integer * value);
+
+#endif /* LUABINS_BYTEORDER_H_INCLUDED_ */
@@ -0,0 +1,210 @@
+/*
+* channel.c
+* Luabins Lua-less lock-free message channel
+* See copyright notice in luabins.h
+*/
+
+#include <stdlib.h> /* malloc(), calloc(), free() */
+#include <string.h> /* memcpy(), memset() */
+
+#include "luaheaders.h"
+
+#include "channel.h"
+
+#ifndef LUABINS_NOCHANNEL
+
+#if 0
+  #define SPAM(a) printf a
+#else
+  #define SPAM(a) (void)0
+#endif
+
+#define lbsC_load(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define lbsC_store(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#define lbsC_cas(p, expected, v) \
+  __atomic_compare_exchange_n( \
+      (p), (expected), (v), 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED \
+    )
+
+/* Record header flags, length is in the rest of bits */
+#define LUABINS_CHANNELPAD (1)
+#define LUABINS_CHANNELMSG (2)
+
+/* Header of record at given ring position */
+#define lbsC_header(ch, pos) \
+  ((size_t *)((ch)->data + ((pos) & ((ch)->capacity - 1))))
+
+#define lbsC_recordSize(length) \
+  ( \
+    (LUABINS_LCHANNELHEADER + (length) + LUABINS_CHANNELALIGN - 1) \
+    & ~(size_t)(LUABINS_CHANNELALIGN - 1) \
+  )
+
+/* Header must fit, and records must keep it aligned */
+luabins_static_assert(sizeof(size_t) <= LUABINS_LCHANNELHEADER);
+luabins_static_assert(LUABINS_MINCHANNEL % LUABINS_CHANNELALIGN == 0);
+
+lbs_Channel * lbs_channelNew(size_t capacity)
+{
+  lbs_Channel * ch = NULL;
+  size_t size = LUABINS_MINCHANNEL;
+
+  while (size < capacity)
+  {
+    if (size > ((size_t)-1) / 8) /* Length must fit header */
+    {
+      return NULL;
+    }
+    size *= 2;
+  }
+
+  ch = (lbs_Channel *)malloc(sizeof(lbs_Channel));
+  if (ch == NULL)
+  {
+    return NULL;
+  }
+
+  /* Zeroed, so no record is published */
+  ch->data = (unsigned char *)calloc(size, 1);
+  if (ch->data == NULL)
+  {
+    free(ch);
+    return NULL;
+  }
+
+  ch->head = 0;
+  ch->tail = 0;
+  ch->magic = LUABINS_CHANNELMAGIC;
+  ch->refs = 1;
+  ch->capacity = size;
+
+  return ch;
+}
+
+void lbs_channelRetain(lbs_Channel * ch)
+{
+  __atomic_add_fetch(&ch->refs, 1, __ATOMIC_RELAXED);
+}
+
+void lbs_channelRelease(lbs_Channel * ch)
+{
+  if (__atomic_sub_fetch(&ch->refs, 1, __ATOMIC_ACQ_REL) == 0)
+  {
+    free(ch->data);
+    free(ch);
+  }
+}
+
+int lbs_channelPush(
+    lbs_Channel * ch,
+    const unsigned char * data,
+    size_t length
+  )
+{
+  size_t record_size = 0;
+  size_t head = 0;
+  size_t skip = 0;
+
+  if (length > lbs_channelMaxMessage(ch))
+  {
+    return LUABINS_ETOOLONG;
+  }
+
+  record_size = lbsC_recordSize(length);
+
+  for (;;)
+  {
+    /*
+    * Head is loaded after tail: both only grow, and tail never passes
+    * head, so head - tail does not wrap around.
+    */
+    size_t tail = lbsC_load(&ch->tail);
+    size_t offset = 0;
+
+    head = lbsC_load(&ch->head);
+    offset = head & (ch->capacity - 1);
+
+    /* Record is never split by the end of ring */
+    skip = (offset + record_size > ch->capacity)
+      ? ch->capacity - offset
+      : 0
+      ;
+
+    if (head - tail + skip + record_size > ch->capacity)
+    {
+      SPAM(("channel: full\n"));
+      return LUABINS_EFULL;
+    }
+
+    /* On failure tail and head are loaded again */
+    if (lbsC_cas(&ch->head, &head, head + skip + record_size))
+    {
+      break;
+    }
+  }
+
+  if (skip > 0)
+  {
+    lbsC_store(
+        lbsC_header(ch, head),
+        ((skip - LUABINS_LCHANNELHEADER) << 2) | LUABINS_CHANNELPAD
+      );
+    head += skip;
+  }
+
+  memcpy(
+      (unsigned char *)lbsC_header(ch, head) + LUABINS_LCHANNELHEADER,
+      data,
+      length
+    );
+
+  /* Publishes the message */
+  lbsC_store(lbsC_header(ch, head), (length << 2) | LUABINS_CHANNELMSG);
+
+  return LUABINS_ESUCCESS;
+}
+
+const unsigned char * lbs_channelPeek(lbs_Channel * ch, size_t * length)
+{
+  size_t tail = ch->tail; /* Written by consumer only */
+  size_t header = lbsC_load(lbsC_header(ch, tail));
+
+  if (header & LUABINS_CHANNELPAD)
+  {
+    /* Padding, its body was cleared already */
+    *lbsC_header(ch, tail) = 0;
+    tail += LUABINS_LCHANNELHEADER + (header >> 2);
+    lbsC_store(&ch->tail, tail);
+
+    header = lbsC_load(lbsC_header(ch, tail));
+  }
+
+  if (header == 0)
+  {
+    return NULL;
+  }
+
+  *length = header >> 2;
+
+  return (const unsigned char *)lbsC_header(ch, tail)
+    + LUABINS_LCHANNELHEADER;
+}
+
+void lbs_channelPop(lbs_Channel * ch)
+{
+  size_t tail = ch->tail;
+  size_t * header = lbsC_header(ch, tail);
+  size_t record_size = lbsC_recordSize(*header >> 2);
+
+  /* Any byte may be a header when ring wraps next time */
+  memset(header, 0, record_size);
+
+  lbsC_store(&ch->tail, tail + record_size);
+}
+
+#else /* LUABINS_NOCHANNEL */
+
+/* Translation unit may not be empty */
+typedef int lbs_ChannelDisabled;
+
+#endif /* LUABINS_NOCHANNEL */
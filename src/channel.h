@@ -0,0 +1,117 @@
+/*
+* channel.h
+* Luabins Lua-less lock-free message channel
+* See copyright notice in luabins.h
+*/
+
+#ifndef LUABINS_CHANNEL_H_INCLUDED_
+#define LUABINS_CHANNEL_H_INCLUDED_
+
+#include "saveload.h"
+
+/*
+* Channels need atomic operations, GCC and Clang builtins are used.
+* Define LUABINS_NOCHANNEL to build without channels.
+*/
+#if !defined(LUABINS_NOCHANNEL) && \
+  !(defined(__GNUC__) && defined(__ATOMIC_ACQUIRE))
+  #define LUABINS_NOCHANNEL
+#endif
+
+#ifndef LUABINS_NOCHANNEL
+
+/* Head and tail are kept this far apart to avoid false sharing */
+#define LUABINS_CACHELINE (64)
+
+/* Message records are aligned to this many bytes */
+#define LUABINS_CHANNELALIGN (8)
+
+/* Message record header size, holds size_t */
+#define LUABINS_LCHANNELHEADER (LUABINS_CHANNELALIGN)
+
+#define LUABINS_MINCHANNEL (64)
+
+/* Marks live channels, see lbs_channelCheck() */
+#define LUABINS_CHANNELMAGIC (0x4C42534CUL)
+
+/*
+* Channel is a bounded ring buffer of messages (byte strings),
+* with many producers and a single consumer. Producers reserve space
+* for a message by moving head forward with compare-and-swap, copy
+* message there, then publish it by storing its header. Consumer
+* reads messages in place at tail, clears them and moves tail forward.
+* Neither side ever blocks or allocates.
+*
+* Each message is stored as a record of header (message length
+* shifted left by two, with flag bits for message or padding record)
+* and message bytes, aligned to LUABINS_CHANNELALIGN. Record that does
+* not fit before the end of ring is preceded by padding record up to
+* the end.
+* Zero header means that record is not published yet.
+*
+* Channel memory is allocated with malloc() and is reference counted,
+* so channel may outlive Lua state which created it.
+*/
+typedef struct lbs_Channel
+{
+  size_t head; /* Next byte to reserve, written by producers */
+  unsigned char head_pad_[LUABINS_CACHELINE - sizeof(size_t)];
+  size_t tail; /* Next byte to read, written by consumer */
+  unsigned char tail_pad_[LUABINS_CACHELINE - sizeof(size_t)];
+  unsigned long magic; /* LUABINS_CHANNELMAGIC */
+  size_t refs;
+  size_t capacity; /* Power of two */
+  unsigned char * data;
+} lbs_Channel;
+
+/*
+* Returns new channel with at least capacity bytes for records
+* (at least LUABINS_MINCHANNEL), and reference count of one.
+* Returns NULL if out of memory.
+*/
+lbs_Channel * lbs_channelNew(size_t capacity);
+
+void lbs_channelRetain(lbs_Channel * ch);
+
+/* Frees channel when the last reference is released */
+void lbs_channelRelease(lbs_Channel * ch);
+
+/*
+* Returns non-zero if ch is a channel. Catches light userdata
+* of other kinds, ch must still point to live memory:
+* released channel may not be checked.
+*/
+#define lbs_channelCheck(ch) \
+  ((ch) != NULL && (ch)->magic == LUABINS_CHANNELMAGIC && (ch)->refs > 0)
+
+/*
+* Longest message which always fits the channel once it is drained.
+* Half of the ring may be taken by padding.
+*/
+#define lbs_channelMaxMessage(ch) \
+  ((ch)->capacity / 2 - LUABINS_LCHANNELHEADER)
+
+/*
+* Copies message to the channel. Safe to call from many threads.
+* Returns LUABINS_EFULL if there is no space for message now,
+* LUABINS_ETOOLONG if message would never fit.
+*/
+int lbs_channelPush(
+    lbs_Channel * ch,
+    const unsigned char * data,
+    size_t length
+  );
+
+/*
+* Returns oldest published message in place and sets its length,
+* or returns NULL if there is none. Message stays in channel
+* until lbs_channelPop(). Consumer only.
+*/
+const unsigned char * lbs_channelPeek(lbs_Channel * ch, size_t * length);
+
+/* Removes message returned by lbs_channelPeek(). Consumer only. */
+void lbs_channelPop(lbs_Channel * ch);
+
+#endif /* LUABINS_NOCHANNEL */
+
+#endif /* LUABINS_CHANNEL_H_INCLUDED_ */
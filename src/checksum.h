@@ -0,0 +1,53 @@
+/*
+* checksum.h
+* Luabins Lua-less integrity checksum
+* See copyright notice in luabins.h
+*/
+
+#ifndef LUABINS_CHECKSUM_H_INCLUDED_
+#define LUABINS_CHECKSUM_H_INCLUDED_
+
+#include "saveload.h"
+#include "savebuffer.h"
+
+/*
+* Checksummed data is saved as:
+*
+*   LUABINS_CCHECKSUM, data, CRC32C of data (LUABINS_LCHECKSUM).
+*
+* Data is either plain saved data or compressed envelope (see compress.h).
+*
+* CRC32C uses SSE 4.2 crc32 instruction on x86-64 if CPU supports it.
+* Define LUABINS_NOHWCRC32C to always use portable slicing-by-8 code.
+*/
+
+/*
+* Updates CRC32C of data. Pass zero as crc to start,
+* then pass previous result to continue with more data.
+*/
+unsigned long lbs_crc32c(
+    unsigned long crc,
+    const unsigned char * data,
+    size_t length
+  );
+
+/* Appends length bytes of data to sb as checksummed envelope */
+int lbs_writeChecksummed(
+    luabins_SaveBuffer * sb,
+    const unsigned char * data,
+    size_t length
+  );
+
+/*
+* Verifies checksummed envelope, on success sets inner
+* and inner_length to the data inside it.
+* Returns LUABINS_ECHECKSUM if data does not match checksum.
+*/
+int lbs_verifyChecksum(
+    const unsigned char * data,
+    size_t length,
+    const unsigned char ** inner,
+    size_t * inner_length
+  );
+
+#endif /* LUABINS_CHECKSUM_H_INCLUDED_ */
@@ -0,0 +1,60 @@
+/*
+* common.hpp
+* Luabins C++ headers common definitions
+* See copyright notice in luabins.h
+*/
+
+#ifndef LUABINS_COMMON_HPP_INCLUDED_
+#define LUABINS_COMMON_HPP_INCLUDED_
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include "saveload.h"
+
+namespace luabins
+{
+
+/* Must match lua_Number of the other side */
+typedef double Number;
+
+/* Keep these in sync with luabins.h and luainternals.h */
+enum
+{
+  MaxTuple = 250,        /* LUABINS_MAXTUPLE */
+  MaxTableNesting = 250, /* LUABINS_MAXTABLENESTING */
+  MaxArraySize = 1 << 26 /* MAXASIZE, also limits hash size */
+};
+
+static_assert(sizeof(Number) == LUABINS_LNUMBER, "bad lua_Number size");
+static_assert(sizeof(int) == LUABINS_LINT, "bad int size");
+static_assert(sizeof(std::uint32_t) == LUABINS_LSIZET, "bad size length");
+
+namespace detail
+{
+
+/*
+* Data is little-endian (see LUABINS_BIGENDIAN in saveload.h).
+* Copies value of width bytes between data and host variable,
+* reversing bytes on big-endian hosts only.
+*/
+inline void copy_le(void * dst, const void * src, std::size_t width)
+{
+#if LUABINS_BIGENDIAN
+  unsigned char * out = static_cast<unsigned char *>(dst);
+  const unsigned char * in = static_cast<const unsigned char *>(src);
+  for (std::size_t i = 0; i < width; ++i)
+  {
+    out[i] = in[width - 1 - i];
+  }
+#else
+  std::memcpy(dst, src, width);
+#endif
+}
+
+} /* namespace detail */
+
+} /* namespace luabins */
+
+#endif /* LUABINS_COMMON_HPP_INCLUDED_ */
@@ -0,0 +1,419 @@
+/*
+* compress.c
+* Luabins Lua-less block compression
+* See copyright notice in luabins.h
+*/
+
+#include <string.h> /* memcpy(), memcmp(), memset() */
+
+#include "luaheaders.h"
+
+#include "compress.h"
+#include "byteorder.h"
+
+#if 0
+  #define SPAM(a) printf a
+#else
+  #define SPAM(a) (void)0
+#endif
+
+/* Match finder hash table has 2^LUABINS_HASHLOG entries */
+#define LUABINS_HASHLOG (12)
+
+/* Each stored byte expands at most this many times, see lbs_readBlock() */
+#define LUABINS_MAXRATIO (255)
+
+/* Block positions must fit hash table entries */
+luabins_static_assert(LUABINS_BLOCKSIZE <= 65536);
+
+static unsigned int lbsZ_hash(const unsigned char * p)
+{
+  unsigned long v =
+      (unsigned long)p[0]
+    | ((unsigned long)p[1] << 8)
+    | ((unsigned long)p[2] << 16)
+    | ((unsigned long)p[3] << 24)
+    ;
+
+  return (unsigned int)(
+      ((v * 2654435761UL) & 0xFFFFFFFFUL) >> (32 - LUABINS_HASHLOG)
+    );
+}
+
+/* Writes length continuation bytes, returns new output position */
+static unsigned char * lbsZ_putLength(unsigned char * op, size_t length)
+{
+  while (length >= 255)
+  {
+    *op++ = 255;
+    length -= 255;
+  }
+  *op++ = (unsigned char)length;
+
+  return op;
+}
+
+/*
+* Writes a command with literals and a match.
+* Match length of zero means last command without a match.
+*/
+static unsigned char * lbsZ_putCommand(
+    unsigned char * op,
+    const unsigned char * literals,
+    size_t num_literals,
+    size_t offset,
+    size_t match_length
+  )
+{
+  unsigned char * token = op++;
+  size_t extra_match = (match_length > 0)
+    ? match_length - LUABINS_MINMATCH
+    : 0
+    ;
+
+  *token = (unsigned char)(
+      (luabins_min(num_literals, 15) << 4) | luabins_min(extra_match, 15)
+    );
+
+  if (num_literals >= 15)
+  {
+    op = lbsZ_putLength(op, num_literals - 15);
+  }
+
+  memcpy(op, literals, num_literals);
+  op += num_literals;
+
+  if (match_length > 0)
+  {
+    *op++ = (unsigned char)(offset & 0xFF);
+    *op++ = (unsigned char)(offset >> 8);
+
+    if (extra_match >= 15)
+    {
+      op = lbsZ_putLength(op, extra_match - 15);
+    }
+  }
+
+  return op;
+}
+
+size_t lbs_compressBlock(
+    const unsigned char * src,
+    size_t length,
+    unsigned char * dst
+  )
+{
+  unsigned short table[1 << LUABINS_HASHLOG];
+  unsigned char * op = dst;
+  size_t anchor = 0;
+  size_t pos = 0;
+
+  memset(table, 0, sizeof(table));
+
+  while (pos + LUABINS_MINMATCH <= length)
+  {
+    unsigned int h = lbsZ_hash(src + pos);
+    size_t ref = table[h];
+
+    table[h] = (unsigned short)pos;
+
+    if (ref < pos && memcmp(src + ref, src + pos, LUABINS_MINMATCH) == 0)
+    {
+      size_t match_length = LUABINS_MINMATCH;
+      while (
+          pos + match_length < length &&
+          src[ref + match_length] == src[pos + match_length]
+        )
+      {
+        ++match_length;
+      }
+
+      op = lbsZ_putCommand(
+          op, src + anchor, pos - anchor, pos - ref, match_length
+        );
+
+      pos += match_length;
+      anchor = pos;
+    }
+    else
+    {
+      /* Skip faster through data that does not compress */
+      pos += 1 + ((pos - anchor) >> 6);
+    }
+  }
+
+  op = lbsZ_putCommand(op, src + anchor, length - anchor, 0, 0);
+
+  return (size_t)(op - dst);
+}
+
+/* Reads length continuation bytes, returns zero on overrun */
+static int lbsZ_getLength(
+    const unsigned char ** ip,
+    const unsigned char * end,
+    size_t * length
+  )
+{
+  unsigned char b = 255;
+  while (b == 255)
+  {
+    if (*ip >= end)
+    {
+      return 0;
+    }
+    b = *(*ip)++;
+    *length += b;
+  }
+
+  return 1;
+}
+
+int lbs_decompressBlock(
+    const unsigned char * src,
+    size_t length,
+    unsigned char * dst,
+    size_t raw_length
+  )
+{
+  const unsigned char * ip = src;
+  const unsigned char * const ip_end = src + length;
+  unsigned char * op = dst;
+  unsigned char * const op_end = dst + raw_length;
+
+  while (ip < ip_end)
+  {
+    unsigned char token = *ip++;
+    size_t num_literals = token >> 4;
+    size_t match_length = token & 0x0F;
+    size_t offset = 0;
+
+    if (num_literals == 15 && !lbsZ_getLength(&ip, ip_end, &num_literals))
+    {
+      return LUABINS_EBADDATA;
+    }
+
+    if (
+        num_literals > (size_t)(ip_end - ip) ||
+        num_literals > (size_t)(op_end - op)
+      )
+    {
+      SPAM(("decompress: literals overrun\n"));
+      return LUABINS_EBADDATA;
+    }
+
+    memcpy(op, ip, num_literals);
+    ip += num_literals;
+    op += num_literals;
+
+    if (ip == ip_end)
+    {
+      break; /* Last command */
+    }
+
+    if (ip_end - ip < 2)
+    {
+      return LUABINS_EBADDATA;
+    }
+
+    offset = ip[0] | ((size_t)ip[1] << 8);
+    ip += 2;
+
+    if (match_length == 15 && !lbsZ_getLength(&ip, ip_end, &match_length))
+    {
+      return LUABINS_EBADDATA;
+    }
+    match_length += LUABINS_MINMATCH;
+
+    if (
+        offset == 0 ||
+        offset > (size_t)(op - dst) ||
+        match_length > (size_t)(op_end - op)
+      )
+    {
+      SPAM(("decompress: bad match\n"));
+      return LUABINS_EBADDATA;
+    }
+
+    if (offset >= match_length)
+    {
+      memcpy(op, op - offset, match_length);
+      op += match_length;
+    }
+    else
+    {
+      /* Overlapping match repeats the last offset bytes */
+      const unsigned char * ref = op - offset;
+      unsigned char * const match_end = op + match_length;
+      while (op < match_end)
+      {
+        *op++ = *ref++;
+      }
+    }
+  }
+
+  return (op == op_end) ? LUABINS_ESUCCESS : LUABINS_EBADDATA;
+}
+
+int lbs_writeCompressed(
+    luabins_SaveBuffer * sb,
+    const unsigned char * data,
+    size_t length
+  )
+{
+  size_t offset = 0;
+
+  int result = lbsSB_grow(sb, LUABINS_LMINCOMPRESSED);
+  if (result == LUABINS_ESUCCESS)
+  {
+    unsigned char buf[LUABINS_LSIZET];
+    lbs_storeSize(buf, length);
+    lbsSB_writechar(sb, LUABINS_CCOMPRESSED);
+    lbsSB_write(sb, buf, LUABINS_LSIZET);
+  }
+
+  while (offset < length && result == LUABINS_ESUCCESS)
+  {
+    size_t raw_length = luabins_min(length - offset, LUABINS_BLOCKSIZE);
+    unsigned char * out = lbsSB_reserve(
+        sb,
+        LUABINS_LBLOCKHEADER + lbs_compressBound(raw_length)
+      );
+    if (out == NULL)
+    {
+      result = LUABINS_ETOOLONG;
+    }
+    else
+    {
+      size_t stored_length = lbs_compressBlock(
+          data + offset, raw_length, out + LUABINS_LBLOCKHEADER
+        );
+      if (stored_length >= raw_length)
+      {
+        /* Does not compress, store as is */
+        stored_length = raw_length;
+        memcpy(out + LUABINS_LBLOCKHEADER, data + offset, raw_length);
+      }
+
+      lbs_storeSize(out, raw_length);
+      lbs_storeSize(out + LUABINS_LSIZET, stored_length);
+      lbsSB_commit(sb, LUABINS_LBLOCKHEADER + stored_length);
+
+      offset += raw_length;
+    }
+  }
+
+  return result;
+}
+
+int lbs_blockReaderInit(
+    lbs_BlockReader * r,
+    const unsigned char * data,
+    size_t length
+  )
+{
+  size_t total = 0;
+
+  if (length < LUABINS_LMINCOMPRESSED || data[0] != LUABINS_CCOMPRESSED)
+  {
+    return LUABINS_EBADDATA;
+  }
+
+  lbs_loadSize(total, data + 1);
+
+  r->pos = data + LUABINS_LMINCOMPRESSED;
+  r->unread = length - LUABINS_LMINCOMPRESSED;
+  r->pending = total;
+
+  if (total / LUABINS_MAXRATIO > r->unread)
+  {
+    SPAM(("decompress: total length %lu is too large\n", total));
+    return LUABINS_EBADSIZE;
+  }
+
+  return LUABINS_ESUCCESS;
+}
+
+int lbs_readBlock(
+    lbs_BlockReader * r,
+    unsigned char * dst,
+    size_t * raw_length
+  )
+{
+  size_t raw = 0;
+  size_t stored = 0;
+  int result = LUABINS_ESUCCESS;
+
+  if (r->unread < LUABINS_LBLOCKHEADER)
+  {
+    return LUABINS_EBADDATA;
+  }
+
+  lbs_loadSize(raw, r->pos);
+  lbs_loadSize(stored, r->pos + LUABINS_LSIZET);
+
+  if (
+      raw == 0 || raw > LUABINS_BLOCKSIZE || raw > r->pending ||
+      stored == 0 || stored > raw ||
+      stored > r->unread - LUABINS_LBLOCKHEADER
+    )
+  {
+    SPAM(("decompress: bad block header\n"));
+    return LUABINS_EBADSIZE;
+  }
+
+  if (stored == raw)
+  {
+    memcpy(dst, r->pos + LUABINS_LBLOCKHEADER, raw);
+  }
+  else
+  {
+    result = lbs_decompressBlock(
+        r->pos + LUABINS_LBLOCKHEADER, stored, dst, raw
+      );
+  }
+
+  if (result == LUABINS_ESUCCESS)
+  {
+    r->pos += LUABINS_LBLOCKHEADER + stored;
+    r->unread -= LUABINS_LBLOCKHEADER + stored;
+    r->pending -= raw;
+    *raw_length = raw;
+  }
+
+  return result;
+}
+
+int lbs_decompress(
+    luabins_SaveBuffer * sb,
+    const unsigned char * data,
+    size_t length
+  )
+{
+  lbs_BlockReader r;
+
+  int result = lbs_blockReaderInit(&r, data, length);
+  while (result == LUABINS_ESUCCESS && lbs_blockReaderPending(&r) > 0)
+  {
+    unsigned char * out = lbsSB_reserve(sb, LUABINS_BLOCKSIZE);
+    if (out == NULL)
+    {
+      result = LUABINS_ETOOLONG;
+    }
+    else
+    {
+      size_t raw_length = 0;
+      result = lbs_readBlock(&r, out, &raw_length);
+      if (result == LUABINS_ESUCCESS)
+      {
+        lbsSB_commit(sb, raw_length);
+      }
+    }
+  }
+
+  if (result == LUABINS_ESUCCESS && r.unread > 0)
+  {
+    result = LUABINS_ETAILEFT;
+  }
+
+  return result;
+}
@@ -0,0 +1,115 @@
+/*
+* compress.h
+* Luabins Lua-less block compression
+* See copyright notice in luabins.h
+*/
+
+#ifndef LUABINS_COMPRESS_H_INCLUDED_
+#define LUABINS_COMPRESS_H_INCLUDED_
+
+#include "saveload.h"
+#include "savebuffer.h"
+
+/*
+* Compressed data is saved as:
+*
+*   LUABINS_CCOMPRESSED, total uncompressed length (LUABINS_LSIZET),
+*   then blocks until the end of data. Each block is:
+*   uncompressed length (LUABINS_LSIZET), stored length (LUABINS_LSIZET),
+*   stored bytes.
+*
+* Uncompressed length of a block is from 1 to LUABINS_BLOCKSIZE.
+* If stored length equals uncompressed length, block is stored as is,
+* otherwise it is compressed with the LZ codec below.
+*
+* Compressed block is a sequence of commands. Each command is a token
+* byte, with literal count in its high four bits and match length minus
+* LUABINS_MINMATCH in its low four bits. If either is 15, it continues
+* in the following bytes, which are added to it until a byte is not 255.
+* Literals follow, then two byte match offset (least significant byte
+* first). The last command of a block ends after its literals.
+*/
+
+/* Maximum uncompressed block length, match offsets must fit two bytes */
+#define LUABINS_BLOCKSIZE (64 * 1024)
+
+#define LUABINS_MINMATCH (4)
+
+/* Returns maximum compressed length for the given uncompressed length */
+#define lbs_compressBound(length) \
+  ((length) + (length) / 255 + 16)
+
+/*
+* Compresses length bytes from src into dst, length must not exceed
+* LUABINS_BLOCKSIZE. There must be lbs_compressBound(length) bytes in dst.
+* Returns compressed length.
+*/
+size_t lbs_compressBlock(
+    const unsigned char * src,
+    size_t length,
+    unsigned char * dst
+  );
+
+/*
+* Decompresses block of given length from src into exactly
+* raw_length bytes at dst.
+* Returns LUABINS_EBADDATA if block is corrupt.
+*/
+int lbs_decompressBlock(
+    const unsigned char * src,
+    size_t length,
+    unsigned char * dst,
+    size_t raw_length
+  );
+
+/* Appends length bytes of data to sb as compressed envelope */
+int lbs_writeCompressed(
+    luabins_SaveBuffer * sb,
+    const unsigned char * data,
+    size_t length
+  );
+
+/* Reads compressed envelope block by block */
+typedef struct lbs_BlockReader
+{
+  const unsigned char * pos;
+  size_t unread;
+  size_t pending; /* Uncompressed bytes in the blocks left */
+} lbs_BlockReader;
+
+/*
+* Starts reading compressed envelope from data.
+* Returns LUABINS_EBADDATA if data does not start with the envelope header.
+*/
+int lbs_blockReaderInit(
+    lbs_BlockReader * r,
+    const unsigned char * data,
+    size_t length
+  );
+
+#define lbs_blockReaderPending(r) \
+  ((r)->pending)
+
+/*
+* Decompresses next block into dst, which must have room
+* for LUABINS_BLOCKSIZE or pending bytes, whichever is less.
+* Sets raw_length to the number of bytes written.
+* Must not be called when no bytes are pending.
+*/
+int lbs_readBlock(
+    lbs_BlockReader * r,
+    unsigned char * dst,
+    size_t * raw_length
+  );
+
+/*
+* Decompresses the whole envelope, appending data to sb.
+* Use it to pass compressed data to Lua-less readers.
+*/
+int lbs_decompress(
+    luabins_SaveBuffer * sb,
+    const unsigned char * data,
+    size_t length
+  );
+
+#endif /* LUABINS_COMPRESS_H_INCLUDED_ */
@@ -0,0 +1,515 @@
+/*
+* extension.c
+* Luabins custom type registry
+* See copyright notice in luabins.h
+*/
+
+#include <string.h> /* memcpy() */
+
+#include "luaheaders.h"
+
+#include "luabins.h"
+#include "extension.h"
+#include "write.h"
+#include "byteorder.h"
+
+#if 0
+  #define SPAM(a) printf a
+#else
+  #define SPAM(a) (void)0
+#endif
+
+/*
+* Type entry is a table with fields below.
+* Types registered from C have codec, types registered from Lua
+* have save and load functions instead.
+*/
+#define LUABINS_XNAME  (1) /* Type name string */
+#define LUABINS_XMT    (2) /* Metatable */
+#define LUABINS_XCODEC (3) /* lbs_Codec userdata */
+#define LUABINS_XSAVE  (4) /* Lua save function */
+#define LUABINS_XLOAD  (5) /* Lua load function */
+
+typedef struct lbs_Codec
+{
+  luabins_EncodeFn encode;
+  luabins_DecodeFn decode;
+  void * ud;
+} lbs_Codec;
+
+/*
+* Arguments of protected codec calls. Codec functions are C code
+* of the user, Lua errors they raise must not unwind through
+* luabins buffers, so they are called with lua_pcall().
+*/
+typedef struct lbs_CodecCall
+{
+  const lbs_Codec * codec;
+  luabins_SaveBuffer * sb; /* Encoder only */
+  const unsigned char * data; /* Decoder only */
+  size_t len;
+  int result;
+} lbs_CodecCall;
+
+/* Takes lbs_CodecCall as light userdata and value to encode */
+static int encode_protected(lua_State * L)
+{
+  lbs_CodecCall * call = (lbs_CodecCall *)lua_touserdata(L, 1);
+  call->result = call->codec->encode(L, 2, call->sb, call->codec->ud);
+  return 0;
+}
+
+/* Takes lbs_CodecCall as light userdata, returns decoded value */
+static int decode_protected(lua_State * L)
+{
+  lbs_CodecCall * call = (lbs_CodecCall *)lua_touserdata(L, 1);
+  call->result = call->codec->decode(
+      L, call->data, call->len, call->codec->ud
+    );
+  return lua_gettop(L) - 1;
+}
+
+/* Converts relative stack index to absolute one */
+static int abs_index(lua_State * L, int index)
+{
+  return (index < 0 && index > LUA_REGISTRYINDEX)
+    ? lua_gettop(L) + index + 1
+    : index
+    ;
+}
+
+/* Pushes custom types table, creates it if needed */
+static void push_types(lua_State * L)
+{
+  lua_getfield(L, LUA_REGISTRYINDEX, LUABINS_TYPES);
+  if (!lua_istable(L, -1))
+  {
+    lua_pop(L, 1);
+    lua_newtable(L);
+    lua_pushvalue(L, -1);
+    lua_setfield(L, LUA_REGISTRYINDEX, LUABINS_TYPES);
+  }
+}
+
+/* Pushes new type entry with given name and metatable */
+static void push_entry(lua_State * L, int name_index, int mt_index)
+{
+  lua_createtable(L, LUABINS_XLOAD, 0);
+
+  lua_pushvalue(L, name_index);
+  lua_rawseti(L, -2, LUABINS_XNAME);
+
+  lua_pushvalue(L, mt_index);
+  lua_rawseti(L, -2, LUABINS_XMT);
+}
+
+/*
+* Registers type entry on the top of the stack by its name
+* and metatable, pops it. Previous registrations of the same name
+* or metatable are removed with both of their keys.
+*/
+static void link_entry(lua_State * L)
+{
+  int entry = lua_gettop(L);
+  int types = entry + 1;
+  int key = 0;
+
+  push_types(L);
+
+  for (key = LUABINS_XNAME; key <= LUABINS_XMT; ++key)
+  {
+    lua_rawgeti(L, entry, key);
+    lua_rawget(L, types);
+    if (lua_istable(L, -1))
+    {
+      lua_rawgeti(L, -1, LUABINS_XNAME);
+      lua_pushnil(L);
+      lua_rawset(L, types);
+
+      lua_rawgeti(L, -1, LUABINS_XMT);
+      lua_pushnil(L);
+      lua_rawset(L, types);
+    }
+    lua_pop(L, 1);
+  }
+
+  for (key = LUABINS_XNAME; key <= LUABINS_XMT; ++key)
+  {
+    lua_rawgeti(L, entry, key);
+    lua_pushvalue(L, entry);
+    lua_rawset(L, types);
+  }
+
+  lua_settop(L, entry - 1);
+}
+
+int luabins_register_type(
+    lua_State * L,
+    const char * name,
+    size_t name_len,
+    int mt_index,
+    luabins_EncodeFn encode,
+    luabins_DecodeFn decode,
+    void * ud
+  )
+{
+  lbs_Codec * codec = NULL;
+
+  mt_index = abs_index(L, mt_index);
+
+  if (name_len == 0)
+  {
+    lua_pushliteral(L, "can't register type: empty name");
+    return LUABINS_EFAILURE;
+  }
+
+  if (!lua_istable(L, mt_index))
+  {
+    lua_pushliteral(L, "can't register type: metatable expected");
+    return LUABINS_EFAILURE;
+  }
+
+  luaL_checkstack(L, 5, "register_type");
+
+  lua_pushlstring(L, name, name_len);
+  push_entry(L, lua_gettop(L), mt_index);
+  lua_remove(L, -2); /* Remove name */
+
+  codec = (lbs_Codec *)lua_newuserdata(L, sizeof(lbs_Codec));
+  codec->encode = encode;
+  codec->decode = decode;
+  codec->ud = ud;
+  lua_rawseti(L, -2, LUABINS_XCODEC);
+
+  link_entry(L);
+
+  return LUABINS_ESUCCESS;
+}
+
+void lbs_registerLuaType(
+    lua_State * L,
+    int name_index,
+    int mt_index,
+    int save_index,
+    int load_index
+  )
+{
+  luaL_checkstack(L, 5, "register_type");
+
+  push_entry(L, name_index, mt_index);
+
+  lua_pushvalue(L, save_index);
+  lua_rawseti(L, -2, LUABINS_XSAVE);
+
+  lua_pushvalue(L, load_index);
+  lua_rawseti(L, -2, LUABINS_XLOAD);
+
+  link_entry(L);
+}
+
+int lbs_pushType(lua_State * L)
+{
+  lua_getfield(L, LUA_REGISTRYINDEX, LUABINS_TYPES);
+  if (!lua_istable(L, -1))
+  {
+    lua_pop(L, 2);
+    return 0;
+  }
+
+  lua_insert(L, -2);
+  lua_rawget(L, -2);
+  lua_remove(L, -2); /* Remove types table */
+
+  if (lua_isnil(L, -1))
+  {
+    lua_pop(L, 1);
+    return 0;
+  }
+
+  return 1;
+}
+
+int lbs_saveExtension(
+    lua_State * L,
+    luabins_SaveBuffer * sb,
+    int entry,
+    int index
+  )
+{
+  int base = lua_gettop(L);
+  size_t name_len = 0;
+  const char * name = NULL;
+  int result = LUABINS_ESUCCESS;
+
+  luaL_checkstack(L, 5, "save_extension");
+
+  lua_rawgeti(L, entry, LUABINS_XNAME); /* Keeps name alive */
+  name = lua_tolstring(L, -1, &name_len);
+
+  lua_rawgeti(L, entry, LUABINS_XCODEC);
+  if (lua_isuserdata(L, -1))
+  {
+    lbs_CodecCall call;
+
+    call.codec = (const lbs_Codec *)lua_touserdata(L, -1);
+    call.sb = sb;
+    call.data = NULL;
+    call.len = 0;
+    call.result = 0;
+
+    /* Payload is written in place, its size is fixed afterwards */
+    result = lbs_writeExtensionHeader(sb, name, name_len, 0);
+    if (result == LUABINS_ESUCCESS)
+    {
+      size_t size_pos = lbsSB_length(sb) - LUABINS_LSIZET;
+
+      lua_pushcfunction(L, encode_protected);
+      lua_pushlightuserdata(L, &call);
+      lua_pushvalue(L, index);
+      if (lua_pcall(L, 2, 0, 0) != 0 || call.result != 0)
+      {
+        SPAM(("save: custom type encoder failed\n"));
+        result = LUABINS_EEXTENSION;
+      }
+      else
+      {
+        result = lbs_writeExtensionSizeAt(
+            sb,
+            size_pos,
+            lbsSB_length(sb) - size_pos - LUABINS_LSIZET
+          );
+      }
+    }
+  }
+  else
+  {
+    lua_rawgeti(L, entry, LUABINS_XSAVE);
+    lua_pushvalue(L, index);
+    if (lua_pcall(L, 1, 1, 0) != 0 || lua_type(L, -1) != LUA_TSTRING)
+    {
+      SPAM(("save: custom type save function failed\n"));
+      result = LUABINS_EEXTENSION;
+    }
+    else
+    {
+      size_t len = 0;
+      const char * payload = lua_tolstring(L, -1, &len);
+
+      result = lbs_writeExtensionHeader(sb, name, name_len, len);
+      if (result == LUABINS_ESUCCESS)
+      {
+        result = lbsSB_write(sb, (const unsigned char *)payload, len);
+      }
+    }
+  }
+
+  lua_settop(L, base);
+
+  return result;
+}
+
+int lbs_loadExtension(
+    lua_State * L,
+    int entry,
+    const unsigned char * data,
+    size_t len
+  )
+{
+  int base = lua_gettop(L);
+  int result = LUABINS_ESUCCESS;
+
+  luaL_checkstack(L, 3, "load_extension");
+
+  lua_rawgeti(L, entry, LUABINS_XCODEC);
+  if (lua_isuserdata(L, -1))
+  {
+    lbs_CodecCall call;
+
+    /* Codec is kept alive by the entry */
+    call.codec = (const lbs_Codec *)lua_touserdata(L, -1);
+    call.sb = NULL;
+    call.data = data;
+    call.len = len;
+    call.result = 0;
+    lua_pop(L, 1);
+
+    lua_pushcfunction(L, decode_protected);
+    lua_pushlightuserdata(L, &call);
+    if (
+        lua_pcall(L, 1, LUA_MULTRET, 0) != 0 ||
+        call.result != 0 ||
+        lua_gettop(L) != base + 1
+      )
+    {
+      SPAM(("load: custom type decoder failed\n"));
+      result = LUABINS_EEXTENSION;
+    }
+  }
+  else
+  {
+    lua_pop(L, 1);
+
+    lua_rawgeti(L, entry, LUABINS_XLOAD);
+    lua_pushlstring(L, (const char *)data, len);
+    if (lua_pcall(L, 1, 1, 0) != 0)
+    {
+      SPAM(("load: custom type load function failed\n"));
+      result = LUABINS_EEXTENSION;
+    }
+  }
+
+  if (result != LUABINS_ESUCCESS)
+  {
+    lua_settop(L, base);
+  }
+
+  return result;
+}
+
+#if LUABINS_LUAJIT
+
+/*
+* Converters are in Lua, since there is no C API for cdata.
+* First one returns integer bytes in host order, or nothing
+* if value is not a boxed integer in int64_t range.
+* Second one makes int64_t cdata from such bytes.
+*/
+static const char lbs_boxedConverters[] =
+  "local ffi = require 'ffi'\n"
+  "local int64, uint64 = ffi.typeof 'int64_t', ffi.typeof 'uint64_t'\n"
+  "local box = ffi.typeof 'int64_t[1]'\n"
+  "return {\n"
+  "  function(value)\n"
+  "    if\n"
+  "      ffi.istype(int64, value) or\n"
+  "      (ffi.istype(uint64, value) and value < 2^63)\n"
+  "    then\n"
+  "      return ffi.string(box(value), 8)\n"
+  "    end\n"
+  "  end;\n"
+  "  function(bytes)\n"
+  "    local result = box()\n"
+  "    ffi.copy(result, bytes, 8)\n"
+  "    return result[0]\n"
+  "  end;\n"
+  "}\n"
+  ;
+
+/* Boxed integer converter indices in LUABINS_BOXED table */
+#define LUABINS_BOXEDSAVE (1)
+#define LUABINS_BOXEDLOAD (2)
+
+luabins_static_assert(LUABINS_LINTEGER == 8);
+
+void lbs_initBoxedIntegers(lua_State * L)
+{
+  int base = lua_gettop(L);
+
+  luaL_checkstack(L, 2, "boxed_integers");
+
+  if (
+      luaL_loadbuffer(
+          L,
+          lbs_boxedConverters,
+          sizeof(lbs_boxedConverters) - 1,
+          "=luabins.boxed"
+        ) == 0 &&
+      lua_pcall(L, 0, 1, 0) == 0 &&
+      lua_istable(L, -1)
+    )
+  {
+    lua_setfield(L, LUA_REGISTRYINDEX, LUABINS_BOXED);
+  }
+  else
+  {
+    SPAM(("boxed integers are not supported\n"));
+  }
+
+  lua_settop(L, base);
+}
+
+/* Pushes boxed integer converter, returns zero if there is none */
+static int push_converter(lua_State * L, int key)
+{
+  lua_getfield(L, LUA_REGISTRYINDEX, LUABINS_BOXED);
+  if (!lua_istable(L, -1))
+  {
+    lua_pop(L, 1);
+    return 0;
+  }
+
+  lua_rawgeti(L, -1, key);
+  lua_remove(L, -2);
+
+  return 1;
+}
+
+int lbs_saveBoxedInteger(
+    lua_State * L,
+    luabins_SaveBuffer * sb,
+    int index
+  )
+{
+  int base = lua_gettop(L);
+  int result = LUABINS_EBADTYPE;
+
+  luaL_checkstack(L, 2, "save_boxed");
+
+  if (push_converter(L, LUABINS_BOXEDSAVE))
+  {
+    size_t len = 0;
+    const char * bytes = NULL;
+
+    /* Errors are caught here, not to leak the save buffer */
+    lua_pushvalue(L, index);
+    if (lua_pcall(L, 1, 1, 0) == 0)
+    {
+      bytes = lua_tolstring(L, -1, &len);
+    }
+
+    if (bytes != NULL && len == LUABINS_LINTEGER)
+    {
+      unsigned char buf[LUABINS_LINTEGER];
+      memcpy(buf, bytes, LUABINS_LINTEGER);
+      lbs_fixByteOrder(buf, LUABINS_LINTEGER, 1);
+
+      result = lbsSB_grow(sb, LUABINS_LMININTEGER);
+      if (result == LUABINS_ESUCCESS)
+      {
+        lbsSB_writechar(sb, LUABINS_CINTEGER);
+        lbsSB_write(sb, buf, LUABINS_LINTEGER);
+      }
+    }
+  }
+
+  lua_settop(L, base);
+
+  return result;
+}
+
+int lbs_pushBoxedInteger(lua_State * L, const unsigned char * pos)
+{
+  unsigned char buf[LUABINS_LINTEGER];
+
+  luaL_checkstack(L, 2, "load_boxed");
+
+  if (!push_converter(L, LUABINS_BOXEDLOAD))
+  {
+    return 0;
+  }
+
+  memcpy(buf, pos, LUABINS_LINTEGER);
+  lbs_fixByteOrder(buf, LUABINS_LINTEGER, 1);
+
+  /* On error value is loaded as number instead */
+  lua_pushlstring(L, (const char *)buf, LUABINS_LINTEGER);
+  if (lua_pcall(L, 1, 1, 0) != 0)
+  {
+    lua_pop(L, 1);
+    return 0;
+  }
+
+  return 1;
+}
+
+#endif /* LUABINS_LUAJIT */
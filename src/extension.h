@@ -0,0 +1,95 @@
+/*
+* extension.h
+* Luabins custom type registry
+* See copyright notice in luabins.h
+*/
+
+#ifndef LUABINS_EXTENSION_H_INCLUDED_
+#define LUABINS_EXTENSION_H_INCLUDED_
+
+#include "saveload.h"
+#include "savebuffer.h"
+
+/*
+* Registry field with custom types table. It maps both type names
+* and metatables to type entries, see extension.c.
+*/
+#define LUABINS_TYPES "luabins.types"
+
+/*
+* Registers custom type with Lua callbacks. Save function takes userdata
+* and returns payload string, load function takes payload string
+* and returns loaded value. Arguments are at given stack indices,
+* name must be a non-empty string.
+*/
+void lbs_registerLuaType(
+    lua_State * L,
+    int name_index,
+    int mt_index,
+    int save_index,
+    int load_index
+  );
+
+/*
+* Replaces type name or metatable on the top of the stack
+* with the type entry and returns non-zero if type is registered.
+* Otherwise pops the key and returns zero.
+*/
+int lbs_pushType(lua_State * L);
+
+/*
+* Writes userdata at given stack index as extension value
+* of the type with entry at given stack index.
+*/
+int lbs_saveExtension(
+    lua_State * L,
+    luabins_SaveBuffer * sb,
+    int entry,
+    int index
+  );
+
+/*
+* Pushes value decoded from extension value payload of the type
+* with entry at given stack index. Nothing is pushed on failure.
+*/
+int lbs_loadExtension(
+    lua_State * L,
+    int entry,
+    const unsigned char * data,
+    size_t len
+  );
+
+#if LUABINS_LUAJIT
+
+/* LuaJIT lua_type() of cdata, it is not in LuaJIT headers */
+#define LUABINS_TCDATA (10)
+
+/*
+* Registry field with LuaJIT boxed integer converters, see extension.c.
+* Boxed integers are int64_t and uint64_t cdata, they are saved
+* as integers. If FFI is not available, they are not supported.
+*/
+#define LUABINS_BOXED "luabins.boxed"
+
+/* Sets up boxed integer converters, call once on module load */
+void lbs_initBoxedIntegers(lua_State * L);
+
+/*
+* Writes cdata at given stack index as integer.
+* Fails with LUABINS_EBADTYPE if it is not a boxed integer in int64_t range.
+*/
+int lbs_saveBoxedInteger(
+    lua_State * L,
+    luabins_SaveBuffer * sb,
+    int index
+  );
+
+/*
+* Pushes int64_t cdata with integer stored at pos.
+* Returns zero and pushes nothing if boxed integers are not supported.
+*/
+int lbs_pushBoxedInteger(lua_State * L, const unsigned char * pos);
+
+#endif /* LUABINS_LUAJIT */
+
+#endif /* LUABINS_EXTENSION_H_INCLUDED_ */
@@ -0,0 +1,317 @@
+/*
+* fdwrite.c
+* Luabins Lua-less buffered write API using file descriptor as output
+* See copyright notice in luabins.h
+*/
+
+#ifndef _POSIX_C_SOURCE
+  #define _POSIX_C_SOURCE 200809L /* write(), pwrite() */
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "luaheaders.h"
+
+#include "luabins.h"
+#include "fdwrite.h"
+#include "write.h"
+#include "byteorder.h"
+
+#if 0
+  #define SPAM(a) printf a
+#else
+  #define SPAM(a) (void)0
+#endif
+
+/* Nesting limit in fdwrite.h is out of sync with the one in luabins.h */
+luabins_static_assert(LUABINS_FDWRITEMAXNESTING == LUABINS_MAXTABLENESTING);
+
+/*
+* Buffer may be written out unless we're spooling open tables
+* for non-seekable file descriptor.
+*/
+#define lbsFW_canflush(w) \
+  ((w)->base >= 0 || (w)->nesting == 0)
+
+/* Handles partial writes and interrupts */
+static int lbsFW_writeall(int fd, const unsigned char * buf, size_t len)
+{
+  while (len > 0)
+  {
+    ssize_t written = write(fd, buf, len);
+    if (written < 0)
+    {
+      if (errno == EINTR)
+      {
+        continue;
+      }
+
+      SPAM(("fdwrite: write failed, errno %d\n", errno));
+      return LUABINS_EWRITE;
+    }
+
+    buf += written;
+    len -= (size_t)written;
+  }
+
+  return LUABINS_ESUCCESS;
+}
+
+/* Remembers first error and flushes the buffer if it is large enough */
+static int lbsFW_commit(lbs_FdWriter * w, int result)
+{
+  if (result != LUABINS_ESUCCESS)
+  {
+    w->error = result;
+  }
+  else if (lbsSB_length(&w->sb) >= LUABINS_FDWRITEFLUSH)
+  {
+    result = lbs_fdwriterFlush(w);
+  }
+
+  return result;
+}
+
+void lbs_fdwriterInit(
+    lbs_FdWriter * w,
+    int fd,
+    lua_Alloc alloc_fn,
+    void * alloc_ud
+  )
+{
+  w->fd = fd;
+  w->error = LUABINS_ESUCCESS;
+  lbsSB_init(&w->sb, alloc_fn, alloc_ud);
+
+  w->flushed = 0;
+  w->nesting = 0;
+
+  /*
+  * Note that pwrite() ignores offset for files opened with O_APPEND
+  * on some systems, so we treat such files as non-seekable.
+  */
+  w->base = lseek(fd, 0, SEEK_CUR);
+  if (w->base >= 0)
+  {
+    int flags = fcntl(fd, F_GETFL);
+    if (flags == -1 || (flags & O_APPEND) != 0)
+    {
+      w->base = -1;
+    }
+  }
+}
+
+int lbs_fdwriterFlush(lbs_FdWriter * w)
+{
+  if (
+      w->error == LUABINS_ESUCCESS &&
+      lbsSB_length(&w->sb) > 0 &&
+      lbsFW_canflush(w)
+    )
+  {
+    size_t len = 0;
+    const unsigned char * buf = lbsSB_buffer(&w->sb, &len);
+
+    w->error = lbsFW_writeall(w->fd, buf, len);
+    w->flushed += len;
+    lbsSB_reset(&w->sb);
+  }
+
+  return w->error;
+}
+
+int lbs_fdwriterDestroy(lbs_FdWriter * w)
+{
+  int result = LUABINS_ESUCCESS;
+
+  if (w->error == LUABINS_ESUCCESS && w->nesting > 0)
+  {
+    SPAM(("fdwrite: destroying writer with open tables\n"));
+    w->error = LUABINS_EFAILURE;
+  }
+
+  result = lbs_fdwriterFlush(w);
+  lbsSB_destroy(&w->sb);
+  return result;
+}
+
+int lbs_fdwriteTupleSize(lbs_FdWriter * w, unsigned char tuple_size)
+{
+  if (w->error != LUABINS_ESUCCESS)
+  {
+    return w->error;
+  }
+
+  return lbsFW_commit(w, lbs_writeTupleSize(&w->sb, tuple_size));
+}
+
+int lbs_fdwriteTableHeader(
+    lbs_FdWriter * w,
+    int array_size,
+    int hash_size
+  )
+{
+  if (w->error != LUABINS_ESUCCESS)
+  {
+    return w->error;
+  }
+
+  return lbsFW_commit(
+      w,
+      lbs_writeTableHeader(&w->sb, array_size, hash_size)
+    );
+}
+
+int lbs_fdwriteTableBegin(lbs_FdWriter * w)
+{
+  if (w->error != LUABINS_ESUCCESS)
+  {
+    return w->error;
+  }
+
+  if (w->nesting >= LUABINS_FDWRITEMAXNESTING)
+  {
+    w->error = LUABINS_ETOODEEP;
+    return w->error;
+  }
+
+  w->headers[w->nesting++] = w->flushed + lbsSB_length(&w->sb);
+
+  /* Sizes are to be patched in lbs_fdwriteTableEnd() */
+  return lbsFW_commit(w, lbs_writeTableHeader(&w->sb, 0, 0));
+}
+
+int lbs_fdwriteTableEnd(
+    lbs_FdWriter * w,
+    int array_size,
+    int hash_size
+  )
+{
+  off_t pos = 0;
+  int result = LUABINS_ESUCCESS;
+
+  if (w->error != LUABINS_ESUCCESS)
+  {
+    return w->error;
+  }
+
+  if (w->nesting <= 0)
+  {
+    SPAM(("fdwrite: table end without table begin\n"));
+    w->error = LUABINS_EFAILURE;
+    return w->error;
+  }
+
+  pos = w->headers[--w->nesting];
+  if (pos >= w->flushed)
+  {
+    /* Header is still in buffer */
+    result = lbs_writeTableHeaderAt(
+        &w->sb,
+        (size_t)(pos - w->flushed),
+        array_size,
+        hash_size
+      );
+  }
+  else
+  {
+    /* Header is already written, we're seekable, patch it in file */
+    unsigned char buf[1 + LUABINS_LINT + LUABINS_LINT];
+    ssize_t written = 0;
+
+    buf[0] = LUABINS_CTABLE;
+    lbs_storeLE(&buf[1], array_size, LUABINS_LINT);
+    lbs_storeLE(&buf[1 + LUABINS_LINT], hash_size, LUABINS_LINT);
+
+    do
+    {
+      written = pwrite(w->fd, buf, sizeof(buf), w->base + pos);
+    }
+    while (written < 0 && errno == EINTR);
+
+    if (written != (ssize_t)sizeof(buf))
+    {
+      SPAM(("fdwrite: pwrite failed, errno %d\n", errno));
+      result = LUABINS_EWRITE;
+    }
+  }
+
+  /* Flush data spooled for non-seekable descriptor, if we can */
+  return lbsFW_commit(w, result);
+}
+
+int lbs_fdwriteNil(lbs_FdWriter * w)
+{
+  if (w->error != LUABINS_ESUCCESS)
+  {
+    return w->error;
+  }
+
+  return lbsFW_commit(w, lbs_writeNil(&w->sb));
+}
+
+int lbs_fdwriteBoolean(lbs_FdWriter * w, int value)
+{
+  if (w->error != LUABINS_ESUCCESS)
+  {
+    return w->error;
+  }
+
+  return lbsFW_commit(w, lbs_writeBoolean(&w->sb, value));
+}
+
+int lbs_fdwriteNumber(lbs_FdWriter * w, lua_Number value)
+{
+  if (w->error != LUABINS_ESUCCESS)
+  {
+    return w->error;
+  }
+
+  return lbsFW_commit(w, lbs_writeNumber(&w->sb, value));
+}
+
+int lbs_fdwriteString(
+    lbs_FdWriter * w,
+    const char * value,
+    size_t length
+  )
+{
+  if (w->error != LUABINS_ESUCCESS)
+  {
+    return w->error;
+  }
+
+  if (length < LUABINS_FDWRITEFLUSH || !lbsFW_canflush(w))
+  {
+    return lbsFW_commit(w, lbs_writeString(&w->sb, value, length));
+  }
+
+  /* Large string: buffer header only, and write data directly */
+  {
+    unsigned char buf[LUABINS_LSIZET];
+    int result = lbsSB_grow(&w->sb, 1 + LUABINS_LSIZET);
+    if (result == LUABINS_ESUCCESS)
+    {
+      lbs_storeSize(buf, length);
+      lbsSB_writechar(&w->sb, LUABINS_CSTRING);
+      lbsSB_write(&w->sb, buf, LUABINS_LSIZET);
+
+      result = lbs_fdwriterFlush(w);
+    }
+
+    if (result == LUABINS_ESUCCESS)
+    {
+      result = lbsFW_writeall(w->fd, (const unsigned char *)value, length);
+      w->flushed += length;
+    }
+
+    if (result != LUABINS_ESUCCESS)
+    {
+      w->error = result;
+    }
+
+    return result;
+  }
+}
@@ -0,0 +1,121 @@
+/*
+* fdwrite.h
+* Luabins Lua-less buffered write API using file descriptor as output
+* See copyright notice in luabins.h
+*/
+
+#ifndef LUABINS_FDWRITE_H_INCLUDED_
+#define LUABINS_FDWRITE_H_INCLUDED_
+
+#include <sys/types.h> /* off_t */
+
+#include "saveload.h"
+#include "savebuffer.h"
+
+/*
+* Buffered data is written out with write(2) as soon as buffer
+* grows beyond this size.
+* Strings that large or larger are written directly, without copying.
+*/
+#define LUABINS_FDWRITEFLUSH (64 * 1024)
+
+/*
+* Maximum number of simultaneously open tables.
+* Should match LUABINS_MAXTABLENESTING in luabins.h.
+*/
+#define LUABINS_FDWRITEMAXNESTING (250)
+
+/*
+* Writer accumulates data in the buffer, and writes it to the file
+* descriptor in large chunks.
+*
+* Errors are sticky: after the first failure writer ignores all
+* further writes, and returns the error code from every call.
+* So it is enough to check result of lbs_fdwriterDestroy()
+* (or lbs_fdwriterFlush()) at the end.
+*
+* Tables of unknown size may be written with lbs_fdwriteTableBegin()
+* and lbs_fdwriteTableEnd(). If file descriptor is seekable, table header
+* is patched in place with pwrite(2) when table ends. Otherwise (pipes,
+* sockets, files opened with O_APPEND) all data since the beginning
+* of the outermost open table is kept in buffer until that table ends.
+*/
+typedef struct lbs_FdWriter
+{
+  int fd;
+  int error;
+  luabins_SaveBuffer sb;
+
+  off_t base; /* File offset of the first byte written, -1 if not seekable */
+  off_t flushed; /* Number of bytes already written to fd */
+
+  int nesting; /* Number of open tables */
+  off_t headers[LUABINS_FDWRITEMAXNESTING]; /* Open table header positions */
+} lbs_FdWriter;
+
+void lbs_fdwriterInit(
+    lbs_FdWriter * w,
+    int fd,
+    lua_Alloc alloc_fn,
+    void * alloc_ud
+  );
+
+#define lbs_fdwriterError(w) \
+  ((w)->error)
+
+/*
+* Writes out all buffered data. Returns first error encountered, if any.
+* Note that nothing is written if file descriptor is not seekable
+* and there are open tables.
+*/
+int lbs_fdwriterFlush(lbs_FdWriter * w);
+
+/*
+* Writes out all buffered data and frees the buffer.
+* Note that file descriptor is not closed.
+* Returns first error encountered, if any.
+* Fails with LUABINS_EFAILURE if there are open tables.
+*/
+int lbs_fdwriterDestroy(lbs_FdWriter * w);
+
+int lbs_fdwriteTupleSize(lbs_FdWriter * w, unsigned char tuple_size);
+
+int lbs_fdwriteTableHeader(
+    lbs_FdWriter * w,
+    int array_size,
+    int hash_size
+  );
+
+/*
+* Begins table of yet unknown size.
+* Table contents (key-value pairs) should follow.
+* Fails with LUABINS_ETOODEEP if there are LUABINS_FDWRITEMAXNESTING
+* tables open.
+*/
+int lbs_fdwriteTableBegin(lbs_FdWriter * w);
+
+/*
+* Ends the last table begun with lbs_fdwriteTableBegin(),
+* setting its header sizes.
+*/
+int lbs_fdwriteTableEnd(
+    lbs_FdWriter * w,
+    int array_size,
+    int hash_size
+  );
+
+int lbs_fdwriteNil(lbs_FdWriter * w);
+
+int lbs_fdwriteBoolean(lbs_FdWriter * w, int value);
+
+int lbs_fdwriteNumber(lbs_FdWriter * w, lua_Number value);
+
+#define lbs_fdwriteInteger lbs_fdwriteNumber
+
+int lbs_fdwriteString(
+    lbs_FdWriter * w,
+    const char * value,
+    size_t length
+  );
+
+#endif /* LUABINS_FDWRITE_H_INCLUDED_ */
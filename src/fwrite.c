@@ -7,8 +7,17 @@
 #include "luaheaders.h"
 
 #include "fwrite.h"
+#include "byteorder.h"
 
-/* TODO: Note that stream errors are ignored. Handle them better? */
+/*
+* TODO: Note that stream errors are ignored. Handle them better?
+*       (See fdwrite.h for the error-checked alternative.)
+*/
+
+/*
+* Each value header is assembled on stack and written with single
+* fwrite() call, to avoid paying for stream locking for each field.
+*/
 
 void lbs_fwriteTableHeader(
     FILE * f,
@@ -16,25 +25,23 @@ void lbs_fwriteTableHeader(
     int hash_size
   )
 {
-  fputc(LUABINS_CTABLE, f);
-  fwrite(
-      (const unsigned char *)&array_size,
-      LUABINS_LINT,
-      1,
-      f
-    );
-  fwrite(
-      (const unsigned char *)&hash_size,
-      LUABINS_LINT,
-      1,
-      f
-    );
+  unsigned char buf[1 + LUABINS_LINT + LUABINS_LINT];
+
+  buf[0] = LUABINS_CTABLE;
+  lbs_storeLE(&buf[1], array_size, LUABINS_LINT);
+  lbs_storeLE(&buf[1 + LUABINS_LINT], hash_size, LUABINS_LINT);
+
+  fwrite(buf, sizeof(buf), 1, f);
 }
 
 void lbs_fwriteNumber(FILE * f, lua_Number value)
 {
-  fputc(LUABINS_CNUMBER, f);
-  fwrite((const unsigned char *)&value, LUABINS_LNUMBER, 1, f);
+  unsigned char buf[1 + LUABINS_LNUMBER];
+
+  buf[0] = LUABINS_CNUMBER;
+  lbs_storeLE(&buf[1], value, LUABINS_LNUMBER);
+
+  fwrite(buf, sizeof(buf), 1, f);
 }
 
 void lbs_fwriteString(
@@ -43,7 +50,14 @@ void lbs_fwriteString(
     size_t length
   )
 {
-  fputc(LUABINS_CSTRING, f);
-  fwrite((const unsigned char *)&length, LUABINS_LSIZET, 1, f);
-  fwrite((const unsigned char *)value, length, 1, f);
+  unsigned char buf[1 + LUABINS_LSIZET];
+
+  buf[0] = LUABINS_CSTRING;
+  lbs_storeSize(&buf[1], length);
+
+  fwrite(buf, sizeof(buf), 1, f);
+  if (length > 0)
+  {
+    fwrite((const unsigned char *)value, length, 1, f);
+  }
 }
@@ -0,0 +1,251 @@
+/*
+* iovwrite.c
+* Luabins Lua-less scatter/gather write API
+* See copyright notice in luabins.h
+*/
+
+#ifndef _XOPEN_SOURCE
+  #define _XOPEN_SOURCE 600 /* writev(), IOV_MAX */
+#endif
+
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+
+#include "luaheaders.h"
+
+#include "iovwrite.h"
+#include "byteorder.h"
+
+#if 0
+  #define SPAM(a) printf a
+#else
+  #define SPAM(a) (void)0
+#endif
+
+/* Minimum number of refs to allocate */
+#define LUABINS_IOVMINREFS (16)
+
+/* Maximum number of vectors to pass to single writev() call */
+#if defined (IOV_MAX) && (IOV_MAX < 1024)
+  #define LUABINS_IOVMAX (IOV_MAX)
+#elif defined (IOV_MAX)
+  #define LUABINS_IOVMAX (1024)
+#else
+  #define LUABINS_IOVMAX (16) /* _XOPEN_IOV_MAX */
+#endif
+
+void lbs_iovwriterInit(
+    lbs_IovWriter * w,
+    size_t threshold,
+    lua_Alloc alloc_fn,
+    void * alloc_ud
+  )
+{
+  lbsSB_init(&w->sb, alloc_fn, alloc_ud);
+
+  w->refs = NULL;
+  w->num_refs = 0;
+  w->refs_size = 0;
+
+  w->threshold = threshold;
+  w->ref_length = 0;
+}
+
+void lbs_iovwriterDestroy(lbs_IovWriter * w)
+{
+  if (w->refs != NULL)
+  {
+    /* Ignoring errors */
+    w->sb.alloc_fn(
+        w->sb.alloc_ud,
+        w->refs,
+        w->refs_size * sizeof(lbs_IovRef),
+        0UL
+      );
+    w->refs = NULL;
+    w->refs_size = 0;
+  }
+
+  w->num_refs = 0;
+  w->ref_length = 0;
+
+  lbsSB_destroy(&w->sb);
+}
+
+static int lbsIW_addref(
+    lbs_IovWriter * w,
+    const char * value,
+    size_t length
+  )
+{
+  lbs_IovRef * ref = NULL;
+
+  if (w->num_refs == w->refs_size)
+  {
+    size_t new_size = (w->refs_size < LUABINS_IOVMINREFS)
+      ? LUABINS_IOVMINREFS
+      : w->refs_size * 2
+      ;
+
+    lbs_IovRef * refs = (lbs_IovRef *)w->sb.alloc_fn(
+        w->sb.alloc_ud,
+        w->refs,
+        w->refs_size * sizeof(lbs_IovRef),
+        new_size * sizeof(lbs_IovRef)
+      );
+    if (refs == NULL)
+    {
+      return LUABINS_ETOOLONG;
+    }
+
+    w->refs = refs;
+    w->refs_size = new_size;
+  }
+
+  ref = &w->refs[w->num_refs++];
+  ref->offset = lbsSB_length(&w->sb);
+  ref->data = value;
+  ref->length = length;
+
+  w->ref_length += length;
+
+  return LUABINS_ESUCCESS;
+}
+
+int lbs_iovwriteString(
+    lbs_IovWriter * w,
+    const char * value,
+    size_t length
+  )
+{
+  int result = LUABINS_ESUCCESS;
+
+  if (length < w->threshold)
+  {
+    return lbs_writeString(&w->sb, value, length);
+  }
+
+  /* Write header inline, and reference the string data */
+  result = lbsSB_grow(&w->sb, 1 + LUABINS_LSIZET);
+  if (result == LUABINS_ESUCCESS)
+  {
+    unsigned char buf[LUABINS_LSIZET];
+    lbs_storeSize(buf, length);
+    lbsSB_writechar(&w->sb, LUABINS_CSTRING);
+    lbsSB_write(&w->sb, buf, LUABINS_LSIZET);
+
+    result = lbsIW_addref(w, value, length);
+  }
+
+  return result;
+}
+
+/*
+* Segment 2 * i is inline data before i-th ref (or after the last one),
+* segment 2 * i + 1 is i-th ref data.
+*/
+int lbs_iovwriterSegments(
+    lbs_IovWriter * w,
+    size_t first,
+    struct iovec * iov,
+    int max_iov,
+    size_t * next
+  )
+{
+  const size_t num_segments = lbs_iovwriterNumSegments(w);
+  const unsigned char * inline_data = lbsSB_buffer(&w->sb, NULL);
+  size_t segment = first;
+  int count = 0;
+
+  for ( ; segment < num_segments && count < max_iov; ++segment)
+  {
+    const size_t i = segment / 2;
+    const void * base = NULL;
+    size_t len = 0;
+
+    if (segment % 2 == 0)
+    {
+      size_t from = (i == 0) ? 0 : w->refs[i - 1].offset;
+      size_t to = (i < w->num_refs)
+        ? w->refs[i].offset
+        : lbsSB_length(&w->sb)
+        ;
+
+      base = inline_data + from;
+      len = to - from;
+    }
+    else
+    {
+      base = w->refs[i].data;
+      len = w->refs[i].length;
+    }
+
+    if (len > 0)
+    {
+      iov[count].iov_base = (void *)base;
+      iov[count].iov_len = len;
+      ++count;
+    }
+  }
+
+  if (next != NULL)
+  {
+    *next = segment;
+  }
+
+  return count;
+}
+
+int lbs_iovwriterWrite(lbs_IovWriter * w, int fd)
+{
+  struct iovec iov[LUABINS_IOVMAX];
+  size_t segment = 0;
+
+  for (;;)
+  {
+    int count = lbs_iovwriterSegments(
+        w,
+        segment,
+        iov,
+        LUABINS_IOVMAX,
+        &segment
+      );
+    int i = 0;
+
+    if (count == 0)
+    {
+      break;
+    }
+
+    while (i < count)
+    {
+      ssize_t written = writev(fd, &iov[i], count - i);
+      if (written < 0)
+      {
+        if (errno == EINTR)
+        {
+          continue;
+        }
+
+        SPAM(("iovwrite: writev failed, errno %d\n", errno));
+        return LUABINS_EWRITE;
+      }
+
+      /* Skip fully written vectors, adjust partially written one */
+      while (i < count && (size_t)written >= iov[i].iov_len)
+      {
+        written -= iov[i].iov_len;
+        ++i;
+      }
+
+      if (i < count)
+      {
+        iov[i].iov_base = (char *)iov[i].iov_base + written;
+        iov[i].iov_len -= written;
+      }
+    }
+  }
+
+  return LUABINS_ESUCCESS;
+}
@@ -0,0 +1,128 @@
+/*
+* iovwrite.h
+* Luabins Lua-less scatter/gather write API
+* See copyright notice in luabins.h
+*/
+
+#ifndef LUABINS_IOVWRITE_H_INCLUDED_
+#define LUABINS_IOVWRITE_H_INCLUDED_
+
+#include <sys/uio.h> /* struct iovec */
+
+#include "saveload.h"
+#include "savebuffer.h"
+#include "write.h"
+
+/* Reasonable default for string reference threshold */
+#define LUABINS_IOVTHRESHOLD (4096)
+
+/* String data, referenced by the writer */
+typedef struct lbs_IovRef
+{
+  size_t offset; /* Position in inline data where string is inserted */
+  const char * data;
+  size_t length;
+} lbs_IovRef;
+
+/*
+* Writer keeps small values in inline buffer, and strings
+* not shorter than threshold as references to original memory.
+* Referenced strings are NOT copied, caller must keep them alive
+* and unchanged until writer is destroyed.
+*
+* Resulting data is a sequence of segments: inline chunk, referenced string,
+* inline chunk, and so on. It may be written with single writev(2) call
+* (see lbs_iovwriterWrite()), or fetched with lbs_iovwriterSegments()
+* to be used with sendmsg(2) and such.
+*
+* Note that table headers in inline buffer may be patched with
+* lbs_writeTableHeaderAt() (see write.h), since references do not occupy
+* any space in inline buffer.
+*/
+typedef struct lbs_IovWriter
+{
+  luabins_SaveBuffer sb; /* Inline data */
+
+  lbs_IovRef * refs;
+  size_t num_refs;
+  size_t refs_size; /* Allocated number of refs */
+
+  size_t threshold;
+  size_t ref_length; /* Total length of referenced strings */
+} lbs_IovWriter;
+
+void lbs_iovwriterInit(
+    lbs_IovWriter * w,
+    size_t threshold,
+    lua_Alloc alloc_fn,
+    void * alloc_ud
+  );
+
+void lbs_iovwriterDestroy(lbs_IovWriter * w);
+
+/* Total data length, referenced strings included */
+#define lbs_iovwriterLength(w) \
+  (lbsSB_length(&(w)->sb) + (w)->ref_length)
+
+/* Maximum number of segments needed to describe all data */
+#define lbs_iovwriterNumSegments(w) \
+  ((w)->num_refs * 2 + 1)
+
+/*
+* Fills at most max_iov vectors, beginning from given segment.
+* Empty segments are skipped. Sets *next to the first segment not filled.
+* Returns number of filled vectors.
+*/
+int lbs_iovwriterSegments(
+    lbs_IovWriter * w,
+    size_t first,
+    struct iovec * iov,
+    int max_iov,
+    size_t * next
+  );
+
+/*
+* Writes all data to file descriptor with writev(2).
+* Returns non-zero (LUABINS_EWRITE) if write failed.
+*/
+int lbs_iovwriterWrite(lbs_IovWriter * w, int fd);
+
+#define lbs_iovwriteTupleSize(w, tuple_size) \
+  lbs_writeTupleSize(&(w)->sb, (tuple_size))
+
+#define lbs_iovwriteTableHeader(w, array_size, hash_size) \
+  lbs_writeTableHeader(&(w)->sb, (array_size), (hash_size))
+
+#define lbs_iovwriteNil(w) \
+  lbs_writeNil(&(w)->sb)
+
+#define lbs_iovwriteBoolean(w, value) \
+  lbs_writeBoolean(&(w)->sb, (value))
+
+#define lbs_iovwriteNumber(w, value) \
+  lbs_writeNumber(&(w)->sb, (value))
+
+#define lbs_iovwriteFloat(w, value) \
+  lbs_writeFloat(&(w)->sb, (value))
+
+#define lbs_iovwriteInteger lbs_iovwriteNumber
+
+#define lbs_iovwritePackedNumbers(w, values, count, use_float) \
+  lbs_writePackedNumbers(&(w)->sb, (values), (count), (use_float))
+
+#define lbs_iovwriteBitset(w, bits, count) \
+  lbs_writeBitset(&(w)->sb, (bits), (count))
+
+#define lbs_iovwriteSpansHeader(w, num_spans, total) \
+  lbs_writeSpansHeader(&(w)->sb, (num_spans), (total))
+
+#define lbs_iovwriteSpanHeader(w, first_key, count) \
+  lbs_writeSpanHeader(&(w)->sb, (first_key), (count))
+
+int lbs_iovwriteString(
+    lbs_IovWriter * w,
+    const char * value,
+    size_t length
+  );
+
+#endif /* LUABINS_IOVWRITE_H_INCLUDED_ */
@@ -4,6 +4,7 @@
 * See copyright notice in luabins.h
 */
 
+#include <limits.h> /* INT_MAX */
 #include <string.h>
 
 #include "luaheaders.h"
@@ -11,6 +12,12 @@
 #include "luabins.h"
 #include "saveload.h"
 #include "luainternals.h"
+#include "packed.h"
+#include "compress.h"
+#include "checksum.h"
+#include "extension.h"
+#include "byteorder.h"
+#include "stage.h"
 
 #if 0
   #define XSPAM(a) printf a
@@ -24,33 +31,150 @@
   #define SPAM(a) (void)0
 #endif
 
+/* Number of packed array elements to unpack at once */
+#define LUABINS_PACKEDCHUNK (256)
+
 typedef struct lbs_LoadState
 {
   const unsigned char * pos;
   size_t unread;
+  size_t length; /* Total data length, decompressed, see lbsLS_tell() */
+  int flags; /* LUABINS_F* load flags */
+  int shapes_index; /* Stack index of shape definitions, see load_shaped() */
+
+  /* Compressed data only, see lbsLS_refill() */
+  lua_State * L;
+  lbs_BlockReader blocks;
+  int window_index; /* Stack index of window userdata */
+  unsigned char * window;
+  size_t window_size;
 } lbs_LoadState;
 
-static void lbsLS_init(
+/*
+* Note that if data is compressed, this pushes window placeholder
+* on the stack.
+*/
+static int lbsLS_init(
     lbs_LoadState * ls,
+    lua_State * L,
     const unsigned char * data,
-    size_t len
+    size_t len,
+    int flags
   )
 {
   ls->pos = (len > 0) ? data : NULL;
   ls->unread = len;
+  ls->length = len;
+  ls->flags = flags;
+  ls->shapes_index = 0;
+
+  ls->L = L;
+  ls->blocks.pos = NULL;
+  ls->blocks.unread = 0;
+  ls->blocks.pending = 0;
+  ls->window_index = 0;
+  ls->window = NULL;
+  ls->window_size = 0;
+
+  if (len > 0 && data[0] == LUABINS_CCOMPRESSED)
+  {
+    int result = lbs_blockReaderInit(&ls->blocks, data, len);
+    if (result != LUABINS_ESUCCESS)
+    {
+      return result;
+    }
+
+    /* Nothing is decompressed yet */
+    ls->pos = data;
+    ls->unread = 0;
+    ls->length = ls->blocks.pending;
+
+    luaL_checkstack(L, 1, "load");
+    lua_pushnil(L);
+    ls->window_index = lua_gettop(L);
+  }
+
+  return LUABINS_ESUCCESS;
 }
 
 #define lbsLS_good(ls) \
   ((ls)->pos != NULL)
 
+/* Includes data which is not decompressed yet */
 #define lbsLS_unread(ls) \
-  ((ls)->unread)
+  ((ls)->unread + (ls)->blocks.pending)
+
+/* Offset of the next byte to read from data start, decompressed */
+#define lbsLS_tell(ls) \
+  ((ls)->length - lbsLS_unread(ls))
+
+/*
+* Decompresses blocks until at least len bytes are available.
+* Unread bytes are moved to the start of the window first,
+* so the window holds at most the largest value and a block.
+*/
+static int lbsLS_refill(lbs_LoadState * ls, size_t len)
+{
+  size_t needed = 0;
+
+  if (len - ls->unread > ls->blocks.pending)
+  {
+    return LUABINS_EBADDATA;
+  }
+
+  needed = len + luabins_min(ls->blocks.pending, LUABINS_BLOCKSIZE);
+  if (needed > ls->window_size)
+  {
+    size_t size = luabins_max(needed, 2 * ls->window_size);
+    unsigned char * window = NULL;
+
+    XSPAM(("* load: window grows to %lu\n", (unsigned long)size));
+
+    luaL_checkstack(ls->L, 1, "load");
+    window = (unsigned char *)lua_newuserdata(ls->L, size);
+    memcpy(window, ls->pos, ls->unread);
+    lua_replace(ls->L, ls->window_index); /* Old window is collected */
+
+    ls->window = window;
+    ls->window_size = size;
+  }
+  else
+  {
+    memmove(ls->window, ls->pos, ls->unread);
+  }
+  ls->pos = ls->window;
+
+  while (ls->unread < len)
+  {
+    size_t raw_length = 0;
+    int result = lbs_readBlock(
+        &ls->blocks,
+        ls->window + ls->unread,
+        &raw_length
+      );
+    if (result != LUABINS_ESUCCESS)
+    {
+      SPAM(("load: Failed to decompress block\n"));
+      return result;
+    }
+
+    ls->unread += raw_length;
+  }
+
+  return LUABINS_ESUCCESS;
+}
 
 static unsigned char lbsLS_readbyte(lbs_LoadState * ls)
 {
   if (lbsLS_good(ls))
   {
-    if (lbsLS_unread(ls) > 0)
+    if (
+        ls->unread > 0 ||
+        (
+          ls->blocks.pending > 0 &&
+          lbsLS_refill(ls, 1) == LUABINS_ESUCCESS
+        )
+      )
     {
       const unsigned char b = *ls->pos;
       ++ls->pos;
@@ -66,12 +190,22 @@ static unsigned char lbsLS_readbyte(lbs_LoadState * ls)
   return 0;
 }
 
+/*
+* Returned pointer is valid until the next read.
+* Note that this is the only place where compressed data is handled.
+*/
 static const unsigned char * lbsLS_eat(lbs_LoadState * ls, size_t len)
 {
   const unsigned char * result = NULL;
   if (lbsLS_good(ls))
   {
-    if (lbsLS_unread(ls) >= len)
+    if (
+        ls->unread >= len ||
+        (
+          ls->blocks.pending > 0 &&
+          lbsLS_refill(ls, len) == LUABINS_ESUCCESS
+        )
+      )
     {
       XSPAM(("* eat: len %u\n", (int)len));
       result = ls->pos;
@@ -88,279 +222,1755 @@ static const unsigned char * lbsLS_eat(lbs_LoadState * ls, size_t len)
   return result;
 }
 
-static int lbsLS_readbytes(
-    lbs_LoadState * ls,
-    unsigned char * buf,
-    size_t len
-  )
+/* Skips data in chunks, so compressed data window does not grow */
+static int lbsLS_skip(lbs_LoadState * ls, size_t len)
+{
+  while (len > 0)
+  {
+    size_t chunk = luabins_min(len, LUABINS_BLOCKSIZE);
+    if (lbsLS_eat(ls, chunk) == NULL)
+    {
+      SPAM(("load: Failed to skip %lu bytes\n", (unsigned long)len));
+      return LUABINS_EBADDATA;
+    }
+    len -= chunk;
+  }
+  return LUABINS_ESUCCESS;
+}
+
+/* Multibyte values are little-endian in data, see byteorder.h */
+
+static int lbsLS_readint(lbs_LoadState * ls, int * value)
+{
+  const unsigned char * pos = lbsLS_eat(ls, LUABINS_LINT);
+  if (pos != NULL)
+  {
+    lbs_loadLE(*value, pos, LUABINS_LINT);
+    return LUABINS_ESUCCESS;
+  }
+  SPAM(("load: Failed to read int\n"));
+  return LUABINS_EBADDATA;
+}
+
+static int lbsLS_readsize(lbs_LoadState * ls, size_t * value)
 {
-  const unsigned char * pos = lbsLS_eat(ls, len);
+  const unsigned char * pos = lbsLS_eat(ls, LUABINS_LSIZET);
   if (pos != NULL)
   {
-    memcpy(buf, pos, len);
+    lbs_loadSize(*value, pos);
     return LUABINS_ESUCCESS;
   }
-  SPAM(("load: Failed to read %lu bytes\n", (unsigned long)len));
+  SPAM(("load: Failed to read size\n"));
   return LUABINS_EBADDATA;
 }
 
+/*
+* Converts stored integer to number, for integers that do not fit
+* lua_Integer. High half times 2^32 is exact, so result is rounded once.
+*/
+static lua_Number integer_to_number(const unsigned char * pos)
+{
+  lua_Number lo = 0;
+  lua_Number hi = 0;
+  int i = 0;
+
+  for (i = 3; i >= 0; --i)
+  {
+    lo = lo * 256 + pos[i];
+  }
+
+  for (i = LUABINS_LINTEGER - 1; i >= 4; --i)
+  {
+    hi = hi * 256 + pos[i];
+  }
+
+  if (pos[LUABINS_LINTEGER - 1] & 0x80)
+  {
+    hi -= 4294967296.0; /* Two's complement */
+  }
+
+  return hi * 4294967296.0 + lo;
+}
+
+/*
+* Pushes integer stored at pos. Where Lua has no integer subtype,
+* integer is pushed as number. LuaJIT gets int64_t cdata instead
+* if number would lose precision.
+*/
+static void push_integer(lua_State * L, const unsigned char * pos)
+{
+  lua_Integer value = 0;
+
+  if (!lbs_getInteger(pos, &value))
+  {
+#if LUABINS_LUAJIT
+    if (lbs_pushBoxedInteger(L, pos))
+    {
+      return;
+    }
+#endif
+    lua_pushnumber(L, integer_to_number(pos));
+    return;
+  }
+
+#if LUABINS_INTEGERS
+  lua_pushinteger(L, value);
+#else
+#if LUABINS_LUAJIT
+  if (
+      ((lua_Number)value > 9007199254740992.0 || /* 2^53 */
+      (lua_Number)value < -9007199254740992.0) &&
+      lbs_pushBoxedInteger(L, pos)
+    )
+  {
+    return;
+  }
+#endif
+  lua_pushnumber(L, (lua_Number)value);
+#endif
+}
+
 static int load_value(lua_State * L, lbs_LoadState * ls);
 
-static int load_table(lua_State * L, lbs_LoadState * ls)
+/* Packed array userdata __index metamethod */
+static int l_packed_index(lua_State * L)
 {
-  int array_size = 0;
-  int hash_size = 0;
-  unsigned int total_size = 0;
+  size_t count = lbs_objlen(L, 1) / sizeof(lua_Number);
+
+  if (lua_type(L, 2) == LUA_TNUMBER)
+  {
+    lua_Number key = lua_tonumber(L, 2);
+    if (key >= 1 && key <= (lua_Number)count && key == (size_t)key)
+    {
+      const lua_Number * values = (const lua_Number *)lua_touserdata(L, 1);
+      lua_pushnumber(L, values[(size_t)key - 1]);
+      return 1;
+    }
+  }
+
+  lua_pushnil(L);
+  return 1;
+}
+
+/* Packed array userdata __len metamethod */
+static int l_packed_len(lua_State * L)
+{
+  lua_pushinteger(L, lbs_objlen(L, 1) / sizeof(lua_Number));
+  return 1;
+}
+
+static void push_packed_metatable(lua_State * L)
+{
+  if (luaL_newmetatable(L, LUABINS_PACKEDMT))
+  {
+    lua_pushcfunction(L, l_packed_index);
+    lua_setfield(L, -2, "__index");
+
+    lua_pushcfunction(L, l_packed_len);
+    lua_setfield(L, -2, "__len");
+  }
+}
+
+static int load_packed(lua_State * L, lbs_LoadState * ls)
+{
+  const unsigned char * data = NULL;
+  size_t width = 0;
+  int count = 0;
+
+  unsigned char type = lbsLS_readbyte(ls);
+  int result = lbsLS_good(ls) ? LUABINS_ESUCCESS : LUABINS_EBADDATA;
 
-  int result = lbsLS_readbytes(ls, (unsigned char *)&array_size, LUABINS_LINT);
   if (result == LUABINS_ESUCCESS)
   {
-    result = lbsLS_readbytes(ls, (unsigned char *)&hash_size, LUABINS_LINT);
+    width = lbs_packedWidth(type);
+    if (width == 0)
+    {
+      SPAM(("load: Unknown packed element type 0x%02X found\n", type));
+      result = LUABINS_EBADDATA;
+    }
+  }
+
+  if (result == LUABINS_ESUCCESS)
+  {
+    result = lbsLS_readint(ls, &count);
   }
 
   if (result == LUABINS_ESUCCESS)
   {
-    total_size = array_size + hash_size;
-/*
-    SPAM((
-        "LT SIZE CHECK\n"
-        "* array_size %d limit 0 .. %d\n"
-        "* hash_size %d limit >0\n"
-        "* hash_size bytes %d, limit %d\n"
-        "* unread %u limit >min_size %u (total_size %u)\n",
-        array_size, MAXASIZE,
-        hash_size,
-        ceillog2((unsigned int)hash_size), MAXBITS,
-        (unsigned int)lbsLS_unread(ls),
-        (unsigned int)luabins_min_table_data_size(total_size),
-        (unsigned int)total_size
-      ));
-*/
     if (
-        array_size < 0 || array_size > MAXASIZE ||
-        hash_size < 0  ||
-        (hash_size > 0 && ceillog2((unsigned int)hash_size) > MAXBITS) ||
-        lbsLS_unread(ls) < luabins_min_table_data_size(total_size)
+        count < 0 || count > MAXASIZE ||
+        lbsLS_unread(ls) / width < (size_t)count
       )
     {
       result = LUABINS_EBADSIZE;
     }
+    else
+    {
+      /* Pending compressed block may still fail to decode */
+      data = lbsLS_eat(ls, count * width);
+      if (data == NULL)
+      {
+        result = LUABINS_EBADSIZE;
+      }
+    }
   }
 
   if (result == LUABINS_ESUCCESS)
   {
-    unsigned int i = 0;
-
-    XSPAM((
-        "* load: creating table a:%d + h:%d = %d\n",
-        array_size, hash_size, total_size
-      ));
+    XSPAM(("* load: packed '%c' x %d\n", type, count));
 
-    lua_createtable(L, array_size, hash_size);
+    if (ls->flags & LUABINS_FRAWPACKED)
+    {
+      luaL_checkstack(L, 2, "load_packed");
 
-    for (i = 0; i < total_size; ++i)
+      lbs_packedUnpack(
+          data,
+          type,
+          count,
+          (lua_Number *)lua_newuserdata(L, count * sizeof(lua_Number))
+        );
+      push_packed_metatable(L);
+      lua_setmetatable(L, -2);
+    }
+    else
     {
-      int key_type = LUA_TNONE;
+      /* Unpack in chunks to keep the element loop tight */
+      lua_Number buf[LUABINS_PACKEDCHUNK];
+      int i = 0;
 
-      result = load_value(L, ls); /* Load key. */
-      if (result != LUABINS_ESUCCESS)
-      {
-        break;
-      }
+      /* Integer elements keep integer subtype, see save_array() */
+      const int as_integer = LUABINS_INTEGERS &&
+        type != LUABINS_PNUMBER && type != LUABINS_PFLOAT;
 
-      /* Table key can't be nil or NaN */
-      key_type = lua_type(L, -1);
-      if (key_type == LUA_TNIL)
-      {
-        /* Corrupt data? */
-        SPAM(("load: nil as key detected\n"));
-        result = LUABINS_EBADDATA;
-        break;
-      }
+      luaL_checkstack(L, 2, "load_packed");
 
-      if (key_type == LUA_TNUMBER)
+      lua_createtable(L, count, 0);
+      while (i < count)
       {
-        lua_Number key = lua_tonumber(L, -1);
-        if (luai_numisnan(key))
+        int chunk = luabins_min(count - i, LUABINS_PACKEDCHUNK);
+        int j = 0;
+
+        lbs_packedUnpack(data + i * width, type, chunk, buf);
+        for (j = 0; j < chunk; ++j)
         {
-          /* Corrupt data? */
-          SPAM(("load: NaN as key detected\n"));
-          result = LUABINS_EBADDATA;
-          break;
+          if (as_integer)
+          {
+            lua_pushinteger(L, (lua_Integer)buf[j]);
+          }
+          else
+          {
+            lua_pushnumber(L, buf[j]);
+          }
+          lua_rawseti(L, -2, ++i);
         }
       }
+    }
+  }
 
-      result = load_value(L, ls); /* Load value. */
-      if (result != LUABINS_ESUCCESS)
+  return result;
+}
+
+static int load_bitset(lua_State * L, lbs_LoadState * ls)
+{
+  const unsigned char * bits = NULL;
+  int count = 0;
+
+  int result = lbsLS_readint(ls, &count);
+  if (result == LUABINS_ESUCCESS)
+  {
+    if (count < 0 || count > MAXASIZE)
+    {
+      result = LUABINS_EBADSIZE;
+    }
+    else
+    {
+      bits = lbsLS_eat(ls, lbs_bitsetSize(count));
+      if (bits == NULL)
       {
-        break;
+        result = LUABINS_EBADSIZE;
       }
+    }
+  }
 
-      lua_rawset(L, -3);
+  if (result == LUABINS_ESUCCESS)
+  {
+    int i = 0;
+
+    XSPAM(("* load: bitset x %d\n", count));
+
+    luaL_checkstack(L, 2, "load_bitset");
+
+    lua_createtable(L, count, 0);
+    while (i < count)
+    {
+      /* Note that unused bits of the last byte are ignored */
+      unsigned int byte = *bits++;
+      int last = luabins_min(count, i + 8);
+
+      for ( ; i < last; ++i, byte >>= 1)
+      {
+        lua_pushboolean(L, byte & 1);
+        lua_rawseti(L, -2, i + 1);
+      }
     }
   }
 
   return result;
 }
 
-static int load_value(lua_State * L, lbs_LoadState * ls)
+static int load_spans(lua_State * L, lbs_LoadState * ls)
 {
-  int result = LUABINS_ESUCCESS;
-  unsigned char type = lbsLS_readbyte(ls);
-  if (!lbsLS_good(ls))
+  int num_spans = 0;
+  int total = 0;
+
+  int result = lbsLS_readint(ls, &num_spans);
+  if (result == LUABINS_ESUCCESS)
   {
-    SPAM(("load: Failed to read value type byte\n"));
-    return LUABINS_EBADDATA;
+    result = lbsLS_readint(ls, &total);
   }
 
-  XSPAM(("* load: begin load_value\n"));
-
-  luaL_checkstack(L, 1, "load_value");
+  if (result == LUABINS_ESUCCESS)
+  {
+    /* Each span has at least one value, values are at least one byte */
+    if (
+        total < 0 || total > MAXASIZE ||
+        num_spans < 0 || num_spans > total ||
+        lbsLS_unread(ls) <
+          (size_t)num_spans * LUABINS_LSPAN + (size_t)total * LUABINS_LTYPEBYTE
+      )
+    {
+      result = LUABINS_EBADSIZE;
+    }
+  }
 
-  switch (type)
+  if (result == LUABINS_ESUCCESS)
   {
-  case LUABINS_CNIL:
-    XSPAM(("* load: nil\n"));
-    lua_pushnil(L);
-    break;
+    int remaining = total;
+    int last_key = 0;
+    int i = 0;
 
-  case LUABINS_CFALSE:
-    XSPAM(("* load: false\n"));
-    lua_pushboolean(L, 0);
-    break;
+    XSPAM(("* load: spans %d, values %d\n", num_spans, total));
 
-  case LUABINS_CTRUE:
-    XSPAM(("* load: true\n"));
-    lua_pushboolean(L, 1);
-    break;
+    luaL_checkstack(L, 2, "load_spans");
 
-  case LUABINS_CNUMBER:
+    lua_createtable(L, total, 0);
+    for (i = 0; i < num_spans && result == LUABINS_ESUCCESS; ++i)
     {
-      lua_Number value;
+      int first_key = 0;
+      int count = 0;
+      int j = 0;
 
-      XSPAM(("* load: number\n"));
-
-      result = lbsLS_readbytes(ls, (unsigned char *)&value, LUABINS_LNUMBER);
+      result = lbsLS_readint(ls, &first_key);
       if (result == LUABINS_ESUCCESS)
       {
-        lua_pushnumber(L, value);
+        result = lbsLS_readint(ls, &count);
       }
-    }
+
+      if (result != LUABINS_ESUCCESS)
+      {
+        break;
+      }
+
+      /* Spans must be sorted, must not overlap, and keys must fit int */
+      if (
+          first_key <= last_key ||
+          count < 1 || count > remaining ||
+          count - 1 > INT_MAX - first_key
+        )
+      {
+        SPAM(("load: bad span %d x %d\n", first_key, count));
+        result = LUABINS_EBADSIZE;
+        break;
+      }
+
+      for (j = 0; j < count; ++j)
+      {
+        result = load_value(L, ls);
+        if (result != LUABINS_ESUCCESS)
+        {
+          break;
+        }
+
+        if (lua_isnil(L, -1))
+        {
+          /* Corrupt data? */
+          SPAM(("load: nil in span detected\n"));
+          result = LUABINS_EBADDATA;
+          break;
+        }
+
+        lua_rawseti(L, -2, first_key + j);
+      }
+
+      last_key = first_key + count - 1;
+      remaining -= count;
+    }
+
+    if (result == LUABINS_ESUCCESS && remaining != 0)
+    {
+      result = LUABINS_EBADSIZE;
+    }
+  }
+
+  return result;
+}
+
+/*
+* Loads values of a shaped table.
+* Expects key table of its shape on stack top, replaces it with loaded table.
+*/
+static int load_shaped_values(lua_State * L, lbs_LoadState * ls)
+{
+  int result = LUABINS_ESUCCESS;
+  int num_keys = (int)lbs_objlen(L, -1);
+  int i = 0;
+
+  luaL_checkstack(L, 3, "load_shaped");
+
+  lua_createtable(L, 0, num_keys);
+  for (i = 1; i <= num_keys; ++i)
+  {
+    lua_rawgeti(L, -2, i); /* Key */
+
+    result = load_value(L, ls);
+    if (result != LUABINS_ESUCCESS)
+    {
+      break;
+    }
+
+    if (lua_isnil(L, -1))
+    {
+      /* Corrupt data? */
+      SPAM(("load: nil in shaped table detected\n"));
+      result = LUABINS_EBADDATA;
+      break;
+    }
+
+    lua_rawset(L, -3);
+  }
+
+  if (result == LUABINS_ESUCCESS)
+  {
+    lua_remove(L, -2); /* Remove keys */
+  }
+
+  return result;
+}
+
+static int load_shape_def(lua_State * L, lbs_LoadState * ls)
+{
+  /* Type byte is already read */
+  size_t def_pos = lbsLS_tell(ls) - LUABINS_LTYPEBYTE;
+  int num_keys = 0;
+
+  int result = lbsLS_readint(ls, &num_keys);
+  if (result == LUABINS_ESUCCESS)
+  {
+    /* Each key has at least its length and a value type byte */
+    if (
+        num_keys < 1 || num_keys > MAXASIZE ||
+        lbsLS_unread(ls) / (LUABINS_LSIZET + LUABINS_LTYPEBYTE) <
+          (size_t)num_keys
+      )
+    {
+      result = LUABINS_EBADSIZE;
+    }
+  }
+
+  if (result == LUABINS_ESUCCESS)
+  {
+    int i = 0;
+
+    XSPAM((
+        "* load: shape at %lu, keys %d\n",
+        (unsigned long)def_pos, num_keys
+      ));
+
+    luaL_checkstack(L, 3, "load_shape_def");
+
+    if (lua_isnil(L, ls->shapes_index))
+    {
+      lua_newtable(L);
+      lua_replace(L, ls->shapes_index);
+    }
+
+    lua_createtable(L, num_keys, 0);
+    for (i = 1; i <= num_keys; ++i)
+    {
+      size_t len = 0;
+      const unsigned char * key = NULL;
+
+      result = lbsLS_readsize(ls, &len);
+      if (result != LUABINS_ESUCCESS)
+      {
+        break;
+      }
+
+      key = lbsLS_eat(ls, len);
+      if (key == NULL)
+      {
+        result = LUABINS_EBADSIZE;
+        break;
+      }
+
+      lua_pushlstring(L, (const char *)key, len);
+      lua_rawseti(L, -2, i);
+    }
+  }
+
+  if (result == LUABINS_ESUCCESS)
+  {
+    lua_pushnumber(L, (lua_Number)def_pos);
+    lua_pushvalue(L, -2);
+    lua_rawset(L, ls->shapes_index);
+
+    result = load_shaped_values(L, ls);
+  }
+
+  return result;
+}
+
+static int load_shaped(lua_State * L, lbs_LoadState * ls)
+{
+  /* Type byte is already read */
+  size_t type_pos = lbsLS_tell(ls) - LUABINS_LTYPEBYTE;
+  size_t distance = 0;
+
+  int result = lbsLS_readsize(ls, &distance);
+  if (result == LUABINS_ESUCCESS)
+  {
+    if (distance == 0 || distance > type_pos)
+    {
+      result = LUABINS_EBADSIZE;
+    }
+  }
+
+  if (result == LUABINS_ESUCCESS)
+  {
+    XSPAM(("* load: shaped, distance %lu\n", (unsigned long)distance));
+
+    luaL_checkstack(L, 1, "load_shaped");
+
+    /* Definition must have been loaded already */
+    lua_pushnil(L);
+    if (!lua_isnil(L, ls->shapes_index))
+    {
+      lua_pop(L, 1);
+      lua_pushnumber(L, (lua_Number)(type_pos - distance));
+      lua_rawget(L, ls->shapes_index);
+    }
+
+    if (lua_istable(L, -1))
+    {
+      result = load_shaped_values(L, ls);
+    }
+    else
+    {
+      SPAM(("load: shaped table refers to unknown shape\n"));
+      result = LUABINS_EBADDATA;
+    }
+  }
+
+  return result;
+}
+
+/* Reads columns header (after the type byte) */
+static int load_columns_header(
+    lbs_LoadState * ls,
+    int * num_records,
+    int * num_columns
+  )
+{
+  int result = lbsLS_readint(ls, num_records);
+  if (result == LUABINS_ESUCCESS)
+  {
+    result = lbsLS_readint(ls, num_columns);
+  }
+
+  if (result == LUABINS_ESUCCESS)
+  {
+    /* Each column has at least directory entry and a type byte */
+    if (
+        *num_records < 0 || *num_records > MAXASIZE ||
+        *num_columns < 0 ||
+        (*num_records == 0) != (*num_columns == 0) ||
+        lbsLS_unread(ls) / (LUABINS_LCOLUMN + LUABINS_LTYPEBYTE) <
+          (size_t)*num_columns
+      )
+    {
+      result = LUABINS_EBADSIZE;
+    }
+  }
+
+  return result;
+}
+
+/*
+* Reads name of column directory entry.
+* Returned name is valid until the next read, so use it before
+* reading entry size with load_column_size().
+*/
+static int load_column_name(
+    lbs_LoadState * ls,
+    const unsigned char ** name,
+    size_t * name_len
+  )
+{
+  int result = lbsLS_readsize(ls, name_len);
+  if (result == LUABINS_ESUCCESS)
+  {
+    *name = lbsLS_eat(ls, *name_len);
+    result = (*name != NULL) ? LUABINS_ESUCCESS : LUABINS_EBADSIZE;
+  }
+
+  return result;
+}
+
+/* Reads column size of directory entry, after load_column_name() */
+static int load_column_size(lbs_LoadState * ls, size_t * size)
+{
+  int result = lbsLS_readsize(ls, size);
+  if (result == LUABINS_ESUCCESS && *size > lbsLS_unread(ls))
+  {
+    result = LUABINS_EBADSIZE;
+  }
+
+  return result;
+}
+
+/* Loads single column of given size, checks that it is a table */
+static int load_column_value(lua_State * L, lbs_LoadState * ls, size_t size)
+{
+  size_t start = lbsLS_tell(ls);
+
+  int result = load_value(L, ls);
+  if (result == LUABINS_ESUCCESS)
+  {
+    if (lbsLS_tell(ls) - start != size)
+    {
+      SPAM(("load: column size mismatch\n"));
+      result = LUABINS_EBADSIZE;
+    }
+    else if (!lua_istable(L, -1) && !lua_isuserdata(L, -1))
+    {
+      SPAM(("load: column is not a table\n"));
+      result = LUABINS_EBADDATA;
+    }
+  }
+
+  return result;
+}
+
+/* Loads columns back as an array of records */
+static int load_columns(lua_State * L, lbs_LoadState * ls)
+{
+  int num_records = 0;
+  int num_columns = 0;
+  int num_created = 0;
+  int flags = ls->flags;
+  int records = 0;
+  size_t * sizes = NULL;
+  int i = 0;
+
+  int result = load_columns_header(ls, &num_records, &num_columns);
+  if (result != LUABINS_ESUCCESS)
+  {
+    return result;
+  }
+
+  XSPAM(("* load: columns %d x %d\n", num_records, num_columns));
+
+  luaL_checkstack(L, 10, "load_columns");
+
+  /* Record count alone is not trusted to preallocate */
+  lua_createtable(
+      L,
+      (int)luabins_min((size_t)num_records, lbsLS_unread(ls)),
+      0
+    );
+  records = lua_gettop(L);
+  lua_createtable(L, num_columns, 0); /* Names */
+  sizes = (size_t *)lua_newuserdata(L, num_columns * sizeof(size_t));
+
+  for (i = 0; i < num_columns && result == LUABINS_ESUCCESS; ++i)
+  {
+    const unsigned char * name = NULL;
+    size_t name_len = 0;
+
+    result = load_column_name(ls, &name, &name_len);
+    if (result == LUABINS_ESUCCESS)
+    {
+      lua_pushlstring(L, (const char *)name, name_len);
+      lua_rawseti(L, records + 1, i + 1);
+
+      result = load_column_size(ls, &sizes[i]);
+    }
+  }
+
+  /* Columns are transposed back, they must be plain tables for that */
+  ls->flags &= ~LUABINS_FRAWPACKED;
+
+  for (i = 0; i < num_columns && result == LUABINS_ESUCCESS; ++i)
+  {
+    result = load_column_value(L, ls, sizes[i]);
+    if (result != LUABINS_ESUCCESS)
+    {
+      break;
+    }
+
+    if (!lua_istable(L, -1))
+    {
+      result = LUABINS_EBADDATA;
+      break;
+    }
+
+    lua_rawgeti(L, records + 1, i + 1); /* Name */
+
+    lua_pushnil(L);
+    while (result == LUABINS_ESUCCESS && lua_next(L, -3) != 0)
+    {
+      lua_Number key = lua_tonumber(L, -2);
+      int index = 0;
+
+      if (lua_type(L, -2) == LUA_TNUMBER && key >= 1 && key <= num_records)
+      {
+        index = (int)key;
+      }
+
+      if (index == 0 || key != (lua_Number)index)
+      {
+        SPAM(("load: bad column key\n"));
+        result = LUABINS_EBADDATA;
+        break;
+      }
+
+      lua_rawgeti(L, records, index);
+      if (lua_isnil(L, -1))
+      {
+        lua_pop(L, 1);
+        lua_createtable(L, 0, num_columns);
+        lua_pushvalue(L, -1);
+        lua_rawseti(L, records, index);
+        ++num_created;
+      }
+
+      lua_pushvalue(L, -4); /* Name */
+      lua_pushvalue(L, -3); /* Value */
+      lua_rawset(L, -3);
+      lua_pop(L, 2); /* Leave key for the next iteration. */
+    }
+
+    if (result == LUABINS_ESUCCESS)
+    {
+      lua_pop(L, 2); /* Remove column and name */
+    }
+  }
+
+  ls->flags = flags;
+
+  /* Each record has at least one field */
+  if (result == LUABINS_ESUCCESS && num_created != num_records)
+  {
+    SPAM(("load: column records mismatch\n"));
+    result = LUABINS_EBADDATA;
+  }
+
+  if (result == LUABINS_ESUCCESS)
+  {
+    lua_pop(L, 2); /* Remove names and sizes */
+  }
+
+  return result;
+}
+
+/* Loads extension value with its registered type, see extension.h */
+static int load_extension(lua_State * L, lbs_LoadState * ls)
+{
+  const unsigned char * pos = NULL;
+  size_t len = 0;
+
+  int result = lbsLS_readsize(ls, &len);
+  if (result == LUABINS_ESUCCESS)
+  {
+    pos = lbsLS_eat(ls, len);
+    if (pos == NULL)
+    {
+      result = LUABINS_EBADSIZE;
+    }
+  }
+
+  if (result != LUABINS_ESUCCESS)
+  {
+    return result;
+  }
+
+  /* Name is pushed since payload read may move the data */
+  luaL_checkstack(L, 2, "load_extension");
+  lua_pushlstring(L, (const char *)pos, len);
+
+  result = lbsLS_readsize(ls, &len);
+  if (result == LUABINS_ESUCCESS)
+  {
+    pos = lbsLS_eat(ls, len);
+    if (pos == NULL)
+    {
+      result = LUABINS_EBADSIZE;
+    }
+  }
+
+  if (result != LUABINS_ESUCCESS)
+  {
+    lua_pop(L, 1); /* Remove name */
+    return result;
+  }
+
+  /* Name is replaced with type entry */
+  if (!lbs_pushType(L))
+  {
+    SPAM(("load: unknown custom type\n"));
+    return LUABINS_EBADTYPE;
+  }
+
+  result = lbs_loadExtension(L, lua_gettop(L), pos, len);
+  if (result == LUABINS_ESUCCESS)
+  {
+    lua_remove(L, -2); /* Remove type entry */
+  }
+  else
+  {
+    lua_pop(L, 1);
+  }
+
+  return result;
+}
+
+static int load_table(lua_State * L, lbs_LoadState * ls)
+{
+  int array_size = 0;
+  int hash_size = 0;
+  unsigned int total_size = 0;
+
+  int result = lbsLS_readint(ls, &array_size);
+  if (result == LUABINS_ESUCCESS)
+  {
+    result = lbsLS_readint(ls, &hash_size);
+  }
+
+  if (result == LUABINS_ESUCCESS)
+  {
+    total_size = array_size + hash_size;
+/*
+    SPAM((
+        "LT SIZE CHECK\n"
+        "* array_size %d limit 0 .. %d\n"
+        "* hash_size %d limit >0\n"
+        "* hash_size bytes %d, limit %d\n"
+        "* unread %u limit >min_size %u (total_size %u)\n",
+        array_size, MAXASIZE,
+        hash_size,
+        ceillog2((unsigned int)hash_size), MAXBITS,
+        (unsigned int)lbsLS_unread(ls),
+        (unsigned int)luabins_min_table_data_size(total_size),
+        (unsigned int)total_size
+      ));
+*/
+    if (
+        array_size < 0 || array_size > MAXASIZE ||
+        hash_size < 0  ||
+        (hash_size > 0 && ceillog2((unsigned int)hash_size) > MAXBITS) ||
+        lbsLS_unread(ls) < luabins_min_table_data_size(total_size)
+      )
+    {
+      result = LUABINS_EBADSIZE;
+    }
+  }
+
+  if (result == LUABINS_ESUCCESS)
+  {
+    unsigned int i = 0;
+
+    XSPAM((
+        "* load: creating table a:%d + h:%d = %d\n",
+        array_size, hash_size, total_size
+      ));
+
+    lua_createtable(L, array_size, hash_size);
+
+    for (i = 0; i < total_size; ++i)
+    {
+      int key_type = LUA_TNONE;
+
+      result = load_value(L, ls); /* Load key. */
+      if (result != LUABINS_ESUCCESS)
+      {
+        break;
+      }
+
+      /* Table key can't be nil or NaN */
+      key_type = lua_type(L, -1);
+      if (key_type == LUA_TNIL)
+      {
+        /* Corrupt data? */
+        SPAM(("load: nil as key detected\n"));
+        result = LUABINS_EBADDATA;
+        break;
+      }
+
+      if (key_type == LUA_TNUMBER)
+      {
+        lua_Number key = lua_tonumber(L, -1);
+        if (luai_numisnan(key))
+        {
+          /* Corrupt data? */
+          SPAM(("load: NaN as key detected\n"));
+          result = LUABINS_EBADDATA;
+          break;
+        }
+      }
+
+      result = load_value(L, ls); /* Load value. */
+      if (result != LUABINS_ESUCCESS)
+      {
+        break;
+      }
+
+      lua_rawset(L, -3);
+    }
+  }
+
+  return result;
+}
+
+static int load_value(lua_State * L, lbs_LoadState * ls)
+{
+  int result = LUABINS_ESUCCESS;
+  unsigned char type = lbsLS_readbyte(ls);
+  if (!lbsLS_good(ls))
+  {
+    SPAM(("load: Failed to read value type byte\n"));
+    return LUABINS_EBADDATA;
+  }
+
+  XSPAM(("* load: begin load_value\n"));
+
+  luaL_checkstack(L, 1, "load_value");
+
+  switch (type)
+  {
+  case LUABINS_CNIL:
+    XSPAM(("* load: nil\n"));
+    lua_pushnil(L);
+    break;
+
+  case LUABINS_CFALSE:
+    XSPAM(("* load: false\n"));
+    lua_pushboolean(L, 0);
+    break;
+
+  case LUABINS_CTRUE:
+    XSPAM(("* load: true\n"));
+    lua_pushboolean(L, 1);
+    break;
+
+  case LUABINS_CNUMBER:
+    {
+      lua_Number value;
+      const unsigned char * pos = NULL;
+
+      XSPAM(("* load: number\n"));
+
+      pos = lbsLS_eat(ls, LUABINS_LNUMBER);
+      if (pos != NULL)
+      {
+        lbs_loadLE(value, pos, LUABINS_LNUMBER);
+        lua_pushnumber(L, value);
+      }
+      else
+      {
+        result = LUABINS_EBADDATA;
+      }
+    }
+    break;
+
+  case LUABINS_CINTEGER:
+    {
+      const unsigned char * pos = NULL;
+
+      XSPAM(("* load: integer\n"));
+
+      pos = lbsLS_eat(ls, LUABINS_LINTEGER);
+      if (pos != NULL)
+      {
+        push_integer(L, pos);
+      }
+      else
+      {
+        result = LUABINS_EBADDATA;
+      }
+    }
+    break;
+
+  case LUABINS_CFLOAT:
+    {
+      float value;
+      const unsigned char * pos = NULL;
+
+      XSPAM(("* load: float\n"));
+
+      pos = lbsLS_eat(ls, LUABINS_LFLOAT);
+      if (pos != NULL)
+      {
+        lbs_loadLE(value, pos, LUABINS_LFLOAT);
+        lua_pushnumber(L, value);
+      }
+      else
+      {
+        result = LUABINS_EBADDATA;
+      }
+    }
+    break;
+
+  case LUABINS_CSTRING:
+    {
+      size_t len = 0;
+
+      XSPAM(("* load: string\n"));
+
+      result = lbsLS_readsize(ls, &len);
+      if (result == LUABINS_ESUCCESS)
+      {
+        const unsigned char * pos = lbsLS_eat(ls, len);
+
+        XSPAM(("* load: string size %u\n", (int)len));
+
+        if (pos != NULL)
+        {
+          lua_pushlstring(L, (const char *)pos, len);
+        }
+        else
+        {
+          result = LUABINS_EBADSIZE;
+        }
+      }
+    }
+    break;
+
+  case LUABINS_CTABLE:
+    XSPAM(("* load: table\n"));
+    result = load_table(L, ls);
+    break;
+
+  case LUABINS_CPACKED:
+    XSPAM(("* load: packed\n"));
+    result = load_packed(L, ls);
+    break;
+
+  case LUABINS_CBITSET:
+    XSPAM(("* load: bitset\n"));
+    result = load_bitset(L, ls);
+    break;
+
+  case LUABINS_CSPANS:
+    XSPAM(("* load: spans\n"));
+    result = load_spans(L, ls);
+    break;
+
+  case LUABINS_CSHAPEDEF:
+    XSPAM(("* load: shape definition\n"));
+    result = load_shape_def(L, ls);
+    break;
+
+  case LUABINS_CSHAPED:
+    XSPAM(("* load: shaped\n"));
+    result = load_shaped(L, ls);
+    break;
+
+  case LUABINS_CCOLUMNS:
+    XSPAM(("* load: columns\n"));
+    result = load_columns(L, ls);
+    break;
+
+  case LUABINS_CEXTENSION:
+    XSPAM(("* load: extension\n"));
+    result = load_extension(L, ls);
+    break;
+
+  default:
+    SPAM(("load: Unknown type char 0x%02X found\n", type));
+    result = LUABINS_EBADDATA;
+    break;
+  }
+
+  XSPAM(("* load: end load_value\n"));
+
+  return result;
+}
+
+static void push_load_error(lua_State * L, int result)
+{
+  switch (result)
+  {
+  case LUABINS_EBADDATA:
+    lua_pushliteral(L, "can't load: corrupt data");
+    break;
+
+  case LUABINS_EBADSIZE:
+    lua_pushliteral(L, "can't load: corrupt data, bad size");
+    break;
+
+  case LUABINS_ETAILEFT:
+    lua_pushliteral(L, "can't load: extra data at end");
+    break;
+
+  case LUABINS_ECHECKSUM:
+    lua_pushliteral(L, "can't load: checksum mismatch");
+    break;
+
+  case LUABINS_EBADPATH:
+    lua_pushliteral(L, "can't patch: path not found");
+    break;
+
+  case LUABINS_EBADTYPE:
+    lua_pushliteral(L, "can't load: unknown custom type");
+    break;
+
+  case LUABINS_EEXTENSION:
+    lua_pushliteral(L, "can't load: custom type decoder failed");
+    break;
+
+  default: /* Should not happen */
+    lua_pushliteral(L, "load failed");
+    break;
+  }
+}
+
+int luabins_load(
+    lua_State * L,
+    const unsigned char * data,
+    size_t len,
+    int * count
+  )
+{
+  return luabins_load_ex(L, data, len, count, 0);
+}
+
+int luabins_load_ex(
+    lua_State * L,
+    const unsigned char * data,
+    size_t len,
+    int * count,
+    int flags
+  )
+{
+  lbs_LoadState ls;
+  int result = LUABINS_ESUCCESS;
+  unsigned char num_items = 0;
+  int base = 0;
+  int i = 0;
+
+  base = lua_gettop(L);
+
+  if (len > 0 && data[0] == LUABINS_CCHECKSUM)
+  {
+    /* Checked before anything is loaded, data is unwrapped */
+    result = lbs_verifyChecksum(data, len, &data, &len);
+  }
+
+  if (result == LUABINS_ESUCCESS)
+  {
+    result = lbsLS_init(&ls, L, data, len, flags);
+  }
+
+  if (result == LUABINS_ESUCCESS)
+  {
+    /* Placeholder for shape definitions, see load_shape_def() */
+    luaL_checkstack(L, 1, "load");
+    lua_pushnil(L);
+    ls.shapes_index = lua_gettop(L);
+
+    num_items = lbsLS_readbyte(&ls);
+  }
+
+  if (result != LUABINS_ESUCCESS)
+  {
+    SPAM(("load: bad envelope\n"));
+  }
+  else if (!lbsLS_good(&ls))
+  {
+    SPAM(("load: failed to read num_items byte\n"));
+    result = LUABINS_EBADDATA;
+  }
+  else if (num_items > LUABINS_MAXTUPLE)
+  {
+    SPAM(("load: tuple too large: %d\n", (int)num_items));
+    result = LUABINS_EBADSIZE;
+  }
+  else
+  {
+    XSPAM(("* load: tuple size %d\n", (int)num_items));
+    for (
+        i = 0;
+        i < num_items && result == LUABINS_ESUCCESS;
+        ++i
+      )
+    {
+      XSPAM(("* load: loading tuple item %d\n", i));
+      result = load_value(L, &ls);
+    }
+  }
+
+  if (
+      result == LUABINS_ESUCCESS &&
+      (lbsLS_unread(&ls) > 0 || ls.blocks.unread > 0)
+    )
+  {
+    SPAM(("load: %lu chars left at tail\n", lbsLS_unread(&ls)));
+    result = LUABINS_ETAILEFT;
+  }
+
+  if (result == LUABINS_ESUCCESS)
+  {
+    /* Shapes are above the window */
+    lua_remove(L, ls.shapes_index);
+    if (ls.window_index != 0)
+    {
+      lua_remove(L, ls.window_index);
+    }
+    *count = num_items;
+  }
+  else
+  {
+    lua_settop(L, base); /* Discard intermediate results */
+    push_load_error(L, result);
+  }
+
+  return result;
+}
+
+int luabins_load_column(
+    lua_State * L,
+    const unsigned char * data,
+    size_t len,
+    const char * name,
+    size_t name_len,
+    int flags
+  )
+{
+  lbs_LoadState ls;
+  int result = LUABINS_ESUCCESS;
+  int base = lua_gettop(L);
+  int num_records = 0;
+  int num_columns = 0;
+  size_t offset = 0; /* Of the column from the end of directory */
+  size_t size = 0;
+  int found = 0;
+  int i = 0;
+
+  if (len > 0 && data[0] == LUABINS_CCHECKSUM)
+  {
+    result = lbs_verifyChecksum(data, len, &data, &len);
+  }
+
+  if (result == LUABINS_ESUCCESS)
+  {
+    result = lbsLS_init(&ls, L, data, len, flags);
+  }
+
+  if (result == LUABINS_ESUCCESS)
+  {
+    /* Placeholder for shape definitions, see load_shape_def() */
+    luaL_checkstack(L, 1, "load_column");
+    lua_pushnil(L);
+    ls.shapes_index = lua_gettop(L);
+
+    /* Columnar data is a single columns value */
+    if (
+        lbsLS_readbyte(&ls) != 1 ||
+        lbsLS_readbyte(&ls) != LUABINS_CCOLUMNS
+      )
+    {
+      SPAM(("load: not columnar data\n"));
+      result = LUABINS_EBADDATA;
+    }
+  }
+
+  if (result == LUABINS_ESUCCESS)
+  {
+    result = load_columns_header(&ls, &num_records, &num_columns);
+  }
+
+  /* Whole directory is read, it is before the first column */
+  for (i = 0; i < num_columns && result == LUABINS_ESUCCESS; ++i)
+  {
+    const unsigned char * entry_name = NULL;
+    size_t entry_name_len = 0;
+    size_t entry_size = 0;
+    int matches = 0;
+
+    result = load_column_name(&ls, &entry_name, &entry_name_len);
+    if (result == LUABINS_ESUCCESS)
+    {
+      /* Name is not valid after the size is read */
+      matches = !found &&
+        entry_name_len == name_len &&
+        memcmp(entry_name, name, name_len) == 0;
+
+      result = load_column_size(&ls, &entry_size);
+    }
+
+    if (result == LUABINS_ESUCCESS && !found)
+    {
+      if (matches)
+      {
+        found = 1;
+        size = entry_size;
+      }
+      else
+      {
+        offset += entry_size;
+      }
+    }
+  }
+
+  if (result == LUABINS_ESUCCESS)
+  {
+    if (!found)
+    {
+      lua_pushnil(L);
+    }
+    else
+    {
+      result = lbsLS_skip(&ls, offset);
+      if (result == LUABINS_ESUCCESS)
+      {
+        result = load_column_value(L, &ls, size);
+      }
+    }
+  }
+
+  if (result == LUABINS_ESUCCESS)
+  {
+    /* Shapes are above the window */
+    lua_remove(L, ls.shapes_index);
+    if (ls.window_index != 0)
+    {
+      lua_remove(L, ls.window_index);
+    }
+  }
+  else
+  {
+    lua_settop(L, base); /* Discard intermediate results */
+    push_load_error(L, result);
+  }
+
+  return result;
+}
+
+/*
+* Pushes value of staged node, except for table end.
+* Table is pushed empty, its keys and values follow.
+*/
+static int push_staged(lua_State * L, const lbs_StageNode * node)
+{
+  unsigned char buf[LUABINS_LINTEGER];
+  int result = LUABINS_ESUCCESS;
+
+  luaL_checkstack(L, 2, "load_staged");
+
+  switch (node->type)
+  {
+  case LUABINS_CNIL:
+    lua_pushnil(L);
+    break;
+
+  case LUABINS_CFALSE:
+    lua_pushboolean(L, 0);
+    break;
+
+  case LUABINS_CTRUE:
+    lua_pushboolean(L, 1);
+    break;
+
+  case LUABINS_CNUMBER:
+    lua_pushnumber(L, node->value.number);
+    break;
+
+  case LUABINS_CINTEGER:
+    lbs_putInteger(buf, node->value.integer);
+    push_integer(L, buf);
     break;
 
   case LUABINS_CSTRING:
+    lua_pushlstring(L, (const char *)node->str, node->length);
+    break;
+
+  case LUABINS_CTABLE:
+    lua_createtable(L, (int)node->length, node->value.hash_size);
+    break;
+
+  case LUABINS_CEXTENSION:
+    lua_pushlstring(L, (const char *)node->str, node->length);
+
+    /* Name is replaced with type entry */
+    if (!lbs_pushType(L))
     {
-      size_t len = 0;
+      SPAM(("load: unknown custom type\n"));
+      return LUABINS_EBADTYPE;
+    }
 
-      XSPAM(("* load: string\n"));
+    result = lbs_loadExtension(
+        L, lua_gettop(L), node->payload, node->value.payload_length
+      );
+    if (result == LUABINS_ESUCCESS)
+    {
+      lua_remove(L, -2); /* Remove type entry */
+    }
+    else
+    {
+      lua_pop(L, 1);
+    }
+    break;
 
-      result = lbsLS_readbytes(ls, (unsigned char *)&len, LUABINS_LSIZET);
-      if (result == LUABINS_ESUCCESS)
-      {
-        const unsigned char * pos = lbsLS_eat(ls, len);
+  default: /* Should not happen, stage is validated */
+    SPAM(("load: unknown staged node %d\n", (int)node->type));
+    result = LUABINS_EBADDATA;
+    break;
+  }
 
-        XSPAM(("* load: string size %u\n", (int)len));
+  return result;
+}
 
-        if (pos != NULL)
+int luabins_load_staged(lua_State * L, struct lbs_Stage * s, int * count)
+{
+  /* For each open table, whether value (not key) is next */
+  unsigned char is_value[LUABINS_MAXTABLENESTING + 2];
+  const lbs_StageNode * nodes = NULL;
+  size_t num_nodes = 0;
+  int result = s->result;
+  int base = lua_gettop(L);
+  int nesting = 0;
+  size_t i = 0;
+
+  if (result == LUABINS_ESUCCESS)
+  {
+    nodes = lbs_stageNodes(s, &num_nodes);
+  }
+
+  for (i = 0; i < num_nodes && result == LUABINS_ESUCCESS; ++i)
+  {
+    if (nodes[i].type == LUABINS_STAGEEND)
+    {
+      if (nesting == 0)
+      {
+        result = LUABINS_EBADDATA;
+        break;
+      }
+      --nesting;
+    }
+    else
+    {
+      result = push_staged(L, &nodes[i]);
+      if (result != LUABINS_ESUCCESS)
+      {
+        break;
+      }
+
+      if (nodes[i].type == LUABINS_CTABLE)
+      {
+        if (nesting > LUABINS_MAXTABLENESTING)
         {
-          lua_pushlstring(L, (const char *)pos, len);
+          result = LUABINS_EBADDATA;
+          break;
         }
-        else
+        is_value[++nesting] = 0;
+        continue; /* Table is complete at its end node */
+      }
+    }
+
+    /* Complete value is on top, put it into enclosing table */
+    if (nesting > 0)
+    {
+      if (is_value[nesting])
+      {
+        lua_rawset(L, -3);
+      }
+      else if (
+          lua_isnil(L, -1) ||
+          (lua_type(L, -1) == LUA_TNUMBER &&
+          luai_numisnan(lua_tonumber(L, -1)))
+        )
+      {
+        /* Table key can't be nil or NaN, custom type may decode to such */
+        SPAM(("load: nil or NaN as key detected\n"));
+        result = LUABINS_EBADDATA;
+        break;
+      }
+      is_value[nesting] = !is_value[nesting];
+    }
+  }
+
+  if (result == LUABINS_ESUCCESS && nesting != 0)
+  {
+    result = LUABINS_EBADDATA; /* Should not happen, stage is validated */
+  }
+
+  if (result == LUABINS_ESUCCESS)
+  {
+    *count = s->count;
+  }
+  else
+  {
+    lua_settop(L, base); /* Discard intermediate results */
+    push_load_error(L, result);
+  }
+
+  return result;
+}
+
+/* Loads patch path key, it may not be nil, NaN or a table */
+static int load_path_key(lua_State * L, lbs_LoadState * ls)
+{
+  int result = load_value(L, ls);
+  if (result == LUABINS_ESUCCESS)
+  {
+    switch (lua_type(L, -1))
+    {
+    case LUA_TNIL:
+    case LUA_TTABLE:
+    case LUA_TUSERDATA:
+      SPAM(("load: bad patch path key\n"));
+      result = LUABINS_EBADDATA;
+      break;
+
+    case LUA_TNUMBER:
+      {
+        lua_Number key = lua_tonumber(L, -1);
+        if (key != key)
         {
-          result = LUABINS_EBADSIZE;
+          SPAM(("load: NaN patch path key\n"));
+          result = LUABINS_EBADDATA;
         }
       }
+      break;
+
+    default:
+      break;
     }
-    break;
+  }
 
-  case LUABINS_CTABLE:
-    XSPAM(("* load: table\n"));
-    result = load_table(L, ls);
-    break;
+  return result;
+}
 
-  default:
-    SPAM(("load: Unknown type char 0x%02X found\n", type));
-    result = LUABINS_EBADDATA;
-    break;
+/*
+* Loads single patch operation for the table at index. Stores table
+* to change, key and value to the ops table at n + 1, n + 2 and n + 3.
+* Table is not changed yet, see luabins_patch().
+*/
+static int load_patch_op(
+    lua_State * L,
+    lbs_LoadState * ls,
+    int index,
+    int ops,
+    int n
+  )
+{
+  int path_length = 0;
+  int i = 0;
+
+  int result = lbsLS_readint(ls, &path_length);
+  if (
+      result == LUABINS_ESUCCESS &&
+      (path_length < 1 || path_length > LUABINS_MAXTABLENESTING)
+    )
+  {
+    SPAM(("load: bad patch path length %d\n", path_length));
+    result = LUABINS_EBADSIZE;
   }
 
-  XSPAM(("* load: end load_value\n"));
+  if (result == LUABINS_ESUCCESS)
+  {
+    luaL_checkstack(L, 3, "load_patch"); /* Table, key, value */
+    lua_pushvalue(L, index);
+  }
+
+  /* Find table to change */
+  for (i = 1; i < path_length && result == LUABINS_ESUCCESS; ++i)
+  {
+    result = load_path_key(L, ls);
+    if (result == LUABINS_ESUCCESS)
+    {
+      lua_rawget(L, -2);
+      if (!lua_istable(L, -1))
+      {
+        SPAM(("load: patch path not found\n"));
+        result = LUABINS_EBADPATH;
+      }
+      else
+      {
+        lua_remove(L, -2);
+      }
+    }
+  }
+
+  if (result == LUABINS_ESUCCESS)
+  {
+    result = load_path_key(L, ls);
+  }
+
+  if (result == LUABINS_ESUCCESS)
+  {
+    result = load_value(L, ls);
+  }
+
+  if (result == LUABINS_ESUCCESS)
+  {
+    lua_rawseti(L, ops, n + 3); /* Nil value removes the key */
+    lua_rawseti(L, ops, n + 2);
+    lua_rawseti(L, ops, n + 1);
+  }
 
   return result;
 }
 
-int luabins_load(
+int luabins_patch(
     lua_State * L,
+    int index,
     const unsigned char * data,
     size_t len,
-    int * count
+    int flags
   )
 {
   lbs_LoadState ls;
   int result = LUABINS_ESUCCESS;
-  unsigned char num_items = 0;
-  int base = 0;
+  int base = lua_gettop(L);
+  int num_ops = 0;
+  int ops = 0;
   int i = 0;
 
-  base = lua_gettop(L);
-
-  lbsLS_init(&ls, data, len);
-  num_items = lbsLS_readbyte(&ls);
-  if (!lbsLS_good(&ls))
+  if (index < 1 || index > base)
   {
-    SPAM(("load: failed to read num_items byte\n"));
-    result = LUABINS_EBADDATA;
+    lua_pushliteral(L, "can't patch: inexistant index");
+    return LUABINS_EFAILURE;
   }
-  else if (num_items > LUABINS_MAXTUPLE)
+
+  if (lua_type(L, index) == LUA_TSTRING)
   {
-    SPAM(("load: tuple too large: %d\n", (int)num_items));
-    result = LUABINS_EBADSIZE;
+    size_t target_len = 0;
+    const unsigned char * target = (const unsigned char *)lua_tolstring(
+        L, index, &target_len
+      );
+    int count = 0;
+
+    result = luabins_load_ex(L, target, target_len, &count, flags);
+    if (result != LUABINS_ESUCCESS)
+    {
+      return result; /* Error message is pushed */
+    }
+
+    if (count != 1)
+    {
+      lua_settop(L, base);
+      lua_pushnil(L); /* Not a table */
+    }
   }
   else
   {
-    XSPAM(("* load: tuple size %d\n", (int)num_items));
-    for (
-        i = 0;
-        i < num_items && result == LUABINS_ESUCCESS;
-        ++i
+    luaL_checkstack(L, 1, "patch");
+    lua_pushvalue(L, index);
+  }
+
+  /* Table to patch is at base + 1 now */
+  if (!lua_istable(L, base + 1))
+  {
+    lua_settop(L, base);
+    lua_pushliteral(L, "can't patch: not a table");
+    return LUABINS_EFAILURE;
+  }
+
+  if (len > 0 && data[0] == LUABINS_CCHECKSUM)
+  {
+    result = lbs_verifyChecksum(data, len, &data, &len);
+  }
+
+  if (result == LUABINS_ESUCCESS)
+  {
+    result = lbsLS_init(&ls, L, data, len, flags);
+  }
+
+  if (result == LUABINS_ESUCCESS)
+  {
+    /* Placeholder for shape definitions, see load_shape_def() */
+    luaL_checkstack(L, 1, "patch");
+    lua_pushnil(L);
+    ls.shapes_index = lua_gettop(L);
+
+    if (lbsLS_readbyte(&ls) != LUABINS_CPATCH)
+    {
+      SPAM(("load: not a patch\n"));
+      result = LUABINS_EBADDATA;
+    }
+  }
+
+  if (result == LUABINS_ESUCCESS)
+  {
+    result = lbsLS_readint(&ls, &num_ops);
+    if (
+        result == LUABINS_ESUCCESS &&
+        (
+          num_ops < 0 ||
+          num_ops > INT_MAX / 3 ||
+          lbsLS_unread(&ls) / LUABINS_LMINPATCHOP < (size_t)num_ops
+        )
       )
     {
-      XSPAM(("* load: loading tuple item %d\n", i));
-      result = load_value(L, &ls);
+      SPAM(("load: bad number of patch operations %d\n", num_ops));
+      result = LUABINS_EBADSIZE;
     }
   }
 
-  if (result == LUABINS_ESUCCESS && lbsLS_unread(&ls) > 0)
+  /*
+  * All operations are loaded first, so that bad patch does not leave
+  * table half patched. Paths are found in the table as it was.
+  */
+  if (result == LUABINS_ESUCCESS)
   {
-    SPAM(("load: %lu chars left at tail\n", lbsLS_unread(&ls)));
+    luaL_checkstack(L, 1, "patch");
+    lua_newtable(L);
+    ops = lua_gettop(L);
+  }
+
+  for (i = 0; i < num_ops && result == LUABINS_ESUCCESS; ++i)
+  {
+    result = load_patch_op(L, &ls, base + 1, ops, i * 3);
+  }
+
+  if (
+      result == LUABINS_ESUCCESS &&
+      (lbsLS_unread(&ls) > 0 || ls.blocks.unread > 0)
+    )
+  {
+    SPAM(("load: %lu chars left at patch tail\n", lbsLS_unread(&ls)));
     result = LUABINS_ETAILEFT;
   }
 
   if (result == LUABINS_ESUCCESS)
   {
-    *count = num_items;
+    luaL_checkstack(L, 3, "patch"); /* Table, key, value */
+    for (i = 0; i < num_ops; ++i)
+    {
+      lua_rawgeti(L, ops, i * 3 + 1);
+      lua_rawgeti(L, ops, i * 3 + 2);
+      lua_rawgeti(L, ops, i * 3 + 3);
+      lua_rawset(L, -3);
+      lua_pop(L, 1);
+    }
+
+    lua_settop(L, base + 1); /* Leave patched table only */
   }
   else
   {
     lua_settop(L, base); /* Discard intermediate results */
-    switch (result)
-    {
-    case LUABINS_EBADDATA:
-      lua_pushliteral(L, "can't load: corrupt data");
-      break;
-
-    case LUABINS_EBADSIZE:
-      lua_pushliteral(L, "can't load: corrupt data, bad size");
-      break;
-
-    case LUABINS_ETAILEFT:
-      lua_pushliteral(L, "can't load: extra data at end");
-      break;
-
-    default: /* Should not happen */
-      lua_pushliteral(L, "load failed");
-      break;
-    }
+    push_load_error(L, result);
   }
 
   return result;
@@ -4,10 +4,70 @@
 * See copyright notice in luabins.h
 */
 
+#include <string.h> /* strerror() */
+
 #include "luaheaders.h"
 
 #include "luabins.h"
 #include "saveload.h"
+#include "savebuffer.h"
+#include "extension.h"
+#include "channel.h"
+#include "stage.h"
+#include "bgsave.h"
+#include "asyncwrite.h"
+
+/* Maps option table field to a flag */
+typedef struct lbs_Option
+{
+  const char * name;
+  int flag;
+} lbs_Option;
+
+static const lbs_Option SAVE_OPTIONS[] =
+{
+  { "packed", LUABINS_FPACKED },
+  { "float32", LUABINS_FFLOAT32 },
+  { "bitset", LUABINS_FBITSET },
+  { "sparse", LUABINS_FSPARSE },
+  { "shapes", LUABINS_FSHAPES },
+  { "compress", LUABINS_FCOMPRESS },
+  { "checksum", LUABINS_FCHECKSUM },
+  { NULL, 0 }
+};
+
+static const lbs_Option LOAD_OPTIONS[] =
+{
+  { "rawpacked", LUABINS_FRAWPACKED },
+  { NULL, 0 }
+};
+
+/*
+* Returns flags for options table at given index.
+* Missing (nil) options table means no flags.
+*/
+static int get_flags(lua_State * L, int index, const lbs_Option * options)
+{
+  int flags = 0;
+
+  if (lua_isnoneornil(L, index))
+  {
+    return 0;
+  }
+
+  luaL_checktype(L, index, LUA_TTABLE);
+  for ( ; options->name != NULL; ++options)
+  {
+    lua_getfield(L, index, options->name);
+    if (lua_toboolean(L, -1))
+    {
+      flags |= options->flag;
+    }
+    lua_pop(L, 1);
+  }
+
+  return flags;
+}
 
 /*
 * On success returns data string.
@@ -27,6 +87,78 @@ static int l_save(lua_State * L)
 }
 
 /*
+* Takes options table and values to save.
+* On success returns data string.
+* On failure returns nil and error message.
+*/
+static int l_save_ex(lua_State * L)
+{
+  int flags = get_flags(L, 1, SAVE_OPTIONS);
+  int error = luabins_save_ex(L, 2, lua_gettop(L), flags);
+  if (error == 0)
+  {
+    return 1;
+  }
+
+  lua_pushnil(L);
+  lua_replace(L, -3); /* Put nil before error message on stack */
+  return 2;
+}
+
+/*
+* Takes options table and values to save. Besides save options,
+* threads field sets number of threads.
+* On success returns data string.
+* On failure returns nil and error message.
+*/
+static int l_save_parallel(lua_State * L)
+{
+  int flags = get_flags(L, 1, SAVE_OPTIONS);
+  int num_threads = 0;
+  int error = 0;
+
+  if (!lua_isnoneornil(L, 1))
+  {
+    lua_getfield(L, 1, "threads");
+    num_threads = (int)lua_tonumber(L, -1);
+    lua_pop(L, 1);
+  }
+
+  error = luabins_save_parallel(L, 2, lua_gettop(L), flags, num_threads);
+  if (error == 0)
+  {
+    return 1;
+  }
+
+  lua_pushnil(L);
+  lua_insert(L, -2); /* Put nil before error message on stack */
+  return 2;
+}
+
+/*
+* Takes array of records and optional options table.
+* On success returns data string.
+* On failure returns nil and error message.
+*/
+static int l_save_columnar(lua_State * L)
+{
+  int flags = get_flags(L, 2, SAVE_OPTIONS);
+  int error = 0;
+
+  luaL_checkany(L, 1);
+  error = luabins_save_columnar(L, 1, flags);
+  if (error == 0)
+  {
+    return 1;
+  }
+
+  lua_pushnil(L);
+  lua_insert(L, -2); /* Put nil before error message on stack */
+  return 2;
+}
+
+/*
+* Takes data string and optional options table.
 * On success returns true and loaded data tuple.
 * On failure returns nil and error message.
 */
@@ -38,10 +170,11 @@ static int l_load(lua_State * L)
   const unsigned char * data = (const unsigned char *)luaL_checklstring(
       L, 1, &len
     );
+  int flags = get_flags(L, 2, LOAD_OPTIONS);
 
   lua_pushboolean(L, 1);
 
-  error = luabins_load(L, data, len, &count);
+  error = luabins_load_ex(L, data, len, &count, flags);
   if (error == 0)
   {
     return count + 1;
@@ -53,11 +186,789 @@ static int l_load(lua_State * L)
   return 2;
 }
 
+/*
+* Takes data string saved with save_columnar(), column name
+* and optional options table.
+* On success returns true and column (nil if there is no such column).
+* On failure returns nil and error message.
+*/
+static int l_load_column(lua_State * L)
+{
+  int error = 0;
+  size_t len = 0;
+  size_t name_len = 0;
+  const unsigned char * data = (const unsigned char *)luaL_checklstring(
+      L, 1, &len
+    );
+  const char * name = luaL_checklstring(L, 2, &name_len);
+  int flags = get_flags(L, 3, LOAD_OPTIONS);
+
+  lua_pushboolean(L, 1);
+
+  error = luabins_load_column(L, data, len, name, name_len, flags);
+  if (error == 0)
+  {
+    return 2;
+  }
+
+  lua_pushnil(L);
+  lua_replace(L, -3); /* Put nil before error message on stack */
+
+  return 2;
+}
+
+/*
+* Takes old table (or data string with it), new table
+* and optional options table.
+* On success returns patch string.
+* On failure returns nil and error message.
+*/
+static int l_diff(lua_State * L)
+{
+  int flags = get_flags(L, 3, SAVE_OPTIONS);
+  int error = 0;
+
+  luaL_checkany(L, 1);
+  luaL_checktype(L, 2, LUA_TTABLE);
+  error = luabins_diff(L, 1, 2, flags);
+  if (error == 0)
+  {
+    return 1;
+  }
+
+  lua_pushnil(L);
+  lua_insert(L, -2); /* Put nil before error message on stack */
+  return 2;
+}
+
+/*
+* Takes table (or data string with it), patch string
+* and optional options table.
+* On success returns patched table.
+* On failure returns nil and error message.
+*/
+static int l_patch(lua_State * L)
+{
+  int error = 0;
+  size_t len = 0;
+  const unsigned char * data = NULL;
+  int flags = get_flags(L, 3, LOAD_OPTIONS);
+
+  luaL_checkany(L, 1);
+  data = (const unsigned char *)luaL_checklstring(L, 2, &len);
+
+  error = luabins_patch(L, 1, data, len, flags);
+  if (error == 0)
+  {
+    return 1;
+  }
+
+  lua_pushnil(L);
+  lua_insert(L, -2); /* Put nil before error message on stack */
+  return 2;
+}
+
+/*
+* Takes type name, metatable, save function and load function.
+* Save function takes userdata and returns payload string,
+* load function takes payload string and returns loaded value.
+* Returns true.
+*/
+static int l_register_type(lua_State * L)
+{
+  size_t len = 0;
+
+  luaL_checklstring(L, 1, &len);
+  luaL_argcheck(L, len > 0, 1, "empty type name");
+  luaL_checktype(L, 2, LUA_TTABLE);
+  luaL_checktype(L, 3, LUA_TFUNCTION);
+  luaL_checktype(L, 4, LUA_TFUNCTION);
+
+  lbs_registerLuaType(L, 1, 2, 3, 4);
+
+  lua_pushboolean(L, 1);
+  return 1;
+}
+
+#ifndef LUABINS_NOCHANNEL
+
+/* Channel handle userdata, one per Lua state using the channel */
+typedef struct lbs_ChannelHandle
+{
+  lbs_Channel * ch; /* NULL after collection */
+  luabins_SaveBuffer sb; /* Reused by each push */
+} lbs_ChannelHandle;
+
+static lbs_ChannelHandle * check_channel(lua_State * L)
+{
+  lbs_ChannelHandle * h = (lbs_ChannelHandle *)luaL_checkudata(
+      L, 1, LUABINS_CHANNELMT
+    );
+  luaL_argcheck(L, h->ch != NULL, 1, "channel is closed");
+  return h;
+}
+
+/*
+* Takes values to push.
+* On success returns true.
+* On failure (including full channel) returns nil and error message.
+*/
+static int l_channel_push(lua_State * L)
+{
+  lbs_ChannelHandle * h = check_channel(L);
+  size_t len = 0;
+  const unsigned char * buf = NULL;
+  int error = 0;
+
+  lbsSB_reset(&h->sb);
+  error = luabins_save_buffer(L, 2, lua_gettop(L), &h->sb);
+  if (error != 0)
+  {
+    lua_pushnil(L);
+    lua_insert(L, -2); /* Put nil before error message on stack */
+    return 2;
+  }
+
+  buf = lbsSB_buffer(&h->sb, &len);
+  error = lbs_channelPush(h->ch, buf, len);
+  if (error == LUABINS_ESUCCESS)
+  {
+    lua_pushboolean(L, 1);
+    return 1;
+  }
+
+  lua_pushnil(L);
+  if (error == LUABINS_EFULL)
+  {
+    lua_pushliteral(L, "can't push: channel is full");
+  }
+  else
+  {
+    lua_pushliteral(L, "can't push: message is too large");
+  }
+  return 2;
+}
+
+/*
+* Must be called from one thread at a time.
+* On success returns true and the oldest pushed tuple.
+* Returns false if channel is empty.
+* On failure returns nil and error message, message is dropped.
+*/
+static int l_channel_pop(lua_State * L)
+{
+  lbs_ChannelHandle * h = check_channel(L);
+  int count = 0;
+  int error = 0;
+  size_t len = 0;
+  const unsigned char * data = lbs_channelPeek(h->ch, &len);
+
+  if (data == NULL)
+  {
+    lua_pushboolean(L, 0);
+    return 1;
+  }
+
+  lua_pushboolean(L, 1);
+
+  /* Loaded in place, then the slot is released */
+  error = luabins_load(L, data, len, &count);
+  lbs_channelPop(h->ch);
+  if (error == 0)
+  {
+    return count + 1;
+  }
+
+  lua_remove(L, -2); /* Remove true */
+  lua_pushnil(L);
+  lua_insert(L, -2); /* Put nil before error message on stack */
+
+  return 2;
+}
+
+/*
+* Returns channel as light userdata, to be passed to other Lua state
+* and opened there with luabins.channel(). Reference is not taken,
+* this handle must stay open until the other state opens the pointer.
+* Pointer may be opened any number of times.
+*/
+static int l_channel_pointer(lua_State * L)
+{
+  lua_pushlightuserdata(L, check_channel(L)->ch);
+  return 1;
+}
+
+static int l_channel_gc(lua_State * L)
+{
+  lbs_ChannelHandle * h = (lbs_ChannelHandle *)luaL_checkudata(
+      L, 1, LUABINS_CHANNELMT
+    );
+  if (h->ch != NULL)
+  {
+    lbs_channelRelease(h->ch);
+    h->ch = NULL;
+    lbsSB_destroy(&h->sb);
+  }
+  return 0;
+}
+
+static const luaL_Reg CHANNEL_METHODS[] =
+{
+  { "push", l_channel_push },
+  { "pop", l_channel_pop },
+  { "pointer", l_channel_pointer },
+  { NULL, NULL }
+};
+
+void luabins_push_channel(lua_State * L, struct lbs_Channel * ch)
+{
+  lbs_ChannelHandle * h = NULL;
+
+  luaL_checkstack(L, 3, "channel");
+
+  h = (lbs_ChannelHandle *)lua_newuserdata(L, sizeof(lbs_ChannelHandle));
+  h->ch = NULL;
+
+  if (luaL_newmetatable(L, LUABINS_CHANNELMT))
+  {
+    const luaL_Reg * reg = CHANNEL_METHODS;
+
+    lua_pushcfunction(L, l_channel_gc);
+    lua_setfield(L, -2, "__gc");
+
+    lua_newtable(L);
+    for ( ; reg->name != NULL; ++reg)
+    {
+      lua_pushcfunction(L, reg->func);
+      lua_setfield(L, -2, reg->name);
+    }
+    lua_setfield(L, -2, "__index");
+  }
+  lua_setmetatable(L, -2);
+
+  {
+    void * alloc_ud = NULL;
+    lua_Alloc alloc_fn = lua_getallocf(L, &alloc_ud);
+    lbsSB_init(&h->sb, alloc_fn, alloc_ud);
+  }
+
+  lbs_channelRetain(ch);
+  h->ch = ch;
+}
+
+/*
+* Takes capacity in bytes, or light userdata returned
+* by channel:pointer() to open existing channel.
+* On success returns channel.
+* On failure returns nil and error message.
+*/
+static int l_channel(lua_State * L)
+{
+  lbs_Channel * ch = NULL;
+  lua_Number capacity = 0;
+
+  if (lua_islightuserdata(L, 1))
+  {
+    ch = (lbs_Channel *)lua_touserdata(L, 1);
+    if (!lbs_channelCheck(ch))
+    {
+      lua_pushnil(L);
+      lua_pushliteral(L, "can't open channel: bad pointer");
+      return 2;
+    }
+
+    luabins_push_channel(L, ch); /* Takes own reference */
+    return 1;
+  }
+
+  capacity = luaL_checknumber(L, 1);
+  luaL_argcheck(L, capacity >= 0, 1, "negative capacity");
+
+  ch = lbs_channelNew((size_t)capacity);
+  if (ch == NULL)
+  {
+    lua_pushnil(L);
+    lua_pushliteral(L, "can't create channel: not enough memory");
+    return 2;
+  }
+
+  luabins_push_channel(L, ch);
+  lbs_channelRelease(ch); /* Handle holds the only reference */
+
+  return 1;
+}
+
+#endif /* LUABINS_NOCHANNEL */
+
+/* Upper limit for luabins.stage() blobs */
+#define LUABINS_MAXSTAGED (1 << 20)
+
+/* Staged blobs userdata */
+typedef struct lbs_StagedHandle
+{
+  int count; /* Number of stages, 0 after collection */
+  int ref; /* Registry reference to the table of staged blobs */
+  lbs_Stage * stages; /* Follow the handle */
+} lbs_StagedHandle;
+
+static lbs_StagedHandle * check_staged(lua_State * L)
+{
+  lbs_StagedHandle * h = (lbs_StagedHandle *)luaL_checkudata(
+      L, 1, LUABINS_STAGEDMT
+    );
+  luaL_argcheck(L, h->stages != NULL, 1, "staged data is released");
+  return h;
+}
+
+/*
+* Takes index of staged blob, from 1.
+* On success returns true and loaded data tuple.
+* On failure (including failure to stage) returns nil and error message.
+*/
+static int l_staged_load(lua_State * L)
+{
+  lbs_StagedHandle * h = check_staged(L);
+  int i = (int)luaL_checknumber(L, 2);
+  int count = 0;
+  int error = 0;
+
+  luaL_argcheck(L, i >= 1 && i <= h->count, 2, "index out of range");
+
+  lua_pushboolean(L, 1);
+
+  error = luabins_load_staged(L, &h->stages[i - 1], &count);
+  if (error == 0)
+  {
+    return count + 1;
+  }
+
+  lua_remove(L, -2); /* Remove true */
+  lua_pushnil(L);
+  lua_insert(L, -2); /* Put nil before error message on stack */
+
+  return 2;
+}
+
+static int l_staged_len(lua_State * L)
+{
+  lua_pushnumber(L, check_staged(L)->count);
+  return 1;
+}
+
+static int l_staged_gc(lua_State * L)
+{
+  lbs_StagedHandle * h = (lbs_StagedHandle *)luaL_checkudata(
+      L, 1, LUABINS_STAGEDMT
+    );
+  if (h->stages != NULL)
+  {
+    int i = 0;
+    for (i = 0; i < h->count; ++i)
+    {
+      lbs_stageDestroy(&h->stages[i]);
+    }
+    h->stages = NULL;
+    h->count = 0;
+
+    luaL_unref(L, LUA_REGISTRYINDEX, h->ref);
+    h->ref = LUA_NOREF;
+  }
+  return 0;
+}
+
+static const luaL_Reg STAGED_METHODS[] =
+{
+  { "load", l_staged_load },
+  { NULL, NULL }
+};
+
+/*
+* Takes array of data strings and optional number of threads
+* (default is one per CPU). Strings are staged in parallel.
+* Returns staged data, load each blob with staged:load(i).
+*/
+static int l_stage(lua_State * L)
+{
+  lbs_StagedHandle * h = NULL;
+  const unsigned char ** data = NULL;
+  size_t * lengths = NULL;
+  int num_threads = (int)luaL_optnumber(L, 2, 0);
+  size_t count = 0;
+  int i = 0;
+
+  luaL_checktype(L, 1, LUA_TTABLE);
+  count = lbs_objlen(L, 1);
+  luaL_argcheck(
+      L,
+      count <= (size_t)LUABINS_MAXSTAGED,
+      1,
+      "too many blobs"
+    );
+
+  lua_settop(L, 1);
+  luaL_checkstack(L, 4, "stage");
+
+  /* Blobs are copied, so the caller may change the table */
+  lua_createtable(L, (int)count, 0);
+  for (i = 1; i <= (int)count; ++i)
+  {
+    lua_rawgeti(L, 1, i);
+    if (lua_type(L, -1) != LUA_TSTRING)
+    {
+      return luaL_argerror(L, 1, "array of strings expected");
+    }
+    lua_rawseti(L, 2, i);
+  }
+
+  /* Scratch arrays for lbs_stageBatch(), collected with the call */
+  data = (const unsigned char **)lua_newuserdata(
+      L, count * (sizeof(const unsigned char *) + sizeof(size_t)) + 1
+    );
+  lengths = (size_t *)(data + count);
+
+  for (i = 1; i <= (int)count; ++i)
+  {
+    lua_rawgeti(L, 2, i);
+    data[i - 1] = (const unsigned char *)lua_tolstring(
+        L, -1, &lengths[i - 1]
+      );
+    lua_pop(L, 1); /* Referenced by the table */
+  }
+
+  h = (lbs_StagedHandle *)lua_newuserdata(
+      L, sizeof(lbs_StagedHandle) + count * sizeof(lbs_Stage)
+    );
+  h->count = (int)count;
+  h->stages = (lbs_Stage *)(h + 1);
+
+  /* Stages are filled in other threads, Lua allocator may be unsafe */
+  for (i = 0; i < h->count; ++i)
+  {
+    lbs_stageInit(&h->stages[i], lbs_simplealloc, NULL);
+  }
+
+  lua_pushvalue(L, 2);
+  h->ref = luaL_ref(L, LUA_REGISTRYINDEX);
+
+  if (luaL_newmetatable(L, LUABINS_STAGEDMT))
+  {
+    const luaL_Reg * reg = STAGED_METHODS;
+
+    lua_pushcfunction(L, l_staged_gc);
+    lua_setfield(L, -2, "__gc");
+
+    lua_pushcfunction(L, l_staged_len);
+    lua_setfield(L, -2, "__len");
+
+    lua_newtable(L);
+    for ( ; reg->name != NULL; ++reg)
+    {
+      lua_pushcfunction(L, reg->func);
+      lua_setfield(L, -2, reg->name);
+    }
+    lua_setfield(L, -2, "__index");
+  }
+  lua_setmetatable(L, -2);
+
+  lbs_stageBatch(h->stages, data, lengths, count, num_threads);
+
+  return 1;
+}
+
+static lbs_BgSave * check_bgsave(lua_State * L)
+{
+  return (lbs_BgSave *)luaL_checkudata(L, 1, LUABINS_BGSAVEMT);
+}
+
+/* Returns true if finished job succeeded, nil and error message if not */
+static int push_bgsave_result(lua_State * L, lbs_BgSave * job)
+{
+  if (job->result == LUABINS_ESUCCESS)
+  {
+    lua_pushboolean(L, 1);
+    return 1;
+  }
+
+  lua_pushnil(L);
+  lua_pushstring(L, job->error);
+  return 2;
+}
+
+/*
+* Returns false if the job is still running.
+* Returns true if the job succeeded, nil and error message if it failed.
+*/
+static int l_bgsave_poll(lua_State * L)
+{
+  lbs_BgSave * job = check_bgsave(L);
+  if (!lbs_bgsaveFinish(job, 0))
+  {
+    lua_pushboolean(L, 0);
+    return 1;
+  }
+
+  return push_bgsave_result(L, job);
+}
+
+/*
+* Waits for the job.
+* Returns true if the job succeeded, nil and error message if it failed.
+*/
+static int l_bgsave_wait(lua_State * L)
+{
+  lbs_BgSave * job = check_bgsave(L);
+  lbs_bgsaveFinish(job, 1);
+  return push_bgsave_result(L, job);
+}
+
+/* Does not wait for running job, see lbs_bgsaveDetach() */
+static int l_bgsave_gc(lua_State * L)
+{
+  lbs_BgSave * job = check_bgsave(L);
+  if (!lbs_bgsaveFinish(job, 0))
+  {
+    lbs_bgsaveDetach(job);
+  }
+  return 0;
+}
+
+static const luaL_Reg BGSAVE_METHODS[] =
+{
+  { "poll", l_bgsave_poll },
+  { "wait", l_bgsave_wait },
+  { NULL, NULL }
+};
+
+/*
+* Takes file path and values to save. Values are saved to the file
+* in forked process.
+* On success returns job handle, poll it with job:poll()
+* or wait for it with job:wait().
+* On failure returns nil and error message.
+*/
+static int l_bgsave(lua_State * L)
+{
+  const char * path = luaL_checkstring(L, 1);
+  int base = lua_gettop(L);
+  lbs_BgSave * job = (lbs_BgSave *)lua_newuserdata(L, sizeof(lbs_BgSave));
+
+  /* Finished until started */
+  job->pid = 0;
+  job->fd = -1;
+  job->result = LUABINS_EFAILURE;
+  job->error[0] = '\0';
+
+  if (luaL_newmetatable(L, LUABINS_BGSAVEMT))
+  {
+    const luaL_Reg * reg = BGSAVE_METHODS;
+
+    lua_pushcfunction(L, l_bgsave_gc);
+    lua_setfield(L, -2, "__gc");
+
+    lua_newtable(L);
+    for ( ; reg->name != NULL; ++reg)
+    {
+      lua_pushcfunction(L, reg->func);
+      lua_setfield(L, -2, reg->name);
+    }
+    lua_setfield(L, -2, "__index");
+  }
+  lua_setmetatable(L, -2);
+
+  if (luabins_bgsave(L, 2, base, 0, path, job) != 0)
+  {
+    lua_pushnil(L);
+    lua_insert(L, -2); /* Put nil before error message on stack */
+    return 2;
+  }
+
+  return 1;
+}
+
+/* Handle holds writer made with lbs_asyncwriterNew() */
+static lbs_AsyncWriter * check_async(lua_State * L)
+{
+  return *(lbs_AsyncWriter **)luaL_checkudata(L, 1, LUABINS_ASYNCMT);
+}
+
+/* Returns true if finished write succeeded, nil and error message if not */
+static int push_async_result(lua_State * L, lbs_AsyncWriter * w)
+{
+  if (w->result == LUABINS_ESUCCESS)
+  {
+    lua_pushboolean(L, 1);
+    return 1;
+  }
+
+  lua_pushnil(L);
+  if (w->error != 0)
+  {
+    lua_pushfstring(
+        L,
+        "can't write: %s failed: %s",
+        w->failed,
+        strerror(w->error)
+      );
+  }
+  else
+  {
+    lua_pushfstring(L, "can't write: %s is not supported", w->failed);
+  }
+  return 2;
+}
+
+/*
+* Returns false if data is still being written.
+* Returns true if the write succeeded, nil and error message if it failed.
+*/
+static int l_async_poll(lua_State * L)
+{
+  lbs_AsyncWriter * w = check_async(L);
+  if (!lbs_asyncwriterFinish(w, 0))
+  {
+    lua_pushboolean(L, 0);
+    return 1;
+  }
+
+  return push_async_result(L, w);
+}
+
+/*
+* Waits for the write.
+* Returns true if the write succeeded, nil and error message if it failed.
+*/
+static int l_async_wait(lua_State * L)
+{
+  lbs_AsyncWriter * w = check_async(L);
+  lbs_asyncwriterFinish(w, 1);
+  return push_async_result(L, w);
+}
+
+/* Does not wait for running write, worker frees the writer then */
+static int l_async_gc(lua_State * L)
+{
+  lbs_AsyncWriter * w = check_async(L);
+  if (w != NULL)
+  {
+    lbs_asyncwriterClose(w);
+  }
+  return 0;
+}
+
+static const luaL_Reg ASYNC_METHODS[] =
+{
+  { "poll", l_async_poll },
+  { "wait", l_async_wait },
+  { NULL, NULL }
+};
+
+/*
+* Takes file path or descriptor and values to save. Saved data is
+* written and synced to disk in worker thread.
+* On success returns write handle, poll it with handle:poll()
+* or wait for it with handle:wait().
+* On failure returns nil and error message.
+*/
+static int l_save_async(lua_State * L)
+{
+  lbs_AsyncWriter ** handle = NULL;
+  lbs_AsyncWriter * w = NULL;
+  const char * path = NULL;
+  int fd = -1;
+  int base = 0;
+  int result = LUABINS_ESUCCESS;
+
+  if (lua_type(L, 1) == LUA_TNUMBER)
+  {
+    fd = (int)lua_tonumber(L, 1);
+    luaL_argcheck(L, fd >= 0, 1, "bad file descriptor");
+  }
+  else
+  {
+    path = luaL_checkstring(L, 1);
+  }
+
+  base = lua_gettop(L);
+  handle = (lbs_AsyncWriter **)lua_newuserdata(
+      L,
+      sizeof(lbs_AsyncWriter *)
+    );
+  *handle = NULL;
+
+  if (luaL_newmetatable(L, LUABINS_ASYNCMT))
+  {
+    const luaL_Reg * reg = ASYNC_METHODS;
+
+    lua_pushcfunction(L, l_async_gc);
+    lua_setfield(L, -2, "__gc");
+
+    lua_newtable(L);
+    for ( ; reg->name != NULL; ++reg)
+    {
+      lua_pushcfunction(L, reg->func);
+      lua_setfield(L, -2, reg->name);
+    }
+    lua_setfield(L, -2, "__index");
+  }
+  lua_setmetatable(L, -2);
+
+  /*
+  * Writer may outlive the handle and the state, its worker frees it.
+  * So it does not use allocator of the state.
+  */
+  w = lbs_asyncwriterNew(lbs_simplealloc, NULL);
+  if (w == NULL)
+  {
+    lua_pushnil(L);
+    lua_pushliteral(L, "can't save: not enough memory");
+    return 2;
+  }
+  *handle = w;
+
+  /* Data is saved straight to the writer buffer, there is no string */
+  if (luabins_save_buffer(L, 2, base, &w->sb) != 0)
+  {
+    lua_pushnil(L);
+    lua_insert(L, -2); /* Put nil before error message on stack */
+    return 2;
+  }
+
+  result = lbs_asyncwriterStart(w, path, fd);
+  if (result != LUABINS_ESUCCESS)
+  {
+    lua_pushnil(L);
+    if (result == LUABINS_EFULL)
+    {
+      lua_pushliteral(L, "can't save: too many writes in progress");
+    }
+    else
+    {
+      lua_pushliteral(L, "can't save: not enough memory");
+    }
+    return 2;
+  }
+
+  return 1;
+}
+
 /* luabins Lua module API */
-static const struct luaL_reg R[] =
+static const luaL_Reg R[] =
 {
   { "save", l_save },
+  { "save_ex", l_save_ex },
+  { "save_parallel", l_save_parallel },
   { "load", l_load },
+  { "save_columnar", l_save_columnar },
+  { "load_column", l_load_column },
+  { "diff", l_diff },
+  { "patch", l_patch },
+  { "register_type", l_register_type },
+#ifndef LUABINS_NOCHANNEL
+  { "channel", l_channel },
+#endif
+  { "stage", l_stage },
+  { "bgsave", l_bgsave },
+  { "save_async", l_save_async },
   { NULL, NULL }
 };
 
@@ -79,10 +990,23 @@ LUALIB_API int luaopen_luabins(lua_State * L)
   /* unexpected lua_Number size, fix LUABINS_LNUMBER */
   luabins_static_assert(sizeof(lua_Number) == LUABINS_LNUMBER);
 
+  /* Byte order detection is wrong, fix LUABINS_BIGENDIAN in saveload.h */
+  {
+    int one = 1;
+    if ((*(const unsigned char *)&one == 0) != LUABINS_BIGENDIAN)
+    {
+      return luaL_error(L, "luabins: wrong LUABINS_BIGENDIAN setting");
+    }
+  }
+
   /*
   * Register module
   */
+#if LUA_VERSION_NUM >= 502
+  luaL_newlib(L, R);
+#else
   luaL_register(L, "luabins", R);
+#endif
 
   /*
   * Register module information
@@ -96,6 +1020,10 @@ LUALIB_API int luaopen_luabins(lua_State * L)
   lua_pushliteral(L, LUABINS_DESCRIPTION);
   lua_setfield(L, -2, "_DESCRIPTION");
 
+#if LUABINS_LUAJIT
+  lbs_initBoxedIntegers(L);
+#endif
+
   return 1;
 }
 
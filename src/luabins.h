@@ -28,11 +28,204 @@
 */
 int luabins_save(lua_State * L, int index_from, int index_to);
 
+/*
+* Save flags, opt-in encodings for luabins_save_ex().
+* Data saved with any of these is not readable by older luabins versions.
+*/
+
+/* Save tables with number values at keys 1 .. n as packed arrays */
+#define LUABINS_FPACKED (0x01)
+
+/*
+* Save numbers which do not change when converted to single precision
+* float and back as 4-byte floats, both standalone and in packed arrays
+*/
+#define LUABINS_FFLOAT32 (0x02)
+
+/* Save tables with boolean values at keys 1 .. n as bitsets */
+#define LUABINS_FBITSET (0x04)
+
+/*
+* Save tables with positive integer keys as runs of values
+* at consecutive keys, with keys implied
+*/
+#define LUABINS_FSPARSE (0x08)
+
+/*
+* Save tables with string keys only as values in key order,
+* with each distinct key set written once per save
+*/
+#define LUABINS_FSHAPES (0x40)
+
+/*
+* Compress saved data in blocks with built-in LZ codec.
+* Loading such data does not need a flag, it is detected.
+*/
+#define LUABINS_FCOMPRESS (0x10)
+
+/*
+* Append CRC32C checksum of saved data, see checksum.h.
+* Loading such data does not need a flag, checksum is always verified.
+*/
+#define LUABINS_FCHECKSUM (0x20)
+
+/* Same as luabins_save(), flags is a combination of save flags above */
+int luabins_save_ex(lua_State * L, int index_from, int index_to, int flags);
+
+/*
+* Same as luabins_save_ex(), for large data. Values are captured
+* into a flat snapshot first (see snapshot.h), without copying strings,
+* then the snapshot is encoded in chunks by up to num_threads threads
+* (one per CPU if num_threads is not positive). Saved data is the same
+* as luabins_save() makes. Flags other than LUABINS_FCOMPRESS and
+* LUABINS_FCHECKSUM are not supported, save fails with them.
+*/
+int luabins_save_parallel(
+    lua_State * L,
+    int index_from,
+    int index_to,
+    int flags,
+    int num_threads
+  );
+
+/*
+* Capture Lua values at given stack index range into snapshot
+* (see snapshot.h), initialized by the caller, to encode them later.
+* Strings are not copied, so saved values must be kept alive
+* and unchanged until the snapshot is encoded.
+* Returns 0 on success, nothing is pushed on stack.
+* Returns non-zero on failure, pushes error message on the top
+* of the stack. Snapshot contents are undefined after failure.
+*/
+struct lbs_Snapshot;
+
+int luabins_capture(
+    lua_State * L,
+    int index_from,
+    int index_to,
+    struct lbs_Snapshot * s
+  );
+
+/*
+* Save Lua values at given stack index range to file at path
+* in background (see bgsave.h). Forked child process saves values
+* as they were at the fork, parent may change them right away.
+* Without flags data is streamed to the file one snapshot chunk
+* at a time, with flags it is saved in memory first, as
+* luabins_save_ex() does. Lua errors in child process are caught,
+* they fail the job.
+* Wait for the job with lbs_bgsaveFinish().
+* Not available if luabins is built with LUABINS_NOFORK.
+* Returns 0 on success, job is started, nothing is pushed on stack.
+* Returns non-zero on failure, pushes error message on the top
+* of the stack.
+*/
+struct lbs_BgSave;
+
+int luabins_bgsave(
+    lua_State * L,
+    int index_from,
+    int index_to,
+    int flags,
+    const char * path,
+    struct lbs_BgSave * job
+  );
+
+#define LUABINS_BGSAVEMT "luabins.bgsave"
+
+/* Metatable of luabins.save_async() handles, see asyncwrite.h */
+#define LUABINS_ASYNCMT "luabins.async"
+
+/*
+* Save array of records (tables with string keys) at given stack index
+* column by column, see packed.h. Each record must have at least one field.
+* Columns are saved as packed arrays and bitsets where possible,
+* flags are the same as for luabins_save_ex().
+* Returns 0 on success, pushes saved data as a string on the top of the stack.
+* Returns non-zero on failure, pushes error message on the top
+* of the stack.
+*/
+int luabins_save_columnar(lua_State * L, int index, int flags);
+
+/*
+* Save changes turning table at old_index into table at new_index
+* as a patch, see packed.h. Value at old_index may also be a string
+* with single saved table, it is loaded first. Nested tables at the same
+* keys are compared recursively, other values are compared with
+* lua_rawequal(). Tables with table keys are not supported.
+* Flags are the same as for luabins_save_ex().
+* Returns 0 on success, pushes patch as a string on the top of the stack.
+* Returns non-zero on failure, pushes error message on the top
+* of the stack.
+*/
+int luabins_diff(lua_State * L, int old_index, int new_index, int flags);
+
+/*
+* Save Lua values from given state at given stack index range
+* to the scatter/gather writer (see iovwrite.h).
+* Strings not shorter than writer threshold are not copied,
+* so saved values must be kept alive and unchanged until the writer
+* is done with the data.
+* Returns 0 on success, nothing is pushed on stack.
+* Returns non-zero on failure, pushes error message on the top
+* of the stack. Writer contents are undefined after failure.
+*/
+struct lbs_IovWriter;
+
+int luabins_savev(
+    lua_State * L,
+    int index_from,
+    int index_to,
+    struct lbs_IovWriter * w
+  );
+
+/*
+* Save Lua values from given state at given stack index range,
+* appending saved data to the save buffer (see savebuffer.h).
+* Returns 0 on success, nothing is pushed on stack.
+* Returns non-zero on failure, pushes error message on the top
+* of the stack. Buffer contents are undefined after failure.
+*/
+struct luabins_SaveBuffer;
+
+int luabins_save_buffer(
+    lua_State * L,
+    int index_from,
+    int index_to,
+    struct luabins_SaveBuffer * sb
+  );
+
+/*
+* Copy Lua values from given stack index range of state L
+* to the top of the stack of other state Ldst, as if saved
+* with luabins_save() and loaded with luabins_load(), but without
+* intermediate Lua string. Values of L are left untouched.
+* Nils, booleans, numbers and strings only are copied directly.
+* Otherwise data is saved to sb, which is reset first, so the same
+* buffer may be reused for many transfers. If sb is NULL,
+* temporary buffer is used.
+* Returns 0 on success, pushes values on Ldst stack,
+* sets count to the number of values pushed.
+* Returns non-zero on failure, pushes error message on the top
+* of Ldst stack. Stack of L is left as is.
+*/
+int luabins_transfer(
+    lua_State * L,
+    int index_from,
+    int index_to,
+    lua_State * Ldst,
+    struct luabins_SaveBuffer * sb,
+    int * count
+  );
+
 /*
 * Load Lua values from given byte chunk.
 * Returns 0 on success, pushes loaded values on stack.
 * Sets count to the number of values pushed.
 * Note that to have zero loaded items is a valid scenario.
+* Compressed data (see LUABINS_FCOMPRESS) is decompressed
+* block by block while loading. Checksum (see LUABINS_FCHECKSUM)
+* is verified before anything is loaded.
 * Returns non-zero on failure, pushes error message on the top
 * of the stack.
 */
@@ -43,6 +236,148 @@ int luabins_load(
     int * count
   );
 
+/* Load flags for luabins_load_ex() */
+
+/*
+* Load packed arrays as userdata with LUABINS_PACKEDMT metatable,
+* holding plain lua_Number array. Metatable provides read-only indexing
+* from 1 and the length operator. Such userdata is saved back
+* as a packed array.
+*/
+#define LUABINS_FRAWPACKED (0x100)
+
+#define LUABINS_PACKEDMT "luabins.packed"
+
+/* Same as luabins_load(), flags is a combination of load flags above */
+int luabins_load_ex(
+    lua_State * L,
+    const unsigned char * data,
+    size_t len,
+    int * count,
+    int flags
+  );
+
+/*
+* Load single column of data saved with luabins_save_columnar(),
+* without loading other columns. Flags are the same as for luabins_load_ex().
+* Returns 0 on success, pushes column table on the top of the stack,
+* or nil if there is no such column.
+* Returns non-zero on failure, pushes error message on the top
+* of the stack.
+* Note that data after the column is not checked.
+*/
+int luabins_load_column(
+    lua_State * L,
+    const unsigned char * data,
+    size_t len,
+    const char * name,
+    size_t name_len,
+    int flags
+  );
+
+/*
+* Apply patch saved with luabins_diff() to the table at given stack index,
+* in place. Value at index may also be a string with single saved table,
+* it is loaded first. Flags are the same as for luabins_load_ex().
+* Returns 0 on success, pushes patched table on the top of the stack.
+* Returns non-zero on failure, pushes error message on the top
+* of the stack, table is not changed then. Whole patch is loaded
+* before it is applied, paths are looked up in the table as it was.
+*/
+int luabins_patch(
+    lua_State * L,
+    int index,
+    const unsigned char * data,
+    size_t len,
+    int flags
+  );
+
+/*
+* Load Lua values from stage filled by lbs_stage() (see stage.h),
+* possibly in other thread. Stage must not change during the call.
+* Packed arrays are loaded as tables, load flags are not supported.
+* Returns 0 on success, pushes loaded values on stack.
+* Sets count to the number of values pushed.
+* Returns non-zero on failure (including failure to stage),
+* pushes error message on the top of the stack.
+*/
+struct lbs_Stage;
+
+int luabins_load_staged(lua_State * L, struct lbs_Stage * s, int * count);
+
+#define LUABINS_STAGEDMT "luabins.staged"
+
+/*
+* Custom types. Userdata with registered metatable is saved
+* as extension value (see packed.h), tagged with type name.
+* Extension value with registered type name is loaded back
+* with the type decoder. Registrations are per Lua state.
+*/
+struct luabins_SaveBuffer;
+
+/*
+* Writes payload of userdata at given stack index to the buffer
+* with lbsSB_write() or lbsSB_reserve() (see savebuffer.h).
+* Must leave the stack as is.
+* Returns 0 on success, non-zero to fail the save.
+* Called in protected mode: Lua error raised here fails the save too.
+*/
+typedef int (*luabins_EncodeFn)(
+    lua_State * L,
+    int index,
+    struct luabins_SaveBuffer * sb,
+    void * ud
+  );
+
+/*
+* Pushes value decoded from payload of len bytes on the stack.
+* Data is valid only during the call.
+* Returns 0 on success, non-zero to fail the load
+* (nothing must be pushed then).
+* Called in protected mode: Lua error raised here fails the load too.
+*/
+typedef int (*luabins_DecodeFn)(
+    lua_State * L,
+    const unsigned char * data,
+    size_t len,
+    void * ud
+  );
+
+/*
+* Registers custom type with given non-empty name for userdata
+* with metatable at mt_index. Registering the same name or metatable
+* again replaces previous registration.
+* Returns 0 on success.
+* Returns non-zero on failure, pushes error message on the top
+* of the stack.
+*/
+int luabins_register_type(
+    lua_State * L,
+    const char * name,
+    size_t name_len,
+    int mt_index,
+    luabins_EncodeFn encode,
+    luabins_DecodeFn decode,
+    void * ud
+  );
+
+/*
+* Channels. Channel (see channel.h) is a lock-free message queue
+* in memory shared by Lua states in different threads. Tuples are
+* saved with luabins_save_buffer() and loaded in place.
+* Not available if luabins is built with LUABINS_NOCHANNEL.
+*/
+struct lbs_Channel;
+
+#define LUABINS_CHANNELMT "luabins.channel"
+
+/*
+* Pushes handle of the channel on the stack, with LUABINS_CHANNELMT
+* metatable. Handle holds a reference to the channel.
+* Use it to give channel made in C to Lua states.
+*/
+void luabins_push_channel(lua_State * L, struct lbs_Channel * ch);
+
 /******************************************************************************
 * Copyright (C) 2009-2010 Luabins authors. All rights reserved.
 *
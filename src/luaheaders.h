@@ -11,4 +11,28 @@ extern "C" {
 }
 #endif
 
+/*
+* Lua version differences. Lua 5.1 and LuaJIT are the baseline.
+* Define LUABINS_LUAJIT when building with LuaJIT.
+*/
+
+#if LUA_VERSION_NUM >= 502
+  #define lbs_objlen(L, index) lua_rawlen((L), (index))
+#else
+  #define lbs_objlen(L, index) lua_objlen((L), (index))
+#endif
+
+/* Lua 5.3+ numbers have integer subtype, saved as LUABINS_CINTEGER */
+#if LUA_VERSION_NUM >= 503
+  #define LUABINS_INTEGERS (1)
+  #define lbs_isinteger(L, index) lua_isinteger((L), (index))
+#else
+  #define LUABINS_INTEGERS (0)
+  #define lbs_isinteger(L, index) (0)
+#endif
+
+#ifndef LUABINS_LUAJIT
+  #define LUABINS_LUAJIT (0)
+#endif
+
 #endif /* LUABINS_LUAHEADERS_H_INCLUDED_ */
@@ -31,6 +31,11 @@ int luaO_log2 (unsigned int x);
 * END COPY-PASTE FROM Lua 5.1.4 lobject.h
 */
 
+/* Lua 5.4 luaconf.h does not define it, its int is 32-bit at least */
+#ifndef LUAI_BITSINT
+#define LUAI_BITSINT 32
+#endif
+
 /*
 * BEGIN COPY-PASTE FROM Lua 5.1.4 ltable.c
 */
@@ -0,0 +1,264 @@
+/*
+* packed.c
+* Luabins Lua-less packed numeric array helpers
+* See copyright notice in luabins.h
+*/
+
+#include <float.h> /* FLT_MAX */
+#include <string.h> /* memcpy(), memcmp() */
+
+#include "luaheaders.h"
+
+#include "packed.h"
+#include "byteorder.h"
+
+/* Element types must have exact sizes, fix typedefs below if not */
+typedef signed char lbs_PackedInt8;
+typedef short lbs_PackedInt16;
+typedef int lbs_PackedInt32;
+
+luabins_static_assert(sizeof(lbs_PackedInt8) == 1);
+luabins_static_assert(sizeof(lbs_PackedInt16) == 2);
+luabins_static_assert(sizeof(lbs_PackedInt32) == 4);
+luabins_static_assert(sizeof(float) == LUABINS_LFLOAT);
+
+/* Element types from the narrowest to the widest */
+static const unsigned char lbsPK_types[] =
+{
+  LUABINS_PINT8,
+  LUABINS_PINT16,
+  LUABINS_PINT32,
+  LUABINS_PNUMBER
+};
+
+#define LUABINS_PRANKNUMBER (3)
+
+size_t lbs_packedWidth(unsigned char type)
+{
+  switch (type)
+  {
+  case LUABINS_PINT8:
+    return 1;
+
+  case LUABINS_PINT16:
+    return 2;
+
+  case LUABINS_PINT32:
+    return 4;
+
+  case LUABINS_PNUMBER:
+    return LUABINS_LNUMBER;
+
+  case LUABINS_PFLOAT:
+    return LUABINS_LFLOAT;
+
+  default:
+    return 0;
+  }
+}
+
+int lbs_fitsFloat(lua_Number value)
+{
+  /*
+  * Conversion of out-of-range value is undefined, so check range first.
+  * Note that this is false for NaN.
+  */
+  if (!(value >= -FLT_MAX && value <= FLT_MAX))
+  {
+    return 0;
+  }
+
+  return (lua_Number)(float)value == value;
+}
+
+/* Returns rank of the narrowest element type that holds value losslessly */
+static int lbsPK_rank(lua_Number value)
+{
+  lua_Number zero = 0;
+
+  /* Note that this is false for NaN */
+  if (!(value >= -2147483648.0 && value <= 2147483647.0))
+  {
+    return LUABINS_PRANKNUMBER;
+  }
+
+  if ((lua_Number)(lbs_PackedInt32)value != value)
+  {
+    return LUABINS_PRANKNUMBER; /* Has fractional part */
+  }
+
+  if (value == 0 && memcmp(&value, &zero, sizeof(lua_Number)) != 0)
+  {
+    return LUABINS_PRANKNUMBER; /* Negative zero */
+  }
+
+  if (value >= -128 && value <= 127)
+  {
+    return 0;
+  }
+
+  if (value >= -32768 && value <= 32767)
+  {
+    return 1;
+  }
+
+  return 2;
+}
+
+void lbs_packedClassInit(lbs_PackedClass * pc)
+{
+  pc->rank = 0;
+  pc->fits_float = 1;
+}
+
+void lbs_packedClassAdd(lbs_PackedClass * pc, lua_Number value)
+{
+  if (pc->rank < LUABINS_PRANKNUMBER)
+  {
+    pc->rank = luabins_max(pc->rank, lbsPK_rank(value));
+  }
+
+  if (pc->fits_float)
+  {
+    pc->fits_float = lbs_fitsFloat(value);
+  }
+}
+
+unsigned char lbs_packedClassType(const lbs_PackedClass * pc, int use_float)
+{
+  /* Note that integer types are preferred, int32 is as narrow as float */
+  if (use_float && pc->rank == LUABINS_PRANKNUMBER && pc->fits_float)
+  {
+    return LUABINS_PFLOAT;
+  }
+
+  return lbsPK_types[pc->rank];
+}
+
+void lbs_packedPut(unsigned char * out, unsigned char type, lua_Number value)
+{
+  switch (type)
+  {
+  case LUABINS_PINT8:
+    {
+      lbs_PackedInt8 v = (lbs_PackedInt8)value;
+      memcpy(out, &v, 1);
+    }
+    break;
+
+  case LUABINS_PINT16:
+    {
+      lbs_PackedInt16 v = (lbs_PackedInt16)value;
+      lbs_storeLE(out, v, 2);
+    }
+    break;
+
+  case LUABINS_PINT32:
+    {
+      lbs_PackedInt32 v = (lbs_PackedInt32)value;
+      lbs_storeLE(out, v, 4);
+    }
+    break;
+
+  case LUABINS_PFLOAT:
+    {
+      float v = (float)value;
+      lbs_storeLE(out, v, LUABINS_LFLOAT);
+    }
+    break;
+
+  case LUABINS_PNUMBER:
+  default: /* Should not happen */
+    lbs_storeLE(out, value, LUABINS_LNUMBER);
+    break;
+  }
+}
+
+lua_Number lbs_packedGet(
+    const unsigned char * data,
+    unsigned char type,
+    size_t index
+  )
+{
+  lua_Number value = 0;
+  lbs_packedUnpack(data + index * lbs_packedWidth(type), type, 1, &value);
+  return value;
+}
+
+/*
+* Loops are kept trivial on purpose, so compiler is able to unroll
+* and vectorize them. Element reads go through memcpy() since
+* packed data is not aligned.
+*/
+void lbs_packedUnpack(
+    const unsigned char * data,
+    unsigned char type,
+    size_t count,
+    lua_Number * out
+  )
+{
+  size_t i = 0;
+
+#if LUABINS_BIGENDIAN
+  /*
+  * Narrow elements are copied to the tail of out and swapped there
+  * in bulk, then widened front to back as on little-endian hosts.
+  * Element i is read before out[i] is written, and out[i] never
+  * reaches elements after it.
+  */
+  size_t width = lbs_packedWidth(type);
+  if (width > 1 && width < LUABINS_LNUMBER)
+  {
+    unsigned char * tail = (unsigned char *)out
+      + count * (LUABINS_LNUMBER - width);
+    memmove(tail, data, count * width);
+    lbs_swapBytes(tail, width, count);
+    data = tail;
+  }
+#endif /* LUABINS_BIGENDIAN */
+
+  switch (type)
+  {
+  case LUABINS_PINT8:
+    for (i = 0; i < count; ++i)
+    {
+      out[i] = (lbs_PackedInt8)data[i];
+    }
+    break;
+
+  case LUABINS_PINT16:
+    for (i = 0; i < count; ++i)
+    {
+      lbs_PackedInt16 v;
+      memcpy(&v, data + i * 2, 2);
+      out[i] = v;
+    }
+    break;
+
+  case LUABINS_PINT32:
+    for (i = 0; i < count; ++i)
+    {
+      lbs_PackedInt32 v;
+      memcpy(&v, data + i * 4, 4);
+      out[i] = v;
+    }
+    break;
+
+  case LUABINS_PFLOAT:
+    for (i = 0; i < count; ++i)
+    {
+      float v;
+      memcpy(&v, data + i * LUABINS_LFLOAT, LUABINS_LFLOAT);
+      out[i] = v;
+    }
+    break;
+
+  case LUABINS_PNUMBER:
+    memcpy(out, data, count * LUABINS_LNUMBER);
+    lbs_fixByteOrder((unsigned char *)out, LUABINS_LNUMBER, count);
+    break;
+
+  default: /* Should not happen */
+    break;
+  }
+}
@@ -0,0 +1,161 @@
+/*
+* packed.h
+* Luabins Lua-less packed numeric array helpers
+* See copyright notice in luabins.h
+*/
+
+#ifndef LUABINS_PACKED_H_INCLUDED_
+#define LUABINS_PACKED_H_INCLUDED_
+
+#include "saveload.h"
+
+/*
+* Packed array is a table with number values at keys 1 .. count
+* and no other keys. It is saved as:
+*
+*   LUABINS_CPACKED, element type (one of LUABINS_P*),
+*   count (LUABINS_LINT), count raw elements.
+*
+* Element type is the narrowest one that holds all values losslessly.
+* Single precision float element type is used only if allowed.
+* Elements are stored in the same byte order as the rest of data.
+*/
+
+/* Returns element size in bytes, zero for unknown element type */
+size_t lbs_packedWidth(unsigned char type);
+
+/*
+* Returns non-zero if value survives conversion to single precision float
+* and back unchanged. NaN never does.
+*/
+int lbs_fitsFloat(lua_Number value);
+
+/* Finds out narrowest element type for a sequence of values */
+typedef struct lbs_PackedClass
+{
+  int rank; /* Index of the current element type, see packed.c */
+  int fits_float; /* Non-zero if all values fit float */
+} lbs_PackedClass;
+
+void lbs_packedClassInit(lbs_PackedClass * pc);
+
+void lbs_packedClassAdd(lbs_PackedClass * pc, lua_Number value);
+
+/*
+* Returns element type, suitable for all values added so far.
+* If use_float is non-zero, float is preferred to double when possible.
+*/
+unsigned char lbs_packedClassType(const lbs_PackedClass * pc, int use_float);
+
+/*
+* Stores value as element of given type at out.
+* Value must fit into given type, see lbs_PackedClass.
+*/
+void lbs_packedPut(unsigned char * out, unsigned char type, lua_Number value);
+
+/* Returns element with zero-based index from packed data */
+lua_Number lbs_packedGet(
+    const unsigned char * data,
+    unsigned char type,
+    size_t index
+  );
+
+/* Widens count elements from packed data to out */
+void lbs_packedUnpack(
+    const unsigned char * data,
+    unsigned char type,
+    size_t count,
+    lua_Number * out
+  );
+
+/*
+* Bitset is a table with boolean values at keys 1 .. count
+* and no other keys. It is saved as:
+*
+*   LUABINS_CBITSET, count (LUABINS_LINT), lbs_bitsetSize(count) bytes.
+*
+* Value for key i + 1 is bit (i % 8) of byte (i / 8), least significant
+* bit first. Unused bits of the last byte are zero.
+*/
+
+#define lbs_bitsetSize(count) \
+  (((size_t)(count) + 7) / 8)
+
+#define lbs_bitsetGet(bits, index) \
+  (((bits)[(index) / 8] >> ((index) % 8)) & 1)
+
+/*
+* Spans is a table with positive integer keys. It is saved as:
+*
+*   LUABINS_CSPANS, number of spans (LUABINS_LINT),
+*   total number of values (LUABINS_LINT), then for each span:
+*   first key (LUABINS_LINT), number of values (LUABINS_LINT), values.
+*
+* Values of a span are at consecutive keys. Spans are sorted by key
+* and do not overlap. Values may not be nil.
+*/
+
+/*
+* Shaped table is a table with string keys only. Its key set is its shape.
+* First table of each shape is saved with shape definition:
+*
+*   LUABINS_CSHAPEDEF, number of keys (LUABINS_LINT), then for each key:
+*   length (LUABINS_LSIZET), key bytes. Then values in key order.
+*
+* Other tables of the same shape refer to the definition:
+*
+*   LUABINS_CSHAPED, distance (LUABINS_LSIZET) back from this type byte
+*   to the type byte of the definition. Then values in key order.
+*
+* Keys in a definition are sorted. Values may not be nil.
+*/
+
+/*
+* Columns is an array of records (tables with string keys),
+* saved column by column. It is saved as:
+*
+*   LUABINS_CCOLUMNS, number of records (LUABINS_LINT),
+*   number of columns (LUABINS_LINT), then column directory,
+*   for each column: name length (LUABINS_LSIZET), name bytes,
+*   column size in bytes (LUABINS_LSIZET). Then for each column
+*   its values as a single table value of column size bytes.
+*
+* Column table has values of the named field at record indices,
+* it is usually a packed array or a bitset. Columns are sorted by name.
+* Each record has at least one field, so there are no columns
+* only if there are no records.
+*
+* Column sizes allow to load a single column without loading others.
+* Shaped tables (see above) never refer to definitions
+* in other columns for the same reason.
+*/
+
+/*
+* Extension value is a userdata of a custom type, registered
+* with luabins_register_type(). It is saved as:
+*
+*   LUABINS_CEXTENSION, type name length (LUABINS_LSIZET), name bytes,
+*   payload length (LUABINS_LSIZET), payload bytes.
+*
+* Payload is opaque, it is produced and consumed by the type callbacks.
+* Data with extension values loads only where the same type name
+* is registered.
+*/
+
+/*
+* Patch is a list of changes from one table to another. It is saved
+* instead of a tuple, in place of the tuple size byte (and inside
+* envelopes, if any):
+*
+*   LUABINS_CPATCH, number of operations (LUABINS_LINT),
+*   then for each operation: path length (LUABINS_LINT),
+*   path keys as values, new value.
+*
+* Operation sets value at the last path key in the table found
+* by the previous keys. Nil value removes the key. Path keys
+* may not be nil, NaN or tables, path length is from 1 to
+* LUABINS_MAXTABLENESTING. Values are saved as in a tuple,
+* shaped tables may refer to definitions in previous operations.
+*/
+
+#endif /* LUABINS_PACKED_H_INCLUDED_ */
@@ -0,0 +1,127 @@
+/*
+* parallel.c
+* Luabins Lua-less parallel task runner
+* See copyright notice in luabins.h
+*/
+
+#ifndef _POSIX_C_SOURCE
+  #define _POSIX_C_SOURCE 200809L /* sysconf() */
+#endif
+
+#include <stddef.h> /* size_t */
+
+#ifndef LUABINS_NOTHREADS
+  #include <pthread.h>
+  #include <unistd.h>
+#endif
+
+#include "parallel.h"
+
+/* Runs tasks in calling thread */
+static void lbsT_runSerial(lbs_TaskFn fn, void * ud, size_t count)
+{
+  size_t i = 0;
+  for (i = 0; i < count; ++i)
+  {
+    fn(ud, i);
+  }
+}
+
+#ifndef LUABINS_NOTHREADS
+
+/* Work shared by lbs_runTasks() threads */
+typedef struct lbs_TaskQueue
+{
+  lbs_TaskFn fn;
+  void * ud;
+  size_t count;
+  size_t next; /* Next task to take */
+  pthread_mutex_t lock;
+} lbs_TaskQueue;
+
+static void * lbsT_worker(void * arg)
+{
+  lbs_TaskQueue * q = (lbs_TaskQueue *)arg;
+
+  for (;;)
+  {
+    size_t i = 0;
+
+    pthread_mutex_lock(&q->lock);
+    i = q->next++;
+    pthread_mutex_unlock(&q->lock);
+
+    if (i >= q->count)
+    {
+      break;
+    }
+
+    q->fn(q->ud, i);
+  }
+
+  return NULL;
+}
+
+void lbs_runTasks(lbs_TaskFn fn, void * ud, size_t count, int num_threads)
+{
+  pthread_t threads[LUABINS_MAXTHREADS];
+  lbs_TaskQueue q;
+  int num_started = 0;
+  int i = 0;
+
+  if (num_threads <= 0)
+  {
+#ifdef _SC_NPROCESSORS_ONLN
+    num_threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+  }
+
+  if (num_threads > LUABINS_MAXTHREADS)
+  {
+    num_threads = LUABINS_MAXTHREADS;
+  }
+  if ((size_t)num_threads > count)
+  {
+    num_threads = (int)count;
+  }
+
+  if (num_threads <= 1 || pthread_mutex_init(&q.lock, NULL) != 0)
+  {
+    lbsT_runSerial(fn, ud, count);
+    return;
+  }
+
+  q.fn = fn;
+  q.ud = ud;
+  q.count = count;
+  q.next = 0;
+
+  /* Calling thread is one of workers. If thread fails to start, others
+     do its share. */
+  for (i = 1; i < num_threads; ++i)
+  {
+    if (pthread_create(&threads[num_started], NULL, lbsT_worker, &q) == 0)
+    {
+      ++num_started;
+    }
+  }
+
+  lbsT_worker(&q);
+
+  for (i = 0; i < num_started; ++i)
+  {
+    pthread_join(threads[i], NULL);
+  }
+
+  pthread_mutex_destroy(&q.lock);
+}
+
+#else /* LUABINS_NOTHREADS */
+
+void lbs_runTasks(lbs_TaskFn fn, void * ud, size_t count, int num_threads)
+{
+  (void)num_threads;
+  lbsT_runSerial(fn, ud, count);
+}
+
+#endif /* LUABINS_NOTHREADS */
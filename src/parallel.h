@@ -0,0 +1,26 @@
+/*
+* parallel.h
+* Luabins Lua-less parallel task runner
+* See copyright notice in luabins.h
+*/
+
+#ifndef LUABINS_PARALLEL_H_INCLUDED_
+#define LUABINS_PARALLEL_H_INCLUDED_
+
+/* Upper limit for lbs_runTasks() threads */
+#define LUABINS_MAXTHREADS (64)
+
+/* Runs task number i, tasks may run in different threads */
+typedef void (*lbs_TaskFn)(void * ud, size_t i);
+
+/*
+* Runs count tasks using up to num_threads threads, one of them is
+* the calling thread. Tasks are taken in order as threads get free.
+* If num_threads is not positive, one thread per CPU is used.
+* Returns when all tasks are done.
+* If luabins is built with LUABINS_NOTHREADS (or if threads fail
+* to start), calling thread does all the work.
+*/
+void lbs_runTasks(lbs_TaskFn fn, void * ud, size_t count, int num_threads);
+
+#endif /* LUABINS_PARALLEL_H_INCLUDED_ */
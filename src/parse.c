@@ -0,0 +1,605 @@
+/*
+* parse.c
+* Luabins Lua-less event-based parser
+* See copyright notice in luabins.h
+*/
+
+#include "luaheaders.h"
+
+#include "luabins.h"
+#include "parse.h"
+#include "read.h"
+#include "packed.h"
+#include "luainternals.h"
+
+#if 0
+  #define SPAM(a) printf a
+#else
+  #define SPAM(a) (void)0
+#endif
+
+/* Note callback name is not parenthesized on purpose */
+#define lbsP_emit(cb, ud, name, args) \
+  ( \
+    ((cb)->name == NULL || (cb)->name args == LUABINS_ESUCCESS) \
+      ? LUABINS_ESUCCESS \
+      : LUABINS_EABORTED \
+  )
+
+static int parse_value(
+    lbs_Reader * r,
+    const luabins_ParseCallbacks * cb,
+    void * ud,
+    int nesting,
+    int is_key
+  );
+
+static int parse_table(
+    lbs_Reader * r,
+    const luabins_ParseCallbacks * cb,
+    void * ud,
+    int nesting
+  )
+{
+  int array_size = 0;
+  int hash_size = 0;
+  unsigned int total_size = 0;
+  unsigned int i = 0;
+
+  int result = LUABINS_ESUCCESS;
+
+  if (nesting > LUABINS_MAXTABLENESTING)
+  {
+    return LUABINS_ETOODEEP;
+  }
+
+  result = lbs_readTableHeader(r, &array_size, &hash_size);
+  if (result == LUABINS_ESUCCESS)
+  {
+    result = lbsP_emit(cb, ud, on_table_begin, (ud, array_size, hash_size));
+  }
+
+  total_size = array_size + hash_size;
+  for (i = 0; i < total_size && result == LUABINS_ESUCCESS; ++i)
+  {
+    result = lbsP_emit(cb, ud, on_key, (ud));
+    if (result == LUABINS_ESUCCESS)
+    {
+      result = parse_value(r, cb, ud, nesting, 1); /* Parse key. */
+    }
+
+    if (result == LUABINS_ESUCCESS)
+    {
+      result = parse_value(r, cb, ud, nesting, 0); /* Parse value. */
+    }
+  }
+
+  if (result == LUABINS_ESUCCESS)
+  {
+    result = lbsP_emit(cb, ud, on_table_end, (ud));
+  }
+
+  return result;
+}
+
+/* Packed array is reported as a regular table */
+static int parse_packed(
+    lbs_Reader * r,
+    const luabins_ParseCallbacks * cb,
+    void * ud,
+    int nesting
+  )
+{
+  unsigned char type = 0;
+  int count = 0;
+  const unsigned char * data = NULL;
+  int i = 0;
+
+  int result = LUABINS_ESUCCESS;
+
+  if (nesting > LUABINS_MAXTABLENESTING)
+  {
+    return LUABINS_ETOODEEP;
+  }
+
+  result = lbs_readPacked(r, &type, &count, &data);
+  if (result == LUABINS_ESUCCESS)
+  {
+    result = lbsP_emit(cb, ud, on_table_begin, (ud, count, 0));
+  }
+
+  for (i = 0; i < count && result == LUABINS_ESUCCESS; ++i)
+  {
+    result = lbsP_emit(cb, ud, on_key, (ud));
+    if (result == LUABINS_ESUCCESS)
+    {
+      result = lbsP_emit(cb, ud, on_number, (ud, (lua_Number)(i + 1)));
+    }
+
+    if (result == LUABINS_ESUCCESS)
+    {
+      result = lbsP_emit(
+          cb, ud, on_number, (ud, lbs_packedGet(data, type, i))
+        );
+    }
+  }
+
+  if (result == LUABINS_ESUCCESS)
+  {
+    result = lbsP_emit(cb, ud, on_table_end, (ud));
+  }
+
+  return result;
+}
+
+/* Bitset is reported as a regular table */
+static int parse_bitset(
+    lbs_Reader * r,
+    const luabins_ParseCallbacks * cb,
+    void * ud,
+    int nesting
+  )
+{
+  int count = 0;
+  const unsigned char * bits = NULL;
+  int i = 0;
+
+  int result = LUABINS_ESUCCESS;
+
+  if (nesting > LUABINS_MAXTABLENESTING)
+  {
+    return LUABINS_ETOODEEP;
+  }
+
+  result = lbs_readBitset(r, &count, &bits);
+  if (result == LUABINS_ESUCCESS)
+  {
+    result = lbsP_emit(cb, ud, on_table_begin, (ud, count, 0));
+  }
+
+  for (i = 0; i < count && result == LUABINS_ESUCCESS; ++i)
+  {
+    result = lbsP_emit(cb, ud, on_key, (ud));
+    if (result == LUABINS_ESUCCESS)
+    {
+      result = lbsP_emit(cb, ud, on_number, (ud, (lua_Number)(i + 1)));
+    }
+
+    if (result == LUABINS_ESUCCESS)
+    {
+      result = lbsP_emit(cb, ud, on_boolean, (ud, lbs_bitsetGet(bits, i)));
+    }
+  }
+
+  if (result == LUABINS_ESUCCESS)
+  {
+    result = lbsP_emit(cb, ud, on_table_end, (ud));
+  }
+
+  return result;
+}
+
+/*
+* Spans are reported as a regular table. Values of the span
+* beginning at key 1 are counted as array part.
+*/
+static int parse_spans(
+    lbs_Reader * r,
+    const luabins_ParseCallbacks * cb,
+    void * ud,
+    int nesting
+  )
+{
+  int num_spans = 0;
+  int total = 0;
+  int remaining = 0;
+  int last_key = 0;
+  int i = 0;
+
+  int result = LUABINS_ESUCCESS;
+
+  if (nesting > LUABINS_MAXTABLENESTING)
+  {
+    return LUABINS_ETOODEEP;
+  }
+
+  result = lbs_readSpans(r, &num_spans, &total);
+  if (result == LUABINS_ESUCCESS && num_spans == 0)
+  {
+    result = lbsP_emit(cb, ud, on_table_begin, (ud, 0, 0));
+  }
+
+  remaining = total;
+  for (i = 0; i < num_spans && result == LUABINS_ESUCCESS; ++i)
+  {
+    int first_key = 0;
+    int count = 0;
+    int j = 0;
+
+    result = lbs_readSpan(r, last_key, &first_key, &count);
+    if (result == LUABINS_ESUCCESS && count > remaining)
+    {
+      result = LUABINS_EBADSIZE;
+    }
+
+    if (result == LUABINS_ESUCCESS && i == 0)
+    {
+      int array_size = (first_key == 1) ? count : 0;
+      result = lbsP_emit(
+          cb, ud, on_table_begin, (ud, array_size, total - array_size)
+        );
+    }
+
+    for (j = 0; j < count && result == LUABINS_ESUCCESS; ++j)
+    {
+      result = lbsP_emit(cb, ud, on_key, (ud));
+      if (result == LUABINS_ESUCCESS)
+      {
+        result = lbsP_emit(
+            cb, ud, on_number, (ud, (lua_Number)first_key + j)
+          );
+      }
+
+      if (result == LUABINS_ESUCCESS)
+      {
+        /* Span value can't be nil */
+        if (lbs_readerUnread(r) > 0 && *r->pos == LUABINS_CNIL)
+        {
+          SPAM(("parse: nil in span detected\n"));
+          result = LUABINS_EBADDATA;
+        }
+        else
+        {
+          result = parse_value(r, cb, ud, nesting, 0);
+        }
+      }
+    }
+
+    last_key = first_key + count - 1;
+    remaining -= count;
+  }
+
+  if (result == LUABINS_ESUCCESS && remaining != 0)
+  {
+    result = LUABINS_EBADSIZE;
+  }
+
+  if (result == LUABINS_ESUCCESS)
+  {
+    result = lbsP_emit(cb, ud, on_table_end, (ud));
+  }
+
+  return result;
+}
+
+/* Shaped table is reported as a regular table with string keys */
+static int parse_shaped(
+    lbs_Reader * r,
+    unsigned char type,
+    const luabins_ParseCallbacks * cb,
+    void * ud,
+    int nesting
+  )
+{
+  lbs_Reader keys;
+  int num_keys = 0;
+  int i = 0;
+
+  int result = LUABINS_ESUCCESS;
+
+  if (nesting > LUABINS_MAXTABLENESTING)
+  {
+    return LUABINS_ETOODEEP;
+  }
+
+  if (type == LUABINS_CSHAPEDEF)
+  {
+    /* Keys are read twice: skipped here, reported below */
+    result = lbs_readShapeDef(r, &num_keys);
+    keys = *r;
+    for (i = 0; i < num_keys && result == LUABINS_ESUCCESS; ++i)
+    {
+      const char * key = NULL;
+      size_t length = 0;
+      result = lbs_readShapeKey(r, &key, &length);
+    }
+  }
+  else
+  {
+    result = lbs_readShaped(r, &keys, &num_keys);
+  }
+
+  if (result == LUABINS_ESUCCESS)
+  {
+    result = lbsP_emit(cb, ud, on_table_begin, (ud, 0, num_keys));
+  }
+
+  for (i = 0; i < num_keys && result == LUABINS_ESUCCESS; ++i)
+  {
+    result = lbsP_emit(cb, ud, on_key, (ud));
+    if (result == LUABINS_ESUCCESS)
+    {
+      const char * key = NULL;
+      size_t length = 0;
+      result = lbs_readShapeKey(&keys, &key, &length);
+      if (result == LUABINS_ESUCCESS)
+      {
+        result = lbsP_emit(cb, ud, on_string, (ud, key, length));
+      }
+    }
+
+    if (result == LUABINS_ESUCCESS)
+    {
+      /* Shaped table value can't be nil */
+      if (lbs_readerUnread(r) > 0 && *r->pos == LUABINS_CNIL)
+      {
+        SPAM(("parse: nil in shaped table detected\n"));
+        result = LUABINS_EBADDATA;
+      }
+      else
+      {
+        result = parse_value(r, cb, ud, nesting, 0);
+      }
+    }
+  }
+
+  if (result == LUABINS_ESUCCESS)
+  {
+    result = lbsP_emit(cb, ud, on_table_end, (ud));
+  }
+
+  return result;
+}
+
+/*
+* Columns are reported as a table, mapping column name to column table.
+* Records are not transposed back.
+*/
+static int parse_columns(
+    lbs_Reader * r,
+    const luabins_ParseCallbacks * cb,
+    void * ud,
+    int nesting
+  )
+{
+  lbs_Reader entries;
+  int num_records = 0;
+  int num_columns = 0;
+  int i = 0;
+
+  int result = LUABINS_ESUCCESS;
+
+  if (nesting > LUABINS_MAXTABLENESTING)
+  {
+    return LUABINS_ETOODEEP;
+  }
+
+  /* Directory is read twice: skipped here, reported below */
+  result = lbs_readColumns(r, &num_records, &num_columns);
+  entries = *r;
+  for (i = 0; i < num_columns && result == LUABINS_ESUCCESS; ++i)
+  {
+    const char * name = NULL;
+    size_t length = 0;
+    size_t size = 0;
+    result = lbs_readColumnEntry(r, &name, &length, &size);
+  }
+
+  if (result == LUABINS_ESUCCESS)
+  {
+    result = lbsP_emit(cb, ud, on_table_begin, (ud, 0, num_columns));
+  }
+
+  for (i = 0; i < num_columns && result == LUABINS_ESUCCESS; ++i)
+  {
+    const char * name = NULL;
+    size_t length = 0;
+    size_t size = 0;
+    size_t unread = lbs_readerUnread(r);
+
+    result = lbsP_emit(cb, ud, on_key, (ud));
+    if (result == LUABINS_ESUCCESS)
+    {
+      result = lbs_readColumnEntry(&entries, &name, &length, &size);
+    }
+
+    if (result == LUABINS_ESUCCESS)
+    {
+      result = lbsP_emit(cb, ud, on_string, (ud, name, length));
+    }
+
+    if (result == LUABINS_ESUCCESS)
+    {
+      if (unread == 0 || !lbs_isTableType(*r->pos))
+      {
+        SPAM(("parse: column is not a table\n"));
+        result = LUABINS_EBADDATA;
+      }
+      else
+      {
+        result = parse_value(r, cb, ud, nesting, 0);
+      }
+    }
+
+    if (result == LUABINS_ESUCCESS && unread - lbs_readerUnread(r) != size)
+    {
+      SPAM(("parse: column size mismatch\n"));
+      result = LUABINS_EBADSIZE;
+    }
+  }
+
+  if (result == LUABINS_ESUCCESS)
+  {
+    result = lbsP_emit(cb, ud, on_table_end, (ud));
+  }
+
+  return result;
+}
+
+static int parse_value(
+    lbs_Reader * r,
+    const luabins_ParseCallbacks * cb,
+    void * ud,
+    int nesting,
+    int is_key
+  )
+{
+  unsigned char type = 0;
+
+  int result = lbs_readType(r, &type);
+  if (result != LUABINS_ESUCCESS)
+  {
+    return result;
+  }
+
+  switch (type)
+  {
+  case LUABINS_CNIL:
+    /* Table key can't be nil */
+    if (is_key)
+    {
+      SPAM(("parse: nil as key detected\n"));
+      result = LUABINS_EBADDATA;
+    }
+    else
+    {
+      result = lbsP_emit(cb, ud, on_nil, (ud));
+    }
+    break;
+
+  case LUABINS_CFALSE:
+    result = lbsP_emit(cb, ud, on_boolean, (ud, 0));
+    break;
+
+  case LUABINS_CTRUE:
+    result = lbsP_emit(cb, ud, on_boolean, (ud, 1));
+    break;
+
+  case LUABINS_CNUMBER:
+  case LUABINS_CFLOAT:
+    {
+      lua_Number value = 0;
+      result = (type == LUABINS_CNUMBER)
+        ? lbs_readNumber(r, &value)
+        : lbs_readFloat(r, &value)
+        ;
+      if (result == LUABINS_ESUCCESS)
+      {
+        /* Table key can't be NaN */
+        if (is_key && luai_numisnan(value))
+        {
+          SPAM(("parse: NaN as key detected\n"));
+          result = LUABINS_EBADDATA;
+        }
+        else
+        {
+          result = lbsP_emit(cb, ud, on_number, (ud, value));
+        }
+      }
+    }
+    break;
+
+  case LUABINS_CINTEGER:
+    {
+      lua_Integer value = 0;
+      result = lbs_readInteger(r, &value);
+      if (result == LUABINS_ESUCCESS)
+      {
+        result = (cb->on_integer != NULL)
+          ? lbsP_emit(cb, ud, on_integer, (ud, value))
+          : lbsP_emit(cb, ud, on_number, (ud, (lua_Number)value))
+          ;
+      }
+    }
+    break;
+
+  case LUABINS_CSTRING:
+    {
+      const char * value = NULL;
+      size_t length = 0;
+      result = lbs_readString(r, &value, &length);
+      if (result == LUABINS_ESUCCESS)
+      {
+        result = lbsP_emit(cb, ud, on_string, (ud, value, length));
+      }
+    }
+    break;
+
+  case LUABINS_CEXTENSION:
+    {
+      const char * name = NULL;
+      size_t name_length = 0;
+      const unsigned char * data = NULL;
+      size_t length = 0;
+      result = lbs_readExtension(r, &name, &name_length, &data, &length);
+      if (result == LUABINS_ESUCCESS)
+      {
+        result = lbsP_emit(
+            cb, ud, on_extension, (ud, name, name_length, data, length)
+          );
+      }
+    }
+    break;
+
+  case LUABINS_CTABLE:
+    result = parse_table(r, cb, ud, nesting + 1);
+    break;
+
+  case LUABINS_CPACKED:
+    result = parse_packed(r, cb, ud, nesting + 1);
+    break;
+
+  case LUABINS_CBITSET:
+    result = parse_bitset(r, cb, ud, nesting + 1);
+    break;
+
+  case LUABINS_CSPANS:
+    result = parse_spans(r, cb, ud, nesting + 1);
+    break;
+
+  case LUABINS_CSHAPEDEF:
+  case LUABINS_CSHAPED:
+    result = parse_shaped(r, type, cb, ud, nesting + 1);
+    break;
+
+  case LUABINS_CCOLUMNS:
+    result = parse_columns(r, cb, ud, nesting + 1);
+    break;
+
+  default: /* Should not happen */
+    result = LUABINS_EBADDATA;
+    break;
+  }
+
+  return result;
+}
+
+int luabins_parse(
+    const unsigned char * data,
+    size_t len,
+    const luabins_ParseCallbacks * callbacks,
+    void * ud
+  )
+{
+  lbs_Reader r;
+  int num_items = 0;
+  int i = 0;
+
+  int result = LUABINS_ESUCCESS;
+
+  lbs_readerInit(&r, data, len);
+
+  result = lbs_readTupleSize(&r, &num_items);
+  for (i = 0; i < num_items && result == LUABINS_ESUCCESS; ++i)
+  {
+    result = parse_value(&r, callbacks, ud, 0, 0);
+  }
+
+  if (result == LUABINS_ESUCCESS && lbs_readerUnread(&r) > 0)
+  {
+    SPAM(("parse: %lu chars left at tail\n", lbs_readerUnread(&r)));
+    result = LUABINS_ETAILEFT;
+  }
+
+  return result;
+}
@@ -0,0 +1,66 @@
+/*
+* parse.h
+* Luabins Lua-less event-based parser
+* See copyright notice in luabins.h
+*/
+
+#ifndef LUABINS_PARSE_H_INCLUDED_
+#define LUABINS_PARSE_H_INCLUDED_
+
+#include "saveload.h"
+
+/*
+* Parser callbacks. Any callback may be NULL, corresponding events
+* are ignored then. Callbacks must return LUABINS_ESUCCESS (zero)
+* to continue parsing, anything else aborts parsing.
+*
+* Table contents are reported between on_table_begin and on_table_end
+* as a sequence of key-value pairs. Each key is preceded by on_key.
+* Packed arrays and bitsets are reported as tables with number keys 1 .. n,
+* spans are reported as tables with number keys as well.
+*
+* Strings passed to on_string point inside parsed buffer
+* and are NOT zero-terminated.
+*
+* Extension values (see packed.h) are reported to on_extension
+* with type name and payload, both pointing inside parsed buffer.
+*
+* Integers are reported to on_integer. If it is NULL, they are reported
+* to on_number instead, converted to lua_Number.
+*/
+typedef struct luabins_ParseCallbacks
+{
+  int (*on_nil)(void * ud);
+  int (*on_boolean)(void * ud, int value);
+  int (*on_number)(void * ud, lua_Number value);
+  int (*on_string)(void * ud, const char * value, size_t length);
+  int (*on_table_begin)(void * ud, int array_size, int hash_size);
+  int (*on_key)(void * ud);
+  int (*on_table_end)(void * ud);
+  int (*on_extension)(
+      void * ud,
+      const char * name,
+      size_t name_length,
+      const unsigned char * data,
+      size_t length
+    );
+  int (*on_integer)(void * ud, lua_Integer value);
+} luabins_ParseCallbacks;
+
+/*
+* Parse luabins data, reporting each value to callbacks.
+* Data is validated the same way luabins_load() does it,
+* but note that events for the data preceding an error
+* are already reported at the moment error is detected.
+* Returns LUABINS_ESUCCESS on success,
+* LUABINS_EABORTED if callback aborted the parsing,
+* and other non-zero error code if data is corrupt.
+*/
+int luabins_parse(
+    const unsigned char * data,
+    size_t len,
+    const luabins_ParseCallbacks * callbacks,
+    void * ud
+  );
+
+#endif /* LUABINS_PARSE_H_INCLUDED_ */
@@ -0,0 +1,980 @@
+/*
+* read.c
+* Luabins Lua-less read API
+* See copyright notice in luabins.h
+*/
+
+#include <limits.h> /* INT_MAX */
+#include <string.h> /* memcpy() */
+
+#include "luaheaders.h"
+
+#include "luabins.h"
+#include "read.h"
+#include "packed.h"
+#include "byteorder.h"
+#include "luainternals.h"
+
+#if 0
+  #define SPAM(a) printf a
+#else
+  #define SPAM(a) (void)0
+#endif
+
+void lbs_readerInit(
+    lbs_Reader * r,
+    const unsigned char * data,
+    size_t len
+  )
+{
+  r->begin = data;
+  r->pos = (len > 0) ? data : NULL;
+  r->unread = len;
+}
+
+/* Puts reader into bad state */
+static void lbsR_fail(lbs_Reader * r)
+{
+  r->unread = 0;
+  r->pos = NULL;
+}
+
+/* Note that on failure reader is put into bad state */
+static const unsigned char * lbsR_eat(lbs_Reader * r, size_t len)
+{
+  const unsigned char * result = NULL;
+  if (lbs_readerGood(r))
+  {
+    if (lbs_readerUnread(r) >= len)
+    {
+      result = r->pos;
+      r->pos += len;
+      r->unread -= len;
+    }
+    else
+    {
+      lbsR_fail(r);
+    }
+  }
+  return result;
+}
+
+static int lbsR_readbytes(
+    lbs_Reader * r,
+    unsigned char * buf,
+    size_t len
+  )
+{
+  const unsigned char * pos = lbsR_eat(r, len);
+  if (pos != NULL)
+  {
+    memcpy(buf, pos, len);
+    return LUABINS_ESUCCESS;
+  }
+  SPAM(("read: Failed to read %lu bytes\n", (unsigned long)len));
+  return LUABINS_EBADDATA;
+}
+
+/* Multibyte values are little-endian in data, see byteorder.h */
+
+static int lbsR_readint(lbs_Reader * r, int * value)
+{
+  const unsigned char * pos = lbsR_eat(r, LUABINS_LINT);
+  if (pos == NULL)
+  {
+    return LUABINS_EBADDATA;
+  }
+
+  lbs_loadLE(*value, pos, LUABINS_LINT);
+  return LUABINS_ESUCCESS;
+}
+
+static int lbsR_readsize(lbs_Reader * r, size_t * value)
+{
+  const unsigned char * pos = lbsR_eat(r, LUABINS_LSIZET);
+  if (pos == NULL)
+  {
+    return LUABINS_EBADDATA;
+  }
+
+  lbs_loadSize(*value, pos);
+  return LUABINS_ESUCCESS;
+}
+
+int lbs_readTupleSize(lbs_Reader * r, int * tuple_size)
+{
+  const unsigned char * pos = lbsR_eat(r, 1);
+  if (pos == NULL)
+  {
+    SPAM(("read: failed to read num_items byte\n"));
+    return LUABINS_EBADDATA;
+  }
+
+  if (*pos > LUABINS_MAXTUPLE)
+  {
+    SPAM(("read: tuple too large: %d\n", (int)*pos));
+    lbsR_fail(r);
+    return LUABINS_EBADSIZE;
+  }
+
+  *tuple_size = *pos;
+
+  return LUABINS_ESUCCESS;
+}
+
+int lbs_readType(lbs_Reader * r, unsigned char * type)
+{
+  const unsigned char * pos = lbsR_eat(r, 1);
+  if (pos == NULL)
+  {
+    SPAM(("read: Failed to read value type byte\n"));
+    return LUABINS_EBADDATA;
+  }
+
+  switch (*pos)
+  {
+  case LUABINS_CNIL:
+  case LUABINS_CFALSE:
+  case LUABINS_CTRUE:
+  case LUABINS_CNUMBER:
+  case LUABINS_CINTEGER:
+  case LUABINS_CFLOAT:
+  case LUABINS_CSTRING:
+  case LUABINS_CTABLE:
+  case LUABINS_CPACKED:
+  case LUABINS_CBITSET:
+  case LUABINS_CSPANS:
+  case LUABINS_CSHAPEDEF:
+  case LUABINS_CSHAPED:
+  case LUABINS_CCOLUMNS:
+  case LUABINS_CEXTENSION:
+    *type = *pos;
+    break;
+
+  default:
+    SPAM(("read: Unknown type char 0x%02X found\n", *pos));
+    lbsR_fail(r);
+    return LUABINS_EBADDATA;
+  }
+
+  return LUABINS_ESUCCESS;
+}
+
+int lbs_readTableHeader(lbs_Reader * r, int * array_size, int * hash_size)
+{
+  int asize = 0;
+  int hsize = 0;
+  unsigned int total_size = 0;
+
+  int result = lbsR_readint(r, &asize);
+  if (result == LUABINS_ESUCCESS)
+  {
+    result = lbsR_readint(r, &hsize);
+  }
+
+  if (result == LUABINS_ESUCCESS)
+  {
+    /* Keep in sync with load_table() in load.c */
+    total_size = asize + hsize;
+    if (
+        asize < 0 || asize > MAXASIZE ||
+        hsize < 0  ||
+        (hsize > 0 && ceillog2((unsigned int)hsize) > MAXBITS) ||
+        lbs_readerUnread(r) < luabins_min_table_data_size(total_size)
+      )
+    {
+      lbsR_fail(r);
+      result = LUABINS_EBADSIZE;
+    }
+  }
+
+  if (result == LUABINS_ESUCCESS)
+  {
+    *array_size = asize;
+    *hash_size = hsize;
+  }
+
+  return result;
+}
+
+int lbs_readNumber(lbs_Reader * r, lua_Number * value)
+{
+  int result = lbsR_readbytes(r, (unsigned char *)value, LUABINS_LNUMBER);
+  lbs_fixByteOrder((unsigned char *)value, LUABINS_LNUMBER, 1);
+  return result;
+}
+
+int lbs_readInteger(lbs_Reader * r, lua_Integer * value)
+{
+  const unsigned char * pos = lbsR_eat(r, LUABINS_LINTEGER);
+  if (pos == NULL)
+  {
+    return LUABINS_EBADDATA;
+  }
+
+  if (!lbs_getInteger(pos, value))
+  {
+    SPAM(("read: integer does not fit lua_Integer\n"));
+    lbsR_fail(r);
+    return LUABINS_EBADSIZE;
+  }
+
+  return LUABINS_ESUCCESS;
+}
+
+int lbs_readFloat(lbs_Reader * r, lua_Number * value)
+{
+  float f;
+  int result = lbsR_readbytes(r, (unsigned char *)&f, LUABINS_LFLOAT);
+  if (result == LUABINS_ESUCCESS)
+  {
+    lbs_fixByteOrder((unsigned char *)&f, LUABINS_LFLOAT, 1);
+    *value = f;
+  }
+  return result;
+}
+
+int lbs_readString(lbs_Reader * r, const char ** value, size_t * length)
+{
+  size_t len = 0;
+
+  int result = lbsR_readsize(r, &len);
+  if (result == LUABINS_ESUCCESS)
+  {
+    const unsigned char * pos = lbsR_eat(r, len);
+    if (pos != NULL)
+    {
+      *value = (const char *)pos;
+      *length = len;
+    }
+    else
+    {
+      result = LUABINS_EBADSIZE;
+    }
+  }
+
+  return result;
+}
+
+int lbs_readPacked(
+    lbs_Reader * r,
+    unsigned char * type,
+    int * count,
+    const unsigned char ** data
+  )
+{
+  const unsigned char * pos = lbsR_eat(r, 1);
+  size_t width = 0;
+  int num = 0;
+  int result = LUABINS_ESUCCESS;
+
+  if (pos == NULL)
+  {
+    return LUABINS_EBADDATA;
+  }
+
+  width = lbs_packedWidth(*pos);
+  if (width == 0)
+  {
+    SPAM(("read: Unknown packed element type 0x%02X found\n", *pos));
+    lbsR_fail(r);
+    return LUABINS_EBADDATA;
+  }
+
+  result = lbsR_readint(r, &num);
+  if (result == LUABINS_ESUCCESS)
+  {
+    /* Keep in sync with load_packed() in load.c */
+    if (
+        num < 0 || num > MAXASIZE ||
+        lbs_readerUnread(r) / width < (size_t)num
+      )
+    {
+      lbsR_fail(r);
+      result = LUABINS_EBADSIZE;
+    }
+  }
+
+  if (result == LUABINS_ESUCCESS)
+  {
+    *type = *pos;
+    *count = num;
+    *data = lbsR_eat(r, num * width);
+  }
+
+  return result;
+}
+
+int lbs_readBitset(lbs_Reader * r, int * count, const unsigned char ** bits)
+{
+  int num = 0;
+
+  int result = lbsR_readint(r, &num);
+  if (result == LUABINS_ESUCCESS)
+  {
+    /* Keep in sync with load_bitset() in load.c */
+    if (num < 0 || num > MAXASIZE)
+    {
+      lbsR_fail(r);
+      result = LUABINS_EBADSIZE;
+    }
+  }
+
+  if (result == LUABINS_ESUCCESS)
+  {
+    const unsigned char * pos = lbsR_eat(r, lbs_bitsetSize(num));
+    if (pos != NULL)
+    {
+      *count = num;
+      *bits = pos;
+    }
+    else
+    {
+      result = LUABINS_EBADSIZE;
+    }
+  }
+
+  return result;
+}
+
+int lbs_readSpans(lbs_Reader * r, int * num_spans, int * total)
+{
+  int spans = 0;
+  int values = 0;
+
+  int result = lbsR_readint(r, &spans);
+  if (result == LUABINS_ESUCCESS)
+  {
+    result = lbsR_readint(r, &values);
+  }
+
+  if (result == LUABINS_ESUCCESS)
+  {
+    /* Keep in sync with load_spans() in load.c */
+    if (
+        values < 0 || values > MAXASIZE ||
+        spans < 0 || spans > values ||
+        lbs_readerUnread(r) <
+          (size_t)spans * LUABINS_LSPAN + (size_t)values * LUABINS_LTYPEBYTE
+      )
+    {
+      lbsR_fail(r);
+      result = LUABINS_EBADSIZE;
+    }
+  }
+
+  if (result == LUABINS_ESUCCESS)
+  {
+    *num_spans = spans;
+    *total = values;
+  }
+
+  return result;
+}
+
+int lbs_readSpan(
+    lbs_Reader * r,
+    int last_key,
+    int * first_key,
+    int * count
+  )
+{
+  int first = 0;
+  int num = 0;
+
+  int result = lbsR_readint(r, &first);
+  if (result == LUABINS_ESUCCESS)
+  {
+    result = lbsR_readint(r, &num);
+  }
+
+  if (result == LUABINS_ESUCCESS)
+  {
+    /* Keep in sync with load_spans() in load.c */
+    if (
+        first <= last_key ||
+        num < 1 || num - 1 > INT_MAX - first
+      )
+    {
+      lbsR_fail(r);
+      result = LUABINS_EBADSIZE;
+    }
+  }
+
+  if (result == LUABINS_ESUCCESS)
+  {
+    *first_key = first;
+    *count = num;
+  }
+
+  return result;
+}
+
+int lbs_readShapeDef(lbs_Reader * r, int * num_keys)
+{
+  int keys = 0;
+
+  int result = lbsR_readint(r, &keys);
+  if (result == LUABINS_ESUCCESS)
+  {
+    /* Keep in sync with load_shape_def() in load.c */
+    if (
+        keys < 1 || keys > MAXASIZE ||
+        lbs_readerUnread(r) / (LUABINS_LSIZET + LUABINS_LTYPEBYTE) <
+          (size_t)keys
+      )
+    {
+      lbsR_fail(r);
+      result = LUABINS_EBADSIZE;
+    }
+  }
+
+  if (result == LUABINS_ESUCCESS)
+  {
+    *num_keys = keys;
+  }
+
+  return result;
+}
+
+int lbs_readShapeKey(lbs_Reader * r, const char ** key, size_t * length)
+{
+  /* Keys are stored just as strings, but without type byte */
+  return lbs_readString(r, key, length);
+}
+
+int lbs_readShaped(lbs_Reader * r, lbs_Reader * keys, int * num_keys)
+{
+  size_t distance = 0;
+
+  int result = lbsR_readsize(r, &distance);
+  if (result == LUABINS_ESUCCESS)
+  {
+    const unsigned char * type_pos =
+      r->pos - LUABINS_LSIZET - LUABINS_LTYPEBYTE;
+
+    /*
+    * Weaker than load_shaped() in load.c: reader does not remember
+    * definitions it has read, so only the bytes at distance are checked.
+    */
+    if (
+        distance == 0 ||
+        distance > (size_t)(type_pos - r->begin) ||
+        *(type_pos - distance) != LUABINS_CSHAPEDEF
+      )
+    {
+      SPAM(("read: shaped table refers to unknown shape\n"));
+      lbsR_fail(r);
+      result = LUABINS_EBADDATA;
+    }
+    else
+    {
+      const unsigned char * def = type_pos - distance + LUABINS_LTYPEBYTE;
+
+      lbs_readerInit(keys, def, (size_t)(type_pos - def));
+      keys->begin = r->begin;
+
+      result = lbs_readShapeDef(keys, num_keys);
+      if (result != LUABINS_ESUCCESS)
+      {
+        lbsR_fail(r);
+      }
+    }
+  }
+
+  return result;
+}
+
+int lbs_readColumns(lbs_Reader * r, int * num_records, int * num_columns)
+{
+  int records = 0;
+  int columns = 0;
+
+  int result = lbsR_readint(r, &records);
+  if (result == LUABINS_ESUCCESS)
+  {
+    result = lbsR_readint(r, &columns);
+  }
+
+  if (result == LUABINS_ESUCCESS)
+  {
+    /* Keep in sync with load_columns_header() in load.c */
+    if (
+        records < 0 || records > MAXASIZE ||
+        columns < 0 ||
+        (records == 0) != (columns == 0) ||
+        lbs_readerUnread(r) / (LUABINS_LCOLUMN + LUABINS_LTYPEBYTE) <
+          (size_t)columns
+      )
+    {
+      lbsR_fail(r);
+      result = LUABINS_EBADSIZE;
+    }
+  }
+
+  if (result == LUABINS_ESUCCESS)
+  {
+    *num_records = records;
+    *num_columns = columns;
+  }
+
+  return result;
+}
+
+int lbs_readColumnEntry(
+    lbs_Reader * r,
+    const char ** name,
+    size_t * length,
+    size_t * size
+  )
+{
+  size_t column_size = 0;
+
+  /* Name is stored just as a string, but without type byte */
+  int result = lbs_readString(r, name, length);
+  if (result == LUABINS_ESUCCESS)
+  {
+    result = lbsR_readsize(r, &column_size);
+  }
+
+  if (result == LUABINS_ESUCCESS)
+  {
+    if (column_size > lbs_readerUnread(r))
+    {
+      lbsR_fail(r);
+      result = LUABINS_EBADSIZE;
+    }
+    else
+    {
+      *size = column_size;
+    }
+  }
+
+  return result;
+}
+
+int lbs_readExtension(
+    lbs_Reader * r,
+    const char ** name,
+    size_t * name_length,
+    const unsigned char ** data,
+    size_t * length
+  )
+{
+  int result = lbs_readString(r, name, name_length);
+  if (result == LUABINS_ESUCCESS)
+  {
+    const char * payload = NULL;
+    result = lbs_readString(r, &payload, length);
+    if (result == LUABINS_ESUCCESS)
+    {
+      *data = (const unsigned char *)payload;
+    }
+  }
+
+  return result;
+}
+
+int lbs_readPatch(lbs_Reader * r, int * num_ops)
+{
+  int count = 0;
+  int result = LUABINS_ESUCCESS;
+
+  const unsigned char * pos = lbsR_eat(r, 1);
+  if (pos == NULL || *pos != LUABINS_CPATCH)
+  {
+    SPAM(("read: not a patch\n"));
+    lbsR_fail(r);
+    return LUABINS_EBADDATA;
+  }
+
+  result = lbsR_readint(r, &count);
+  if (result == LUABINS_ESUCCESS)
+  {
+    /* Keep in sync with luabins_patch() in load.c */
+    if (
+        count < 0 ||
+        lbs_readerUnread(r) / LUABINS_LMINPATCHOP < (size_t)count
+      )
+    {
+      lbsR_fail(r);
+      result = LUABINS_EBADSIZE;
+    }
+    else
+    {
+      *num_ops = count;
+    }
+  }
+
+  return result;
+}
+
+int lbs_readPatchOp(lbs_Reader * r, int * path_length)
+{
+  int length = 0;
+
+  int result = lbsR_readint(r, &length);
+  if (result == LUABINS_ESUCCESS)
+  {
+    if (length < 1 || length > LUABINS_MAXTABLENESTING)
+    {
+      lbsR_fail(r);
+      result = LUABINS_EBADSIZE;
+    }
+    else
+    {
+      *path_length = length;
+    }
+  }
+
+  return result;
+}
+
+int lbs_isTableType(unsigned char type)
+{
+  switch (type)
+  {
+  case LUABINS_CTABLE:
+  case LUABINS_CPACKED:
+  case LUABINS_CBITSET:
+  case LUABINS_CSPANS:
+  case LUABINS_CSHAPEDEF:
+  case LUABINS_CSHAPED:
+    return 1;
+
+  default:
+    return 0;
+  }
+}
+
+static int skip_value(lbs_Reader * r, int nesting, int is_key);
+
+static int skip_columns(lbs_Reader * r, int nesting)
+{
+  lbs_Reader entries;
+  int num_records = 0;
+  int num_columns = 0;
+  int i = 0;
+
+  int result = LUABINS_ESUCCESS;
+
+  if (nesting > LUABINS_MAXTABLENESTING)
+  {
+    return LUABINS_ETOODEEP;
+  }
+
+  /* Directory is read twice, to skip it and to get column sizes */
+  result = lbs_readColumns(r, &num_records, &num_columns);
+  entries = *r;
+  for (i = 0; i < num_columns && result == LUABINS_ESUCCESS; ++i)
+  {
+    const char * name = NULL;
+    size_t length = 0;
+    size_t size = 0;
+    result = lbs_readColumnEntry(r, &name, &length, &size);
+  }
+
+  for (i = 0; i < num_columns && result == LUABINS_ESUCCESS; ++i)
+  {
+    const char * name = NULL;
+    size_t length = 0;
+    size_t size = 0;
+    size_t unread = lbs_readerUnread(r);
+
+    result = lbs_readColumnEntry(&entries, &name, &length, &size);
+    if (result != LUABINS_ESUCCESS)
+    {
+      break;
+    }
+
+    if (unread == 0 || !lbs_isTableType(*r->pos))
+    {
+      SPAM(("read: column is not a table\n"));
+      result = LUABINS_EBADDATA;
+    }
+    else
+    {
+      result = skip_value(r, nesting, 0);
+    }
+
+    if (result == LUABINS_ESUCCESS && unread - lbs_readerUnread(r) != size)
+    {
+      SPAM(("read: column size mismatch\n"));
+      result = LUABINS_EBADSIZE;
+    }
+  }
+
+  return result;
+}
+
+static int skip_spans(lbs_Reader * r, int nesting)
+{
+  int num_spans = 0;
+  int remaining = 0;
+  int last_key = 0;
+  int i = 0;
+
+  int result = LUABINS_ESUCCESS;
+
+  if (nesting > LUABINS_MAXTABLENESTING)
+  {
+    return LUABINS_ETOODEEP;
+  }
+
+  result = lbs_readSpans(r, &num_spans, &remaining);
+  for (i = 0; i < num_spans && result == LUABINS_ESUCCESS; ++i)
+  {
+    int first_key = 0;
+    int count = 0;
+    int j = 0;
+
+    result = lbs_readSpan(r, last_key, &first_key, &count);
+    if (result == LUABINS_ESUCCESS && count > remaining)
+    {
+      result = LUABINS_EBADSIZE;
+    }
+
+    for (j = 0; j < count && result == LUABINS_ESUCCESS; ++j)
+    {
+      /* Span value can't be nil */
+      if (lbs_readerUnread(r) > 0 && *r->pos == LUABINS_CNIL)
+      {
+        SPAM(("read: nil in span detected\n"));
+        result = LUABINS_EBADDATA;
+      }
+      else
+      {
+        result = skip_value(r, nesting, 0);
+      }
+    }
+
+    last_key = first_key + count - 1;
+    remaining -= count;
+  }
+
+  if (result == LUABINS_ESUCCESS && remaining != 0)
+  {
+    result = LUABINS_EBADSIZE;
+  }
+
+  return result;
+}
+
+/* Skips shaped table values, keys are already read */
+static int skip_shaped_values(lbs_Reader * r, int num_keys, int nesting)
+{
+  int result = LUABINS_ESUCCESS;
+  int i = 0;
+
+  for (i = 0; i < num_keys && result == LUABINS_ESUCCESS; ++i)
+  {
+    /* Shaped table value can't be nil */
+    if (lbs_readerUnread(r) > 0 && *r->pos == LUABINS_CNIL)
+    {
+      SPAM(("read: nil in shaped table detected\n"));
+      result = LUABINS_EBADDATA;
+    }
+    else
+    {
+      result = skip_value(r, nesting, 0);
+    }
+  }
+
+  return result;
+}
+
+static int skip_shaped(lbs_Reader * r, unsigned char type, int nesting)
+{
+  int num_keys = 0;
+
+  int result = LUABINS_ESUCCESS;
+
+  if (nesting > LUABINS_MAXTABLENESTING)
+  {
+    return LUABINS_ETOODEEP;
+  }
+
+  if (type == LUABINS_CSHAPEDEF)
+  {
+    int i = 0;
+
+    result = lbs_readShapeDef(r, &num_keys);
+    for (i = 0; i < num_keys && result == LUABINS_ESUCCESS; ++i)
+    {
+      const char * key = NULL;
+      size_t len = 0;
+      result = lbs_readShapeKey(r, &key, &len);
+    }
+  }
+  else
+  {
+    lbs_Reader keys;
+    result = lbs_readShaped(r, &keys, &num_keys);
+  }
+
+  if (result == LUABINS_ESUCCESS)
+  {
+    result = skip_shaped_values(r, num_keys, nesting);
+  }
+
+  return result;
+}
+
+static int skip_table(lbs_Reader * r, int nesting)
+{
+  int array_size = 0;
+  int hash_size = 0;
+  unsigned int total_size = 0;
+  unsigned int i = 0;
+
+  int result = LUABINS_ESUCCESS;
+
+  if (nesting > LUABINS_MAXTABLENESTING)
+  {
+    return LUABINS_ETOODEEP;
+  }
+
+  result = lbs_readTableHeader(r, &array_size, &hash_size);
+
+  total_size = array_size + hash_size;
+  for (i = 0; i < total_size && result == LUABINS_ESUCCESS; ++i)
+  {
+    result = skip_value(r, nesting, 1); /* Skip key. */
+    if (result == LUABINS_ESUCCESS)
+    {
+      result = skip_value(r, nesting, 0); /* Skip value. */
+    }
+  }
+
+  return result;
+}
+
+static int skip_value(lbs_Reader * r, int nesting, int is_key)
+{
+  unsigned char type = 0;
+
+  int result = lbs_readType(r, &type);
+  if (result != LUABINS_ESUCCESS)
+  {
+    return result;
+  }
+
+  switch (type)
+  {
+  case LUABINS_CNIL:
+    /* Table key can't be nil */
+    if (is_key)
+    {
+      SPAM(("read: nil as key detected\n"));
+      result = LUABINS_EBADDATA;
+    }
+    break;
+
+  case LUABINS_CFALSE:
+  case LUABINS_CTRUE:
+    break;
+
+  case LUABINS_CNUMBER:
+  case LUABINS_CFLOAT:
+    {
+      lua_Number value = 0;
+      result = (type == LUABINS_CNUMBER)
+        ? lbs_readNumber(r, &value)
+        : lbs_readFloat(r, &value)
+        ;
+      /* Table key can't be NaN */
+      if (result == LUABINS_ESUCCESS && is_key && luai_numisnan(value))
+      {
+        SPAM(("read: NaN as key detected\n"));
+        result = LUABINS_EBADDATA;
+      }
+    }
+    break;
+
+  case LUABINS_CINTEGER:
+    /* Integer needs not fit lua_Integer to be skipped */
+    if (lbsR_eat(r, LUABINS_LINTEGER) == NULL)
+    {
+      result = LUABINS_EBADDATA;
+    }
+    break;
+
+  case LUABINS_CSTRING:
+    {
+      const char * str = NULL;
+      size_t len = 0;
+      result = lbs_readString(r, &str, &len);
+    }
+    break;
+
+  case LUABINS_CEXTENSION:
+    {
+      const char * name = NULL;
+      size_t name_len = 0;
+      const unsigned char * data = NULL;
+      size_t len = 0;
+      result = lbs_readExtension(r, &name, &name_len, &data, &len);
+    }
+    break;
+
+  case LUABINS_CTABLE:
+    result = skip_table(r, nesting + 1);
+    break;
+
+  case LUABINS_CSPANS:
+    result = skip_spans(r, nesting + 1);
+    break;
+
+  case LUABINS_CSHAPEDEF:
+  case LUABINS_CSHAPED:
+    result = skip_shaped(r, type, nesting + 1);
+    break;
+
+  case LUABINS_CCOLUMNS:
+    result = skip_columns(r, nesting + 1);
+    break;
+
+  case LUABINS_CBITSET:
+    if (nesting + 1 > LUABINS_MAXTABLENESTING)
+    {
+      result = LUABINS_ETOODEEP;
+    }
+    else
+    {
+      int count = 0;
+      const unsigned char * bits = NULL;
+      result = lbs_readBitset(r, &count, &bits);
+    }
+    break;
+
+  case LUABINS_CPACKED:
+    if (nesting + 1 > LUABINS_MAXTABLENESTING)
+    {
+      result = LUABINS_ETOODEEP;
+    }
+    else
+    {
+      unsigned char packed_type = 0;
+      int count = 0;
+      const unsigned char * data = NULL;
+      result = lbs_readPacked(r, &packed_type, &count, &data);
+    }
+    break;
+
+  default: /* Should not happen */
+    result = LUABINS_EBADDATA;
+    break;
+  }
+
+  return result;
+}
+
+int lbs_skipValue(lbs_Reader * r)
+{
+  int result = skip_value(r, 0, 0);
+  if (result != LUABINS_ESUCCESS)
+  {
+    lbsR_fail(r);
+  }
+  return result;
+}
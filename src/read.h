@@ -0,0 +1,211 @@
+/*
+* read.h
+* Luabins Lua-less read API
+* See copyright notice in luabins.h
+*/
+
+#ifndef LUABINS_READ_H_INCLUDED_
+#define LUABINS_READ_H_INCLUDED_
+
+#include "saveload.h"
+
+/*
+* Reader walks luabins data in user-owned buffer.
+* Buffer must be valid as long as reader (and any string
+* returned by lbs_readString()) is used.
+*
+* All read functions return LUABINS_ESUCCESS (zero) on success
+* and non-zero error code on failure. After a failure reader is
+* in bad state and all subsequent reads would fail as well.
+*
+* Typical usage:
+*
+*   lbs_readTupleSize(), then for each tuple item:
+*   lbs_readType(), then depending on type:
+*     -- LUABINS_CNIL, LUABINS_CFALSE, LUABINS_CTRUE: no payload;
+*     -- LUABINS_CNUMBER: lbs_readNumber();
+*     -- LUABINS_CINTEGER: lbs_readInteger();
+*     -- LUABINS_CFLOAT: lbs_readFloat();
+*     -- LUABINS_CSTRING: lbs_readString();
+*     -- LUABINS_CTABLE: lbs_readTableHeader(), then
+*        (array_size + hash_size) key-value pairs.
+*     -- LUABINS_CPACKED: lbs_readPacked(), then lbs_packedGet()
+*        or lbs_packedUnpack() (see packed.h) to get values.
+*     -- LUABINS_CBITSET: lbs_readBitset(), then lbs_bitsetGet()
+*        (see packed.h) to get values.
+*     -- LUABINS_CSPANS: lbs_readSpans(), then num_spans times
+*        lbs_readSpan() followed by count values.
+*     -- LUABINS_CSHAPEDEF: lbs_readShapeDef(), then num_keys times
+*        lbs_readShapeKey(), then num_keys values in key order.
+*     -- LUABINS_CSHAPED: lbs_readShaped(), then num_keys times
+*        lbs_readShapeKey() from keys reader, and num_keys values.
+*     -- LUABINS_CCOLUMNS: lbs_readColumns(), then num_columns times
+*        lbs_readColumnEntry(), then num_columns column values.
+*     -- LUABINS_CEXTENSION: lbs_readExtension().
+*
+*   lbs_skipValue() reads type byte and whole value, including
+*   nested tables, and ignores it.
+*
+*   When done, check that lbs_readerUnread() is zero.
+*
+*   Patch (see packed.h) is read with lbs_readPatch() instead
+*   of lbs_readTupleSize(), then for each operation: lbs_readPatchOp(),
+*   then path_length keys and the new value as values.
+*/
+
+typedef struct lbs_Reader
+{
+  const unsigned char * begin; /* See lbs_readShaped() */
+  const unsigned char * pos;
+  size_t unread;
+} lbs_Reader;
+
+void lbs_readerInit(
+    lbs_Reader * r,
+    const unsigned char * data,
+    size_t len
+  );
+
+#define lbs_readerGood(r) \
+  ((r)->pos != NULL)
+
+#define lbs_readerUnread(r) \
+  ((r)->unread)
+
+/* Fails with LUABINS_EBADSIZE if tuple is too large */
+int lbs_readTupleSize(lbs_Reader * r, int * tuple_size);
+
+/* Fails with LUABINS_EBADDATA on unknown type byte */
+int lbs_readType(lbs_Reader * r, unsigned char * type);
+
+/*
+* Reads table header (after the type byte).
+* Sizes are validated the same way luabins_load() does it.
+*/
+int lbs_readTableHeader(lbs_Reader * r, int * array_size, int * hash_size);
+
+/* Reads number value (after the type byte). */
+int lbs_readNumber(lbs_Reader * r, lua_Number * value);
+
+/*
+* Reads integer value (after the type byte).
+* Fails with LUABINS_EBADSIZE if it does not fit lua_Integer.
+*/
+int lbs_readInteger(lbs_Reader * r, lua_Integer * value);
+
+/* Reads single precision float value (after the type byte). */
+int lbs_readFloat(lbs_Reader * r, lua_Number * value);
+
+/*
+* Reads string value (after the type byte).
+* Does not copy data: value points inside the reader buffer.
+* Note that string is NOT zero-terminated.
+*/
+int lbs_readString(lbs_Reader * r, const char ** value, size_t * length);
+
+/*
+* Reads packed array (after the type byte).
+* Does not copy data: data points inside the reader buffer.
+*/
+int lbs_readPacked(
+    lbs_Reader * r,
+    unsigned char * type,
+    int * count,
+    const unsigned char ** data
+  );
+
+/*
+* Reads bitset (after the type byte).
+* Does not copy data: bits points inside the reader buffer.
+*/
+int lbs_readBitset(lbs_Reader * r, int * count, const unsigned char ** bits);
+
+/* Reads spans header (after the type byte). */
+int lbs_readSpans(lbs_Reader * r, int * num_spans, int * total);
+
+/*
+* Reads span header. Pass zero as last_key for the first span,
+* and the last key of the previous span for the rest of them,
+* so span order is validated.
+* Note that caller must check that span values are not nil,
+* and that span counts add up to total.
+*/
+int lbs_readSpan(
+    lbs_Reader * r,
+    int last_key,
+    int * first_key,
+    int * count
+  );
+
+/* Reads shape definition header (after the type byte). */
+int lbs_readShapeDef(lbs_Reader * r, int * num_keys);
+
+/*
+* Reads shape key of a definition.
+* Does not copy data: key points inside the reader buffer.
+*/
+int lbs_readShapeKey(lbs_Reader * r, const char ** key, size_t * length);
+
+/*
+* Reads shaped table header (after the type byte) and initializes
+* keys reader at the first key of the shape definition it refers to.
+* Note that definition is only checked to be a shape definition header
+* between the buffer start and the shaped table. Unlike luabins_load(),
+* it is not checked that definition was actually read as a value:
+* bytes inside a string that look like a definition are accepted too.
+* So reader accepts some corrupt data which luabins_load() rejects.
+*/
+int lbs_readShaped(lbs_Reader * r, lbs_Reader * keys, int * num_keys);
+
+/* Reads columns header (after the type byte). */
+int lbs_readColumns(lbs_Reader * r, int * num_records, int * num_columns);
+
+/*
+* Reads column directory entry. Column value of size bytes follows
+* the directory, after values of all previous columns.
+* Does not copy data: name points inside the reader buffer.
+* Note that caller must check that each column value is a table
+* of size bytes. Unlike luabins_load(), lbs_skipValue() does not check
+* that column keys are record indices.
+*/
+int lbs_readColumnEntry(
+    lbs_Reader * r,
+    const char ** name,
+    size_t * length,
+    size_t * size
+  );
+
+/*
+* Reads extension value (after the type byte), see packed.h.
+* Does not copy data: name and data point inside the reader buffer.
+* Note that name is NOT zero-terminated.
+*/
+int lbs_readExtension(
+    lbs_Reader * r,
+    const char ** name,
+    size_t * name_length,
+    const unsigned char ** data,
+    size_t * length
+  );
+
+/* Reads patch marker and number of operations. */
+int lbs_readPatch(lbs_Reader * r, int * num_ops);
+
+/*
+* Reads patch operation header. Note that caller must check
+* that path keys are not nil, NaN or tables.
+*/
+int lbs_readPatchOp(lbs_Reader * r, int * path_length);
+
+/* Returns non-zero if value of given type loads as a table */
+int lbs_isTableType(unsigned char type);
+
+/*
+* Reads and ignores single value, type byte included.
+* Nested tables are validated as luabins_load() would do,
+* nesting deeper than LUABINS_MAXTABLENESTING is rejected
+* with LUABINS_ETOODEEP.
+*/
+int lbs_skipValue(lbs_Reader * r);
+
+#endif /* LUABINS_READ_H_INCLUDED_ */
@@ -4,12 +4,24 @@
 * See copyright notice in luabins.h
 */
 
+#include <limits.h> /* INT_MAX */
+#include <stdlib.h> /* qsort() */
+#include <string.h> /* memcmp() */
+
 #include "luaheaders.h"
 
 #include "luabins.h"
 #include "saveload.h"
 #include "savebuffer.h"
 #include "write.h"
+#include "iovwrite.h"
+#include "packed.h"
+#include "compress.h"
+#include "checksum.h"
+#include "extension.h"
+#include "luainternals.h"
+#include "snapshot.h"
+#include "bgsave.h"
 
 /* TODO: Test this with custom allocator! */
 
@@ -19,21 +31,451 @@
   #define SPAM(a) (void)0
 #endif
 
+/* Tables with more keys are not saved as shaped */
+#define LUABINS_MAXSHAPEKEYS (64)
+
+/* State shared by all save calls */
+typedef struct lbs_SaveState
+{
+  luabins_SaveBuffer * sb;
+  lbs_IovWriter * iov; /* If not NULL, large strings are saved by reference */
+  int flags; /* LUABINS_F* save flags */
+  int shapes; /* Stack index of shape registry, zero if not used */
+} lbs_SaveState;
+
 static int save_value(
     lua_State * L,
-    luabins_SaveBuffer * sb,
+    lbs_SaveState * ss,
     int index,
     int nesting
   );
 
+/* Writes number values at keys 1 .. count as packed array */
+static int save_packed(
+    lua_State * L,
+    luabins_SaveBuffer * sb,
+    int index,
+    int count,
+    unsigned char type
+  )
+{
+  int result = lbs_writePackedHeader(sb, type, count);
+  int i = 0;
+
+  for (i = 1; i <= count && result == LUABINS_ESUCCESS; ++i)
+  {
+    lua_rawgeti(L, index, i);
+    result = lbs_writePackedElement(sb, type, lua_tonumber(L, -1));
+    lua_pop(L, 1);
+  }
+
+  return result;
+}
+
+/* Writes boolean values at keys 1 .. count as bitset */
+static int save_bitset(
+    lua_State * L,
+    luabins_SaveBuffer * sb,
+    int index,
+    int count
+  )
+{
+  int result = lbs_writeBitsetHeader(sb, count);
+  unsigned char byte = 0;
+  int i = 0;
+
+  for (i = 0; i < count && result == LUABINS_ESUCCESS; ++i)
+  {
+    lua_rawgeti(L, index, i + 1);
+    if (lua_toboolean(L, -1))
+    {
+      byte |= (unsigned char)(1U << (i & 7));
+    }
+    lua_pop(L, 1);
+
+    if ((i & 7) == 7 || i == count - 1)
+    {
+      result = lbsSB_writechar(sb, byte);
+      byte = 0;
+    }
+  }
+
+  return result;
+}
+
+/*
+* Saves table as packed array if it has number values at keys 1 .. n
+* and no other keys, or as bitset if it has boolean values instead.
+* Returns non-zero if table was saved, result is set then.
+* Returns zero if table should be saved as usual.
+*/
+static int save_array(
+    lua_State * L,
+    lbs_SaveState * ss,
+    int index,
+    int * result
+  )
+{
+  lbs_PackedClass pc;
+  size_t len = lbs_objlen(L, index);
+  int value_type = LUA_TNONE;
+  int num_integers = 0;
+  int count = 0;
+  int i = 0;
+  unsigned char type = 0;
+
+  if (len < 1 || len > MAXASIZE)
+  {
+    return 0;
+  }
+
+  if (!lua_checkstack(L, 2)) /* Key and value */
+  {
+    *result = LUABINS_ENOSTACK;
+    return 1;
+  }
+
+  lua_rawgeti(L, index, 1);
+  value_type = lua_type(L, -1);
+  lua_pop(L, 1);
+
+  if (
+      !(value_type == LUA_TNUMBER && (ss->flags & LUABINS_FPACKED)) &&
+      !(value_type == LUA_TBOOLEAN && (ss->flags & LUABINS_FBITSET))
+    )
+  {
+    return 0;
+  }
+
+  count = (int)len;
+  lbs_packedClassInit(&pc);
+  for (i = 1; i <= count; ++i)
+  {
+    int same_type = 0;
+
+    lua_rawgeti(L, index, i);
+    same_type = (lua_type(L, -1) == value_type);
+    if (same_type && value_type == LUA_TNUMBER)
+    {
+      lbs_packedClassAdd(&pc, lua_tonumber(L, -1));
+      if (lbs_isinteger(L, -1))
+      {
+        ++num_integers;
+      }
+    }
+    lua_pop(L, 1);
+
+    if (!same_type)
+    {
+      return 0;
+    }
+  }
+
+  /* All keys 1 .. count are there, make sure there is nothing else */
+  i = 0;
+  lua_pushnil(L);
+  while (lua_next(L, index) != 0)
+  {
+    lua_pop(L, 1); /* Leave key for the next iteration. */
+    if (++i > count)
+    {
+      lua_pop(L, 1);
+      return 0;
+    }
+  }
+
+  if (value_type == LUA_TBOOLEAN)
+  {
+    *result = save_bitset(L, ss->sb, index, count);
+    return 1;
+  }
+
+  /*
+  * Integer subtype survives only if all values are integers in integer
+  * element type range, and other numbers only if element type is not
+  * an integer one. Mixed arrays are saved as usual.
+  */
+  type = lbs_packedClassType(&pc, ss->flags & LUABINS_FFLOAT32);
+  if (num_integers > 0)
+  {
+    if (
+        num_integers < count ||
+        type == LUABINS_PNUMBER || type == LUABINS_PFLOAT
+      )
+    {
+      return 0;
+    }
+  }
+  else if (LUABINS_INTEGERS && type != LUABINS_PNUMBER)
+  {
+    type = ((ss->flags & LUABINS_FFLOAT32) && pc.fits_float)
+      ? LUABINS_PFLOAT
+      : LUABINS_PNUMBER
+      ;
+  }
+
+  *result = save_packed(L, ss->sb, index, count, type);
+
+  return 1;
+}
+
+/* Returns non-zero if key at given index may be saved in a span */
+static int is_span_key(lua_State * L, int index)
+{
+  lua_Number key = 0;
+
+  if (lua_type(L, index) != LUA_TNUMBER)
+  {
+    return 0;
+  }
+
+  key = lua_tonumber(L, index);
+
+  return key >= 1 && key <= INT_MAX && key == (int)key;
+}
+
+static int compare_keys(const void * lhs, const void * rhs)
+{
+  const int a = *(const int *)lhs;
+  const int b = *(const int *)rhs;
+
+  return (a < b) ? -1 : (a > b);
+}
+
+/*
+* Saves table as spans if all its keys are positive integers.
+* Returns non-zero if table was saved, result is set then.
+* Returns zero if table should be saved as usual.
+*/
+static int save_spans(
+    lua_State * L,
+    lbs_SaveState * ss,
+    int index,
+    int nesting,
+    int * result
+  )
+{
+  int * keys = NULL;
+  int total = 0;
+  int num_spans = 0;
+  int i = 0;
+
+  if (!lua_checkstack(L, 3)) /* Key, value and keys buffer */
+  {
+    *result = LUABINS_ENOSTACK;
+    return 1;
+  }
+
+  lua_pushnil(L);
+  while (lua_next(L, index) != 0)
+  {
+    lua_pop(L, 1); /* Leave key for the next iteration. */
+    if (total >= MAXASIZE || !is_span_key(L, -1))
+    {
+      lua_pop(L, 1);
+      return 0;
+    }
+    ++total;
+  }
+
+  if (total == 0)
+  {
+    return 0;
+  }
+
+  /* Userdata is collected even if Lua error is raised below */
+  keys = (int *)lua_newuserdata(L, total * sizeof(int));
+
+  i = 0;
+  lua_pushnil(L);
+  while (lua_next(L, index) != 0)
+  {
+    lua_pop(L, 1); /* Leave key for the next iteration. */
+    keys[i++] = (int)lua_tonumber(L, -1);
+  }
+
+  qsort(keys, total, sizeof(int), compare_keys);
+
+  num_spans = 1;
+  for (i = 1; i < total; ++i)
+  {
+    if (keys[i] != keys[i - 1] + 1)
+    {
+      ++num_spans;
+    }
+  }
+
+  *result = lbs_writeSpansHeader(ss->sb, num_spans, total);
+
+  i = 0;
+  while (i < total && *result == LUABINS_ESUCCESS)
+  {
+    int first = i;
+
+    while (i + 1 < total && keys[i + 1] == keys[i] + 1)
+    {
+      ++i;
+    }
+    ++i;
+
+    *result = lbs_writeSpanHeader(ss->sb, keys[first], i - first);
+    for ( ; first < i && *result == LUABINS_ESUCCESS; ++first)
+    {
+      lua_rawgeti(L, index, keys[first]);
+      *result = save_value(L, ss, lua_gettop(L), nesting);
+      lua_pop(L, 1);
+    }
+  }
+
+  lua_pop(L, 1); /* Remove keys buffer */
+
+  return 1;
+}
+
+/* String key of a shaped table or a column name */
+typedef struct lbs_StringKey
+{
+  const char * str;
+  size_t len;
+  int value_pos; /* Stack index of the value, shaped tables only */
+} lbs_StringKey;
+
+static int compare_string_keys(const void * lhs, const void * rhs)
+{
+  const lbs_StringKey * a = (const lbs_StringKey *)lhs;
+  const lbs_StringKey * b = (const lbs_StringKey *)rhs;
+
+  int result = memcmp(a->str, b->str, luabins_min(a->len, b->len));
+  if (result == 0)
+  {
+    result = (a->len < b->len) ? -1 : (a->len > b->len);
+  }
+
+  return result;
+}
+
+/*
+* Saves table as shaped if all its keys are strings.
+* Shape registry maps key set signature to the shape definition position.
+* Returns non-zero if table was saved, result is set then.
+* Returns zero if table should be saved as usual.
+*/
+static int save_shaped(
+    lua_State * L,
+    lbs_SaveState * ss,
+    int index,
+    int nesting,
+    int * result
+  )
+{
+  lbs_StringKey keys[LUABINS_MAXSHAPEKEYS];
+  luaL_Buffer signature;
+  int base = lua_gettop(L);
+  int num_keys = 0;
+  int i = 0;
+
+  if (!lua_checkstack(L, 2)) /* Key and value */
+  {
+    *result = LUABINS_ENOSTACK;
+    return 1;
+  }
+
+  lua_pushnil(L);
+  while (lua_next(L, index) != 0)
+  {
+    lua_pop(L, 1); /* Leave key for the next iteration. */
+    if (num_keys >= LUABINS_MAXSHAPEKEYS || lua_type(L, -1) != LUA_TSTRING)
+    {
+      lua_pop(L, 1);
+      return 0;
+    }
+    ++num_keys;
+  }
+
+  /*
+  * Keys and values are kept on stack, see below.
+  * Extra slots are for the key signature buffer and registry lookup.
+  */
+  if (num_keys == 0 || !lua_checkstack(L, 2 * num_keys + LUA_MINSTACK))
+  {
+    return 0;
+  }
+
+  lua_pushnil(L);
+  while (lua_next(L, index) != 0)
+  {
+    keys[i].str = lua_tolstring(L, -2, &keys[i].len);
+    keys[i].value_pos = lua_gettop(L);
+    ++i;
+    lua_pushvalue(L, -2); /* Key copy for the next iteration. */
+  }
+
+  qsort(keys, num_keys, sizeof(lbs_StringKey), compare_string_keys);
+
+  luaL_buffinit(L, &signature);
+  for (i = 0; i < num_keys; ++i)
+  {
+    luaL_addlstring(&signature, (const char *)&keys[i].len, sizeof(size_t));
+    luaL_addlstring(&signature, keys[i].str, keys[i].len);
+  }
+  luaL_pushresult(&signature);
+
+  lua_pushvalue(L, -1);
+  lua_rawget(L, ss->shapes);
+  if (lua_isnil(L, -1))
+  {
+    lua_pop(L, 1);
+    lua_pushnumber(L, (lua_Number)lbsSB_length(ss->sb));
+    lua_rawset(L, ss->shapes); /* Pops signature and position */
+
+    *result = lbs_writeShapeDefHeader(ss->sb, num_keys);
+    for (i = 0; i < num_keys && *result == LUABINS_ESUCCESS; ++i)
+    {
+      *result = lbs_writeShapeKey(ss->sb, keys[i].str, keys[i].len);
+    }
+  }
+  else
+  {
+    size_t def_pos = (size_t)lua_tonumber(L, -1);
+    lua_pop(L, 2);
+
+    *result = lbs_writeShapedHeader(ss->sb, lbsSB_length(ss->sb) - def_pos);
+  }
+
+  for (i = 0; i < num_keys && *result == LUABINS_ESUCCESS; ++i)
+  {
+    *result = save_value(L, ss, keys[i].value_pos, nesting);
+  }
+
+  lua_settop(L, base);
+
+  return 1;
+}
+
+/* Returns non-zero if value is a packed array loaded as userdata */
+static int is_packed_userdata(lua_State * L, int index)
+{
+  int result = 0;
+
+  if (lua_getmetatable(L, index))
+  {
+    luaL_getmetatable(L, LUABINS_PACKEDMT);
+    result = lua_rawequal(L, -1, -2);
+    lua_pop(L, 2);
+  }
+
+  return result;
+}
+
 /* Returns 0 on success, non-zero on failure */
 static int save_table(
     lua_State * L,
-    luabins_SaveBuffer * sb,
+    lbs_SaveState * ss,
     int index,
     int nesting
   )
 {
+  luabins_SaveBuffer * sb = ss->sb;
   int result = LUABINS_ESUCCESS;
   int header_pos = 0;
   int total_size = 0;
@@ -43,6 +485,27 @@ static int save_table(
     return LUABINS_ETOODEEP;
   }
 
+  if (
+      (ss->flags & (LUABINS_FPACKED | LUABINS_FBITSET)) &&
+      save_array(L, ss, index, &result)
+    )
+  {
+    return result;
+  }
+
+  if (
+      (ss->flags & LUABINS_FSPARSE) &&
+      save_spans(L, ss, index, nesting, &result)
+    )
+  {
+    return result;
+  }
+
+  if (ss->shapes != 0 && save_shaped(L, ss, index, nesting, &result))
+  {
+    return result;
+  }
+
   /* TODO: Hauling stack for key and value removal
      may get too heavy for larger tables. Think out a better way.
   */
@@ -63,12 +526,12 @@ static int save_table(
     int key_pos = value_pos - 1;
 
     /* Save key. */
-    result = save_value(L, sb, key_pos, nesting);
+    result = save_value(L, ss, key_pos, nesting);
 
     /* Save value. */
     if (result == LUABINS_ESUCCESS)
     {
-      result = save_value(L, sb, value_pos, nesting);
+      result = save_value(L, ss, value_pos, nesting);
     }
 
     if (result == LUABINS_ESUCCESS)
@@ -82,13 +545,13 @@ static int save_table(
   if (result == LUABINS_ESUCCESS)
   {
     /*
-      Note that if array has holes, lua_objlen() may report
+      Note that if array has holes, lbs_objlen() may report
       larger than actual array size. So we need to adjust.
 
       TODO: Note inelegant downsize from size_t to int.
             Handle integer overflow here.
     */
-    int array_size = luabins_min(total_size, (int)lua_objlen(L, index));
+    int array_size = luabins_min(total_size, (int)lbs_objlen(L, index));
     int hash_size = luabins_max(0, total_size - array_size);
 
     result = lbs_writeTableHeaderAt(sb, header_pos, array_size, hash_size);
@@ -100,11 +563,12 @@ static int save_table(
 /* Returns 0 on success, non-zero on failure */
 static int save_value(
     lua_State * L,
-    luabins_SaveBuffer * sb,
+    lbs_SaveState * ss,
     int index,
     int nesting
   )
 {
+  luabins_SaveBuffer * sb = ss->sb;
   int result = LUABINS_ESUCCESS;
 
   switch (lua_type(L, index))
@@ -118,7 +582,19 @@ static int save_value(
     break;
 
   case LUA_TNUMBER:
-    result = lbs_writeNumber(sb, lua_tonumber(L, index));
+    if (lbs_isinteger(L, index))
+    {
+      result = lbs_writeLuaInteger(sb, lua_tointeger(L, index));
+    }
+    else
+    {
+      lua_Number value = lua_tonumber(L, index);
+
+      result = ((ss->flags & LUABINS_FFLOAT32) && lbs_fitsFloat(value))
+        ? lbs_writeFloat(sb, value)
+        : lbs_writeNumber(sb, value)
+        ;
+    }
     break;
 
   case LUA_TSTRING:
@@ -126,18 +602,51 @@ static int save_value(
       size_t len = 0;
       const char * buf = lua_tolstring(L, index, &len);
 
-      result = lbs_writeString(sb, buf, len);
+      result = (ss->iov != NULL)
+        ? lbs_iovwriteString(ss->iov, buf, len)
+        : lbs_writeString(sb, buf, len)
+        ;
     }
     break;
 
   case LUA_TTABLE:
-    result = save_table(L, sb, index, nesting + 1);
+    result = save_table(L, ss, index, nesting + 1);
+    break;
+
+  case LUA_TUSERDATA:
+    if (is_packed_userdata(L, index))
+    {
+      result = lbs_writePackedNumbers(
+          sb,
+          (const lua_Number *)lua_touserdata(L, index),
+          (int)(lbs_objlen(L, index) / sizeof(lua_Number)),
+          ss->flags & LUABINS_FFLOAT32
+        );
+    }
+    else if (
+        lua_checkstack(L, 2) && /* Metatable and types table */
+        lua_getmetatable(L, index) &&
+        lbs_pushType(L)
+      )
+    {
+      result = lbs_saveExtension(L, sb, lua_gettop(L), index);
+      lua_pop(L, 1);
+    }
+    else
+    {
+      result = LUABINS_EBADTYPE;
+    }
+    break;
+
+#if LUABINS_LUAJIT
+  case LUABINS_TCDATA:
+    result = lbs_saveBoxedInteger(L, sb, index);
     break;
+#endif
 
   case LUA_TNONE:
   case LUA_TFUNCTION:
   case LUA_TTHREAD:
-  case LUA_TUSERDATA:
   default:
     result = LUABINS_EBADTYPE;
   }
@@ -145,32 +654,71 @@ static int save_value(
   return result;
 }
 
-int luabins_save(lua_State * L, int index_from, int index_to)
+/*
+* Returns 0 on success.
+* Returns non-zero on failure, pushes error message on the top of the stack.
+*/
+static void push_save_error(lua_State * L, int result)
 {
-  unsigned char num_to_save = 0;
-  int index = index_from;
-  int base = lua_gettop(L);
-  luabins_SaveBuffer sb;
+  switch (result)
+  {
+  case LUABINS_EBADTYPE:
+    lua_pushliteral(L, "can't save: unsupported type detected");
+    break;
 
-  /*
-  * TODO: If lua_error() would happen below, would leak the buffer.
-  */
+  case LUABINS_ETOODEEP:
+    lua_pushliteral(L, "can't save: nesting is too deep");
+    break;
 
-  if (index_to - index_from > LUABINS_MAXTUPLE)
-  {
-    lua_pushliteral(L, "can't save that many items");
-    return LUABINS_EFAILURE;
-  }
+  case LUABINS_ETOOLONG:
+    lua_pushliteral(L, "can't save: not enough memory");
+    break;
 
-  /* Allowing to call luabins_save(L, 1, lua_gettop(L))
-     from C function, called from Lua with no arguments
-     (when lua_gettop() would return 0)
+  case LUABINS_EEXTENSION:
+    lua_pushliteral(L, "can't save: custom type encoder failed");
+    break;
+
+  case LUABINS_EWRITE:
+    lua_pushliteral(L, "can't save: write failed");
+    break;
+
+  case LUABINS_ENOSTACK:
+    lua_pushliteral(L, "can't save: not enough stack");
+    break;
+
+  default: /* Should not happen */
+    lua_pushliteral(L, "save failed");
+    break;
+  }
+}
+
+/*
+* Checks tuple index range, sets number of values to save.
+* Returns 0 on success.
+* Returns non-zero on failure, pushes error message on the top of the stack.
+*/
+static int check_tuple(
+    lua_State * L,
+    int index_from,
+    int index_to,
+    unsigned char * num_to_save
+  )
+{
+  int base = lua_gettop(L);
+
+  if (index_to - index_from > LUABINS_MAXTUPLE)
+  {
+    lua_pushliteral(L, "can't save that many items");
+    return LUABINS_EFAILURE;
+  }
+
+  /* Allowing to call luabins_save(L, 1, lua_gettop(L))
+     from C function, called from Lua with no arguments
+     (when lua_gettop() would return 0)
   */
   if (index_to < index_from)
   {
-    index_from = 0;
-    index_to = 0;
-    num_to_save = 0;
+    *num_to_save = 0;
   }
   else
   {
@@ -183,54 +731,1310 @@ int luabins_save(lua_State * L, int index_from, int index_to)
       return LUABINS_EFAILURE;
     }
 
-    num_to_save = index_to - index_from + 1;
+    *num_to_save = index_to - index_from + 1;
+  }
+
+  return LUABINS_ESUCCESS;
+}
+
+static int save_tuple(
+    lua_State * L,
+    lbs_SaveState * ss,
+    int index_from,
+    int index_to
+  )
+{
+  unsigned char num_to_save = 0;
+  int index = index_from;
+
+  if (check_tuple(L, index_from, index_to, &num_to_save) != 0)
+  {
+    return LUABINS_EFAILURE;
   }
 
+  if (ss->flags & LUABINS_FSHAPES)
   {
-    void * alloc_ud = NULL;
-    lua_Alloc alloc_fn = lua_getallocf(L, &alloc_ud);
-    lbsSB_init(&sb, alloc_fn, alloc_ud);
+    /* Shape registry, above saved values so it can't be saved by mistake */
+    lua_newtable(L);
+    ss->shapes = lua_gettop(L);
   }
 
-  lbs_writeTupleSize(&sb, num_to_save);
+  lbs_writeTupleSize(ss->sb, num_to_save);
   for ( ; index <= index_to; ++index)
   {
     int result = 0;
 
-    result = save_value(L, &sb, index, 0);
+    result = save_value(L, ss, index, 0);
     if (result != LUABINS_ESUCCESS)
     {
-      switch (result)
+      push_save_error(L, result);
+
+      if (ss->shapes != 0)
       {
-      case LUABINS_EBADTYPE:
-        lua_pushliteral(L, "can't save: unsupported type detected");
-        break;
+        lua_remove(L, ss->shapes);
+      }
 
-      case LUABINS_ETOODEEP:
-        lua_pushliteral(L, "can't save: nesting is too deep");
-        break;
+      return result;
+    }
+  }
 
-      case LUABINS_ETOOLONG:
-        lua_pushliteral(L, "can't save: not enough memory");
-        break;
+  if (ss->shapes != 0)
+  {
+    lua_remove(L, ss->shapes);
+  }
 
-      default: /* Should not happen */
-        lua_pushliteral(L, "save failed");
-        break;
-      }
+  return LUABINS_ESUCCESS;
+}
 
-      lbsSB_destroy(&sb);
+int luabins_save(lua_State * L, int index_from, int index_to)
+{
+  return luabins_save_ex(L, index_from, index_to, 0);
+}
 
-      return result;
-    }
+/*
+* Pushes data wrapped into envelopes as a string,
+* compressed first, checksummed second.
+*/
+static int push_enveloped(
+    lua_State * L,
+    luabins_SaveBuffer * sb,
+    int flags
+  )
+{
+  luabins_SaveBuffer compressed;
+  luabins_SaveBuffer checksummed;
+  size_t len = 0UL;
+  const unsigned char * buf = lbsSB_buffer(sb, &len);
+  int result = LUABINS_ESUCCESS;
+
+  lbsSB_init(&compressed, sb->alloc_fn, sb->alloc_ud);
+  lbsSB_init(&checksummed, sb->alloc_fn, sb->alloc_ud);
+
+  if (flags & LUABINS_FCOMPRESS)
+  {
+    result = lbs_writeCompressed(&compressed, buf, len);
+    buf = lbsSB_buffer(&compressed, &len);
+  }
+
+  if (result == LUABINS_ESUCCESS && (flags & LUABINS_FCHECKSUM))
+  {
+    result = lbs_writeChecksummed(&checksummed, buf, len);
+    buf = lbsSB_buffer(&checksummed, &len);
+  }
+
+  if (result == LUABINS_ESUCCESS)
+  {
+    lua_pushlstring(L, (const char *)buf, len);
+  }
+  else
+  {
+    push_save_error(L, result);
   }
 
+  lbsSB_destroy(&checksummed);
+  lbsSB_destroy(&compressed);
+
+  return result;
+}
+
+/* Pushes saved data as a string, in envelopes if flags ask for them */
+static int push_saved(lua_State * L, luabins_SaveBuffer * sb, int flags)
+{
+  if (flags & (LUABINS_FCOMPRESS | LUABINS_FCHECKSUM))
+  {
+    return push_enveloped(L, sb, flags);
+  }
+  else
   {
     size_t len = 0UL;
-    const unsigned char * buf = lbsSB_buffer(&sb, &len);
+    const unsigned char * buf = lbsSB_buffer(sb, &len);
     lua_pushlstring(L, (const char *)buf, len);
-    lbsSB_destroy(&sb);
   }
 
   return LUABINS_ESUCCESS;
 }
+
+int luabins_save_ex(lua_State * L, int index_from, int index_to, int flags)
+{
+  luabins_SaveBuffer sb;
+  lbs_SaveState ss;
+  int result = LUABINS_ESUCCESS;
+
+  /*
+  * TODO: If lua_error() would happen below, would leak the buffer.
+  */
+
+  {
+    void * alloc_ud = NULL;
+    lua_Alloc alloc_fn = lua_getallocf(L, &alloc_ud);
+    lbsSB_init(&sb, alloc_fn, alloc_ud);
+  }
+
+  ss.sb = &sb;
+  ss.iov = NULL;
+  ss.flags = flags;
+  ss.shapes = 0;
+
+  result = save_tuple(L, &ss, index_from, index_to);
+  if (result == LUABINS_ESUCCESS)
+  {
+    result = push_saved(L, &sb, flags);
+  }
+
+  lbsSB_destroy(&sb);
+
+  return result;
+}
+
+int luabins_savev(
+    lua_State * L,
+    int index_from,
+    int index_to,
+    struct lbs_IovWriter * w
+  )
+{
+  lbs_SaveState ss;
+
+  ss.sb = &w->sb;
+  ss.iov = w;
+  ss.flags = 0;
+  ss.shapes = 0;
+
+  return save_tuple(L, &ss, index_from, index_to);
+}
+
+int luabins_save_buffer(
+    lua_State * L,
+    int index_from,
+    int index_to,
+    struct luabins_SaveBuffer * sb
+  )
+{
+  lbs_SaveState ss;
+
+  ss.sb = sb;
+  ss.iov = NULL;
+  ss.flags = 0;
+  ss.shapes = 0;
+
+  return save_tuple(L, &ss, index_from, index_to);
+}
+
+static int capture_value(
+    lua_State * L,
+    lbs_SaveState * ss,
+    lbs_Snapshot * s,
+    int index,
+    int nesting
+  );
+
+/* Same as save_table(), but captures table into the snapshot */
+static int capture_table(
+    lua_State * L,
+    lbs_SaveState * ss,
+    lbs_Snapshot * s,
+    int index,
+    int nesting
+  )
+{
+  lbs_SnapshotNode node;
+  lbs_SnapshotNode * header = NULL;
+  size_t header_index = 0;
+  int total_size = 0;
+  int result = LUABINS_ESUCCESS;
+
+  if (nesting > LUABINS_MAXTABLENESTING)
+  {
+    return LUABINS_ETOODEEP;
+  }
+
+  /* Sizes are known at the end */
+  node.type = LUABINS_CTABLE;
+  node.length = 0;
+  node.value.table.array_size = 0;
+  node.value.table.hash_size = 0;
+
+  result = lbs_snapshotAppend(s, &node, &header_index);
+  if (result == LUABINS_ESUCCESS && !lua_checkstack(L, 2)) /* Key, value */
+  {
+    result = LUABINS_ENOSTACK;
+  }
+
+  if (result == LUABINS_ESUCCESS)
+  {
+    lua_pushnil(L); /* key for lua_next() */
+  }
+
+  while (result == LUABINS_ESUCCESS && lua_next(L, index) != 0)
+  {
+    int value_pos = lua_gettop(L); /* We need absolute values */
+    int key_pos = value_pos - 1;
+
+    result = capture_value(L, ss, s, key_pos, nesting);
+    if (result == LUABINS_ESUCCESS)
+    {
+      result = capture_value(L, ss, s, value_pos, nesting);
+    }
+
+    if (result == LUABINS_ESUCCESS)
+    {
+      /* Remove value from stack, leave key for the next iteration. */
+      lua_pop(L, 1);
+      ++total_size;
+    }
+  }
+
+  if (result == LUABINS_ESUCCESS)
+  {
+    /* See save_table() */
+    int array_size = luabins_min(total_size, (int)lbs_objlen(L, index));
+
+    header = lbs_snapshotNode(s, header_index);
+    header->value.table.array_size = array_size;
+    header->value.table.hash_size = luabins_max(0, total_size - array_size);
+  }
+
+  return result;
+}
+
+/*
+* Captures value into the snapshot. Values of other types than below
+* are saved right away to the snapshot raw buffer.
+*/
+static int capture_value(
+    lua_State * L,
+    lbs_SaveState * ss,
+    lbs_Snapshot * s,
+    int index,
+    int nesting
+  )
+{
+  lbs_SnapshotNode node;
+  int result = LUABINS_ESUCCESS;
+
+  node.length = 0;
+
+  switch (lua_type(L, index))
+  {
+  case LUA_TNIL:
+    node.type = LUABINS_CNIL;
+    break;
+
+  case LUA_TBOOLEAN:
+    node.type = lua_toboolean(L, index) ? LUABINS_CTRUE : LUABINS_CFALSE;
+    break;
+
+  case LUA_TNUMBER:
+    if (lbs_isinteger(L, index))
+    {
+      node.type = LUABINS_CINTEGER;
+      node.value.integer = lua_tointeger(L, index);
+    }
+    else
+    {
+      node.type = LUABINS_CNUMBER;
+      node.value.number = lua_tonumber(L, index);
+    }
+    break;
+
+  case LUA_TSTRING:
+    /* Borrowed, saved values stay on stack until encoded */
+    node.type = LUABINS_CSTRING;
+    node.value.str = lua_tolstring(L, index, &node.length);
+    break;
+
+  case LUA_TTABLE:
+    return capture_table(L, ss, s, index, nesting + 1);
+
+  default:
+    node.type = LUABINS_SNAPSHOTRAW;
+    node.value.offset = lbsSB_length(ss->sb);
+
+    result = save_value(L, ss, index, nesting);
+    node.length = lbsSB_length(ss->sb) - node.value.offset;
+    break;
+  }
+
+  if (result == LUABINS_ESUCCESS)
+  {
+    result = lbs_snapshotAppend(s, &node, NULL);
+  }
+
+  return result;
+}
+
+int luabins_capture(
+    lua_State * L,
+    int index_from,
+    int index_to,
+    struct lbs_Snapshot * s
+  )
+{
+  lbs_SaveState ss;
+  unsigned char num_to_save = 0;
+  int base = lua_gettop(L);
+  int result = LUABINS_ESUCCESS;
+  int index = index_from;
+
+  if (check_tuple(L, index_from, index_to, &num_to_save) != 0)
+  {
+    return LUABINS_EFAILURE;
+  }
+
+  /* Raw buffer takes values which are not captured */
+  ss.sb = &s->raw;
+  ss.iov = NULL;
+  ss.flags = 0;
+  ss.shapes = 0;
+
+  s->count = num_to_save;
+  for ( ; index <= index_to && result == LUABINS_ESUCCESS; ++index)
+  {
+    result = capture_value(L, &ss, s, index, 0);
+  }
+
+  if (result != LUABINS_ESUCCESS)
+  {
+    lua_settop(L, base); /* Discard unfinished table traversals */
+    push_save_error(L, result);
+  }
+
+  return result;
+}
+
+/* Arguments of luabins_save_parallel(), see save_parallel_protected() */
+typedef struct lbs_ParallelArgs
+{
+  lbs_Snapshot * s;
+  luabins_SaveBuffer * sb;
+  int flags;
+  int num_threads;
+  int result;
+} lbs_ParallelArgs;
+
+/*
+* Captures, encodes and pushes values, called in protected mode.
+* Takes lbs_ParallelArgs as light userdata, then values to save.
+* Sets args->result, returns saved data or error message.
+*/
+static int save_parallel_protected(lua_State * L)
+{
+  lbs_ParallelArgs * args = (lbs_ParallelArgs *)lua_touserdata(L, 1);
+  int result = luabins_capture(L, 2, lua_gettop(L), args->s);
+  if (result == LUABINS_ESUCCESS)
+  {
+    result = lbs_snapshotEncode(args->s, args->sb, args->num_threads);
+    if (result != LUABINS_ESUCCESS)
+    {
+      push_save_error(L, result);
+    }
+  }
+
+  /* Snapshot is large, free it before enveloped copies are made */
+  lbs_snapshotDestroy(args->s);
+
+  if (result == LUABINS_ESUCCESS)
+  {
+    result = push_saved(L, args->sb, args->flags);
+  }
+
+  args->result = result;
+
+  return 1;
+}
+
+int luabins_save_parallel(
+    lua_State * L,
+    int index_from,
+    int index_to,
+    int flags,
+    int num_threads
+  )
+{
+  luabins_SaveBuffer sb;
+  lbs_Snapshot s;
+  lbs_ParallelArgs args;
+  unsigned char num_to_save = 0;
+  int index = 0;
+
+  /* Snapshot holds plain values, other encodings need whole tables */
+  if ((flags & ~(LUABINS_FCOMPRESS | LUABINS_FCHECKSUM)) != 0)
+  {
+    lua_pushliteral(L, "can't save: option not supported by parallel save");
+    return LUABINS_EFAILURE;
+  }
+
+  if (check_tuple(L, index_from, index_to, &num_to_save) != 0)
+  {
+    return LUABINS_EFAILURE;
+  }
+
+  if (!lua_checkstack(L, num_to_save + 2))
+  {
+    lua_pushliteral(L, "can't save: not enough stack");
+    return LUABINS_EFAILURE;
+  }
+
+  {
+    void * alloc_ud = NULL;
+    lua_Alloc alloc_fn = lua_getallocf(L, &alloc_ud);
+    lbsSB_init(&sb, alloc_fn, alloc_ud);
+    lbs_snapshotInit(&s, alloc_fn, alloc_ud);
+  }
+
+  args.s = &s;
+  args.sb = &sb;
+  args.flags = flags;
+  args.num_threads = num_threads;
+  args.result = LUABINS_EFAILURE;
+
+  /*
+  * Buffers are freed below even if Lua error happens while values
+  * are captured (say, in custom type encoder) or saved data is pushed.
+  */
+  lua_pushcfunction(L, save_parallel_protected);
+  lua_pushlightuserdata(L, &args);
+  for (index = index_from; index <= index_to; ++index)
+  {
+    lua_pushvalue(L, index);
+  }
+
+  if (lua_pcall(L, num_to_save + 1, 1, 0) != 0)
+  {
+    args.result = LUABINS_EFAILURE;
+  }
+
+  lbs_snapshotDestroy(&s);
+  lbsSB_destroy(&sb);
+
+  return args.result;
+}
+
+/* Arguments of luabins_bgsave(), used in child process */
+typedef struct lbs_BgSaveArgs
+{
+  lua_State * L;
+  int index_from;
+  int index_to;
+  int flags;
+  int fd; /* Set in child process */
+  int result;
+} lbs_BgSaveArgs;
+
+/* Streams snapshot to fd chunk by chunk, sb holds one chunk at a time */
+static int write_snapshot(lbs_Snapshot * s, luabins_SaveBuffer * sb, int fd)
+{
+  size_t num_chunks = lbs_snapshotChunks(s);
+  size_t len = 0UL;
+  const unsigned char * buf = NULL;
+  size_t i = 0;
+  int result = lbs_writeTupleSize(sb, (unsigned char)s->count);
+
+  /* Tuple size goes with the first chunk, alone if there are none */
+  for (i = 0; i < num_chunks && result == LUABINS_ESUCCESS; ++i)
+  {
+    result = lbs_snapshotEncodeChunk(s, i, sb);
+    if (result == LUABINS_ESUCCESS)
+    {
+      buf = lbsSB_buffer(sb, &len);
+      result = lbs_bgsaveWrite(fd, buf, len);
+      lbsSB_reset(sb);
+    }
+  }
+
+  if (result == LUABINS_ESUCCESS && lbsSB_length(sb) > 0)
+  {
+    buf = lbsSB_buffer(sb, &len);
+    result = lbs_bgsaveWrite(fd, buf, len);
+  }
+
+  return result;
+}
+
+/*
+* Saves values to fd in child process, called in protected mode.
+* Takes lbs_BgSaveArgs as light userdata, then values to save.
+* Sets args->result, on failure returns error message.
+*/
+static int bgsave_protected(lua_State * L)
+{
+  lbs_BgSaveArgs * args = (lbs_BgSaveArgs *)lua_touserdata(L, 1);
+  int index_to = lua_gettop(L);
+  int result = LUABINS_ESUCCESS;
+
+  if (args->flags != 0)
+  {
+    /* Envelopes and such need all data, it is saved in memory */
+    result = luabins_save_ex(L, 2, index_to, args->flags);
+    if (result == LUABINS_ESUCCESS)
+    {
+      size_t len = 0UL;
+      const char * buf = lua_tolstring(L, -1, &len);
+
+      result = lbs_bgsaveWrite(args->fd, (const unsigned char *)buf, len);
+      if (result != LUABINS_ESUCCESS)
+      {
+        push_save_error(L, result);
+      }
+    }
+  }
+  else
+  {
+    luabins_SaveBuffer sb;
+    lbs_Snapshot s;
+
+    /*
+    * Buffers are not freed if Lua error happens below,
+    * child process exits right after that anyway.
+    */
+
+    {
+      void * alloc_ud = NULL;
+      lua_Alloc alloc_fn = lua_getallocf(L, &alloc_ud);
+      lbsSB_init(&sb, alloc_fn, alloc_ud);
+      lbs_snapshotInit(&s, alloc_fn, alloc_ud);
+    }
+
+    result = luabins_capture(L, 2, index_to, &s);
+    if (result == LUABINS_ESUCCESS)
+    {
+      result = write_snapshot(&s, &sb, args->fd);
+      if (result != LUABINS_ESUCCESS)
+      {
+        push_save_error(L, result);
+      }
+    }
+
+    lbs_snapshotDestroy(&s);
+    lbsSB_destroy(&sb);
+  }
+
+  args->result = result;
+
+  return (result == LUABINS_ESUCCESS) ? 0 : 1;
+}
+
+/*
+* Saves values to fd in child process, see lbs_BgSaveFn in bgsave.h.
+* Lua errors are caught here. Otherwise child would unwind into
+* protected calls of its parent and go on running its code.
+*/
+static int bgsave_write(void * ud, int fd, char * error)
+{
+  lbs_BgSaveArgs * args = (lbs_BgSaveArgs *)ud;
+  lua_State * L = args->L;
+  int num_values = args->index_to - args->index_from + 1;
+  int result = LUABINS_ESUCCESS;
+  int index = 0;
+
+  if (num_values < 0)
+  {
+    num_values = 0;
+  }
+
+  args->fd = fd;
+  args->result = LUABINS_EFAILURE;
+
+  if (!lua_checkstack(L, num_values + 2))
+  {
+    lua_pushliteral(L, "can't bgsave: not enough stack");
+    result = LUABINS_EFAILURE;
+  }
+  else
+  {
+    lua_pushcfunction(L, bgsave_protected);
+    lua_pushlightuserdata(L, args);
+    for (index = args->index_from; index <= args->index_to; ++index)
+    {
+      lua_pushvalue(L, index);
+    }
+
+    result = (lua_pcall(L, num_values + 1, 1, 0) == 0)
+      ? args->result
+      : LUABINS_EFAILURE
+      ;
+  }
+
+  if (result != LUABINS_ESUCCESS)
+  {
+    size_t len = 0UL;
+    const char * message = lua_tolstring(L, -1, &len);
+    if (message == NULL)
+    {
+      message = "can't bgsave: save failed";
+      len = strlen(message);
+    }
+
+    len = luabins_min(len, LUABINS_BGSAVEMAXERROR - 1);
+    memcpy(error, message, len);
+    error[len] = '\0';
+  }
+
+  return result;
+}
+
+int luabins_bgsave(
+    lua_State * L,
+    int index_from,
+    int index_to,
+    int flags,
+    const char * path,
+    struct lbs_BgSave * job
+  )
+{
+  lbs_BgSaveArgs args;
+  unsigned char num_to_save = 0;
+  int result = LUABINS_ESUCCESS;
+
+  /* Child process relies on valid indices */
+  if (check_tuple(L, index_from, index_to, &num_to_save) != 0)
+  {
+    return LUABINS_EFAILURE;
+  }
+
+  args.L = L;
+  args.index_from = index_from;
+  args.index_to = index_to;
+  args.flags = flags;
+  args.fd = -1;
+  args.result = LUABINS_ESUCCESS;
+
+  result = lbs_bgsaveStart(job, path, bgsave_write, &args);
+  if (result != LUABINS_ESUCCESS)
+  {
+    lua_pushstring(L, job->error);
+  }
+
+  return result;
+}
+
+/*
+* Returns non-zero if index range is valid and holds only values
+* which may be copied to other state as is (no tables or userdata).
+*/
+static int is_plain_tuple(lua_State * L, int index_from, int index_to)
+{
+  int index = index_from;
+
+  if (index_to < index_from)
+  {
+    return 1; /* Empty tuple */
+  }
+
+  if (
+      index_from < 1 || index_to > lua_gettop(L) ||
+      index_to - index_from > LUABINS_MAXTUPLE
+    )
+  {
+    return 0; /* Let save_tuple() report the error */
+  }
+
+  for ( ; index <= index_to; ++index)
+  {
+    switch (lua_type(L, index))
+    {
+    case LUA_TNIL:
+    case LUA_TBOOLEAN:
+    case LUA_TNUMBER:
+    case LUA_TSTRING:
+      break;
+
+    default:
+      return 0;
+    }
+  }
+
+  return 1;
+}
+
+/* Pushes values checked with is_plain_tuple() to Ldst */
+static int push_plain_tuple(
+    lua_State * L,
+    int index_from,
+    int index_to,
+    lua_State * Ldst
+  )
+{
+  int index = index_from;
+  int count = (index_to < index_from) ? 0 : index_to - index_from + 1;
+
+  luaL_checkstack(Ldst, count + 1, "transfer");
+
+  for ( ; index <= index_to; ++index)
+  {
+    switch (lua_type(L, index))
+    {
+    case LUA_TNIL:
+      lua_pushnil(Ldst);
+      break;
+
+    case LUA_TBOOLEAN:
+      lua_pushboolean(Ldst, lua_toboolean(L, index));
+      break;
+
+    case LUA_TNUMBER:
+      if (lbs_isinteger(L, index))
+      {
+        lua_pushinteger(Ldst, lua_tointeger(L, index));
+      }
+      else
+      {
+        lua_pushnumber(Ldst, lua_tonumber(L, index));
+      }
+      break;
+
+    default: /* LUA_TSTRING */
+      {
+        size_t len = 0;
+        const char * str = lua_tolstring(L, index, &len);
+        lua_pushlstring(Ldst, str, len);
+      }
+      break;
+    }
+  }
+
+  return count;
+}
+
+int luabins_transfer(
+    lua_State * L,
+    int index_from,
+    int index_to,
+    lua_State * Ldst,
+    struct luabins_SaveBuffer * sb,
+    int * count
+  )
+{
+  luabins_SaveBuffer own_sb;
+  int result = LUABINS_ESUCCESS;
+
+  if (is_plain_tuple(L, index_from, index_to))
+  {
+    *count = push_plain_tuple(L, index_from, index_to, Ldst);
+    return LUABINS_ESUCCESS;
+  }
+
+  if (sb == NULL)
+  {
+    void * alloc_ud = NULL;
+    lua_Alloc alloc_fn = lua_getallocf(Ldst, &alloc_ud);
+    lbsSB_init(&own_sb, alloc_fn, alloc_ud);
+    sb = &own_sb;
+  }
+  else
+  {
+    lbsSB_reset(sb);
+  }
+
+  result = luabins_save_buffer(L, index_from, index_to, sb);
+  if (result == LUABINS_ESUCCESS)
+  {
+    size_t len = 0UL;
+    const unsigned char * buf = lbsSB_buffer(sb, &len);
+    result = luabins_load(Ldst, buf, len, count);
+  }
+  else
+  {
+    /* Save error is reported to Ldst as well */
+    size_t len = 0UL;
+    const char * msg = lua_tolstring(L, -1, &len);
+    lua_pushlstring(Ldst, msg, len);
+    lua_pop(L, 1);
+  }
+
+  if (sb == &own_sb)
+  {
+    lbsSB_destroy(&own_sb);
+  }
+
+  return result;
+}
+
+/*
+* Transposes records at index into columns table, mapping field name
+* to column table, pushes it on stack. Returns number of columns,
+* or -1 if records are not tables with string keys (nothing is pushed then).
+*/
+static int build_columns(lua_State * L, int index, int num_records)
+{
+  int base = lua_gettop(L);
+  int num_columns = 0;
+  int num_keys = 0;
+  int i = 0;
+
+  /* Records must be an array without holes and other keys */
+  lua_pushnil(L);
+  while (lua_next(L, index) != 0)
+  {
+    lua_pop(L, 1);
+    ++num_keys;
+  }
+  if (num_keys != num_records)
+  {
+    return -1;
+  }
+
+  lua_newtable(L);
+
+  for (i = 1; i <= num_records; ++i)
+  {
+    int empty = 1;
+
+    lua_rawgeti(L, index, i);
+    if (!lua_istable(L, -1))
+    {
+      lua_settop(L, base);
+      return -1;
+    }
+
+    lua_pushnil(L);
+    while (lua_next(L, -2) != 0)
+    {
+      if (lua_type(L, -2) != LUA_TSTRING)
+      {
+        lua_settop(L, base);
+        return -1;
+      }
+      empty = 0;
+
+      lua_pushvalue(L, -2);
+      lua_rawget(L, base + 1);
+      if (lua_isnil(L, -1))
+      {
+        lua_pop(L, 1);
+        lua_createtable(L, num_records, 0);
+        lua_pushvalue(L, -3); /* Field name */
+        lua_pushvalue(L, -2);
+        lua_rawset(L, base + 1);
+        ++num_columns;
+      }
+
+      lua_pushvalue(L, -2); /* Field value */
+      lua_rawseti(L, -2, i);
+      lua_pop(L, 2); /* Leave field name for the next iteration. */
+    }
+
+    lua_pop(L, 1); /* Remove record */
+
+    /* Empty records would be lost */
+    if (empty)
+    {
+      lua_settop(L, base);
+      return -1;
+    }
+  }
+
+  return num_columns;
+}
+
+/* Saves columns table on stack top, see packed.h for format */
+static int save_columns(
+    lua_State * L,
+    lbs_SaveState * ss,
+    int num_records,
+    int num_columns
+  )
+{
+  luabins_SaveBuffer * sb = ss->sb;
+  int columns = lua_gettop(L);
+  lbs_StringKey * names = NULL;
+  size_t size_pos = 0;
+  int result = LUABINS_ESUCCESS;
+  int i = 0;
+
+  /* Names buffer, shapes, name and column */
+  if (!lua_checkstack(L, 4))
+  {
+    return LUABINS_ENOSTACK;
+  }
+
+  names = (lbs_StringKey *)lua_newuserdata(
+      L, num_columns * sizeof(lbs_StringKey)
+    );
+
+  lua_pushnil(L);
+  while (lua_next(L, columns) != 0)
+  {
+    lua_pop(L, 1);
+    names[i].str = lua_tolstring(L, -1, &names[i].len);
+    names[i].value_pos = 0;
+    ++i;
+  }
+
+  qsort(names, num_columns, sizeof(lbs_StringKey), compare_string_keys);
+
+  lbs_writeTupleSize(sb, 1);
+  result = lbs_writeColumnsHeader(sb, num_records, num_columns);
+
+  /* Sizes are not known yet, they are fixed below */
+  size_pos = lbsSB_length(sb);
+  for (i = 0; i < num_columns && result == LUABINS_ESUCCESS; ++i)
+  {
+    result = lbs_writeColumnEntry(sb, names[i].str, names[i].len, 0);
+  }
+
+  for (i = 0; i < num_columns && result == LUABINS_ESUCCESS; ++i)
+  {
+    size_t start = lbsSB_length(sb);
+
+    if (ss->flags & LUABINS_FSHAPES)
+    {
+      /* Shape definitions are not shared between columns */
+      lua_newtable(L);
+      ss->shapes = lua_gettop(L);
+    }
+
+    lua_pushlstring(L, names[i].str, names[i].len);
+    lua_rawget(L, columns);
+
+    /* Column is a field of the records array, nested accordingly */
+    result = save_value(L, ss, lua_gettop(L), 1);
+
+    lua_pop(L, 1);
+    if (ss->shapes != 0)
+    {
+      lua_pop(L, 1);
+      ss->shapes = 0;
+    }
+
+    size_pos += LUABINS_LSIZET + names[i].len;
+    if (result == LUABINS_ESUCCESS)
+    {
+      result = lbs_writeColumnSizeAt(sb, size_pos, lbsSB_length(sb) - start);
+    }
+    size_pos += LUABINS_LSIZET;
+  }
+
+  lua_pop(L, 1); /* Remove names buffer */
+
+  return result;
+}
+
+int luabins_save_columnar(lua_State * L, int index, int flags)
+{
+  luabins_SaveBuffer sb;
+  lbs_SaveState ss;
+  int base = lua_gettop(L);
+  int num_records = 0;
+  int num_columns = 0;
+  int result = LUABINS_ESUCCESS;
+
+  if (index < 1 || index > base)
+  {
+    lua_pushliteral(L, "can't save: inexistant indices");
+    return LUABINS_EFAILURE;
+  }
+
+  /* Columns, record, field, column and copies */
+  if (!lua_checkstack(L, 7))
+  {
+    push_save_error(L, LUABINS_ENOSTACK);
+    return LUABINS_ENOSTACK;
+  }
+
+  if (lua_istable(L, index))
+  {
+    num_records = (int)lbs_objlen(L, index);
+    num_columns = build_columns(L, index, num_records);
+  }
+  else
+  {
+    num_columns = -1;
+  }
+
+  if (num_columns < 0)
+  {
+    lua_pushliteral(
+        L,
+        "can't save: not an array of non-empty tables with string keys"
+      );
+    return LUABINS_EFAILURE;
+  }
+
+  {
+    void * alloc_ud = NULL;
+    lua_Alloc alloc_fn = lua_getallocf(L, &alloc_ud);
+    lbsSB_init(&sb, alloc_fn, alloc_ud);
+  }
+
+  /* Columns are dense arrays, make the most of it */
+  ss.sb = &sb;
+  ss.iov = NULL;
+  ss.flags = flags | LUABINS_FPACKED | LUABINS_FBITSET;
+  ss.shapes = 0;
+
+  result = save_columns(L, &ss, num_records, num_columns);
+  lua_settop(L, base); /* Remove columns */
+
+  if (result == LUABINS_ESUCCESS)
+  {
+    result = push_saved(L, &sb, flags);
+  }
+  else
+  {
+    push_save_error(L, result);
+  }
+
+  lbsSB_destroy(&sb);
+
+  return result;
+}
+
+/* State of luabins_diff() */
+typedef struct lbs_DiffState
+{
+  lbs_SaveState ss;
+  int path; /* Stack index of path keys table, see save_patch_op() */
+  int num_ops;
+} lbs_DiffState;
+
+/* Returns non-zero if value at index may be a patch path key */
+static int is_path_key(lua_State * L, int index)
+{
+  int type = lua_type(L, index);
+  return type != LUA_TTABLE && type != LUA_TUSERDATA;
+}
+
+/* Returns non-zero if values need no patch operation */
+static int is_same_value(lua_State * L, int lhs, int rhs)
+{
+  if (lua_rawequal(L, lhs, rhs))
+  {
+    return 1;
+  }
+
+  if (
+      lua_type(L, lhs) == LUA_TUSERDATA &&
+      lua_type(L, rhs) == LUA_TUSERDATA &&
+      is_packed_userdata(L, lhs) &&
+      is_packed_userdata(L, rhs)
+    )
+  {
+    size_t len = lbs_objlen(L, lhs);
+    return len == lbs_objlen(L, rhs) &&
+      memcmp(lua_touserdata(L, lhs), lua_touserdata(L, rhs), len) == 0;
+  }
+
+  return 0;
+}
+
+/*
+* Writes operation setting value at key of the table
+* at the current path of depth keys.
+*/
+static int save_patch_op(
+    lua_State * L,
+    lbs_DiffState * ds,
+    int depth,
+    int key_pos,
+    int value_pos
+  )
+{
+  int i = 0;
+
+  int result = lbs_writePatchOp(ds->ss.sb, depth + 1);
+  for (i = 1; i <= depth && result == LUABINS_ESUCCESS; ++i)
+  {
+    lua_rawgeti(L, ds->path, i);
+    result = save_value(L, &ds->ss, lua_gettop(L), 0);
+    lua_pop(L, 1);
+  }
+
+  if (result == LUABINS_ESUCCESS)
+  {
+    result = save_value(L, &ds->ss, key_pos, 0);
+  }
+
+  if (result == LUABINS_ESUCCESS)
+  {
+    result = save_value(L, &ds->ss, value_pos, depth);
+  }
+
+  if (result == LUABINS_ESUCCESS)
+  {
+    ++ds->num_ops;
+  }
+
+  return result;
+}
+
+/*
+* Writes operations turning old table into new one.
+* Tables at the same key are compared recursively,
+* other values are replaced as a whole.
+*/
+static int diff_tables(
+    lua_State * L,
+    lbs_DiffState * ds,
+    int old_index,
+    int new_index,
+    int depth
+  )
+{
+  int result = LUABINS_ESUCCESS;
+
+  if (depth >= LUABINS_MAXTABLENESTING)
+  {
+    return LUABINS_ETOODEEP;
+  }
+
+  if (!lua_checkstack(L, 4)) /* Key, value, key copy, other value */
+  {
+    return LUABINS_ENOSTACK;
+  }
+
+  /* Removed keys */
+  lua_pushnil(L);
+  while (result == LUABINS_ESUCCESS && lua_next(L, old_index) != 0)
+  {
+    lua_pop(L, 1); /* Old value is not needed */
+    lua_pushvalue(L, -1);
+    lua_rawget(L, new_index);
+    if (lua_isnil(L, -1))
+    {
+      int value_pos = lua_gettop(L);
+
+      result = is_path_key(L, value_pos - 1)
+        ? save_patch_op(L, ds, depth, value_pos - 1, value_pos)
+        : LUABINS_EBADTYPE
+        ;
+    }
+    lua_pop(L, 1);
+  }
+
+  /* Added and changed keys */
+  if (result == LUABINS_ESUCCESS)
+  {
+    lua_pushnil(L);
+  }
+
+  while (result == LUABINS_ESUCCESS && lua_next(L, new_index) != 0)
+  {
+    int value_pos = lua_gettop(L);
+    int key_pos = value_pos - 1;
+    int old_value_pos = value_pos + 1;
+
+    lua_pushvalue(L, key_pos);
+    lua_rawget(L, old_index);
+    if (!is_same_value(L, old_value_pos, value_pos))
+    {
+      if (!is_path_key(L, key_pos))
+      {
+        result = LUABINS_EBADTYPE;
+      }
+      else if (lua_istable(L, old_value_pos) && lua_istable(L, value_pos))
+      {
+        lua_pushvalue(L, key_pos);
+        lua_rawseti(L, ds->path, depth + 1);
+        result = diff_tables(L, ds, old_value_pos, value_pos, depth + 1);
+      }
+      else
+      {
+        result = save_patch_op(L, ds, depth, key_pos, value_pos);
+      }
+    }
+    lua_pop(L, 2);
+  }
+
+  return result;
+}
+
+int luabins_diff(lua_State * L, int old_index, int new_index, int flags)
+{
+  luabins_SaveBuffer sb;
+  lbs_DiffState ds;
+  int base = lua_gettop(L);
+  int result = LUABINS_ESUCCESS;
+
+  if (
+      old_index < 1 || old_index > base ||
+      new_index < 1 || new_index > base
+    )
+  {
+    lua_pushliteral(L, "can't save: inexistant indices");
+    return LUABINS_EFAILURE;
+  }
+
+  if (lua_type(L, old_index) == LUA_TSTRING)
+  {
+    size_t len = 0;
+    const unsigned char * data = (const unsigned char *)lua_tolstring(
+        L, old_index, &len
+      );
+    int count = 0;
+
+    result = luabins_load(L, data, len, &count);
+    if (result != LUABINS_ESUCCESS)
+    {
+      return result; /* Error message is pushed */
+    }
+
+    if (count != 1)
+    {
+      lua_settop(L, base);
+      lua_pushnil(L); /* Not a table */
+    }
+    old_index = base + 1;
+  }
+
+  if (!lua_istable(L, old_index) || !lua_istable(L, new_index))
+  {
+    lua_settop(L, base);
+    lua_pushliteral(L, "can't diff: not a table");
+    return LUABINS_EFAILURE;
+  }
+
+  if (!lua_checkstack(L, 2)) /* Path keys and shapes tables */
+  {
+    lua_settop(L, base);
+    push_save_error(L, LUABINS_ENOSTACK);
+    return LUABINS_ENOSTACK;
+  }
+
+  {
+    void * alloc_ud = NULL;
+    lua_Alloc alloc_fn = lua_getallocf(L, &alloc_ud);
+    lbsSB_init(&sb, alloc_fn, alloc_ud);
+  }
+
+  ds.ss.sb = &sb;
+  ds.ss.iov = NULL;
+  ds.ss.flags = flags;
+  ds.ss.shapes = 0;
+  ds.num_ops = 0;
+
+  lua_newtable(L);
+  ds.path = lua_gettop(L);
+
+  if (flags & LUABINS_FSHAPES)
+  {
+    lua_newtable(L);
+    ds.ss.shapes = lua_gettop(L);
+  }
+
+  result = lbs_writePatchHeader(&sb, 0);
+  if (result == LUABINS_ESUCCESS)
+  {
+    result = diff_tables(L, &ds, old_index, new_index, 0);
+  }
+
+  if (result == LUABINS_ESUCCESS)
+  {
+    result = lbs_writePatchSizeAt(&sb, 0, ds.num_ops);
+  }
+
+  lua_settop(L, base); /* Remove loaded old table and helper tables */
+
+  if (result == LUABINS_ESUCCESS)
+  {
+    result = push_saved(L, &sb, flags);
+  }
+  else
+  {
+    push_save_error(L, result);
+  }
+
+  lbsSB_destroy(&sb);
+
+  return result;
+}
@@ -113,6 +113,16 @@ int lbsSB_grow(luabins_SaveBuffer * sb, size_t delta)
   return LUABINS_ESUCCESS;
 }
 
+unsigned char * lbsSB_reserve(luabins_SaveBuffer * sb, size_t length)
+{
+  if (lbsSB_grow(sb, length) != LUABINS_ESUCCESS)
+  {
+    return NULL;
+  }
+
+  return &sb->buffer[sb->end];
+}
+
 /*
 * Returns non-zero if write failed.
 * Allocates buffer as needed.
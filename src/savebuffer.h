@@ -55,6 +55,23 @@ int lbsSB_writechar(
 
 #define lbsSB_length(sb) ( (sb)->end )
 
+/*
+* Returns a pointer to at least length bytes of free space
+* after the end of data, or NULL if resize failed.
+* Bytes written there are not part of data until lbsSB_commit().
+* Pointer is valid until next operation with the given sb.
+*/
+unsigned char * lbsSB_reserve(luabins_SaveBuffer * sb, size_t length);
+
+/* Appends length bytes written after lbsSB_reserve() to data */
+#define lbsSB_commit(sb, length) ( (sb)->end += (length) )
+
+/*
+* Discards all data in buffer.
+* Allocated memory is kept for reuse.
+*/
+#define lbsSB_reset(sb) ( (sb)->end = 0UL )
+
 /*
 * If offset is greater than total length, data is appended to the end.
 * Returns non-zero if write failed.
@@ -88,4 +105,15 @@ const unsigned char * lbsSB_buffer(luabins_SaveBuffer * sb, size_t * length);
 
 void lbsSB_destroy(luabins_SaveBuffer * sb);
 
+/*
+* lua_Alloc-compatible allocator based on realloc(), see lualess.c.
+* Unlike Lua state allocator, may be used from any thread.
+*/
+void * lbs_simplealloc(
+    void * ud,
+    void * ptr,
+    size_t osize,
+    size_t nsize
+  );
+
 #endif /* LUABINS_SAVEBUFFER_H_INCLUDED_ */
@@ -43,27 +43,81 @@
 #define LUABINS_ETAILEFT (6)
 #define LUABINS_EBADSIZE (7)
 #define LUABINS_ETOOLONG (8)
+#define LUABINS_EABORTED (9)
+#define LUABINS_EWRITE   (10)
+#define LUABINS_ECHECKSUM (11)
+#define LUABINS_EBADPATH (12)
+#define LUABINS_EEXTENSION (13)
+#define LUABINS_EFULL (14)
 
 /* Type bytes */
 #define LUABINS_CNIL    '-' /* 0x2D (45) */
 #define LUABINS_CFALSE  '0' /* 0x30 (48) */
 #define LUABINS_CTRUE   '1' /* 0x31 (49) */
 #define LUABINS_CNUMBER 'N' /* 0x4E (78) */
+#define LUABINS_CINTEGER 'I' /* 0x49 (73) */
 #define LUABINS_CSTRING 'S' /* 0x53 (83) */
 #define LUABINS_CTABLE  'T' /* 0x54 (84) */
+#define LUABINS_CPACKED 'P' /* 0x50 (80) */
+#define LUABINS_CFLOAT  'F' /* 0x46 (70) */
+#define LUABINS_CBITSET 'B' /* 0x42 (66) */
+#define LUABINS_CSPANS  'R' /* 0x52 (82) */
+#define LUABINS_CSHAPEDEF 'D' /* 0x44 (68) */
+#define LUABINS_CSHAPED 'K' /* 0x4B (75) */
+#define LUABINS_CCOLUMNS 'C' /* 0x43 (67) */
+#define LUABINS_CEXTENSION 'X' /* 0x58 (88) */
+
+/*
+* Envelope markers (see compress.h, checksum.h). These take place of the tuple size
+* byte at the start of data, so they must be above LUABINS_MAXTUPLE.
+*/
+#define LUABINS_CCOMPRESSED 0xFF /* (255) */
+#define LUABINS_CCHECKSUM   0xFE /* (254) */
+
+/* Patch marker (see packed.h), in place of the tuple size byte as well */
+#define LUABINS_CPATCH      0xFD /* (253) */
+
+/* Packed array element types (see packed.h) */
+#define LUABINS_PINT8   'b' /* 0x62 (98) */
+#define LUABINS_PINT16  'h' /* 0x68 (104) */
+#define LUABINS_PINT32  'i' /* 0x69 (105) */
+#define LUABINS_PNUMBER 'd' /* 0x64 (100) */
+#define LUABINS_PFLOAT  'f' /* 0x66 (102) */
+
+/*
+* Data is little-endian on all hosts. Big-endian hosts convert
+* values on save and load, see byteorder.h. Define LUABINS_BIGENDIAN
+* to 1 or 0 if detection below is wrong for your compiler.
+*/
+#ifndef LUABINS_BIGENDIAN
+  #if \
+    defined(__BYTE_ORDER__) && defined(__ORDER_BIG_ENDIAN__) && \
+    (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+    #define LUABINS_BIGENDIAN (1)
+  #elif \
+    defined(__BIG_ENDIAN__) || defined(__ARMEB__) || \
+    defined(__AARCH64EB__) || defined(__MIPSEB__) || defined(__s390__)
+    #define LUABINS_BIGENDIAN (1)
+  #else
+    #define LUABINS_BIGENDIAN (0)
+  #endif
+#endif
 
 /*
 * PORTABILITY WARNING!
 * You have to ensure manually that length constants below are the same
 * for both code that does the save and code that does the load.
 * Also these constants must be actual or code below would break.
-* Beware of endianness and lua_Number actual type as well.
+* Beware of lua_Number actual type as well.
 * Note also that luabins does not check for overflow on save,
 * if your integer does not fit, it would be truncated.
 */
 #define LUABINS_LINT      (4)
 #define LUABINS_LSIZET    (4)
 #define LUABINS_LNUMBER   (8)
+#define LUABINS_LFLOAT    (4)
+#define LUABINS_LINTEGER  (8)
+#define LUABINS_LCHECKSUM (4)
 
 /*
 * Derived lengths
@@ -80,12 +134,64 @@
 /* Minimal number: type, number value */
 #define LUABINS_LMINNUMBER (LUABINS_LTYPEBYTE + LUABINS_LNUMBER)
 
+/*
+* Minimal integer: type, integer value. Integer is signed,
+* stored in LUABINS_LINTEGER bytes, see lbs_putInteger().
+*/
+#define LUABINS_LMININTEGER (LUABINS_LTYPEBYTE + LUABINS_LINTEGER)
+
 /* Minimal string: type, length, no data */
 #define LUABINS_LMINSTRING (LUABINS_LTYPEBYTE + LUABINS_LSIZET)
 
+/* Minimal float: type, single precision value */
+#define LUABINS_LMINFLOAT  (LUABINS_LTYPEBYTE + LUABINS_LFLOAT)
+
+/* Minimal packed array: type, element type, count, no data */
+#define LUABINS_LMINPACKED \
+  (LUABINS_LTYPEBYTE + LUABINS_LTYPEBYTE + LUABINS_LINT)
+
+/* Minimal bitset: type, count, no data */
+#define LUABINS_LMINBITSET (LUABINS_LTYPEBYTE + LUABINS_LINT)
+
+/* Minimal spans: type, number of spans, number of values, no data */
+#define LUABINS_LMINSPANS  (LUABINS_LTYPEBYTE + LUABINS_LINT + LUABINS_LINT)
+
+/* Span header: first key, number of values */
+#define LUABINS_LSPAN      (LUABINS_LINT + LUABINS_LINT)
+
+/* Minimal shape definition: type, number of keys, no keys */
+#define LUABINS_LMINSHAPEDEF (LUABINS_LTYPEBYTE + LUABINS_LINT)
+
+/* Minimal shaped table: type, distance to shape definition, no values */
+#define LUABINS_LMINSHAPED (LUABINS_LTYPEBYTE + LUABINS_LSIZET)
+
+/* Minimal columns: type, number of records, number of columns, no data */
+#define LUABINS_LMINCOLUMNS \
+  (LUABINS_LTYPEBYTE + LUABINS_LINT + LUABINS_LINT)
+
+/* Minimal column directory entry: name length, no name, column size */
+#define LUABINS_LCOLUMN (LUABINS_LSIZET + LUABINS_LSIZET)
+
+/* Minimal extension value: type, name length, payload length, no data */
+#define LUABINS_LMINEXTENSION \
+  (LUABINS_LTYPEBYTE + LUABINS_LSIZET + LUABINS_LSIZET)
+
+/* Patch header: marker, number of operations */
+#define LUABINS_LMINPATCH (LUABINS_LTYPEBYTE + LUABINS_LINT)
+
+/* Minimal patch operation: path length, single key, value */
+#define LUABINS_LMINPATCHOP \
+  (LUABINS_LINT + LUABINS_LTYPEBYTE + LUABINS_LTYPEBYTE)
+
+/* Compressed envelope header: marker, total uncompressed length */
+#define LUABINS_LMINCOMPRESSED (LUABINS_LTYPEBYTE + LUABINS_LSIZET)
+
+/* Compressed block header: uncompressed length, stored length */
+#define LUABINS_LBLOCKHEADER (LUABINS_LSIZET + LUABINS_LSIZET)
+
 /* Minimum large (non-boolean non-nil) value length */
 #define LUABINS_LMINLARGEVALUE \
-  ( luabins_min3(LUABINS_LMINTABLE, LUABINS_LMINSTRING, LUABINS_LMINSTRING) )
+  ( luabins_min3(LUABINS_LMINTABLE, LUABINS_LMINSTRING, LUABINS_LMINFLOAT) )
 
 /*
 * Lower limit on total table data size is determined as follows:
@@ -0,0 +1,338 @@
+/*
+* snapshot.c
+* Luabins Lua-less parallel encoding of captured values
+* See copyright notice in luabins.h
+*/
+
+#include "luaheaders.h"
+
+#include "snapshot.h"
+#include "write.h"
+#include "parallel.h"
+
+#if 0
+  #define SPAM(a) printf a
+#else
+  #define SPAM(a) (void)0
+#endif
+
+/* Returns encoded size of node, see write.c */
+static size_t lbsN_size(const lbs_SnapshotNode * node)
+{
+  switch (node->type)
+  {
+  case LUABINS_CNUMBER:
+    return LUABINS_LMINNUMBER;
+
+  case LUABINS_CINTEGER:
+    return LUABINS_LMININTEGER;
+
+  case LUABINS_CSTRING:
+    return LUABINS_LMINSTRING + node->length;
+
+  case LUABINS_CTABLE:
+    return LUABINS_LMINTABLE;
+
+  case LUABINS_SNAPSHOTRAW:
+    return node->length;
+
+  default: /* Nil and booleans */
+    return LUABINS_LTYPEBYTE;
+  }
+}
+
+void lbs_snapshotInit(lbs_Snapshot * s, lua_Alloc alloc_fn, void * alloc_ud)
+{
+  s->count = 0;
+  s->size = 0;
+  lbsSB_init(&s->nodes, alloc_fn, alloc_ud);
+  lbsSB_init(&s->chunks, alloc_fn, alloc_ud);
+  lbsSB_init(&s->raw, alloc_fn, alloc_ud);
+}
+
+void lbs_snapshotReset(lbs_Snapshot * s)
+{
+  s->count = 0;
+  s->size = 0;
+  lbsSB_reset(&s->nodes);
+  lbsSB_reset(&s->chunks);
+  lbsSB_reset(&s->raw);
+}
+
+int lbs_snapshotAppend(
+    lbs_Snapshot * s,
+    const lbs_SnapshotNode * node,
+    size_t * index
+  )
+{
+  size_t num_nodes = lbsSB_length(&s->nodes) / sizeof(lbs_SnapshotNode);
+  size_t chunks_len = lbsSB_length(&s->chunks);
+  int result = LUABINS_ESUCCESS;
+
+  /* Chunk boundary is before the node which would overfill the chunk */
+  if (
+      chunks_len == 0 ||
+      s->size - ((const lbs_SnapshotChunk *)(
+          s->chunks.buffer + chunks_len - sizeof(lbs_SnapshotChunk)
+        ))->offset >= LUABINS_SNAPSHOTCHUNK
+    )
+  {
+    lbs_SnapshotChunk chunk;
+    chunk.node = num_nodes;
+    chunk.offset = s->size;
+
+    result = lbsSB_write(
+        &s->chunks,
+        (const unsigned char *)&chunk,
+        sizeof(lbs_SnapshotChunk)
+      );
+  }
+
+  if (result == LUABINS_ESUCCESS)
+  {
+    result = lbsSB_write(
+        &s->nodes,
+        (const unsigned char *)node,
+        sizeof(lbs_SnapshotNode)
+      );
+  }
+
+  if (result == LUABINS_ESUCCESS)
+  {
+    s->size += lbsN_size(node);
+    if (index != NULL)
+    {
+      *index = num_nodes;
+    }
+  }
+
+  return result;
+}
+
+lbs_SnapshotNode * lbs_snapshotNode(lbs_Snapshot * s, size_t index)
+{
+  return (lbs_SnapshotNode *)s->nodes.buffer + index;
+}
+
+/* Writes node to sb */
+static int lbsN_write(
+    luabins_SaveBuffer * sb,
+    const lbs_SnapshotNode * node,
+    const unsigned char * raw
+  )
+{
+  switch (node->type)
+  {
+  case LUABINS_CNIL:
+    return lbs_writeNil(sb);
+
+  case LUABINS_CFALSE:
+    return lbs_writeBoolean(sb, 0);
+
+  case LUABINS_CTRUE:
+    return lbs_writeBoolean(sb, 1);
+
+  case LUABINS_CNUMBER:
+    return lbs_writeNumber(sb, node->value.number);
+
+  case LUABINS_CINTEGER:
+    return lbs_writeLuaInteger(sb, node->value.integer);
+
+  case LUABINS_CSTRING:
+    return lbs_writeString(sb, node->value.str, node->length);
+
+  case LUABINS_CTABLE:
+    return lbs_writeTableHeader(
+        sb,
+        node->value.table.array_size,
+        node->value.table.hash_size
+      );
+
+  case LUABINS_SNAPSHOTRAW:
+    return lbsSB_write(sb, raw + node->value.offset, node->length);
+
+  default: /* Should not happen */
+    SPAM(("snapshot: unknown node type %d\n", (int)node->type));
+    return LUABINS_EFAILURE;
+  }
+}
+
+/* Allocator for chunk buffers, which must never grow */
+static void * lbsN_noalloc(
+    void * ud,
+    void * ptr,
+    size_t osize,
+    size_t nsize
+  )
+{
+  (void)ud;
+  (void)ptr;
+  (void)osize;
+  (void)nsize;
+  return NULL;
+}
+
+/* Shared by lbs_snapshotEncode() tasks */
+typedef struct lbs_SnapshotJob
+{
+  const lbs_SnapshotNode * nodes;
+  size_t num_nodes;
+  const lbs_SnapshotChunk * chunks;
+  size_t num_chunks;
+  const unsigned char * raw;
+  size_t size;
+  unsigned char * out;
+  int * results; /* One per chunk */
+} lbs_SnapshotJob;
+
+static void lbsN_job(lbs_Snapshot * s, lbs_SnapshotJob * job)
+{
+  size_t len = 0;
+
+  job->nodes = (const lbs_SnapshotNode *)lbsSB_buffer(&s->nodes, &len);
+  job->num_nodes = len / sizeof(lbs_SnapshotNode);
+  job->chunks = (const lbs_SnapshotChunk *)lbsSB_buffer(&s->chunks, &len);
+  job->num_chunks = len / sizeof(lbs_SnapshotChunk);
+  job->raw = lbsSB_buffer(&s->raw, &len);
+  job->size = s->size;
+  job->out = NULL;
+  job->results = NULL;
+}
+
+/* Returns encoded size of chunk i */
+static size_t lbsN_chunkSize(const lbs_SnapshotJob * job, size_t i)
+{
+  size_t end_offset = (i + 1 < job->num_chunks)
+    ? job->chunks[i + 1].offset
+    : job->size;
+
+  return end_offset - job->chunks[i].offset;
+}
+
+/* Writes nodes of chunk i to sb */
+static int lbsN_writeChunk(
+    const lbs_SnapshotJob * job,
+    size_t i,
+    luabins_SaveBuffer * sb
+  )
+{
+  size_t end = (i + 1 < job->num_chunks)
+    ? job->chunks[i + 1].node
+    : job->num_nodes;
+  int result = LUABINS_ESUCCESS;
+  size_t n = 0;
+
+  for (n = job->chunks[i].node; n < end && result == LUABINS_ESUCCESS; ++n)
+  {
+    result = lbsN_write(sb, &job->nodes[n], job->raw);
+  }
+
+  return result;
+}
+
+/*
+* Encodes chunk i in place. Chunk size is known, so the chunk
+* buffer is exactly its part of the output, and writes never grow it.
+*/
+static void lbsN_task(void * ud, size_t i)
+{
+  const lbs_SnapshotJob * job = (const lbs_SnapshotJob *)ud;
+  luabins_SaveBuffer sb;
+  int result = LUABINS_ESUCCESS;
+
+  lbsSB_init(&sb, lbsN_noalloc, NULL);
+  sb.buffer = job->out + job->chunks[i].offset;
+  sb.buf_size = lbsN_chunkSize(job, i);
+
+  result = lbsN_writeChunk(job, i, &sb);
+  if (result == LUABINS_ESUCCESS && lbsSB_length(&sb) != sb.buf_size)
+  {
+    SPAM(("snapshot: chunk %lu size mismatch\n", (unsigned long)i));
+    result = LUABINS_EFAILURE;
+  }
+
+  job->results[i] = result;
+}
+
+int lbs_snapshotEncode(
+    lbs_Snapshot * s,
+    luabins_SaveBuffer * sb,
+    int num_threads
+  )
+{
+  lbs_SnapshotJob job;
+  luabins_SaveBuffer results;
+  size_t i = 0;
+  int result = LUABINS_ESUCCESS;
+
+  lbsN_job(s, &job);
+  lbsSB_init(&results, sb->alloc_fn, sb->alloc_ud);
+
+  /* Output is allocated beforehand, tasks only fill it */
+  result = lbsSB_grow(sb, LUABINS_LTYPEBYTE + s->size);
+  if (result == LUABINS_ESUCCESS)
+  {
+    lbs_writeTupleSize(sb, (unsigned char)s->count);
+    job.out = lbsSB_reserve(sb, s->size);
+
+    job.results = (int *)lbsSB_reserve(
+        &results,
+        (job.num_chunks + 1) * sizeof(int) /* Never empty */
+      );
+    if (job.results == NULL)
+    {
+      result = LUABINS_ETOOLONG;
+    }
+  }
+
+  if (result == LUABINS_ESUCCESS)
+  {
+    lbs_runTasks(lbsN_task, &job, job.num_chunks, num_threads);
+
+    for (i = 0; i < job.num_chunks && result == LUABINS_ESUCCESS; ++i)
+    {
+      result = job.results[i];
+    }
+  }
+
+  if (result == LUABINS_ESUCCESS)
+  {
+    lbsSB_commit(sb, s->size);
+  }
+
+  lbsSB_destroy(&results);
+
+  return result;
+}
+
+size_t lbs_snapshotChunks(lbs_Snapshot * s)
+{
+  return lbsSB_length(&s->chunks) / sizeof(lbs_SnapshotChunk);
+}
+
+int lbs_snapshotEncodeChunk(
+    lbs_Snapshot * s,
+    size_t i,
+    luabins_SaveBuffer * sb
+  )
+{
+  lbs_SnapshotJob job;
+  int result = LUABINS_ESUCCESS;
+
+  lbsN_job(s, &job);
+
+  result = lbsSB_grow(sb, lbsN_chunkSize(&job, i));
+  if (result == LUABINS_ESUCCESS)
+  {
+    result = lbsN_writeChunk(&job, i, sb);
+  }
+
+  return result;
+}
+
+void lbs_snapshotDestroy(lbs_Snapshot * s)
+{
+  lbsSB_destroy(&s->raw);
+  lbsSB_destroy(&s->chunks);
+  lbsSB_destroy(&s->nodes);
+}
@@ -0,0 +1,116 @@
+/*
+* snapshot.h
+* Luabins Lua-less parallel encoding of captured values
+* See copyright notice in luabins.h
+*/
+
+#ifndef LUABINS_SNAPSHOT_H_INCLUDED_
+#define LUABINS_SNAPSHOT_H_INCLUDED_
+
+#include "saveload.h"
+#include "savebuffer.h"
+
+/*
+* Snapshot is a flat array of nodes, captured from Lua values
+* by luabins_save_parallel() in a single pass. Nodes are in the order
+* of saved data: tuple values, each table followed by its keys
+* and values in turn. Each node is saved independently of others,
+* so any run of nodes may be encoded on its own, and encoded size
+* of each run is known beforehand. Snapshot is split into chunks
+* of about LUABINS_SNAPSHOTCHUNK bytes as it is captured,
+* lbs_snapshotEncode() encodes chunks in parallel.
+*/
+
+/* Encoded bytes per chunk, approximately */
+#define LUABINS_SNAPSHOTCHUNK (256 * 1024)
+
+/*
+* Node type for values encoded while capturing (custom types
+* and such), other types are LUABINS_C*
+*/
+#define LUABINS_SNAPSHOTRAW (0)
+
+typedef struct lbs_SnapshotNode
+{
+  unsigned char type; /* LUABINS_CNIL, CFALSE, CTRUE, CNUMBER, CINTEGER,
+                         CSTRING, CTABLE or SNAPSHOTRAW */
+  size_t length; /* String or raw data length */
+  union
+  {
+    const char * str; /* Borrowed, must outlive the snapshot */
+    lua_Number number;
+    lua_Integer integer;
+    size_t offset; /* Of raw data in the raw buffer */
+    struct
+    {
+      int array_size;
+      int hash_size;
+    } table;
+  } value;
+} lbs_SnapshotNode;
+
+/* First node of a chunk and its encoded offset */
+typedef struct lbs_SnapshotChunk
+{
+  size_t node;
+  size_t offset;
+} lbs_SnapshotChunk;
+
+typedef struct lbs_Snapshot
+{
+  int count; /* Number of tuple values, set by the caller */
+  size_t size; /* Encoded size of nodes */
+  luabins_SaveBuffer nodes;
+  luabins_SaveBuffer chunks; /* Of lbs_SnapshotChunk */
+  luabins_SaveBuffer raw; /* Data of raw nodes, written by the caller */
+} lbs_Snapshot;
+
+void lbs_snapshotInit(lbs_Snapshot * s, lua_Alloc alloc_fn, void * alloc_ud);
+
+/* Discards all nodes, allocated memory is kept for reuse */
+void lbs_snapshotReset(lbs_Snapshot * s);
+
+/*
+* Appends node, sets index to its index (pass NULL if not needed).
+* Returns non-zero if there is not enough memory.
+*/
+int lbs_snapshotAppend(
+    lbs_Snapshot * s,
+    const lbs_SnapshotNode * node,
+    size_t * index
+  );
+
+/* Returns node at given index, valid until next append */
+lbs_SnapshotNode * lbs_snapshotNode(lbs_Snapshot * s, size_t index);
+
+/*
+* Appends tuple size and encoded nodes to sb, using up to
+* num_threads threads, see lbs_runTasks() in parallel.h.
+* Strings must not change while encoding runs. Allocator of sb
+* is used by the calling thread only.
+* Returns non-zero if there is not enough memory.
+*/
+int lbs_snapshotEncode(
+    lbs_Snapshot * s,
+    luabins_SaveBuffer * sb,
+    int num_threads
+  );
+
+/* Returns number of chunks */
+size_t lbs_snapshotChunks(lbs_Snapshot * s);
+
+/*
+* Appends encoded chunk i to sb, without tuple size. Encoding chunks
+* one by one in order streams the same data as lbs_snapshotEncode()
+* makes, without holding all of it in memory.
+* Returns non-zero if there is not enough memory.
+*/
+int lbs_snapshotEncodeChunk(
+    lbs_Snapshot * s,
+    size_t i,
+    luabins_SaveBuffer * sb
+  );
+
+void lbs_snapshotDestroy(lbs_Snapshot * s);
+
+#endif /* LUABINS_SNAPSHOT_H_INCLUDED_ */
@@ -0,0 +1,235 @@
+/*
+* stage.c
+* Luabins Lua-less off-thread load staging
+* See copyright notice in luabins.h
+*/
+
+#include <string.h> /* memset() */
+
+#include "luaheaders.h"
+
+#include "stage.h"
+#include "parse.h"
+#include "compress.h"
+#include "checksum.h"
+#include "parallel.h"
+
+#if 0
+  #define SPAM(a) printf a
+#else
+  #define SPAM(a) (void)0
+#endif
+
+/* Appends node, counts tuple values */
+static int lbsG_push(lbs_Stage * s, const lbs_StageNode * node)
+{
+  unsigned char * out = lbsSB_reserve(&s->nodes, sizeof(lbs_StageNode));
+  if (out == NULL)
+  {
+    return LUABINS_ETOOLONG;
+  }
+
+  memcpy(out, node, sizeof(lbs_StageNode));
+  lbsSB_commit(&s->nodes, sizeof(lbs_StageNode));
+
+  if (s->nesting == 0 && node->type != LUABINS_STAGEEND)
+  {
+    ++s->count;
+  }
+
+  return LUABINS_ESUCCESS;
+}
+
+static void lbsG_node(lbs_StageNode * node, unsigned char type)
+{
+  memset(node, 0, sizeof(lbs_StageNode));
+  node->type = type;
+}
+
+static int lbsG_on_nil(void * ud)
+{
+  lbs_StageNode node;
+  lbsG_node(&node, LUABINS_CNIL);
+  return lbsG_push((lbs_Stage *)ud, &node);
+}
+
+static int lbsG_on_boolean(void * ud, int value)
+{
+  lbs_StageNode node;
+  lbsG_node(&node, value ? LUABINS_CTRUE : LUABINS_CFALSE);
+  return lbsG_push((lbs_Stage *)ud, &node);
+}
+
+static int lbsG_on_number(void * ud, lua_Number value)
+{
+  lbs_StageNode node;
+  lbsG_node(&node, LUABINS_CNUMBER);
+  node.value.number = value;
+  return lbsG_push((lbs_Stage *)ud, &node);
+}
+
+static int lbsG_on_integer(void * ud, lua_Integer value)
+{
+  lbs_StageNode node;
+  lbsG_node(&node, LUABINS_CINTEGER);
+  node.value.integer = value;
+  return lbsG_push((lbs_Stage *)ud, &node);
+}
+
+static int lbsG_on_string(void * ud, const char * value, size_t length)
+{
+  lbs_StageNode node;
+  lbsG_node(&node, LUABINS_CSTRING);
+  node.str = (const unsigned char *)value;
+  node.length = length;
+  return lbsG_push((lbs_Stage *)ud, &node);
+}
+
+static int lbsG_on_table_begin(void * ud, int array_size, int hash_size)
+{
+  lbs_Stage * s = (lbs_Stage *)ud;
+  lbs_StageNode node;
+  int result = LUABINS_ESUCCESS;
+
+  lbsG_node(&node, LUABINS_CTABLE);
+  node.length = (size_t)array_size;
+  node.value.hash_size = hash_size;
+
+  result = lbsG_push(s, &node);
+  ++s->nesting;
+
+  return result;
+}
+
+static int lbsG_on_table_end(void * ud)
+{
+  lbs_Stage * s = (lbs_Stage *)ud;
+  lbs_StageNode node;
+
+  --s->nesting;
+  lbsG_node(&node, LUABINS_STAGEEND);
+
+  return lbsG_push(s, &node);
+}
+
+static int lbsG_on_extension(
+    void * ud,
+    const char * name,
+    size_t name_length,
+    const unsigned char * data,
+    size_t length
+  )
+{
+  lbs_StageNode node;
+  lbsG_node(&node, LUABINS_CEXTENSION);
+  node.str = (const unsigned char *)name;
+  node.length = name_length;
+  node.payload = data;
+  node.value.payload_length = length;
+  return lbsG_push((lbs_Stage *)ud, &node);
+}
+
+static const luabins_ParseCallbacks STAGE_CALLBACKS =
+{
+  lbsG_on_nil,
+  lbsG_on_boolean,
+  lbsG_on_number,
+  lbsG_on_string,
+  lbsG_on_table_begin,
+  NULL, /* Keys and values alternate */
+  lbsG_on_table_end,
+  lbsG_on_extension,
+  lbsG_on_integer
+};
+
+void lbs_stageInit(lbs_Stage * s, lua_Alloc alloc_fn, void * alloc_ud)
+{
+  s->result = LUABINS_EFAILURE; /* Nothing staged yet */
+  s->count = 0;
+  s->nesting = 0;
+  lbsSB_init(&s->nodes, alloc_fn, alloc_ud);
+  lbsSB_init(&s->unpacked, alloc_fn, alloc_ud);
+}
+
+int lbs_stage(lbs_Stage * s, const unsigned char * data, size_t len)
+{
+  int result = LUABINS_ESUCCESS;
+
+  lbsSB_reset(&s->nodes);
+  lbsSB_reset(&s->unpacked);
+  s->count = 0;
+  s->nesting = 0;
+
+  /* Same envelopes as luabins_load() takes, checksum is the outer one */
+  if (len > 0 && data[0] == LUABINS_CCHECKSUM)
+  {
+    result = lbs_verifyChecksum(data, len, &data, &len);
+  }
+
+  if (result == LUABINS_ESUCCESS && len > 0 && data[0] == LUABINS_CCOMPRESSED)
+  {
+    result = lbs_decompress(&s->unpacked, data, len);
+    data = lbsSB_buffer(&s->unpacked, &len);
+  }
+
+  if (result == LUABINS_ESUCCESS)
+  {
+    result = luabins_parse(data, len, &STAGE_CALLBACKS, s);
+    if (result == LUABINS_EABORTED)
+    {
+      SPAM(("stage: out of memory\n"));
+      result = LUABINS_ETOOLONG; /* Only node allocation aborts */
+    }
+  }
+
+  s->result = result;
+
+  return result;
+}
+
+const lbs_StageNode * lbs_stageNodes(lbs_Stage * s, size_t * num_nodes)
+{
+  size_t len = 0;
+  const unsigned char * buf = lbsSB_buffer(&s->nodes, &len);
+
+  *num_nodes = len / sizeof(lbs_StageNode);
+
+  return (const lbs_StageNode *)buf;
+}
+
+void lbs_stageDestroy(lbs_Stage * s)
+{
+  lbsSB_destroy(&s->unpacked);
+  lbsSB_destroy(&s->nodes);
+}
+
+/* Arguments of lbs_stageBatch() */
+typedef struct lbs_StageBatch
+{
+  lbs_Stage * stages;
+  const unsigned char * const * data;
+  const size_t * lengths;
+} lbs_StageBatch;
+
+static void lbsG_task(void * ud, size_t i)
+{
+  lbs_StageBatch * batch = (lbs_StageBatch *)ud;
+  lbs_stage(&batch->stages[i], batch->data[i], batch->lengths[i]);
+}
+
+void lbs_stageBatch(
+    lbs_Stage * stages,
+    const unsigned char * const * data,
+    const size_t * lengths,
+    size_t count,
+    int num_threads
+  )
+{
+  lbs_StageBatch batch;
+
+  batch.stages = stages;
+  batch.data = data;
+  batch.lengths = lengths;
+
+  lbs_runTasks(lbsG_task, &batch, count, num_threads);
+}
@@ -0,0 +1,86 @@
+/*
+* stage.h
+* Luabins Lua-less off-thread load staging
+* See copyright notice in luabins.h
+*/
+
+#ifndef LUABINS_STAGE_H_INCLUDED_
+#define LUABINS_STAGE_H_INCLUDED_
+
+#include "saveload.h"
+#include "savebuffer.h"
+
+/*
+* Staging does all the work of luabins_load() that does not need
+* Lua state: checksum verification, decompression, validation
+* and walking the data. Result is a flat array of nodes, which
+* luabins_load_staged() turns into Lua values with minimal work.
+* Staging needs no Lua state, so it may be done in other threads.
+*
+* Nodes are in the order of parser events (see parse.h):
+* tuple values, each table followed by its keys and values
+* in turn, then by LUABINS_STAGEEND node. Packed arrays, bitsets,
+* spans, shaped tables and columns become plain tables.
+*/
+
+/* Node type for the end of a table, other types are LUABINS_C* */
+#define LUABINS_STAGEEND (0)
+
+typedef struct lbs_StageNode
+{
+  unsigned char type; /* LUABINS_CNIL, CFALSE, CTRUE, CNUMBER, CINTEGER,
+                         CSTRING, CTABLE, CEXTENSION or STAGEEND */
+  size_t length; /* String or type name length, table array size */
+  const unsigned char * str; /* String or type name */
+  union
+  {
+    lua_Number number;
+    lua_Integer integer;
+    int hash_size; /* Table */
+    size_t payload_length; /* Extension, payload follows type name */
+  } value;
+  const unsigned char * payload; /* Extension */
+} lbs_StageNode;
+
+typedef struct lbs_Stage
+{
+  int result; /* Staging result, LUABINS_ESUCCESS if nodes are ready */
+  int count; /* Number of tuple values */
+  int nesting; /* Current table nesting while staging */
+  luabins_SaveBuffer nodes;
+  luabins_SaveBuffer unpacked; /* Decompressed data, strings point here */
+} lbs_Stage;
+
+/*
+* Allocator must be thread-safe if stage is filled in other thread.
+* lbs_simplealloc() is.
+*/
+void lbs_stageInit(lbs_Stage * s, lua_Alloc alloc_fn, void * alloc_ud);
+
+/*
+* Stages data of given length. Strings of nodes point inside data
+* (unless it was compressed), so data must be kept alive and unchanged
+* while stage is used. Restaging discards previous nodes.
+* Returns stage result.
+*/
+int lbs_stage(lbs_Stage * s, const unsigned char * data, size_t len);
+
+/* Returns nodes and sets their number, valid until next staging */
+const lbs_StageNode * lbs_stageNodes(lbs_Stage * s, size_t * num_nodes);
+
+void lbs_stageDestroy(lbs_Stage * s);
+
+/*
+* Stages count blobs into count stages, using up to num_threads
+* threads, see lbs_runTasks() in parallel.h. Blob i goes to stages[i].
+* Returns when all are staged, check result of each stage.
+*/
+void lbs_stageBatch(
+    lbs_Stage * stages,
+    const unsigned char * const * data,
+    const size_t * lengths,
+    size_t count,
+    int num_threads
+  );
+
+#endif /* LUABINS_STAGE_H_INCLUDED_ */
@@ -0,0 +1,1466 @@
+/*
+* view.hpp
+* Luabins header-only C++ zero-copy reader
+* See copyright notice in luabins.h
+*/
+
+#ifndef LUABINS_VIEW_HPP_INCLUDED_
+#define LUABINS_VIEW_HPP_INCLUDED_
+
+/*
+* Requires C++11. std::string_view accessors are available
+* when compiled as C++17.
+*
+* Usage:
+*
+*   luabins::Tuple tuple;
+*   if (tuple.open(data, length) != LUABINS_ESUCCESS) { ... }
+*
+*   luabins::View config = tuple[0];
+*   double port = config.find("port").as_number(80);
+*
+*   for (luabins::View::Entry e : config.find("hosts"))
+*   {
+*     use(e.key.as_number(), e.value.as_string());
+*   }
+*
+* Tuple::open() validates the whole chunk once, with the same checks
+* as luabins_load() does. After that, views point directly into
+* the chunk, nothing is copied, and unwanted subtrees are skipped
+* without further checks. Data must outlive the tuple and all views.
+*/
+
+#include <climits>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <string>
+
+#if __cplusplus >= 201703L
+  #include <string_view>
+#endif
+
+#include "saveload.h"
+#include "common.hpp"
+
+namespace luabins
+{
+
+namespace detail
+{
+
+inline int read_int(const unsigned char * pos)
+{
+  int value = 0;
+  copy_le(&value, pos, LUABINS_LINT);
+  return value;
+}
+
+inline std::size_t read_size(const unsigned char * pos)
+{
+  std::uint32_t value = 0;
+  copy_le(&value, pos, LUABINS_LSIZET);
+  return value;
+}
+
+inline Number read_number(const unsigned char * pos)
+{
+  Number value = 0;
+  copy_le(&value, pos, LUABINS_LNUMBER);
+  return value;
+}
+
+inline std::int64_t read_integer(const unsigned char * pos)
+{
+  std::int64_t value = 0;
+  copy_le(&value, pos, LUABINS_LINTEGER);
+  return value;
+}
+
+inline Number read_float(const unsigned char * pos)
+{
+  float value = 0;
+  copy_le(&value, pos, LUABINS_LFLOAT);
+  return value;
+}
+
+/* Keep in sync with lbs_packedWidth() in packed.c */
+inline std::size_t packed_width(unsigned char type)
+{
+  switch (type)
+  {
+  case LUABINS_PINT8:
+    return 1;
+
+  case LUABINS_PINT16:
+    return 2;
+
+  case LUABINS_PINT32:
+    return 4;
+
+  case LUABINS_PNUMBER:
+    return LUABINS_LNUMBER;
+
+  case LUABINS_PFLOAT:
+    return LUABINS_LFLOAT;
+
+  default:
+    return 0;
+  }
+}
+
+template <typename T>
+inline Number packed_element(const unsigned char * pos)
+{
+  T value = 0;
+  copy_le(&value, pos, sizeof(T));
+  return static_cast<Number>(value);
+}
+
+inline Number packed_get(
+    const unsigned char * data,
+    unsigned char type,
+    std::size_t index
+  )
+{
+  switch (type)
+  {
+  case LUABINS_PINT8:
+    return packed_element<std::int8_t>(data + index);
+
+  case LUABINS_PINT16:
+    return packed_element<std::int16_t>(data + index * 2);
+
+  case LUABINS_PINT32:
+    return packed_element<std::int32_t>(data + index * 4);
+
+  case LUABINS_PFLOAT:
+    return packed_element<float>(data + index * LUABINS_LFLOAT);
+
+  default:
+    return packed_element<Number>(data + index * LUABINS_LNUMBER);
+  }
+}
+
+/* Returns shape definition type byte of shaped table or definition */
+inline const unsigned char * shape_def(const unsigned char * pos)
+{
+  return (*pos == LUABINS_CSHAPED)
+    ? pos - read_size(pos + LUABINS_LTYPEBYTE)
+    : pos
+    ;
+}
+
+/* Returns pointer past the value. Value must be already validated. */
+inline const unsigned char * skip(const unsigned char * pos)
+{
+  switch (*pos)
+  {
+  case LUABINS_CNUMBER:
+    return pos + LUABINS_LMINNUMBER;
+
+  case LUABINS_CINTEGER:
+    return pos + LUABINS_LMININTEGER;
+
+  case LUABINS_CFLOAT:
+    return pos + LUABINS_LMINFLOAT;
+
+  case LUABINS_CSTRING:
+    return pos + LUABINS_LMINSTRING + read_size(pos + LUABINS_LTYPEBYTE);
+
+  case LUABINS_CEXTENSION:
+    pos += LUABINS_LTYPEBYTE;
+    pos += LUABINS_LSIZET + read_size(pos);
+    return pos + LUABINS_LSIZET + read_size(pos);
+
+  case LUABINS_CTABLE:
+    {
+      std::size_t total_size =
+          static_cast<std::size_t>(read_int(pos + LUABINS_LTYPEBYTE))
+        + static_cast<std::size_t>(
+              read_int(pos + LUABINS_LTYPEBYTE + LUABINS_LINT)
+            )
+        ;
+
+      pos += LUABINS_LMINTABLE;
+      for (std::size_t i = 0; i < 2 * total_size; ++i)
+      {
+        pos = skip(pos);
+      }
+      return pos;
+    }
+
+  case LUABINS_CBITSET:
+    return pos + LUABINS_LMINBITSET
+      + (static_cast<std::size_t>(read_int(pos + LUABINS_LTYPEBYTE)) + 7) / 8;
+
+  case LUABINS_CSPANS:
+    {
+      const int num_spans = read_int(pos + LUABINS_LTYPEBYTE);
+
+      pos += LUABINS_LMINSPANS;
+      for (int i = 0; i < num_spans; ++i)
+      {
+        const int count = read_int(pos + LUABINS_LINT);
+
+        pos += LUABINS_LSPAN;
+        for (int j = 0; j < count; ++j)
+        {
+          pos = skip(pos);
+        }
+      }
+      return pos;
+    }
+
+  case LUABINS_CSHAPEDEF:
+  case LUABINS_CSHAPED:
+    {
+      const int num_keys = read_int(shape_def(pos) + LUABINS_LTYPEBYTE);
+
+      if (*pos == LUABINS_CSHAPEDEF)
+      {
+        pos += LUABINS_LMINSHAPEDEF;
+        for (int i = 0; i < num_keys; ++i)
+        {
+          pos += LUABINS_LSIZET + read_size(pos);
+        }
+      }
+      else
+      {
+        pos += LUABINS_LMINSHAPED;
+      }
+
+      for (int i = 0; i < num_keys; ++i)
+      {
+        pos = skip(pos);
+      }
+      return pos;
+    }
+
+  case LUABINS_CCOLUMNS:
+    {
+      const int num_columns = read_int(pos + LUABINS_LTYPEBYTE + LUABINS_LINT);
+      std::size_t total_size = 0;
+
+      pos += LUABINS_LMINCOLUMNS;
+      for (int i = 0; i < num_columns; ++i)
+      {
+        pos += LUABINS_LSIZET + read_size(pos);
+        total_size += read_size(pos);
+        pos += LUABINS_LSIZET;
+      }
+      return pos + total_size;
+    }
+
+  case LUABINS_CPACKED:
+    return pos + LUABINS_LMINPACKED
+      + static_cast<std::size_t>(
+            read_int(pos + LUABINS_LTYPEBYTE + LUABINS_LTYPEBYTE)
+          )
+      * packed_width(pos[LUABINS_LTYPEBYTE])
+      ;
+
+  default: /* nil and booleans */
+    return pos + LUABINS_LTYPEBYTE;
+  }
+}
+
+/*
+* Validates shape definition header and keys, starting at the type byte.
+* On success advances pos past the keys.
+* Keep in sync with load_shape_def() in load.c.
+*/
+inline int check_shape_keys(
+    const unsigned char *& pos,
+    const unsigned char * end,
+    int & num_keys
+  )
+{
+  if (static_cast<std::size_t>(end - pos) < LUABINS_LMINSHAPEDEF)
+  {
+    return LUABINS_EBADDATA;
+  }
+
+  num_keys = read_int(pos + LUABINS_LTYPEBYTE);
+  pos += LUABINS_LMINSHAPEDEF;
+
+  if (
+      num_keys < 1 || num_keys > MaxArraySize ||
+      static_cast<std::size_t>(end - pos)
+        / (LUABINS_LSIZET + LUABINS_LTYPEBYTE)
+        < static_cast<std::size_t>(num_keys)
+    )
+  {
+    return LUABINS_EBADSIZE;
+  }
+
+  for (int i = 0; i < num_keys; ++i)
+  {
+    if (static_cast<std::size_t>(end - pos) < LUABINS_LSIZET)
+    {
+      return LUABINS_EBADDATA;
+    }
+
+    if (
+        static_cast<std::size_t>(end - pos) - LUABINS_LSIZET <
+        read_size(pos)
+      )
+    {
+      return LUABINS_EBADSIZE;
+    }
+
+    pos += LUABINS_LSIZET + read_size(pos);
+  }
+
+  return LUABINS_ESUCCESS;
+}
+
+/*
+* Validates single value. On success advances pos past the value.
+* Chunk begin is needed to resolve shaped tables.
+* Keep in sync with load_value() in load.c and skip_value() in read.c.
+*/
+inline int check(
+    const unsigned char *& pos,
+    const unsigned char * begin,
+    const unsigned char * end,
+    int nesting,
+    bool is_key
+  )
+{
+  const std::size_t unread = end - pos;
+
+  if (unread < LUABINS_LTYPEBYTE)
+  {
+    return LUABINS_EBADDATA;
+  }
+
+  switch (*pos)
+  {
+  case LUABINS_CNIL:
+    /* Table key can't be nil */
+    if (is_key)
+    {
+      return LUABINS_EBADDATA;
+    }
+    ++pos;
+    break;
+
+  case LUABINS_CFALSE:
+  case LUABINS_CTRUE:
+    ++pos;
+    break;
+
+  case LUABINS_CNUMBER:
+    if (unread < LUABINS_LMINNUMBER)
+    {
+      return LUABINS_EBADDATA;
+    }
+
+    /* Table key can't be NaN */
+    if (is_key)
+    {
+      const Number value = read_number(pos + LUABINS_LTYPEBYTE);
+      if (value != value)
+      {
+        return LUABINS_EBADDATA;
+      }
+    }
+
+    pos += LUABINS_LMINNUMBER;
+    break;
+
+  case LUABINS_CINTEGER:
+    if (unread < LUABINS_LMININTEGER)
+    {
+      return LUABINS_EBADDATA;
+    }
+    pos += LUABINS_LMININTEGER;
+    break;
+
+  case LUABINS_CFLOAT:
+    if (unread < LUABINS_LMINFLOAT)
+    {
+      return LUABINS_EBADDATA;
+    }
+
+    /* Table key can't be NaN */
+    if (is_key)
+    {
+      const Number value = read_float(pos + LUABINS_LTYPEBYTE);
+      if (value != value)
+      {
+        return LUABINS_EBADDATA;
+      }
+    }
+
+    pos += LUABINS_LMINFLOAT;
+    break;
+
+  case LUABINS_CSTRING:
+    {
+      if (unread < LUABINS_LMINSTRING)
+      {
+        return LUABINS_EBADDATA;
+      }
+
+      if (unread - LUABINS_LMINSTRING < read_size(pos + LUABINS_LTYPEBYTE))
+      {
+        return LUABINS_EBADSIZE;
+      }
+
+      pos += LUABINS_LMINSTRING + read_size(pos + LUABINS_LTYPEBYTE);
+    }
+    break;
+
+  case LUABINS_CEXTENSION:
+    {
+      if (unread < LUABINS_LMINEXTENSION)
+      {
+        return LUABINS_EBADDATA;
+      }
+
+      /* Type name, then payload, both are sized as strings */
+      pos += LUABINS_LTYPEBYTE;
+      for (int i = 0; i < 2; ++i)
+      {
+        if (static_cast<std::size_t>(end - pos) < LUABINS_LSIZET)
+        {
+          return LUABINS_EBADDATA;
+        }
+
+        if (
+            static_cast<std::size_t>(end - pos) - LUABINS_LSIZET <
+            read_size(pos)
+          )
+        {
+          return LUABINS_EBADSIZE;
+        }
+
+        pos += LUABINS_LSIZET + read_size(pos);
+      }
+    }
+    break;
+
+  case LUABINS_CTABLE:
+    {
+      int array_size = 0;
+      int hash_size = 0;
+      std::size_t total_size = 0;
+
+      if (++nesting > MaxTableNesting)
+      {
+        return LUABINS_ETOODEEP;
+      }
+
+      if (unread < LUABINS_LMINTABLE)
+      {
+        return LUABINS_EBADDATA;
+      }
+
+      array_size = read_int(pos + LUABINS_LTYPEBYTE);
+      hash_size = read_int(pos + LUABINS_LTYPEBYTE + LUABINS_LINT);
+      pos += LUABINS_LMINTABLE;
+
+      if (
+          array_size < 0 || array_size > MaxArraySize ||
+          hash_size < 0 || hash_size > MaxArraySize
+        )
+      {
+        return LUABINS_EBADSIZE;
+      }
+
+      total_size = static_cast<std::size_t>(array_size) + hash_size;
+      if (
+          static_cast<std::size_t>(end - pos) <
+          luabins_min_table_data_size(total_size)
+        )
+      {
+        return LUABINS_EBADSIZE;
+      }
+
+      for (std::size_t i = 0; i < total_size; ++i)
+      {
+        int result = check(pos, begin, end, nesting, true); /* Check key. */
+        if (result == LUABINS_ESUCCESS)
+        {
+          result = check(pos, begin, end, nesting, false); /* Check value. */
+        }
+
+        if (result != LUABINS_ESUCCESS)
+        {
+          return result;
+        }
+      }
+    }
+    break;
+
+  case LUABINS_CPACKED:
+    {
+      std::size_t width = 0;
+      int count = 0;
+
+      if (nesting + 1 > MaxTableNesting)
+      {
+        return LUABINS_ETOODEEP;
+      }
+
+      if (unread < LUABINS_LMINPACKED)
+      {
+        return LUABINS_EBADDATA;
+      }
+
+      width = packed_width(pos[LUABINS_LTYPEBYTE]);
+      if (width == 0)
+      {
+        return LUABINS_EBADDATA;
+      }
+
+      count = read_int(pos + LUABINS_LTYPEBYTE + LUABINS_LTYPEBYTE);
+      if (
+          count < 0 || count > MaxArraySize ||
+          (unread - LUABINS_LMINPACKED) / width <
+            static_cast<std::size_t>(count)
+        )
+      {
+        return LUABINS_EBADSIZE;
+      }
+
+      pos += LUABINS_LMINPACKED + count * width;
+    }
+    break;
+
+  case LUABINS_CBITSET:
+    {
+      int count = 0;
+
+      if (nesting + 1 > MaxTableNesting)
+      {
+        return LUABINS_ETOODEEP;
+      }
+
+      if (unread < LUABINS_LMINBITSET)
+      {
+        return LUABINS_EBADDATA;
+      }
+
+      count = read_int(pos + LUABINS_LTYPEBYTE);
+      if (
+          count < 0 || count > MaxArraySize ||
+          unread - LUABINS_LMINBITSET <
+            (static_cast<std::size_t>(count) + 7) / 8
+        )
+      {
+        return LUABINS_EBADSIZE;
+      }
+
+      pos += LUABINS_LMINBITSET + (static_cast<std::size_t>(count) + 7) / 8;
+    }
+    break;
+
+  case LUABINS_CSPANS:
+    {
+      int num_spans = 0;
+      int remaining = 0;
+      int last_key = 0;
+
+      if (++nesting > MaxTableNesting)
+      {
+        return LUABINS_ETOODEEP;
+      }
+
+      if (unread < LUABINS_LMINSPANS)
+      {
+        return LUABINS_EBADDATA;
+      }
+
+      num_spans = read_int(pos + LUABINS_LTYPEBYTE);
+      remaining = read_int(pos + LUABINS_LTYPEBYTE + LUABINS_LINT);
+      pos += LUABINS_LMINSPANS;
+
+      /* Keep in sync with load_spans() in load.c */
+      if (
+          remaining < 0 || remaining > MaxArraySize ||
+          num_spans < 0 || num_spans > remaining ||
+          static_cast<std::size_t>(end - pos) <
+              static_cast<std::size_t>(num_spans) * LUABINS_LSPAN
+            + static_cast<std::size_t>(remaining) * LUABINS_LTYPEBYTE
+        )
+      {
+        return LUABINS_EBADSIZE;
+      }
+
+      for (int i = 0; i < num_spans; ++i)
+      {
+        int first_key = 0;
+        int count = 0;
+
+        if (static_cast<std::size_t>(end - pos) < LUABINS_LSPAN)
+        {
+          return LUABINS_EBADDATA;
+        }
+
+        first_key = read_int(pos);
+        count = read_int(pos + LUABINS_LINT);
+        pos += LUABINS_LSPAN;
+
+        if (
+            first_key <= last_key ||
+            count < 1 || count > remaining ||
+            count - 1 > INT_MAX - first_key
+          )
+        {
+          return LUABINS_EBADSIZE;
+        }
+
+        for (int j = 0; j < count; ++j)
+        {
+          /* Span value can't be nil */
+          if (pos != end && *pos == LUABINS_CNIL)
+          {
+            return LUABINS_EBADDATA;
+          }
+
+          int result = check(pos, begin, end, nesting, false);
+          if (result != LUABINS_ESUCCESS)
+          {
+            return result;
+          }
+        }
+
+        last_key = first_key + count - 1;
+        remaining -= count;
+      }
+
+      if (remaining != 0)
+      {
+        return LUABINS_EBADSIZE;
+      }
+    }
+    break;
+
+  case LUABINS_CSHAPEDEF:
+  case LUABINS_CSHAPED:
+    {
+      int num_keys = 0;
+      int result = LUABINS_ESUCCESS;
+
+      if (++nesting > MaxTableNesting)
+      {
+        return LUABINS_ETOODEEP;
+      }
+
+      if (*pos == LUABINS_CSHAPEDEF)
+      {
+        result = check_shape_keys(pos, end, num_keys);
+      }
+      else
+      {
+        const unsigned char * type_pos = pos;
+        const unsigned char * def = NULL;
+        std::size_t distance = 0;
+
+        if (unread < LUABINS_LMINSHAPED)
+        {
+          return LUABINS_EBADDATA;
+        }
+
+        /*
+        * Keep in sync with lbs_readShaped() in read.c.
+        * Definition keys are checked again, bounded by this table,
+        * so skip() and find() never read past them.
+        */
+        distance = read_size(pos + LUABINS_LTYPEBYTE);
+        if (
+            distance == 0 ||
+            distance > static_cast<std::size_t>(type_pos - begin) ||
+            *(type_pos - distance) != LUABINS_CSHAPEDEF
+          )
+        {
+          return LUABINS_EBADDATA;
+        }
+
+        def = type_pos - distance;
+        result = check_shape_keys(def, type_pos, num_keys);
+        pos += LUABINS_LMINSHAPED;
+      }
+
+      for (int i = 0; i < num_keys && result == LUABINS_ESUCCESS; ++i)
+      {
+        /* Shaped table value can't be nil */
+        if (pos != end && *pos == LUABINS_CNIL)
+        {
+          return LUABINS_EBADDATA;
+        }
+
+        result = check(pos, begin, end, nesting, false);
+      }
+
+      if (result != LUABINS_ESUCCESS)
+      {
+        return result;
+      }
+    }
+    break;
+
+  case LUABINS_CCOLUMNS:
+    {
+      int num_records = 0;
+      int num_columns = 0;
+      const unsigned char * entry = NULL;
+
+      if (++nesting > MaxTableNesting)
+      {
+        return LUABINS_ETOODEEP;
+      }
+
+      if (unread < LUABINS_LMINCOLUMNS)
+      {
+        return LUABINS_EBADDATA;
+      }
+
+      num_records = read_int(pos + LUABINS_LTYPEBYTE);
+      num_columns = read_int(pos + LUABINS_LTYPEBYTE + LUABINS_LINT);
+      pos += LUABINS_LMINCOLUMNS;
+
+      /* Keep in sync with load_columns_header() in load.c */
+      if (
+          num_records < 0 || num_records > MaxArraySize ||
+          num_columns < 0 ||
+          (num_records == 0) != (num_columns == 0) ||
+          static_cast<std::size_t>(end - pos)
+            / (LUABINS_LCOLUMN + LUABINS_LTYPEBYTE)
+            < static_cast<std::size_t>(num_columns)
+        )
+      {
+        return LUABINS_EBADSIZE;
+      }
+
+      /* Directory is walked twice: to skip it and to check column sizes */
+      entry = pos;
+      for (int i = 0; i < num_columns; ++i)
+      {
+        if (static_cast<std::size_t>(end - pos) < LUABINS_LCOLUMN)
+        {
+          return LUABINS_EBADDATA;
+        }
+
+        if (
+            static_cast<std::size_t>(end - pos) - LUABINS_LCOLUMN <
+            read_size(pos)
+          )
+        {
+          return LUABINS_EBADSIZE;
+        }
+
+        pos += LUABINS_LSIZET + read_size(pos) + LUABINS_LSIZET;
+      }
+
+      for (int i = 0; i < num_columns; ++i)
+      {
+        const unsigned char * column = pos;
+        std::size_t size = 0;
+
+        entry += LUABINS_LSIZET + read_size(entry);
+        size = read_size(entry);
+        entry += LUABINS_LSIZET;
+
+        /* Column must load as a table */
+        switch (pos != end ? *pos : 0)
+        {
+        case LUABINS_CTABLE:
+        case LUABINS_CPACKED:
+        case LUABINS_CBITSET:
+        case LUABINS_CSPANS:
+        case LUABINS_CSHAPEDEF:
+        case LUABINS_CSHAPED:
+          break;
+
+        default:
+          return LUABINS_EBADDATA;
+        }
+
+        int result = check(pos, begin, end, nesting, false);
+        if (result != LUABINS_ESUCCESS)
+        {
+          return result;
+        }
+
+        if (static_cast<std::size_t>(pos - column) != size)
+        {
+          return LUABINS_EBADSIZE;
+        }
+      }
+    }
+    break;
+
+  default:
+    return LUABINS_EBADDATA;
+  }
+
+  return LUABINS_ESUCCESS;
+}
+
+} /* namespace detail */
+
+/*
+* Read-only view of a single value inside validated chunk.
+* Default-constructed view is "none": it is not nil,
+* and all accessors return defaults.
+*/
+class View
+{
+public:
+  struct Entry;
+  class const_iterator;
+
+  View() : pos_(NULL) { }
+
+  /* One of LUABINS_C* type bytes, or 0 for none */
+  unsigned char type() const { return (pos_ == NULL) ? 0 : *pos_; }
+
+  bool is_none() const { return pos_ == NULL; }
+  bool is_nil() const { return type() == LUABINS_CNIL; }
+  bool is_boolean() const
+  {
+    return type() == LUABINS_CFALSE || type() == LUABINS_CTRUE;
+  }
+  /* Note that single precision floats and integers are numbers as well */
+  bool is_number() const
+  {
+    return type() == LUABINS_CNUMBER || type() == LUABINS_CFLOAT ||
+      type() == LUABINS_CINTEGER;
+  }
+  /* Only integers saved with integer subtype, see lbs_writeLuaInteger() */
+  bool is_integer() const { return type() == LUABINS_CINTEGER; }
+  bool is_string() const { return type() == LUABINS_CSTRING; }
+  bool is_table() const { return type() == LUABINS_CTABLE; }
+
+  bool as_boolean(bool def = false) const
+  {
+    return is_boolean() ? (type() == LUABINS_CTRUE) : def;
+  }
+
+  Number as_number(Number def = 0) const
+  {
+    switch (type())
+    {
+    case LUABINS_CNUMBER:
+      return detail::read_number(pos_ + LUABINS_LTYPEBYTE);
+
+    case LUABINS_CFLOAT:
+      return detail::read_float(pos_ + LUABINS_LTYPEBYTE);
+
+    case LUABINS_CINTEGER:
+      return static_cast<Number>(
+          detail::read_integer(pos_ + LUABINS_LTYPEBYTE)
+        );
+
+    default:
+      return def;
+    }
+  }
+
+  std::int64_t as_integer(std::int64_t def = 0) const
+  {
+    return is_integer()
+      ? detail::read_integer(pos_ + LUABINS_LTYPEBYTE)
+      : def
+      ;
+  }
+
+  /* Pointer into the chunk, NOT zero-terminated. NULL if not a string. */
+  const char * string_data() const
+  {
+    return is_string()
+      ? reinterpret_cast<const char *>(pos_ + LUABINS_LMINSTRING)
+      : NULL
+      ;
+  }
+
+  std::size_t string_length() const
+  {
+    return is_string() ? detail::read_size(pos_ + LUABINS_LTYPEBYTE) : 0;
+  }
+
+  /* Note this one copies the data */
+  std::string as_string(const std::string & def = std::string()) const
+  {
+    return is_string() ? std::string(string_data(), string_length()) : def;
+  }
+
+#if __cplusplus >= 201703L
+  std::string_view as_string_view(std::string_view def = {}) const
+  {
+    return is_string()
+      ? std::string_view(string_data(), string_length())
+      : def
+      ;
+  }
+#endif
+
+  /* Table sizes as saved, zero if not a table */
+  int array_size() const
+  {
+    return is_table() ? detail::read_int(pos_ + LUABINS_LTYPEBYTE) : 0;
+  }
+
+  int hash_size() const
+  {
+    return is_table()
+      ? detail::read_int(pos_ + LUABINS_LTYPEBYTE + LUABINS_LINT)
+      : 0
+      ;
+  }
+
+  /* Number of key-value pairs, zero if not a table */
+  std::size_t table_size() const
+  {
+    return static_cast<std::size_t>(array_size())
+      + static_cast<std::size_t>(hash_size());
+  }
+
+  /*
+  * Packed array (see packed.h) is not a table for the view:
+  * it is not iterated and has no table sizes.
+  * Use accessors below to get its values.
+  */
+  bool is_packed() const { return type() == LUABINS_CPACKED; }
+
+  /* One of LUABINS_P* element types, 0 if not a packed array */
+  unsigned char packed_type() const
+  {
+    return is_packed() ? pos_[LUABINS_LTYPEBYTE] : 0;
+  }
+
+  /* Number of elements, zero if not a packed array */
+  std::size_t packed_size() const
+  {
+    return is_packed()
+      ? static_cast<std::size_t>(
+            detail::read_int(pos_ + LUABINS_LTYPEBYTE + LUABINS_LTYPEBYTE)
+          )
+      : 0
+      ;
+  }
+
+  /* Element with zero-based index, def if out of range */
+  Number packed_at(std::size_t index, Number def = 0) const
+  {
+    return (index < packed_size())
+      ? detail::packed_get(pos_ + LUABINS_LMINPACKED, packed_type(), index)
+      : def
+      ;
+  }
+
+  /*
+  * Bitset (see packed.h) is not a table for the view either.
+  */
+  bool is_bitset() const { return type() == LUABINS_CBITSET; }
+
+  /* Number of elements, zero if not a bitset */
+  std::size_t bitset_size() const
+  {
+    return is_bitset()
+      ? static_cast<std::size_t>(detail::read_int(pos_ + LUABINS_LTYPEBYTE))
+      : 0
+      ;
+  }
+
+  /* Element with zero-based index, def if out of range */
+  bool bitset_at(std::size_t index, bool def = false) const
+  {
+    return (index < bitset_size())
+      ? ((pos_[LUABINS_LMINBITSET + index / 8] >> (index % 8)) & 1) != 0
+      : def
+      ;
+  }
+
+  /*
+  * Spans (see packed.h) are not iterated since keys are implied,
+  * find() with number key works for them.
+  */
+  bool is_spans() const { return type() == LUABINS_CSPANS; }
+
+  /*
+  * Shaped tables (see packed.h) are not iterated either,
+  * since their keys are not values, find() with string key works for them.
+  */
+  bool is_shaped() const
+  {
+    return type() == LUABINS_CSHAPEDEF || type() == LUABINS_CSHAPED;
+  }
+
+  /* Number of key-value pairs, zero if not a shaped table */
+  std::size_t shaped_size() const
+  {
+    return is_shaped()
+      ? static_cast<std::size_t>(
+            detail::read_int(detail::shape_def(pos_) + LUABINS_LTYPEBYTE)
+          )
+      : 0
+      ;
+  }
+
+  /*
+  * Columns (see packed.h) are not iterated, find() with column name
+  * returns column as saved, without loading other columns.
+  */
+  bool is_columns() const { return type() == LUABINS_CCOLUMNS; }
+
+  /* Number of records, zero if not columns */
+  std::size_t columns_records() const
+  {
+    return is_columns()
+      ? static_cast<std::size_t>(detail::read_int(pos_ + LUABINS_LTYPEBYTE))
+      : 0
+      ;
+  }
+
+  /*
+  * Extension value (see packed.h) is a userdata of a custom type,
+  * its payload is opaque to the view.
+  */
+  bool is_extension() const { return type() == LUABINS_CEXTENSION; }
+
+  /* Pointer into the chunk, NOT zero-terminated. NULL if not extension. */
+  const char * extension_name() const
+  {
+    return is_extension()
+      ? reinterpret_cast<const char *>(
+            pos_ + LUABINS_LTYPEBYTE + LUABINS_LSIZET
+          )
+      : NULL
+      ;
+  }
+
+  std::size_t extension_name_length() const
+  {
+    return is_extension() ? detail::read_size(pos_ + LUABINS_LTYPEBYTE) : 0;
+  }
+
+  /* Pointer into the chunk, NULL if not extension. */
+  const unsigned char * extension_data() const
+  {
+    return is_extension()
+      ? pos_ + LUABINS_LMINEXTENSION + extension_name_length()
+      : NULL
+      ;
+  }
+
+  std::size_t extension_size() const
+  {
+    return is_extension()
+      ? detail::read_size(
+            pos_ + LUABINS_LTYPEBYTE + LUABINS_LSIZET + extension_name_length()
+          )
+      : 0
+      ;
+  }
+
+  /* Iterate over table key-value pairs in saved order */
+  const_iterator begin() const;
+  const_iterator end() const;
+
+  /*
+  * Finds table value by key. Returns none if not found or not a table.
+  * Linear in table size, values of other keys are skipped, not parsed.
+  */
+  View find(Number key) const;
+  View find(const char * key, std::size_t length) const;
+
+  View find(const char * key) const
+  {
+    return find(key, std::strlen(key));
+  }
+
+  View find(const std::string & key) const
+  {
+    return find(key.data(), key.size());
+  }
+
+#if __cplusplus >= 201703L
+  View find(std::string_view key) const
+  {
+    return find(key.data(), key.size());
+  }
+#endif
+
+  /* Raw encoded value, empty for none */
+  const unsigned char * data() const { return pos_; }
+
+  std::size_t size() const
+  {
+    return (pos_ == NULL) ? 0 : detail::skip(pos_) - pos_;
+  }
+
+private:
+  friend class Tuple;
+
+  explicit View(const unsigned char * pos) : pos_(pos) { }
+
+  const unsigned char * pos_;
+};
+
+struct View::Entry
+{
+  View key;
+  View value;
+};
+
+class View::const_iterator
+{
+public:
+  typedef std::input_iterator_tag iterator_category;
+  typedef Entry value_type;
+  typedef std::ptrdiff_t difference_type;
+  typedef const Entry * pointer;
+  typedef const Entry & reference;
+
+  const_iterator() : remaining_(0) { }
+
+  reference operator*() const { return entry_; }
+  pointer operator->() const { return &entry_; }
+
+  const_iterator & operator++()
+  {
+    if (--remaining_ > 0)
+    {
+      load(detail::skip(entry_.value.pos_));
+    }
+    return *this;
+  }
+
+  const_iterator operator++(int)
+  {
+    const_iterator result = *this;
+    ++*this;
+    return result;
+  }
+
+  bool operator==(const const_iterator & rhs) const
+  {
+    return remaining_ == rhs.remaining_;
+  }
+
+  bool operator!=(const const_iterator & rhs) const
+  {
+    return remaining_ != rhs.remaining_;
+  }
+
+private:
+  friend class View;
+
+  const_iterator(const unsigned char * pos, std::size_t remaining)
+    : remaining_(remaining)
+  {
+    if (remaining_ > 0)
+    {
+      load(pos);
+    }
+  }
+
+  void load(const unsigned char * pos)
+  {
+    entry_.key = View(pos);
+    entry_.value = View(detail::skip(pos));
+  }
+
+  Entry entry_;
+  std::size_t remaining_;
+};
+
+inline View::const_iterator View::begin() const
+{
+  return const_iterator(
+      is_table() ? pos_ + LUABINS_LMINTABLE : NULL,
+      table_size()
+    );
+}
+
+inline View::const_iterator View::end() const
+{
+  return const_iterator();
+}
+
+inline View View::find(Number key) const
+{
+  if (is_spans())
+  {
+    const int num_spans = detail::read_int(pos_ + LUABINS_LTYPEBYTE);
+    const unsigned char * pos = pos_ + LUABINS_LMINSPANS;
+
+    for (int i = 0; i < num_spans; ++i)
+    {
+      const int first_key = detail::read_int(pos);
+      const int count = detail::read_int(pos + LUABINS_LINT);
+
+      pos += LUABINS_LSPAN;
+      if (key >= first_key && key <= static_cast<Number>(first_key) + count - 1)
+      {
+        const Number offset = key - first_key;
+        if (offset != static_cast<int>(offset))
+        {
+          return View(); /* Not an integer */
+        }
+
+        for (int j = 0; j < static_cast<int>(offset); ++j)
+        {
+          pos = detail::skip(pos);
+        }
+        return View(pos);
+      }
+
+      for (int j = 0; j < count; ++j)
+      {
+        pos = detail::skip(pos);
+      }
+    }
+
+    return View();
+  }
+
+  const_iterator it = begin();
+  for ( ; it != end(); ++it)
+  {
+    if (it->key.is_number() && it->key.as_number() == key)
+    {
+      return it->value;
+    }
+  }
+  return View();
+}
+
+inline View View::find(const char * key, std::size_t length) const
+{
+  if (is_columns())
+  {
+    const int num_columns =
+      detail::read_int(pos_ + LUABINS_LTYPEBYTE + LUABINS_LINT);
+    const unsigned char * entry = pos_ + LUABINS_LMINCOLUMNS;
+    std::size_t offset = 0;
+    int index = num_columns;
+
+    for (int i = 0; i < num_columns; ++i)
+    {
+      const std::size_t name_length = detail::read_size(entry);
+      if (
+          index == num_columns &&
+          name_length == length &&
+          std::memcmp(entry + LUABINS_LSIZET, key, length) == 0
+        )
+      {
+        index = i;
+      }
+
+      entry += LUABINS_LSIZET + name_length;
+      if (index == num_columns)
+      {
+        offset += detail::read_size(entry);
+      }
+      entry += LUABINS_LSIZET;
+    }
+
+    /* Entry now points past the directory, at the first column */
+    return (index == num_columns) ? View() : View(entry + offset);
+  }
+
+  if (is_shaped())
+  {
+    const int num_keys = static_cast<int>(shaped_size());
+    const unsigned char * keys = detail::shape_def(pos_) + LUABINS_LMINSHAPEDEF;
+    const unsigned char * pos = NULL;
+    int index = 0;
+
+    for ( ; index < num_keys; ++index)
+    {
+      const std::size_t key_length = detail::read_size(keys);
+      if (
+          key_length == length &&
+          std::memcmp(keys + LUABINS_LSIZET, key, length) == 0
+        )
+      {
+        break;
+      }
+      keys += LUABINS_LSIZET + key_length;
+    }
+
+    if (index == num_keys)
+    {
+      return View();
+    }
+
+    /* Values follow the keys of a definition */
+    pos = pos_;
+    if (*pos == LUABINS_CSHAPEDEF)
+    {
+      pos += LUABINS_LMINSHAPEDEF;
+      for (int i = 0; i < num_keys; ++i)
+      {
+        pos += LUABINS_LSIZET + detail::read_size(pos);
+      }
+    }
+    else
+    {
+      pos += LUABINS_LMINSHAPED;
+    }
+
+    for (int i = 0; i < index; ++i)
+    {
+      pos = detail::skip(pos);
+    }
+    return View(pos);
+  }
+
+  const_iterator it = begin();
+  for ( ; it != end(); ++it)
+  {
+    if (
+        it->key.is_string() &&
+        it->key.string_length() == length &&
+        std::memcmp(it->key.string_data(), key, length) == 0
+      )
+    {
+      return it->value;
+    }
+  }
+  return View();
+}
+
+/* Validated chunk of saved data */
+class Tuple
+{
+public:
+  /* Iterates over tuple values */
+  class const_iterator
+  {
+  public:
+    typedef std::input_iterator_tag iterator_category;
+    typedef View value_type;
+    typedef std::ptrdiff_t difference_type;
+    typedef const View * pointer;
+    typedef const View & reference;
+
+    const_iterator() : remaining_(0) { }
+
+    reference operator*() const { return value_; }
+    pointer operator->() const { return &value_; }
+
+    const_iterator & operator++()
+    {
+      if (--remaining_ > 0)
+      {
+        value_ = View(detail::skip(value_.data()));
+      }
+      return *this;
+    }
+
+    const_iterator operator++(int)
+    {
+      const_iterator result = *this;
+      ++*this;
+      return result;
+    }
+
+    bool operator==(const const_iterator & rhs) const
+    {
+      return remaining_ == rhs.remaining_;
+    }
+
+    bool operator!=(const const_iterator & rhs) const
+    {
+      return remaining_ != rhs.remaining_;
+    }
+
+  private:
+    friend class Tuple;
+
+    const_iterator(const unsigned char * pos, std::size_t remaining)
+      : value_((remaining > 0) ? View(pos) : View()),
+        remaining_(remaining)
+    {
+    }
+
+    View value_;
+    std::size_t remaining_;
+  };
+
+  Tuple() : data_(NULL), size_(0) { }
+
+  /*
+  * Validates data and binds tuple to it.
+  * Returns LUABINS_ESUCCESS on success.
+  * Returns non-zero on failure, tuple is empty then.
+  */
+  int open(const unsigned char * data, std::size_t length)
+  {
+    const unsigned char * pos = data;
+    const unsigned char * end = data + length;
+    std::size_t size = 0;
+
+    data_ = NULL;
+    size_ = 0;
+
+    if (length < 1)
+    {
+      return LUABINS_EBADDATA;
+    }
+
+    size = *pos++;
+    if (size > MaxTuple)
+    {
+      return LUABINS_EBADSIZE;
+    }
+
+    for (std::size_t i = 0; i < size; ++i)
+    {
+      int result = detail::check(pos, data, end, 0, false);
+      if (result != LUABINS_ESUCCESS)
+      {
+        return result;
+      }
+    }
+
+    if (pos != end)
+    {
+      return LUABINS_ETAILEFT;
+    }
+
+    data_ = data;
+    size_ = size;
+
+    return LUABINS_ESUCCESS;
+  }
+
+  /* Number of values */
+  std::size_t size() const { return size_; }
+
+  const_iterator begin() const
+  {
+    return const_iterator((data_ == NULL) ? NULL : data_ + 1, size_);
+  }
+
+  const_iterator end() const
+  {
+    return const_iterator();
+  }
+
+  /* Returns none if index is out of range. Linear in index. */
+  View operator[](std::size_t index) const
+  {
+    const_iterator it = begin();
+    for ( ; it != end() && index > 0; ++it, --index)
+    {
+    }
+    return (it != end()) ? *it : View();
+  }
+
+private:
+  const unsigned char * data_;
+  std::size_t size_;
+};
+
+} /* namespace luabins */
+
+#endif /* LUABINS_VIEW_HPP_INCLUDED_ */
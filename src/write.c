@@ -7,6 +7,46 @@
 #include "luaheaders.h"
 
 #include "write.h"
+#include "packed.h"
+#include "byteorder.h"
+
+/* Multibyte values are written little-endian, see byteorder.h */
+
+static int lbsW_writeInt(luabins_SaveBuffer * sb, int value)
+{
+  unsigned char buf[LUABINS_LINT];
+  lbs_storeLE(buf, value, LUABINS_LINT);
+  return lbsSB_write(sb, buf, LUABINS_LINT);
+}
+
+static int lbsW_writeSize(luabins_SaveBuffer * sb, size_t value)
+{
+  unsigned char buf[LUABINS_LSIZET];
+  lbs_storeSize(buf, value);
+  return lbsSB_write(sb, buf, LUABINS_LSIZET);
+}
+
+static int lbsW_overwriteInt(
+    luabins_SaveBuffer * sb,
+    size_t offset,
+    int value
+  )
+{
+  unsigned char buf[LUABINS_LINT];
+  lbs_storeLE(buf, value, LUABINS_LINT);
+  return lbsSB_overwrite(sb, offset, buf, LUABINS_LINT);
+}
+
+static int lbsW_overwriteSize(
+    luabins_SaveBuffer * sb,
+    size_t offset,
+    size_t value
+  )
+{
+  unsigned char buf[LUABINS_LSIZET];
+  lbs_storeSize(buf, value);
+  return lbsSB_overwrite(sb, offset, buf, LUABINS_LSIZET);
+}
 
 int lbs_writeTableHeaderAt(
     luabins_SaveBuffer * sb,
@@ -30,18 +70,8 @@ int lbs_writeTableHeaderAt(
     }
 
     lbsSB_overwritechar(sb, offset, LUABINS_CTABLE);
-    lbsSB_overwrite(
-        sb,
-        offset + 1,
-        (const unsigned char *)&array_size,
-        LUABINS_LINT
-      );
-    lbsSB_overwrite(
-        sb,
-        offset + 1 + LUABINS_LINT,
-        (const unsigned char *)&hash_size,
-        LUABINS_LINT
-      );
+    lbsW_overwriteInt(sb, offset + 1, array_size);
+    lbsW_overwriteInt(sb, offset + 1 + LUABINS_LINT, hash_size);
   }
 
   return result;
@@ -52,8 +82,37 @@ int lbs_writeNumber(luabins_SaveBuffer * sb, lua_Number value)
   int result = lbsSB_grow(sb, 1 + LUABINS_LNUMBER);
   if (result == LUABINS_ESUCCESS)
   {
+    unsigned char buf[LUABINS_LNUMBER];
+    lbs_storeLE(buf, value, LUABINS_LNUMBER);
     lbsSB_writechar(sb, LUABINS_CNUMBER);
-    lbsSB_write(sb, (const unsigned char *)&value, LUABINS_LNUMBER);
+    lbsSB_write(sb, buf, LUABINS_LNUMBER);
+  }
+  return result;
+}
+
+int lbs_writeLuaInteger(luabins_SaveBuffer * sb, lua_Integer value)
+{
+  int result = lbsSB_grow(sb, LUABINS_LMININTEGER);
+  if (result == LUABINS_ESUCCESS)
+  {
+    unsigned char buf[LUABINS_LINTEGER];
+    lbs_putInteger(buf, value);
+    lbsSB_writechar(sb, LUABINS_CINTEGER);
+    lbsSB_write(sb, buf, LUABINS_LINTEGER);
+  }
+  return result;
+}
+
+int lbs_writeFloat(luabins_SaveBuffer * sb, lua_Number value)
+{
+  int result = lbsSB_grow(sb, 1 + LUABINS_LFLOAT);
+  if (result == LUABINS_ESUCCESS)
+  {
+    float f = (float)value;
+    unsigned char buf[LUABINS_LFLOAT];
+    lbs_storeLE(buf, f, LUABINS_LFLOAT);
+    lbsSB_writechar(sb, LUABINS_CFLOAT);
+    lbsSB_write(sb, buf, LUABINS_LFLOAT);
   }
   return result;
 }
@@ -68,8 +127,250 @@ int lbs_writeString(
   if (result == LUABINS_ESUCCESS)
   {
     lbsSB_writechar(sb, LUABINS_CSTRING);
-    lbsSB_write(sb, (const unsigned char *)&length, LUABINS_LSIZET);
+    lbsW_writeSize(sb, length);
     lbsSB_write(sb, (const unsigned char *)value, length);
   }
   return result;
 }
+
+int lbs_writePackedHeader(
+    luabins_SaveBuffer * sb,
+    unsigned char type,
+    int count
+  )
+{
+  int result = lbsSB_grow(
+      sb,
+      LUABINS_LMINPACKED + (size_t)count * lbs_packedWidth(type)
+    );
+  if (result == LUABINS_ESUCCESS)
+  {
+    lbsSB_writechar(sb, LUABINS_CPACKED);
+    lbsSB_writechar(sb, type);
+    lbsW_writeInt(sb, count);
+  }
+  return result;
+}
+
+int lbs_writePackedElement(
+    luabins_SaveBuffer * sb,
+    unsigned char type,
+    lua_Number value
+  )
+{
+  unsigned char buf[LUABINS_LNUMBER];
+  lbs_packedPut(buf, type, value);
+  return lbsSB_write(sb, buf, lbs_packedWidth(type));
+}
+
+int lbs_writePackedNumbers(
+    luabins_SaveBuffer * sb,
+    const lua_Number * values,
+    int count,
+    int use_float
+  )
+{
+  lbs_PackedClass pc;
+  unsigned char type = 0;
+  int result = LUABINS_ESUCCESS;
+  int i = 0;
+
+  lbs_packedClassInit(&pc);
+  for (i = 0; i < count; ++i)
+  {
+    lbs_packedClassAdd(&pc, values[i]);
+  }
+  type = lbs_packedClassType(&pc, use_float);
+
+  result = lbs_writePackedHeader(sb, type, count);
+  for (i = 0; i < count && result == LUABINS_ESUCCESS; ++i)
+  {
+    result = lbs_writePackedElement(sb, type, values[i]);
+  }
+
+  return result;
+}
+
+int lbs_writeBitsetHeader(luabins_SaveBuffer * sb, int count)
+{
+  int result = lbsSB_grow(sb, LUABINS_LMINBITSET + lbs_bitsetSize(count));
+  if (result == LUABINS_ESUCCESS)
+  {
+    lbsSB_writechar(sb, LUABINS_CBITSET);
+    lbsW_writeInt(sb, count);
+  }
+  return result;
+}
+
+int lbs_writeBitset(
+    luabins_SaveBuffer * sb,
+    const unsigned char * bits,
+    int count
+  )
+{
+  int result = lbs_writeBitsetHeader(sb, count);
+  if (result == LUABINS_ESUCCESS)
+  {
+    result = lbsSB_write(sb, bits, lbs_bitsetSize(count));
+  }
+  return result;
+}
+
+int lbs_writeSpansHeader(luabins_SaveBuffer * sb, int num_spans, int total)
+{
+  int result = lbsSB_grow(sb, LUABINS_LMINSPANS);
+  if (result == LUABINS_ESUCCESS)
+  {
+    lbsSB_writechar(sb, LUABINS_CSPANS);
+    lbsW_writeInt(sb, num_spans);
+    lbsW_writeInt(sb, total);
+  }
+  return result;
+}
+
+int lbs_writeSpanHeader(luabins_SaveBuffer * sb, int first_key, int count)
+{
+  int result = lbsSB_grow(sb, LUABINS_LSPAN);
+  if (result == LUABINS_ESUCCESS)
+  {
+    lbsW_writeInt(sb, first_key);
+    lbsW_writeInt(sb, count);
+  }
+  return result;
+}
+
+int lbs_writeShapeDefHeader(luabins_SaveBuffer * sb, int num_keys)
+{
+  int result = lbsSB_grow(sb, LUABINS_LMINSHAPEDEF);
+  if (result == LUABINS_ESUCCESS)
+  {
+    lbsSB_writechar(sb, LUABINS_CSHAPEDEF);
+    lbsW_writeInt(sb, num_keys);
+  }
+  return result;
+}
+
+int lbs_writeShapeKey(
+    luabins_SaveBuffer * sb,
+    const char * key,
+    size_t length
+  )
+{
+  int result = lbsSB_grow(sb, LUABINS_LSIZET + length);
+  if (result == LUABINS_ESUCCESS)
+  {
+    lbsW_writeSize(sb, length);
+    lbsSB_write(sb, (const unsigned char *)key, length);
+  }
+  return result;
+}
+
+int lbs_writeShapedHeader(luabins_SaveBuffer * sb, size_t distance)
+{
+  int result = lbsSB_grow(sb, LUABINS_LMINSHAPED);
+  if (result == LUABINS_ESUCCESS)
+  {
+    lbsSB_writechar(sb, LUABINS_CSHAPED);
+    lbsW_writeSize(sb, distance);
+  }
+  return result;
+}
+
+int lbs_writeColumnsHeader(
+    luabins_SaveBuffer * sb,
+    int num_records,
+    int num_columns
+  )
+{
+  int result = lbsSB_grow(sb, LUABINS_LMINCOLUMNS);
+  if (result == LUABINS_ESUCCESS)
+  {
+    lbsSB_writechar(sb, LUABINS_CCOLUMNS);
+    lbsW_writeInt(sb, num_records);
+    lbsW_writeInt(sb, num_columns);
+  }
+  return result;
+}
+
+int lbs_writeColumnEntry(
+    luabins_SaveBuffer * sb,
+    const char * name,
+    size_t length,
+    size_t size
+  )
+{
+  int result = lbsSB_grow(sb, LUABINS_LCOLUMN + length);
+  if (result == LUABINS_ESUCCESS)
+  {
+    lbsW_writeSize(sb, length);
+    lbsSB_write(sb, (const unsigned char *)name, length);
+    lbsW_writeSize(sb, size);
+  }
+  return result;
+}
+
+int lbs_writeColumnSizeAt(
+    luabins_SaveBuffer * sb,
+    size_t offset,
+    size_t size
+  )
+{
+  return lbsW_overwriteSize(sb, offset, size);
+}
+
+int lbs_writeExtensionHeader(
+    luabins_SaveBuffer * sb,
+    const char * name,
+    size_t length,
+    size_t size
+  )
+{
+  int result = lbsSB_grow(sb, LUABINS_LMINEXTENSION + length);
+  if (result == LUABINS_ESUCCESS)
+  {
+    lbsSB_writechar(sb, LUABINS_CEXTENSION);
+    lbsW_writeSize(sb, length);
+    lbsSB_write(sb, (const unsigned char *)name, length);
+    lbsW_writeSize(sb, size);
+  }
+  return result;
+}
+
+int lbs_writeExtensionSizeAt(
+    luabins_SaveBuffer * sb,
+    size_t offset,
+    size_t size
+  )
+{
+  return lbsW_overwriteSize(sb, offset, size);
+}
+
+int lbs_writePatchHeader(luabins_SaveBuffer * sb, int num_ops)
+{
+  int result = lbsSB_grow(sb, LUABINS_LMINPATCH);
+  if (result == LUABINS_ESUCCESS)
+  {
+    lbsSB_writechar(sb, LUABINS_CPATCH);
+    lbsW_writeInt(sb, num_ops);
+  }
+  return result;
+}
+
+int lbs_writePatchSizeAt(
+    luabins_SaveBuffer * sb,
+    size_t offset,
+    int num_ops
+  )
+{
+  return lbsW_overwriteInt(sb, offset + LUABINS_LTYPEBYTE, num_ops);
+}
+
+int lbs_writePatchOp(luabins_SaveBuffer * sb, int path_length)
+{
+  int result = lbsSB_grow(sb, LUABINS_LINT);
+  if (result == LUABINS_ESUCCESS)
+  {
+    lbsW_writeInt(sb, path_length);
+  }
+  return result;
+}
@@ -33,12 +33,173 @@ int lbs_writeTableHeaderAt(
 
 int lbs_writeNumber(luabins_SaveBuffer * sb, lua_Number value);
 
+/*
+* Writes number as single precision float.
+* Value should fit, see lbs_fitsFloat() in packed.h, otherwise
+* it is rounded.
+*/
+int lbs_writeFloat(luabins_SaveBuffer * sb, lua_Number value);
+
+/*
+* Note integer is written as a number, so data loads with any luabins
+* version. Use lbs_writeLuaInteger() to keep integer subtype of Lua 5.3+.
+*/
 #define lbs_writeInteger lbs_writeNumber
 
+/*
+* Writes integer with its own type byte. It loads as integer
+* where Lua has integers, and as number elsewhere.
+*/
+int lbs_writeLuaInteger(luabins_SaveBuffer * sb, lua_Integer value);
+
 int lbs_writeString(
     luabins_SaveBuffer * sb,
     const char * value,
     size_t length
   );
 
+/*
+* Writes packed array header (see packed.h) and reserves buffer space
+* for all count elements, so subsequent lbs_writePackedElement() calls
+* for this array do not fail.
+*/
+int lbs_writePackedHeader(
+    luabins_SaveBuffer * sb,
+    unsigned char type,
+    int count
+  );
+
+int lbs_writePackedElement(
+    luabins_SaveBuffer * sb,
+    unsigned char type,
+    lua_Number value
+  );
+
+/*
+* Writes bitset header (see packed.h) and reserves buffer space
+* for lbs_bitsetSize(count) data bytes, which are to be written
+* with lbsSB_writechar().
+*/
+int lbs_writeBitsetHeader(luabins_SaveBuffer * sb, int count);
+
+/* Writes bitset, see packed.h for bits layout */
+int lbs_writeBitset(
+    luabins_SaveBuffer * sb,
+    const unsigned char * bits,
+    int count
+  );
+
+/*
+* Writes spans header (see packed.h). Then for each of num_spans spans,
+* call lbs_writeSpanHeader() and write its values.
+*/
+int lbs_writeSpansHeader(luabins_SaveBuffer * sb, int num_spans, int total);
+
+int lbs_writeSpanHeader(luabins_SaveBuffer * sb, int first_key, int count);
+
+/*
+* Writes shape definition header (see packed.h). Then call
+* lbs_writeShapeKey() for each of num_keys keys and write values.
+*/
+int lbs_writeShapeDefHeader(luabins_SaveBuffer * sb, int num_keys);
+
+int lbs_writeShapeKey(
+    luabins_SaveBuffer * sb,
+    const char * key,
+    size_t length
+  );
+
+/*
+* Writes header of a table with known shape. Distance is from the start
+* of this header back to the start of the shape definition header,
+* so it only makes sense for plain buffer writes.
+* Write values after the header.
+*/
+int lbs_writeShapedHeader(luabins_SaveBuffer * sb, size_t distance);
+
+/*
+* Writes columns header (see packed.h). Then call lbs_writeColumnEntry()
+* for each of num_columns columns and write column values.
+*/
+int lbs_writeColumnsHeader(
+    luabins_SaveBuffer * sb,
+    int num_records,
+    int num_columns
+  );
+
+/*
+* Writes column directory entry. If column size is not known yet,
+* write zero and fix it later with lbs_writeColumnSizeAt().
+*/
+int lbs_writeColumnEntry(
+    luabins_SaveBuffer * sb,
+    const char * name,
+    size_t length,
+    size_t size
+  );
+
+/*
+* Overwrites column size of an entry written with lbs_writeColumnEntry().
+* Offset is of the size itself, that is LUABINS_LSIZET before entry end.
+*/
+int lbs_writeColumnSizeAt(
+    luabins_SaveBuffer * sb,
+    size_t offset,
+    size_t size
+  );
+
+/*
+* Writes extension value header (see packed.h), then write size bytes
+* of payload. If payload size is not known yet, write zero
+* and fix it later with lbs_writeExtensionSizeAt().
+*/
+int lbs_writeExtensionHeader(
+    luabins_SaveBuffer * sb,
+    const char * name,
+    size_t length,
+    size_t size
+  );
+
+/*
+* Overwrites payload size of a header written with lbs_writeExtensionHeader().
+* Offset is of the size itself, that is LUABINS_LSIZET before header end.
+*/
+int lbs_writeExtensionSizeAt(
+    luabins_SaveBuffer * sb,
+    size_t offset,
+    size_t size
+  );
+
+/*
+* Writes patch header (see packed.h), in place of the tuple size.
+* If number of operations is not known yet, write zero and fix it later
+* with lbs_writePatchSizeAt().
+*/
+int lbs_writePatchHeader(luabins_SaveBuffer * sb, int num_ops);
+
+/* Overwrites number of operations of the header written at offset */
+int lbs_writePatchSizeAt(
+    luabins_SaveBuffer * sb,
+    size_t offset,
+    int num_ops
+  );
+
+/*
+* Writes patch operation header. Then write path_length keys
+* and the new value (nil to remove the last key).
+*/
+int lbs_writePatchOp(luabins_SaveBuffer * sb, int path_length);
+
+/*
+* Writes values as a packed array with the narrowest lossless element type.
+* Float element type is used only if use_float is non-zero.
+* Loads as a table with values at keys 1 .. count.
+*/
+int lbs_writePackedNumbers(
+    luabins_SaveBuffer * sb,
+    const lua_Number * values,
+    int count,
+    int use_float
+  );
+
 #endif /* LUABINS_WRITE_H_INCLUDED_ */
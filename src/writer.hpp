@@ -0,0 +1,814 @@
+/*
+* writer.hpp
+* Luabins header-only C++ writer
+* See copyright notice in luabins.h
+*/
+
+#ifndef LUABINS_WRITER_HPP_INCLUDED_
+#define LUABINS_WRITER_HPP_INCLUDED_
+
+/*
+* Requires C++11. std::optional and std::string_view
+* are supported when compiled as C++17.
+*
+* Usage:
+*
+*   std::string data;
+*   luabins::StringSink sink(data);
+*   luabins::Writer<luabins::StringSink> writer(sink);
+*
+*   std::map<std::string, std::vector<double> > values;
+*   int result = writer.tuple(42, "answer", values);
+*
+* Encoded size is computed first, so each tuple is written
+* with a single sink allocation and no per-value grow checks.
+*
+* User structs are saved as tables with string keys,
+* and opt in by specializing luabins::Fields:
+*
+*   struct Point { double x; double y; };
+*
+*   namespace luabins
+*   {
+*     template <>
+*     struct Fields<Point>
+*     {
+*       template <typename Visitor>
+*       static void visit(Visitor & v, const Point & p)
+*       {
+*         v("x", p.x);
+*         v("y", p.y);
+*       }
+*     };
+*   }
+*/
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <array>
+#include <map>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+#if __cplusplus >= 201703L
+  #include <optional>
+  #include <string_view>
+#endif
+
+#include "saveload.h"
+#include "common.hpp"
+
+namespace luabins
+{
+
+/*
+* Specialize for user structs, see usage above.
+* Visitor is called with field name and field value.
+*/
+template <typename T>
+struct Fields;
+
+namespace detail
+{
+
+/* Encoded size accumulator */
+struct Measure
+{
+  std::size_t size;
+  int nesting;
+  int error;
+
+  Measure() : size(0), nesting(0), error(LUABINS_ESUCCESS) { }
+
+  void fail(int e)
+  {
+    if (error == LUABINS_ESUCCESS)
+    {
+      error = e;
+    }
+  }
+};
+
+inline unsigned char * put_byte(unsigned char * out, unsigned char byte)
+{
+  *out = byte;
+  return out + 1;
+}
+
+inline unsigned char * put_number(unsigned char * out, Number value)
+{
+  out = put_byte(out, LUABINS_CNUMBER);
+  copy_le(out, &value, LUABINS_LNUMBER);
+  return out + LUABINS_LNUMBER;
+}
+
+inline unsigned char * put_string(
+    unsigned char * out,
+    const char * value,
+    std::size_t length
+  )
+{
+  /* Truncated to LUABINS_LSIZET bytes, see write.c */
+  out = put_byte(out, LUABINS_CSTRING);
+  const std::uint32_t size = static_cast<std::uint32_t>(length);
+  copy_le(out, &size, LUABINS_LSIZET);
+  out += LUABINS_LSIZET;
+  if (length > 0)
+  {
+    std::memcpy(out, value, length);
+  }
+  return out + length;
+}
+
+inline unsigned char * put_table_header(
+    unsigned char * out,
+    int array_size,
+    int hash_size
+  )
+{
+  out = put_byte(out, LUABINS_CTABLE);
+  copy_le(out, &array_size, LUABINS_LINT);
+  out += LUABINS_LINT;
+  copy_le(out, &hash_size, LUABINS_LINT);
+  return out + LUABINS_LINT;
+}
+
+inline void measure_string(Measure & m, std::size_t length)
+{
+  if (length > 0xFFFFFFFFUL)
+  {
+    m.fail(LUABINS_ETOOLONG);
+  }
+  m.size += LUABINS_LMINSTRING + length;
+}
+
+inline void measure_table(Measure & m, std::size_t total_size)
+{
+  if (total_size > static_cast<std::size_t>(MaxArraySize))
+  {
+    m.fail(LUABINS_ETOOLONG);
+  }
+  m.size += LUABINS_LMINTABLE;
+}
+
+/*
+* Codec<T> encodes values of type T. Each codec has:
+*   -- is_nil(v): true if value is saved as nil
+*      (such values are omitted from tables);
+*   -- is_key(v): true if value may be a table key;
+*   -- measure(m, v): adds encoded size to m;
+*   -- put(out, v): encodes value, returns pointer past written data.
+*
+* Primary template handles user structs (see Fields).
+*/
+template <typename T, typename Enable = void>
+struct Codec;
+
+/* Scalars are never nil, and are always valid keys */
+struct ScalarCodec
+{
+  template <typename T>
+  static bool is_nil(const T &) { return false; }
+
+  template <typename T>
+  static bool is_key(const T &) { return true; }
+};
+
+template <>
+struct Codec<std::nullptr_t>
+{
+  static bool is_nil(std::nullptr_t) { return true; }
+  static bool is_key(std::nullptr_t) { return false; }
+
+  static void measure(Measure & m, std::nullptr_t)
+  {
+    m.size += LUABINS_LTYPEBYTE;
+  }
+
+  static unsigned char * put(unsigned char * out, std::nullptr_t)
+  {
+    return put_byte(out, LUABINS_CNIL);
+  }
+};
+
+template <>
+struct Codec<bool> : ScalarCodec
+{
+  static void measure(Measure & m, bool)
+  {
+    m.size += LUABINS_LTYPEBYTE;
+  }
+
+  static unsigned char * put(unsigned char * out, bool value)
+  {
+    return put_byte(out, value ? LUABINS_CTRUE : LUABINS_CFALSE);
+  }
+};
+
+template <typename T>
+struct Codec<
+    T,
+    typename std::enable_if<std::is_arithmetic<T>::value>::type
+  >
+{
+  static bool is_nil(T) { return false; }
+
+  /* Table key can't be NaN */
+  static bool is_key(T value)
+  {
+    return static_cast<Number>(value) == static_cast<Number>(value);
+  }
+
+  static void measure(Measure & m, T)
+  {
+    m.size += LUABINS_LMINNUMBER;
+  }
+
+  static unsigned char * put(unsigned char * out, T value)
+  {
+    return put_number(out, static_cast<Number>(value));
+  }
+};
+
+template <typename T>
+struct Codec<T, typename std::enable_if<std::is_enum<T>::value>::type>
+  : ScalarCodec
+{
+  static void measure(Measure & m, T)
+  {
+    m.size += LUABINS_LMINNUMBER;
+  }
+
+  static unsigned char * put(unsigned char * out, T value)
+  {
+    return put_number(out, static_cast<Number>(value));
+  }
+};
+
+/* Generic string codec, Traits provide data() and length() */
+template <typename T, typename Traits>
+struct StringCodec : ScalarCodec
+{
+  static void measure(Measure & m, const T & value)
+  {
+    measure_string(m, Traits::length(value));
+  }
+
+  static unsigned char * put(unsigned char * out, const T & value)
+  {
+    return put_string(out, Traits::data(value), Traits::length(value));
+  }
+};
+
+struct StdStringTraits
+{
+  template <typename T>
+  static const char * data(const T & value) { return value.data(); }
+
+  template <typename T>
+  static std::size_t length(const T & value) { return value.size(); }
+};
+
+struct CStringTraits
+{
+  static const char * data(const char * value) { return value; }
+
+  static std::size_t length(const char * value)
+  {
+    return std::strlen(value);
+  }
+};
+
+template <typename CharTraits, typename Alloc>
+struct Codec<std::basic_string<char, CharTraits, Alloc> >
+  : StringCodec<std::basic_string<char, CharTraits, Alloc>, StdStringTraits>
+{
+};
+
+#if __cplusplus >= 201703L
+
+template <typename CharTraits>
+struct Codec<std::basic_string_view<char, CharTraits> >
+  : StringCodec<std::basic_string_view<char, CharTraits>, StdStringTraits>
+{
+};
+
+#endif
+
+/* NULL pointer is saved as nil */
+template <>
+struct Codec<const char *>
+{
+  static bool is_nil(const char * value) { return value == NULL; }
+  static bool is_key(const char * value) { return value != NULL; }
+
+  static void measure(Measure & m, const char * value)
+  {
+    if (value == NULL)
+    {
+      m.size += LUABINS_LTYPEBYTE;
+    }
+    else
+    {
+      measure_string(m, CStringTraits::length(value));
+    }
+  }
+
+  static unsigned char * put(unsigned char * out, const char * value)
+  {
+    return (value == NULL)
+      ? put_byte(out, LUABINS_CNIL)
+      : put_string(out, value, CStringTraits::length(value))
+      ;
+  }
+};
+
+template <>
+struct Codec<char *> : Codec<const char *>
+{
+};
+
+/* String literals. Note the length is up to the first zero. */
+template <std::size_t N>
+struct Codec<char[N]> : StringCodec<const char *, CStringTraits>
+{
+};
+
+/* Sequences are saved as arrays, nil elements are skipped */
+template <typename T>
+struct SequenceCodec
+{
+  typedef typename T::value_type Value;
+
+  static bool is_nil(const T &) { return false; }
+  static bool is_key(const T &) { return true; }
+
+  static std::size_t count(const T & value)
+  {
+    std::size_t result = 0;
+    typename T::const_iterator it = value.begin();
+    for ( ; it != value.end(); ++it)
+    {
+      if (!Codec<Value>::is_nil(*it))
+      {
+        ++result;
+      }
+    }
+    return result;
+  }
+
+  static void measure(Measure & m, const T & value)
+  {
+    typename T::const_iterator it = value.begin();
+
+    if (++m.nesting > MaxTableNesting)
+    {
+      m.fail(LUABINS_ETOODEEP);
+      return;
+    }
+
+    measure_table(m, value.size());
+    for ( ; it != value.end() && m.error == LUABINS_ESUCCESS; ++it)
+    {
+      if (!Codec<Value>::is_nil(*it))
+      {
+        m.size += LUABINS_LMINNUMBER;
+        Codec<Value>::measure(m, *it);
+      }
+    }
+
+    --m.nesting;
+  }
+
+  static unsigned char * put(unsigned char * out, const T & value)
+  {
+    std::size_t index = 0;
+    typename T::const_iterator it = value.begin();
+
+    out = put_table_header(out, static_cast<int>(count(value)), 0);
+    for ( ; it != value.end(); ++it)
+    {
+      ++index;
+      if (!Codec<Value>::is_nil(*it))
+      {
+        out = put_number(out, static_cast<Number>(index));
+        out = Codec<Value>::put(out, *it);
+      }
+    }
+
+    return out;
+  }
+};
+
+template <typename T, typename Alloc>
+struct Codec<std::vector<T, Alloc> >
+  : SequenceCodec<std::vector<T, Alloc> >
+{
+};
+
+template <typename T, std::size_t N>
+struct Codec<std::array<T, N> >
+  : SequenceCodec<std::array<T, N> >
+{
+};
+
+/* Associative containers are saved as hashes, nil values are skipped */
+template <typename T>
+struct MapCodec
+{
+  typedef typename T::key_type Key;
+  typedef typename T::mapped_type Value;
+
+  static bool is_nil(const T &) { return false; }
+  static bool is_key(const T &) { return true; }
+
+  static std::size_t count(const T & value)
+  {
+    std::size_t result = 0;
+    typename T::const_iterator it = value.begin();
+    for ( ; it != value.end(); ++it)
+    {
+      if (!Codec<Value>::is_nil(it->second))
+      {
+        ++result;
+      }
+    }
+    return result;
+  }
+
+  static void measure(Measure & m, const T & value)
+  {
+    typename T::const_iterator it = value.begin();
+
+    if (++m.nesting > MaxTableNesting)
+    {
+      m.fail(LUABINS_ETOODEEP);
+      return;
+    }
+
+    measure_table(m, value.size());
+    for ( ; it != value.end() && m.error == LUABINS_ESUCCESS; ++it)
+    {
+      if (!Codec<Value>::is_nil(it->second))
+      {
+        if (!Codec<Key>::is_key(it->first))
+        {
+          m.fail(LUABINS_EBADDATA);
+        }
+        Codec<Key>::measure(m, it->first);
+        Codec<Value>::measure(m, it->second);
+      }
+    }
+
+    --m.nesting;
+  }
+
+  static unsigned char * put(unsigned char * out, const T & value)
+  {
+    typename T::const_iterator it = value.begin();
+
+    out = put_table_header(out, 0, static_cast<int>(count(value)));
+    for ( ; it != value.end(); ++it)
+    {
+      if (!Codec<Value>::is_nil(it->second))
+      {
+        out = Codec<Key>::put(out, it->first);
+        out = Codec<Value>::put(out, it->second);
+      }
+    }
+
+    return out;
+  }
+};
+
+template <typename K, typename V, typename Compare, typename Alloc>
+struct Codec<std::map<K, V, Compare, Alloc> >
+  : MapCodec<std::map<K, V, Compare, Alloc> >
+{
+};
+
+template <typename K, typename V, typename Hash, typename Eq, typename Alloc>
+struct Codec<std::unordered_map<K, V, Hash, Eq, Alloc> >
+  : MapCodec<std::unordered_map<K, V, Hash, Eq, Alloc> >
+{
+};
+
+#if __cplusplus >= 201703L
+
+/* Empty optional is saved as nil */
+template <typename T>
+struct Codec<std::optional<T> >
+{
+  static bool is_nil(const std::optional<T> & value)
+  {
+    return !value.has_value();
+  }
+
+  static bool is_key(const std::optional<T> & value)
+  {
+    return value.has_value() && Codec<T>::is_key(*value);
+  }
+
+  static void measure(Measure & m, const std::optional<T> & value)
+  {
+    if (value.has_value())
+    {
+      Codec<T>::measure(m, *value);
+    }
+    else
+    {
+      m.size += LUABINS_LTYPEBYTE;
+    }
+  }
+
+  static unsigned char * put(
+      unsigned char * out,
+      const std::optional<T> & value
+    )
+  {
+    return value.has_value()
+      ? Codec<T>::put(out, *value)
+      : put_byte(out, LUABINS_CNIL)
+      ;
+  }
+};
+
+#endif
+
+/* Field visitors for user structs */
+
+struct CountFields
+{
+  std::size_t count;
+
+  CountFields() : count(0) { }
+
+  template <typename F>
+  void operator()(const char *, const F & field)
+  {
+    if (!Codec<F>::is_nil(field))
+    {
+      ++count;
+    }
+  }
+};
+
+struct MeasureFields
+{
+  Measure & m;
+
+  explicit MeasureFields(Measure & m_) : m(m_) { }
+
+  template <typename F>
+  void operator()(const char * name, const F & field)
+  {
+    if (!Codec<F>::is_nil(field))
+    {
+      measure_string(m, CStringTraits::length(name));
+      Codec<F>::measure(m, field);
+    }
+  }
+};
+
+struct PutFields
+{
+  unsigned char * out;
+
+  explicit PutFields(unsigned char * out_) : out(out_) { }
+
+  template <typename F>
+  void operator()(const char * name, const F & field)
+  {
+    if (!Codec<F>::is_nil(field))
+    {
+      out = put_string(out, name, CStringTraits::length(name));
+      out = Codec<F>::put(out, field);
+    }
+  }
+};
+
+/* User structs, saved as tables with field names as keys */
+template <typename T, typename Enable>
+struct Codec
+{
+  static bool is_nil(const T &) { return false; }
+  static bool is_key(const T &) { return true; }
+
+  static std::size_t count(const T & value)
+  {
+    CountFields v;
+    Fields<T>::visit(v, value);
+    return v.count;
+  }
+
+  static void measure(Measure & m, const T & value)
+  {
+    if (++m.nesting > MaxTableNesting)
+    {
+      m.fail(LUABINS_ETOODEEP);
+      return;
+    }
+
+    measure_table(m, 0);
+
+    {
+      MeasureFields v(m);
+      Fields<T>::visit(v, value);
+    }
+
+    --m.nesting;
+  }
+
+  static unsigned char * put(unsigned char * out, const T & value)
+  {
+    PutFields v(put_table_header(out, 0, static_cast<int>(count(value))));
+    Fields<T>::visit(v, value);
+    return v.out;
+  }
+};
+
+inline void measure_all(Measure &)
+{
+}
+
+template <typename T, typename... Rest>
+inline void measure_all(Measure & m, const T & value, const Rest &... rest)
+{
+  Codec<T>::measure(m, value);
+  measure_all(m, rest...);
+}
+
+inline unsigned char * put_all(unsigned char * out)
+{
+  return out;
+}
+
+template <typename T, typename... Rest>
+inline unsigned char * put_all(
+    unsigned char * out,
+    const T & value,
+    const Rest &... rest
+  )
+{
+  return put_all(Codec<T>::put(out, value), rest...);
+}
+
+} /* namespace detail */
+
+/*
+* Sink appending to a contiguous container
+* (std::string or std::vector<unsigned char>).
+*
+* Sink interface:
+*   -- unsigned char * prepare(size_t length): returns room for length
+*      bytes, or NULL on failure;
+*   -- void commit(size_t length): marks prepared bytes as written.
+*/
+template <typename Container>
+class ContainerSink
+{
+public:
+  explicit ContainerSink(Container & container)
+    : container_(container)
+  {
+  }
+
+  unsigned char * prepare(std::size_t length)
+  {
+    const std::size_t offset = container_.size();
+    container_.resize(offset + length);
+    return reinterpret_cast<unsigned char *>(&container_[0]) + offset;
+  }
+
+  void commit(std::size_t)
+  {
+  }
+
+private:
+  Container & container_;
+};
+
+typedef ContainerSink<std::string> StringSink;
+typedef ContainerSink<std::vector<unsigned char> > VectorSink;
+
+template <typename Sink>
+class Writer
+{
+public:
+  explicit Writer(Sink & sink)
+    : sink_(sink)
+  {
+  }
+
+  /*
+  * Writes tuple of given values.
+  * Returns LUABINS_ESUCCESS on success.
+  * Returns non-zero on failure, nothing is written then.
+  */
+  template <typename... Values>
+  int tuple(const Values &... values)
+  {
+    static_assert(sizeof...(Values) <= MaxTuple, "too many values");
+
+    detail::Measure m;
+    m.size = LUABINS_LTYPEBYTE;
+    detail::measure_all(m, values...);
+    if (m.error != LUABINS_ESUCCESS)
+    {
+      return m.error;
+    }
+
+    return write(
+        m.size,
+        static_cast<unsigned char>(sizeof...(Values)),
+        values...
+      );
+  }
+
+  /*
+  * Writes single value without tuple size.
+  * Use to stream tuple items one by one after tuple_size().
+  */
+  template <typename T>
+  int value(const T & item)
+  {
+    detail::Measure m;
+    detail::measure_all(m, item);
+    if (m.error != LUABINS_ESUCCESS)
+    {
+      return m.error;
+    }
+
+    {
+      unsigned char * out = sink_.prepare(m.size);
+      if (out == NULL)
+      {
+        return LUABINS_ETOOLONG;
+      }
+
+      detail::put_all(out, item);
+      sink_.commit(m.size);
+    }
+
+    return LUABINS_ESUCCESS;
+  }
+
+  int tuple_size(unsigned char size)
+  {
+    if (size > MaxTuple)
+    {
+      return LUABINS_EBADSIZE;
+    }
+    return value_raw(size);
+  }
+
+private:
+  template <typename... Values>
+  int write(std::size_t size, unsigned char count, const Values &... values)
+  {
+    unsigned char * out = sink_.prepare(size);
+    if (out == NULL)
+    {
+      return LUABINS_ETOOLONG;
+    }
+
+    detail::put_all(detail::put_byte(out, count), values...);
+    sink_.commit(size);
+
+    return LUABINS_ESUCCESS;
+  }
+
+  int value_raw(unsigned char byte)
+  {
+    unsigned char * out = sink_.prepare(1);
+    if (out == NULL)
+    {
+      return LUABINS_ETOOLONG;
+    }
+
+    detail::put_byte(out, byte);
+    sink_.commit(1);
+
+    return LUABINS_ESUCCESS;
+  }
+
+  Sink & sink_;
+};
+
+/*
+* Convenience function, appends tuple of given values to string.
+* Returns LUABINS_ESUCCESS on success, non-zero on failure.
+*/
+template <typename... Values>
+inline int save(std::string & out, const Values &... values)
+{
+  StringSink sink(out);
+  return Writer<StringSink>(sink).tuple(values...);
+}
+
+} /* namespace luabins */
+
+#endif /* LUABINS_WRITER_HPP_INCLUDED_ */
@@ -0,0 +1,899 @@
+/*
+* bench.c
+* Luabins microbenchmarks
+* See copyright notice in luabins.h
+*/
+
+/*
+* Usage: luabins-bench [--json] [--time <seconds>] [<filter> ...]
+*
+* Each benchmark runs for at least given time (0.2 seconds by default).
+* If filters are given, only benchmarks with names containing any
+* of them are run.
+*
+* Reported for each benchmark:
+*   MB/s      -- saved data bytes processed per second;
+*   ns/value  -- time per saved value (keys, values and tables all count),
+*                or per write call for save buffer benchmarks;
+*   allocs/op -- allocator calls per operation, counted where luabins
+*                is given our allocator (not for FILE * writes);
+*   bytes/op  -- bytes requested from allocator per operation;
+*   cycles/value -- CPU cycles per value, if perf events are available
+*                (Linux only).
+*
+* Use --json to get machine-readable results for regression tracking.
+*/
+
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+  #define _GNU_SOURCE /* syscall() */
+#endif
+
+#ifndef _POSIX_C_SOURCE
+  #define _POSIX_C_SOURCE 200809L /* clock_gettime() */
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef __linux__
+  #include <unistd.h>
+  #include <sys/ioctl.h>
+  #include <sys/syscall.h>
+  #include <linux/perf_event.h>
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+#include <lua.h>
+#include <lauxlib.h>
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#include "luabins.h"
+#include "savebuffer.h"
+#include "write.h"
+#include "fwrite.h"
+
+/******************************************************************************/
+
+#define DEFAULT_TIME (0.2)
+
+/* Data shapes */
+#define SHAPE_NUMBERS (0) /* { 0.25, 0.5, ... } */
+#define SHAPE_STRINGS (1) /* { "string 1", "string 2", ... } */
+#define SHAPE_RECORDS (2) /* { { id = 1, name = "item 1", ... }, ... } */
+
+static const char * const SHAPE_NAMES[] = { "numbers", "strings", "records" };
+
+#define NUM_SHAPES (sizeof(SHAPE_NAMES) / sizeof(SHAPE_NAMES[0]))
+
+/* Number of top-level table elements */
+static const int COUNTS[] = { 16, 1024, 65536 };
+
+#define NUM_COUNTS (sizeof(COUNTS) / sizeof(COUNTS[0]))
+
+/* Save buffer benchmarks: bytes per write call and total bytes */
+static const size_t CHUNKS[] = { 1, 64, 4096 };
+static const size_t TOTALS[] = { 1024, 65536, 4194304 };
+
+#define NUM_CHUNKS (sizeof(CHUNKS) / sizeof(CHUNKS[0]))
+#define NUM_TOTALS (sizeof(TOTALS) / sizeof(TOTALS[0]))
+
+typedef struct AllocStats
+{
+  size_t count;
+  size_t bytes;
+} AllocStats;
+
+typedef struct Options
+{
+  int json;
+  double time; /* Minimum time per benchmark, seconds */
+  int num_filters;
+  char ** filters;
+} Options;
+
+/* Benchmark state, operations take what they need */
+typedef struct Bench
+{
+  lua_State * L; /* Data to save is at index 1 */
+  AllocStats * stats; /* Counts allocations of L and sb */
+  luabins_SaveBuffer sb;
+  FILE * f;
+
+  int shape;
+  int count;
+  size_t chunk;
+  size_t total;
+
+  unsigned char * data; /* Data of L saved with luabins_save() */
+  size_t len;
+
+  size_t bytes; /* Processed by the last operation */
+} Bench;
+
+/* Runs one operation, returns non-zero on failure */
+typedef int (*BenchFn)(Bench * b);
+
+static int g_first_result = 1;
+
+/******************************************************************************/
+
+/* lua_Alloc which counts allocations, ud is AllocStats */
+static void * counting_alloc(
+    void * ud,
+    void * ptr,
+    size_t osize,
+    size_t nsize
+  )
+{
+  AllocStats * stats = (AllocStats *)ud;
+
+  if (nsize == 0)
+  {
+    free(ptr);
+    return NULL;
+  }
+
+  ++stats->count;
+
+  /* Note Lua 5.2+ passes object type in osize if ptr is NULL */
+  if (ptr == NULL)
+  {
+    stats->bytes += nsize;
+  }
+  else if (nsize > osize)
+  {
+    stats->bytes += nsize - osize;
+  }
+
+  return realloc(ptr, nsize);
+}
+
+static double now()
+{
+#ifdef CLOCK_MONOTONIC
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+#else
+  return (double)clock() / CLOCKS_PER_SEC;
+#endif
+}
+
+/*
+* CPU cycle counter of this thread.
+* Returns -1 if not available.
+*/
+static int cycles_open()
+{
+#ifdef __linux__
+  struct perf_event_attr attr;
+
+  memset(&attr, 0, sizeof(attr));
+  attr.type = PERF_TYPE_HARDWARE;
+  attr.size = sizeof(attr);
+  attr.config = PERF_COUNT_HW_CPU_CYCLES;
+  attr.disabled = 1;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+
+  return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+#else
+  return -1;
+#endif
+}
+
+static void cycles_start(int fd)
+{
+#ifdef __linux__
+  if (fd >= 0)
+  {
+    ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+    ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+  }
+#else
+  (void)fd;
+#endif
+}
+
+/* Returns cycles since cycles_start(), or -1 if not available */
+static double cycles_stop(int fd)
+{
+#ifdef __linux__
+  __u64 count = 0;
+
+  if (fd >= 0)
+  {
+    ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+    if (read(fd, &count, sizeof(count)) == (ssize_t)sizeof(count))
+    {
+      return (double)count;
+    }
+  }
+#else
+  (void)fd;
+#endif
+
+  return -1.0;
+}
+
+/******************************************************************************/
+
+/* Number of saved values in data of given shape */
+static size_t count_values(int shape, int count)
+{
+  /* Table itself, then key and value for each element */
+  return (shape == SHAPE_RECORDS)
+    ? 1 + (size_t)count * (2 + 4 * 2)
+    : 1 + (size_t)count * 2
+    ;
+}
+
+static void push_data(lua_State * L, int shape, int count)
+{
+  char name[32];
+  int i = 0;
+
+  lua_createtable(L, count, 0);
+  for (i = 1; i <= count; ++i)
+  {
+    switch (shape)
+    {
+    case SHAPE_NUMBERS:
+      lua_pushnumber(L, i * 0.25);
+      break;
+
+    case SHAPE_STRINGS:
+      sprintf(name, "string %d", i);
+      lua_pushstring(L, name);
+      break;
+
+    default:
+      lua_createtable(L, 0, 4);
+      lua_pushinteger(L, i);
+      lua_setfield(L, -2, "id");
+      sprintf(name, "item %d", i);
+      lua_pushstring(L, name);
+      lua_setfield(L, -2, "name");
+      lua_pushnumber(L, i * 0.25);
+      lua_setfield(L, -2, "value");
+      lua_pushboolean(L, i % 2);
+      lua_setfield(L, -2, "flag");
+      break;
+    }
+
+    lua_rawseti(L, -2, i);
+  }
+}
+
+/* Writes the same data as push_data() with Lua-less write API */
+static int write_data(luabins_SaveBuffer * sb, int shape, int count)
+{
+  char name[32];
+  int result = LUABINS_ESUCCESS;
+  int i = 0;
+
+  result = lbs_writeTupleSize(sb, 1);
+  if (result == LUABINS_ESUCCESS)
+  {
+    result = lbs_writeTableHeader(sb, count, 0);
+  }
+
+  for (i = 1; result == LUABINS_ESUCCESS && i <= count; ++i)
+  {
+    result = lbs_writeInteger(sb, i);
+    if (result != LUABINS_ESUCCESS)
+    {
+      break;
+    }
+
+    switch (shape)
+    {
+    case SHAPE_NUMBERS:
+      result = lbs_writeNumber(sb, i * 0.25);
+      break;
+
+    case SHAPE_STRINGS:
+      result = lbs_writeString(sb, name, sprintf(name, "string %d", i));
+      break;
+
+    default:
+      result = lbs_writeTableHeader(sb, 0, 4);
+      if (result == LUABINS_ESUCCESS)
+      {
+        result = lbs_writeString(sb, "id", 2);
+      }
+      if (result == LUABINS_ESUCCESS)
+      {
+        result = lbs_writeInteger(sb, i);
+      }
+      if (result == LUABINS_ESUCCESS)
+      {
+        result = lbs_writeString(sb, "name", 4);
+      }
+      if (result == LUABINS_ESUCCESS)
+      {
+        result = lbs_writeString(sb, name, sprintf(name, "item %d", i));
+      }
+      if (result == LUABINS_ESUCCESS)
+      {
+        result = lbs_writeString(sb, "value", 5);
+      }
+      if (result == LUABINS_ESUCCESS)
+      {
+        result = lbs_writeNumber(sb, i * 0.25);
+      }
+      if (result == LUABINS_ESUCCESS)
+      {
+        result = lbs_writeString(sb, "flag", 4);
+      }
+      if (result == LUABINS_ESUCCESS)
+      {
+        result = lbs_writeBoolean(sb, i % 2);
+      }
+      break;
+    }
+  }
+
+  return result;
+}
+
+/* Writes the same data as push_data() with FILE * write API */
+static void fwrite_data(FILE * f, int shape, int count)
+{
+  char name[32];
+  int i = 0;
+
+  lbs_fwriteTupleSize(f, 1);
+  lbs_fwriteTableHeader(f, count, 0);
+
+  for (i = 1; i <= count; ++i)
+  {
+    lbs_fwriteInteger(f, i);
+
+    switch (shape)
+    {
+    case SHAPE_NUMBERS:
+      lbs_fwriteNumber(f, i * 0.25);
+      break;
+
+    case SHAPE_STRINGS:
+      lbs_fwriteString(f, name, sprintf(name, "string %d", i));
+      break;
+
+    default:
+      lbs_fwriteTableHeader(f, 0, 4);
+      lbs_fwriteString(f, "id", 2);
+      lbs_fwriteInteger(f, i);
+      lbs_fwriteString(f, "name", 4);
+      lbs_fwriteString(f, name, sprintf(name, "item %d", i));
+      lbs_fwriteString(f, "value", 5);
+      lbs_fwriteNumber(f, i * 0.25);
+      lbs_fwriteString(f, "flag", 4);
+      lbs_fwriteBoolean(f, i % 2);
+      break;
+    }
+  }
+}
+
+/******************************************************************************/
+
+static int bench_save(Bench * b)
+{
+  size_t len = 0;
+
+  if (luabins_save(b->L, 1, 1) != LUABINS_ESUCCESS)
+  {
+    fprintf(stderr, "luabins_save failed: %s\n", lua_tostring(b->L, -1));
+    return LUABINS_EFAILURE;
+  }
+
+  lua_tolstring(b->L, -1, &len);
+  lua_pop(b->L, 1);
+
+  b->bytes = len;
+
+  return LUABINS_ESUCCESS;
+}
+
+static int bench_load(Bench * b)
+{
+  int count = 0;
+
+  if (luabins_load(b->L, b->data, b->len, &count) != LUABINS_ESUCCESS)
+  {
+    fprintf(stderr, "luabins_load failed: %s\n", lua_tostring(b->L, -1));
+    return LUABINS_EFAILURE;
+  }
+
+  lua_pop(b->L, count);
+
+  b->bytes = b->len;
+
+  return LUABINS_ESUCCESS;
+}
+
+/* Save buffer is reused, as luabins_save() would do with its own */
+static int bench_write(Bench * b)
+{
+  lbsSB_reset(&b->sb);
+  if (write_data(&b->sb, b->shape, b->count) != LUABINS_ESUCCESS)
+  {
+    fprintf(stderr, "write_data failed\n");
+    return LUABINS_EFAILURE;
+  }
+
+  b->bytes = lbsSB_length(&b->sb);
+
+  return LUABINS_ESUCCESS;
+}
+
+static int bench_fwrite(Bench * b)
+{
+  rewind(b->f);
+  fwrite_data(b->f, b->shape, b->count);
+  if (ferror(b->f))
+  {
+    fprintf(stderr, "fwrite_data failed\n");
+    return LUABINS_EFAILURE;
+  }
+
+  b->bytes = (size_t)ftell(b->f);
+
+  return LUABINS_ESUCCESS;
+}
+
+/* Fresh save buffer each time, to see how it grows */
+static int bench_savebuffer(Bench * b)
+{
+  static const unsigned char chunk[4096] = { 0 };
+
+  size_t written = 0;
+  int result = LUABINS_ESUCCESS;
+
+  lbsSB_init(&b->sb, counting_alloc, b->stats);
+
+  for (
+      written = 0;
+      result == LUABINS_ESUCCESS && written < b->total;
+      written += b->chunk
+    )
+  {
+    result = (b->chunk == 1)
+      ? lbsSB_writechar(&b->sb, 0)
+      : lbsSB_write(&b->sb, chunk, b->chunk)
+      ;
+  }
+
+  b->bytes = lbsSB_length(&b->sb);
+  lbsSB_destroy(&b->sb);
+
+  if (result != LUABINS_ESUCCESS)
+  {
+    fprintf(stderr, "save buffer write failed\n");
+  }
+
+  return result;
+}
+
+/******************************************************************************/
+
+static int matches(const Options * opts, const char * name)
+{
+  int i = 0;
+
+  if (opts->num_filters == 0)
+  {
+    return 1;
+  }
+
+  for (i = 0; i < opts->num_filters; ++i)
+  {
+    if (strstr(name, opts->filters[i]) != NULL)
+    {
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+static void print_header(const Options * opts, int cycles_fd)
+{
+  if (opts->json)
+  {
+    printf("{\n");
+    printf("  \"version\": \"%s\",\n", LUABINS_VERSION);
+    printf("  \"lua\": \"%s\",\n", LUA_RELEASE);
+    printf("  \"time\": %g,\n", opts->time);
+    printf("  \"cycles\": %s,\n", (cycles_fd >= 0) ? "true" : "false");
+    printf("  \"results\": [");
+  }
+  else
+  {
+    printf("%s benchmark, %s\n", LUABINS_VERSION, LUA_RELEASE);
+    if (cycles_fd < 0)
+    {
+      printf("CPU cycle counter is not available\n");
+    }
+    printf(
+        "%-24s %10s %10s %10s %10s %12s %12s\n",
+        "name", "iterations", "MB/s", "ns/value",
+        "allocs/op", "bytes/op", "cycles/value"
+      );
+  }
+}
+
+static void print_footer(const Options * opts)
+{
+  if (opts->json)
+  {
+    printf("\n  ]\n}\n");
+  }
+}
+
+/* Formats value, or "-" if it is negative (not available) */
+static const char * format_value(char * buf, const char * fmt, double value)
+{
+  if (value < 0)
+  {
+    return "-";
+  }
+
+  sprintf(buf, fmt, value);
+  return buf;
+}
+
+/*
+* Runs fn until at least opts->time seconds pass, prints results.
+* Negative values of allocs and cycles mean they are not available.
+* Returns non-zero on failure.
+*/
+static int run(
+    const Options * opts,
+    int cycles_fd,
+    const char * name,
+    BenchFn fn,
+    Bench * b,
+    size_t values,
+    int track_allocs
+  )
+{
+  unsigned long iterations = 1;
+  unsigned long i = 0;
+  double elapsed = 0.0;
+  double cycles = -1.0;
+  double allocs = -1.0;
+  double alloc_bytes = -1.0;
+  double ops = 0.0;
+
+  if (!matches(opts, name))
+  {
+    return LUABINS_ESUCCESS;
+  }
+
+  /* Warm up caches and buffers */
+  if (fn(b) != LUABINS_ESUCCESS)
+  {
+    fprintf(stderr, "%s failed\n", name);
+    return LUABINS_EFAILURE;
+  }
+
+  for (;;)
+  {
+    double start = 0.0;
+
+    b->stats->count = 0;
+    b->stats->bytes = 0;
+
+    cycles_start(cycles_fd);
+    start = now();
+
+    for (i = 0; i < iterations; ++i)
+    {
+      if (fn(b) != LUABINS_ESUCCESS)
+      {
+        fprintf(stderr, "%s failed\n", name);
+        return LUABINS_EFAILURE;
+      }
+    }
+
+    elapsed = now() - start;
+    cycles = cycles_stop(cycles_fd);
+
+    if (elapsed >= opts->time)
+    {
+      break;
+    }
+
+    iterations *= (elapsed < opts->time / 10) ? 10 : 2;
+  }
+
+  ops = (double)iterations;
+
+  if (track_allocs)
+  {
+    allocs = (double)b->stats->count / ops;
+    alloc_bytes = (double)b->stats->bytes / ops;
+  }
+
+  if (cycles >= 0)
+  {
+    cycles = cycles / ops / (double)values;
+  }
+
+  {
+    double mbs = (double)b->bytes * ops / elapsed / (1024.0 * 1024.0);
+    double ns = elapsed * 1e9 / ops / (double)values;
+
+    if (opts->json)
+    {
+      char buf[3][64];
+
+      printf(
+          "%s\n    {"
+          " \"name\": \"%s\", \"iterations\": %lu,"
+          " \"bytes\": %lu, \"values\": %lu, \"seconds\": %.6f,"
+          " \"mb_per_s\": %.3f, \"ns_per_value\": %.3f,"
+          " \"allocs_per_op\": %s, \"alloc_bytes_per_op\": %s,"
+          " \"cycles_per_value\": %s"
+          " }",
+          g_first_result ? "" : ",",
+          name,
+          iterations,
+          (unsigned long)b->bytes,
+          (unsigned long)values,
+          elapsed,
+          mbs,
+          ns,
+          (allocs < 0) ? "null" : format_value(buf[0], "%.3f", allocs),
+          (allocs < 0) ? "null" : format_value(buf[1], "%.1f", alloc_bytes),
+          (cycles < 0) ? "null" : format_value(buf[2], "%.3f", cycles)
+        );
+    }
+    else
+    {
+      char buf[3][32];
+
+      printf(
+          "%-24s %10lu %10.1f %10.2f %10s %12s %12s\n",
+          name,
+          iterations,
+          mbs,
+          ns,
+          format_value(buf[0], "%.2f", allocs),
+          format_value(buf[1], "%.0f", alloc_bytes),
+          format_value(buf[2], "%.2f", cycles)
+        );
+    }
+
+    fflush(stdout);
+  }
+
+  g_first_result = 0;
+
+  return LUABINS_ESUCCESS;
+}
+
+/******************************************************************************/
+
+/* Runs all data benchmarks for given shape and count */
+static int run_data(
+    const Options * opts,
+    int cycles_fd,
+    Bench * b,
+    int shape,
+    int count
+  )
+{
+  char names[4][64];
+  const char * shape_name = SHAPE_NAMES[shape];
+  size_t values = count_values(shape, count);
+  int result = LUABINS_ESUCCESS;
+
+  b->shape = shape;
+  b->count = count;
+
+  sprintf(names[0], "save/%s/%d", shape_name, count);
+  sprintf(names[1], "load/%s/%d", shape_name, count);
+  sprintf(names[2], "write/%s/%d", shape_name, count);
+  sprintf(names[3], "fwrite/%s/%d", shape_name, count);
+
+  /* Lua data is large, do not build it for nothing */
+  if (matches(opts, names[0]) || matches(opts, names[1]))
+  {
+    const char * saved = NULL;
+
+    lua_settop(b->L, 0);
+    push_data(b->L, shape, count);
+
+    /* Saved data to load */
+    if (luabins_save(b->L, 1, 1) != LUABINS_ESUCCESS)
+    {
+      fprintf(stderr, "luabins_save failed: %s\n", lua_tostring(b->L, -1));
+      return LUABINS_EFAILURE;
+    }
+
+    saved = lua_tolstring(b->L, -1, &b->len);
+    b->data = (unsigned char *)malloc(b->len);
+    if (b->data == NULL)
+    {
+      fprintf(stderr, "not enough memory\n");
+      return LUABINS_EFAILURE;
+    }
+    memcpy(b->data, saved, b->len);
+    lua_pop(b->L, 1);
+
+    result = run(opts, cycles_fd, names[0], bench_save, b, values, 1);
+    if (result == LUABINS_ESUCCESS)
+    {
+      result = run(opts, cycles_fd, names[1], bench_load, b, values, 1);
+    }
+
+    free(b->data);
+    b->data = NULL;
+    b->len = 0;
+
+    lua_settop(b->L, 0);
+  }
+
+  if (result == LUABINS_ESUCCESS)
+  {
+    result = run(opts, cycles_fd, names[2], bench_write, b, values, 1);
+  }
+
+  if (result == LUABINS_ESUCCESS)
+  {
+    result = run(opts, cycles_fd, names[3], bench_fwrite, b, values, 0);
+  }
+
+  return result;
+}
+
+static int parse_options(Options * opts, int argc, char ** argv)
+{
+  int i = 0;
+
+  opts->json = 0;
+  opts->time = DEFAULT_TIME;
+  opts->num_filters = 0;
+  opts->filters = argv + 1;
+
+  for (i = 1; i < argc; ++i)
+  {
+    if (strcmp(argv[i], "--json") == 0)
+    {
+      opts->json = 1;
+    }
+    else if (strcmp(argv[i], "--time") == 0 && i + 1 < argc)
+    {
+      opts->time = strtod(argv[++i], NULL);
+      if (opts->time <= 0)
+      {
+        fprintf(stderr, "bad time: %s\n", argv[i]);
+        return LUABINS_EFAILURE;
+      }
+    }
+    else if (argv[i][0] == '-')
+    {
+      fprintf(
+          stderr,
+          "usage: %s [--json] [--time <seconds>] [<filter> ...]\n",
+          argv[0]
+        );
+      return LUABINS_EFAILURE;
+    }
+    else
+    {
+      /* Filters are collected at the start of argv */
+      opts->filters[opts->num_filters++] = argv[i];
+    }
+  }
+
+  return LUABINS_ESUCCESS;
+}
+
+int main(int argc, char ** argv)
+{
+  Options opts;
+  AllocStats stats;
+  Bench b;
+  int cycles_fd = -1;
+  int result = LUABINS_ESUCCESS;
+  size_t i = 0;
+  size_t j = 0;
+
+  if (parse_options(&opts, argc, argv) != LUABINS_ESUCCESS)
+  {
+    return 1;
+  }
+
+  stats.count = 0;
+  stats.bytes = 0;
+
+  memset(&b, 0, sizeof(b));
+  b.stats = &stats;
+
+  b.L = lua_newstate(counting_alloc, &stats);
+  if (b.L == NULL)
+  {
+    fprintf(stderr, "can't create Lua state\n");
+    return 1;
+  }
+
+  b.f = tmpfile();
+  if (b.f == NULL)
+  {
+    fprintf(stderr, "can't create temporary file\n");
+    lua_close(b.L);
+    return 1;
+  }
+
+  lbsSB_init(&b.sb, counting_alloc, &stats);
+
+  cycles_fd = cycles_open();
+
+  print_header(&opts, cycles_fd);
+
+  for (i = 0; result == LUABINS_ESUCCESS && i < NUM_SHAPES; ++i)
+  {
+    for (j = 0; result == LUABINS_ESUCCESS && j < NUM_COUNTS; ++j)
+    {
+      result = run_data(&opts, cycles_fd, &b, (int)i, COUNTS[j]);
+    }
+  }
+
+  lbsSB_destroy(&b.sb);
+
+  for (i = 0; result == LUABINS_ESUCCESS && i < NUM_CHUNKS; ++i)
+  {
+    for (j = 0; result == LUABINS_ESUCCESS && j < NUM_TOTALS; ++j)
+    {
+      char name[64];
+
+      b.chunk = CHUNKS[i];
+      b.total = TOTALS[j];
+      if (b.chunk > b.total)
+      {
+        continue;
+      }
+
+      sprintf(
+          name,
+          "savebuffer/%lu/%lu",
+          (unsigned long)b.chunk,
+          (unsigned long)b.total
+        );
+      result = run(
+          &opts,
+          cycles_fd,
+          name,
+          bench_savebuffer,
+          &b,
+          (b.total + b.chunk - 1) / b.chunk,
+          1
+        );
+    }
+  }
+
+  print_footer(&opts);
+
+#ifdef __linux__
+  if (cycles_fd >= 0)
+  {
+    close(cycles_fd);
+  }
+#endif
+
+  fclose(b.f);
+  lua_close(b.L);
+
+  return (result == LUABINS_ESUCCESS) ? 0 : 1;
+}
@@ -16,9 +16,21 @@ int main()
   printf("luabins C API test compiled as plain C\n");
 #endif /* __cplusplus */
 
+  test_byteorder_api();
   test_savebuffer();
   test_write_api();
   test_fwrite_api();
+  test_iovwrite_api();
+  test_fdwrite_api();
+  test_read_api();
+  test_parse_api();
+  test_compress_api();
+  test_checksum_api();
+  test_channel_api();
+  test_stage_api();
+  test_snapshot_api();
+  test_bgsave_api();
+  test_asyncwrite_api();
   test_api();
 
   return 0;
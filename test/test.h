@@ -20,6 +20,22 @@
 void test_savebuffer();
 void test_write_api();
 void test_fwrite_api();
+void test_iovwrite_api();
+void test_fdwrite_api();
+void test_read_api();
+void test_parse_api();
+void test_compress_api();
+void test_checksum_api();
+void test_channel_api();
+void test_stage_api();
+void test_snapshot_api();
+void test_bgsave_api();
+void test_asyncwrite_api();
+void test_byteorder_api();
 void test_api();
 
+/* C++ header tests, see test_cxx.cpp */
+void test_writer();
+void test_view();
+
 #endif /* LUABINS_TEST_H_INCLUDED_ */
@@ -16,6 +16,22 @@ math.randomseed(randomseed)
 -- Utility functions
 -- ----------------------------------------------------------------------------
 
+-- Lua 5.2+ compatibility
+
+local unpack = unpack or table.unpack
+
+-- There is no newproxy() since Lua 5.2. Files are userdata as well,
+-- and each one gets its own metatable here.
+local newproxy = newproxy or function(prototype)
+  local result = io.tmpfile()
+  if prototype == true then
+    debug.setmetatable(result, { })
+  else
+    debug.setmetatable(result, prototype and getmetatable(prototype) or nil)
+  end
+  return result
+end
+
 local invariant = function(v)
   return function()
     return v
@@ -145,8 +161,21 @@ end
 -- Test helper functions
 -- ----------------------------------------------------------------------------
 
-local luabins_local = require 'luabins'
-assert(luabins_local == luabins)
+local luabins = require 'luabins'
+if _VERSION == "Lua 5.1" then
+  assert(luabins == _G.luabins) -- Module is a global only in Lua 5.1
+end
+
+-- Lua 5.3+ saves integers with their own type byte
+local has_integers = (math.type ~= nil)
+
+local SAVED_ONE = has_integers
+  and "I\001\000\000\000\000\000\000\000"
+  or "N\000\000\000\000\000\000\240\063" -- Note number is a double
+
+local SAVED_42 = has_integers
+  and "I\042\000\000\000\000\000\000\000"
+  or "N\000\000\000\000\000\000\069\064"
 
 assert(type(luabins.save) == "function")
 assert(type(luabins.load) == "function")
@@ -349,9 +378,7 @@ print("===== BEGIN FORMAT SANITY TESTS =====")
 do
   do
     local saved = check_ok(1)
-    local expected =
-      "\001".."N"
-      .. "\000\000\000\000\000\000\240\063" -- Note number is a double
+    local expected = "\001"..SAVED_ONE
 
     ensure_equals(
         "1 as number",
@@ -366,7 +393,7 @@ do
       "\001".."T"
       .. "\000\000\000\000".."\001\000\000\000"
       .. "1"
-      .. "N\000\000\000\000\000\000\240\063" -- Note number is a double
+      .. SAVED_ONE
 
     ensure_equals(
         "1 as value",
@@ -380,7 +407,7 @@ do
     local expected =
       "\001".."T"
       .. "\001\000\000\000".."\000\000\000\000"
-      .. "N\000\000\000\000\000\000\240\063" -- Note number is a double
+      .. SAVED_ONE
       .. "1"
 
     ensure_equals(
@@ -393,6 +420,1412 @@ end
 
 print("===== FORMAT SANITY TESTS OK =====")
 
+print("===== BEGIN PACKED ARRAY TESTS =====")
+
+assert(type(luabins.save_ex) == "function")
+
+do
+  local PACKED = { packed = true }
+
+  local check_packed = function(msg, expected, ...)
+    local saved = assert(luabins.save_ex(PACKED, ...))
+    ensure_equals(msg, saved, expected)
+    return check_load_ok(saved, ...)
+  end
+
+  -- Tables which are not packed are saved as usual
+  local check_not_packed = function(msg, ...)
+    check_packed(msg, assert(luabins.save(...)), ...)
+  end
+
+  print("---> packed format tests")
+
+  check_packed(
+      "int8",
+      "\001".."P".."b".."\003\000\000\000".."\001\002\253",
+      { 1, 2, -3 }
+    )
+
+  check_packed(
+      "int16",
+      "\001".."P".."h".."\002\000\000\000".."\001\000".."\044\001",
+      { 1, 300 }
+    )
+
+  check_packed(
+      "int32",
+      "\001".."P".."i".."\001\000\000\000".."\160\134\001\000",
+      { 100000 }
+    )
+
+  check_packed(
+      "double",
+      "\001".."P".."d".."\002\000\000\000"
+      .. "\000\000\000\000\000\000\240\063"
+      .. "\000\000\000\000\000\000\224\063",
+      { 1.0, 0.5 }
+    )
+
+  print("---> not packed tests")
+
+  check_not_packed("empty", { })
+  check_not_packed("hole", { 1, nil, 3 })
+  check_not_packed("hash key", { 1, 2, x = 3 })
+  check_not_packed("not a number", { 1, "two" })
+  check_not_packed("scalars", 1, "two", true)
+
+  print("---> packed round trip tests")
+
+  check_ok({ 1, 2, 3 }) -- Default save is not affected
+  check_load_ok(assert(luabins.save_ex(PACKED, { { 1, 2 }, { 0.5 } })), {
+      { 1, 2 }, { 0.5 }
+    })
+  check_load_ok(assert(luabins.save_ex(PACKED, { -0.0, 2^31, -2^31 })), {
+      -0.0, 2^31, -2^31
+    })
+
+  do
+    local t = { }
+    for i = 1, 1000 do
+      t[i] = i * 3
+    end
+    check_load_ok(assert(luabins.save_ex(PACKED, t)), t)
+  end
+
+  print("---> raw packed load tests")
+
+  do
+    local saved = assert(luabins.save_ex(PACKED, { 1, 300 }, 5))
+    local ok, values, five = luabins.load(saved, { rawpacked = true })
+
+    ensure_equals("load ok", ok, true)
+    ensure_equals("type", type(values), "userdata")
+    ensure_equals("length", #values, 2)
+    ensure_equals("first", values[1], 1)
+    ensure_equals("second", values[2], 300)
+    ensure_equals("out of range", values[3], nil)
+    ensure_equals("bad key", values.x, nil)
+    ensure_equals("scalar", five, 5)
+
+    -- Userdata is saved back as packed array
+    ensure_equals(
+        "resave",
+        assert(luabins.save(values, five)),
+        saved
+      )
+  end
+
+  print("---> corrupt packed data tests")
+
+  check_fail_load(
+      "can't load: corrupt data",
+      "\001".."P".."x".."\000\000\000\000"
+    )
+  check_fail_load(
+      "can't load: corrupt data, bad size",
+      "\001".."P".."h".."\002\000\000\000".."\001\000\044"
+    )
+  check_fail_load(
+      "can't load: corrupt data, bad size",
+      "\001".."P".."b".."\255\255\255\255"
+    )
+end
+
+print("===== PACKED ARRAY TESTS OK =====")
+
+print("===== BEGIN FLOAT32 TESTS =====")
+
+do
+  local FLOAT32 = { float32 = true }
+
+  local check_float32 = function(msg, expected, ...)
+    local saved = assert(luabins.save_ex(FLOAT32, ...))
+    ensure_equals(msg, saved, expected)
+    return check_load_ok(saved, ...)
+  end
+
+  local check_not_float32 = function(msg, ...)
+    check_float32(msg, assert(luabins.save(...)), ...)
+  end
+
+  print("---> float32 format tests")
+
+  check_float32("0.5", "\001".."F".."\000\000\000\063", 0.5)
+  check_float32("1", "\001".."F".."\000\000\128\063", 1.0)
+  check_float32(
+      "float key",
+      "\001".."T".."\000\000\000\000".."\001\000\000\000"
+      .. "F".."\000\000\000\063"
+      .. "F".."\000\000\192\063",
+      { [0.5] = 1.5 }
+    )
+
+  print("---> float32 precision tests")
+
+  check_not_float32("0.1", 0.1)
+  check_not_float32("2^24 + 1", 2^24 + 1)
+  check_not_float32("1e300", 1e300)
+  check_not_float32("huge", math.huge)
+  check_not_float32("mixed", 0.5, 0.1, "0.5")
+  check_ok(0.5) -- Default save is not affected
+
+  print("---> float32 packed tests")
+
+  do
+    local OPTIONS = { packed = true, float32 = true }
+
+    ensure_equals(
+        "packed float",
+        assert(luabins.save_ex(OPTIONS, { 0.5, -1.5 })),
+        "\001".."P".."f".."\002\000\000\000"
+        .. "\000\000\000\063".."\000\000\192\191"
+      )
+
+    ensure_equals(
+        "packed integers",
+        assert(luabins.save_ex(OPTIONS, { 1, 2 })),
+        "\001".."P".."b".."\002\000\000\000".."\001\002"
+      )
+
+    ensure_equals(
+        "packed double",
+        assert(luabins.save_ex(OPTIONS, { 0.5, 0.1 })),
+        assert(luabins.save_ex({ packed = true }, { 0.5, 0.1 }))
+      )
+
+    check_load_ok(
+        assert(luabins.save_ex(OPTIONS, { 0.5, 2^24, -0.25 })),
+        { 0.5, 2^24, -0.25 }
+      )
+  end
+
+  print("---> corrupt float32 data tests")
+
+  check_fail_load("can't load: corrupt data", "\001".."F".."\000\000")
+end
+
+print("===== FLOAT32 TESTS OK =====")
+
+print("===== BEGIN BITSET AND SPARSE TESTS =====")
+
+do
+  local BITSET = { bitset = true }
+  local SPARSE = { sparse = true }
+
+  local check_ex = function(options, msg, expected, ...)
+    local saved = assert(luabins.save_ex(options, ...))
+    ensure_equals(msg, saved, expected)
+    return check_load_ok(saved, ...)
+  end
+
+  print("---> bitset format tests")
+
+  check_ex(
+      BITSET,
+      "bitset",
+      "\001".."B".."\009\000\000\000".."\085\001",
+      { true, false, true, false, true, false, true, false, true }
+    )
+
+  check_ex(
+      BITSET,
+      "mixed values",
+      assert(luabins.save({ true, 1 })),
+      { true, 1 }
+    )
+
+  check_ex(
+      BITSET,
+      "extra key",
+      assert(luabins.save({ true, x = true })),
+      { true, x = true }
+    )
+
+  check_ex(
+      BITSET,
+      "numbers are not affected",
+      assert(luabins.save({ 1, 2 })),
+      { 1, 2 }
+    )
+
+  do
+    local t = { }
+    for i = 1, 1000 do
+      t[i] = (i % 3 == 0)
+    end
+
+    local saved = assert(luabins.save_ex(BITSET, t))
+    ensure_equals("long bitset size", #saved, 1 + 5 + 125)
+    check_load_ok(saved, t)
+  end
+
+  print("---> sparse format tests")
+
+  check_ex(
+      SPARSE,
+      "spans",
+      "\001".."R".."\002\000\000\000".."\003\000\000\000"
+      .. "\001\000\000\000".."\001\000\000\000".."1"
+      .. "\005\000\000\000".."\002\000\000\000".."1".."0",
+      { [1] = true, [5] = true, [6] = false }
+    )
+
+  check_ex(
+      SPARSE,
+      "non-integer key",
+      assert(luabins.save({ [1] = true, [1.5] = true })),
+      { [1] = true, [1.5] = true }
+    )
+
+  check_ex(
+      SPARSE,
+      "zero key",
+      assert(luabins.save({ [0] = true })),
+      { [0] = true }
+    )
+
+  check_ex(SPARSE, "empty table", assert(luabins.save({ })), { })
+
+  check_load_ok(
+      assert(luabins.save_ex(SPARSE, { [10] = { [1e6] = "deep" }, [11] = 1 })),
+      { [10] = { [1e6] = "deep" }, [11] = 1 }
+    )
+
+  check_load_ok(
+      assert(
+          luabins.save_ex(
+              { sparse = true, bitset = true, packed = true },
+              { [3] = { true, false }, [4] = { 1, 2, 3 }, [100] = "x" }
+            )
+        ),
+      { [3] = { true, false }, [4] = { 1, 2, 3 }, [100] = "x" }
+    )
+
+  print("---> corrupt bitset and sparse data tests")
+
+  check_fail_load(
+      "can't load: corrupt data",
+      "\001".."B".."\009\000\000\000".."\085"
+    )
+
+  check_fail_load(
+      "can't load: corrupt data",
+      "\001".."R".."\002\000\000\000".."\002\000\000\000"
+      .. "\002\000\000\000".."\001\000\000\000".."1"
+      .. "\002\000\000\000".."\001\000\000\000".."1"
+    )
+
+  check_fail_load(
+      "can't load: corrupt data",
+      "\001".."R".."\001\000\000\000".."\001\000\000\000"
+      .. "\001\000\000\000".."\001\000\000\000".."-"
+    )
+end
+
+print("===== BITSET AND SPARSE TESTS OK =====")
+
+print("===== BEGIN COMPRESSION TESTS =====")
+
+do
+  local COMPRESS = { compress = true }
+
+  local check_compressed = function(...)
+    local saved = assert(luabins.save_ex(COMPRESS, ...))
+    ensure_equals("marker", saved:sub(1, 1), "\255")
+    return check_load_ok(saved, ...)
+  end
+
+  print("---> compression format tests")
+
+  ensure_equals(
+      "empty tuple",
+      assert(luabins.save_ex(COMPRESS)),
+      "\255".."\001\000\000\000"
+      .. "\001\000\000\000".."\001\000\000\000".."\000"
+    )
+
+  print("---> compression roundtrip tests")
+
+  check_compressed()
+  check_compressed(nil, true, 42, "text")
+  check_compressed({ 1, 2, 3, { a = "b" } })
+
+  do
+    -- Larger than a block, values cross block boundaries
+    local t = { }
+    for i = 1, 20000 do
+      t[i] = { id = i, name = "item"..i, flag = (i % 2 == 0) }
+    end
+
+    local plain = assert(luabins.save(t))
+    local saved = check_compressed(t)
+    assert(#saved < #plain / 2, "data does not compress")
+  end
+
+  do
+    -- Single value larger than a block
+    local s = ("0123456789"):rep(20000)
+    check_compressed(s, s:sub(1, 70000), { s })
+  end
+
+  check_load_ok(
+      assert(
+          luabins.save_ex(
+              { compress = true, packed = true, sparse = true },
+              { 1, 2, 3 }, { [10] = "x" }
+            )
+        ),
+      { 1, 2, 3 }, { [10] = "x" }
+    )
+
+  print("---> corrupt compressed data tests")
+
+  check_fail_load("can't load: corrupt data", "\255")
+  check_fail_load("can't load: corrupt data", "\255".."\001\000\000\000")
+  check_fail_load(
+      "can't load: corrupt data",
+      "\255".."\002\000\000\000"
+      .. "\003\000\000\000".."\003\000\000\000".."\001--"
+    )
+  check_fail_load(
+      "can't load: extra data at end",
+      "\255".."\002\000\000\000"
+      .. "\002\000\000\000".."\002\000\000\000".."\001-"
+      .. "\001\000\000\000"
+    )
+  check_fail_load(
+      "can't load: corrupt data",
+      "\255".."\002\000\000\000"
+      .. "\002\000\000\000".."\002\000\000\000".."\002-"
+    )
+  -- Packed array elements are in a block which fails to decompress
+  check_fail_load(
+      "can't load: corrupt data, bad size",
+      "\255".."\009\000\000\000"
+      .. "\007\000\000\000".."\007\000\000\000"
+      .. "\001".."P".."b".."\002\000\000\000"
+      .. "\002\000\000\000".."\001\000\000\000".."\255"
+    )
+end
+
+print("===== COMPRESSION TESTS OK =====")
+
+print("===== BEGIN CHECKSUM TESTS =====")
+
+do
+  local CHECKSUM = { checksum = true }
+
+  print("---> checksum format tests")
+
+  ensure_equals(
+      "checksum",
+      assert(luabins.save_ex(CHECKSUM, "123456789")),
+      "\254".."\001".."S".."\009\000\000\000".."123456789"
+      .. assert(luabins.save_ex(CHECKSUM, "123456789")):sub(-4)
+    )
+
+  ensure_equals(
+      "empty tuple",
+      assert(luabins.save_ex(CHECKSUM)),
+      "\254".."\000".."\081\083\125\082"
+    )
+
+  print("---> checksum roundtrip tests")
+
+  check_load_ok(assert(luabins.save_ex(CHECKSUM)))
+  check_load_ok(
+      assert(luabins.save_ex(CHECKSUM, 1, "two", { 3 })),
+      1, "two", { 3 }
+    )
+  check_load_ok(
+      assert(
+          luabins.save_ex(
+              { checksum = true, compress = true },
+              ("abc"):rep(100000), { x = 1 }
+            )
+        ),
+      ("abc"):rep(100000), { x = 1 }
+    )
+
+  print("---> corrupt checksummed data tests")
+
+  do
+    local saved = assert(luabins.save_ex(CHECKSUM, "some string payload"))
+    for i = 2, #saved do
+      local corrupt = saved:sub(1, i - 1)
+        .. string.char((saved:byte(i) + 1) % 256)
+        .. saved:sub(i + 1)
+      check_fail_load("can't load: checksum mismatch", corrupt)
+    end
+  end
+
+  check_fail_load("can't load: corrupt data", "\254".."\000")
+  check_fail_load(
+      "can't load: corrupt data, bad size",
+      "\254".."\254".."\003\131\107\013"
+    )
+end
+
+print("===== CHECKSUM TESTS OK =====")
+
+print("===== BEGIN SHAPES TESTS =====")
+
+do
+  local SHAPES = { shapes = true }
+
+  local check_ex = function(options, msg, expected, ...)
+    local saved = assert(luabins.save_ex(options, ...))
+    ensure_equals(msg, saved, expected)
+    return check_load_ok(saved, ...)
+  end
+
+  print("---> shapes format tests")
+
+  check_ex(
+      SHAPES,
+      "definition and reference",
+      "\002"
+      .. "D".."\002\000\000\000"
+        .. "\001\000\000\000".."x".."\001\000\000\000".."y"
+        .. "1".."0"
+      .. "K".."\017\000\000\000".."0".."1",
+      { x = true, y = false },
+      { y = true, x = false }
+    )
+
+  check_ex(
+      SHAPES,
+      "different shapes",
+      "\002"
+      .. "D".."\001\000\000\000".."\001\000\000\000".."x".."1"
+      .. "D".."\001\000\000\000".."\001\000\000\000".."y".."1",
+      { x = true },
+      { y = true }
+    )
+
+  check_ex(
+      SHAPES,
+      "non-string key",
+      assert(luabins.save({ 1, x = true })),
+      { 1, x = true }
+    )
+
+  check_ex(SHAPES, "empty table", assert(luabins.save({ })), { })
+
+  do
+    local t = { }
+    for i = 1, 65 do
+      t["k" .. i] = i
+    end
+
+    check_ex(SHAPES, "too many keys", assert(luabins.save(t)), t)
+  end
+
+  do
+    local records = { }
+    for i = 1, 1000 do
+      records[i] = { id = i, name = "record " .. i, pos = { x = i, y = -i } }
+    end
+
+    local plain = assert(luabins.save(records))
+    local saved = assert(luabins.save_ex(SHAPES, records))
+    assert(#saved < #plain, "shapes do not save space")
+    check_load_ok(saved, records)
+
+    check_load_ok(
+        assert(luabins.save_ex({ shapes = true, compress = true }, records)),
+        records
+      )
+
+    check_load_ok(
+        assert(
+            luabins.save_ex(
+                { shapes = true, sparse = true, packed = true },
+                records,
+                { [2] = { a = { 1, 2 } }, [10] = { a = { 3 } } }
+              )
+          ),
+        records,
+        { [2] = { a = { 1, 2 } }, [10] = { a = { 3 } } }
+      )
+  end
+
+  print("---> corrupt shapes data tests")
+
+  -- No keys
+  check_fail_load(
+      "can't load: corrupt data, bad size",
+      "\001".."D".."\000\000\000\000".."1"
+    )
+
+  -- Nil value
+  check_fail_load(
+      "can't load: corrupt data",
+      "\001".."D".."\001\000\000\000".."\001\000\000\000".."x".."-"
+    )
+
+  -- Distance past data start
+  check_fail_load(
+      "can't load: corrupt data, bad size",
+      "\001".."K".."\002\000\000\000".."1"
+    )
+
+  -- Distance points to a string byte
+  check_fail_load(
+      "can't load: corrupt data",
+      "\002".."S".."\001\000\000\000".."D"
+      .. "K".."\001\000\000\000".."1"
+    )
+
+  -- Distance points to a definition key byte
+  check_fail_load(
+      "can't load: corrupt data",
+      "\002".."D".."\001\000\000\000".."\001\000\000\000".."D".."1"
+      .. "K".."\002\000\000\000".."1"
+    )
+end
+
+print("===== SHAPES TESTS OK =====")
+
+print("===== BEGIN COLUMNAR TESTS =====")
+
+do
+  local RECORDS = { { a = 1, b = true }, { a = -1, b = false } }
+
+  local COLUMNS = "\001"
+    .. "C".."\002\000\000\000".."\002\000\000\000"
+    .. "\001\000\000\000".."a".."\008\000\000\000"
+    .. "\001\000\000\000".."b".."\006\000\000\000"
+    .. "P".."b".."\002\000\000\000".."\001\255"
+    .. "B".."\002\000\000\000".."\001"
+
+  local check_column = function(saved, name, expected, options)
+    local ok, column = luabins.load_column(saved, name, options)
+    ensure_equals("load_column ok", ok, true)
+    assert(deepequals(column, expected), "column mismatch")
+  end
+
+  print("---> columnar format tests")
+
+  ensure_equals("columns", assert(luabins.save_columnar(RECORDS)), COLUMNS)
+  check_load_ok(COLUMNS, RECORDS)
+
+  check_column(COLUMNS, "a", { 1, -1 })
+  check_column(COLUMNS, "b", { true, false })
+  check_column(COLUMNS, "c", nil)
+
+  do
+    local ok, column = luabins.load_column(COLUMNS, "a", { rawpacked = true })
+    ensure_equals("rawpacked ok", ok, true)
+    ensure_equals("rawpacked type", type(column), "userdata")
+    ensure_equals("rawpacked value", column[2], -1)
+  end
+
+  check_load_ok(assert(luabins.save_columnar({ })), { })
+
+  do
+    local records = { }
+    for i = 1, 1000 do
+      records[i] =
+      {
+        ts = 1e9 + i;
+        price = i / 4;
+        name = (i % 10 == 0) and ("n" .. i) or nil;
+        flag = (i % 3 == 0);
+        pos = { x = i, y = -i };
+      }
+    end
+
+    local saved = assert(luabins.save_columnar(records))
+    check_load_ok(saved, records)
+
+    local prices = { }
+    for i = 1, #records do
+      prices[i] = records[i].price
+    end
+    check_column(saved, "price", prices)
+
+    local names = { }
+    for i = 10, #records, 10 do
+      names[i] = records[i].name
+    end
+    check_column(saved, "name", names)
+
+    local options = { shapes = true, compress = true, checksum = true }
+    saved = assert(luabins.save_columnar(records, options))
+    check_load_ok(saved, records)
+    check_column(saved, "price", prices)
+
+    local positions = { }
+    for i = 1, #records do
+      positions[i] = records[i].pos
+    end
+    check_column(saved, "pos", positions)
+  end
+
+  do
+    -- Directory crosses compressed block boundary
+    local records = { { }, { } }
+    for i = 1, 4000 do
+      local name = ("column_%032d"):format(i)
+      records[1][name] = i
+      records[2][name] = -i
+    end
+
+    local saved = assert(luabins.save_columnar(records, { compress = true }))
+    check_load_ok(saved, records)
+    check_column(saved, ("column_%032d"):format(3999), { 3999, -3999 })
+  end
+
+  print("---> columnar save errors tests")
+
+  local ERROR = "can't save: not an array of non-empty tables with string keys"
+
+  local check_fail_save_columnar = function(...)
+    local res, err = luabins.save_columnar(...)
+    ensure_equals("result", res, nil)
+    ensure_equals("error message", err, ERROR)
+  end
+
+  check_fail_save_columnar(42)
+  check_fail_save_columnar({ 1 })
+  check_fail_save_columnar({ { a = 1 }, { } })
+  check_fail_save_columnar({ { a = 1 }, { [1] = 1 } })
+  check_fail_save_columnar({ { a = 1 }, x = { a = 1 } })
+  check_fail_save_columnar({ [2] = { a = 1 } })
+
+  print("---> corrupt columnar data tests")
+
+  -- Records without columns
+  check_fail_load(
+      "can't load: corrupt data, bad size",
+      "\001".."C".."\001\000\000\000".."\000\000\000\000"
+    )
+
+  -- Column size mismatch
+  check_fail_load(
+      "can't load: corrupt data, bad size",
+      "\001".."C".."\001\000\000\000".."\001\000\000\000"
+      .. "\001\000\000\000".."a".."\005\000\000\000"
+      .. "B".."\001\000\000\000".."\001"
+    )
+
+  -- Record without fields
+  check_fail_load(
+      "can't load: corrupt data",
+      "\001".."C".."\002\000\000\000".."\001\000\000\000"
+      .. "\001\000\000\000".."a".."\006\000\000\000"
+      .. "B".."\001\000\000\000".."\001"
+    )
+
+  -- Key out of records range
+  check_fail_load(
+      "can't load: corrupt data",
+      "\001".."C".."\001\000\000\000".."\001\000\000\000"
+      .. "\001\000\000\000".."a".."\006\000\000\000"
+      .. "B".."\002\000\000\000".."\003"
+    )
+
+  do
+    local res, err = luabins.load_column(assert(luabins.save(1)), "a")
+    ensure_equals("not columnar result", res, nil)
+    ensure_equals("not columnar error", err, "can't load: corrupt data")
+  end
+end
+
+print("===== COLUMNAR TESTS OK =====")
+
+print("===== BEGIN DIFF TESTS =====")
+
+do
+  local copy = function(t)
+    return select(2, assert(luabins.load(assert(luabins.save(t)))))
+  end
+
+  local check_patch = function(old, new, options)
+    local delta = assert(luabins.diff(old, new, options))
+    local target = copy(old)
+    local patched = assert(luabins.patch(target, delta))
+    ensure_equals("patched in place", patched, target)
+    assert(deepequals(patched, new), "patched table mismatch")
+
+    -- Old state may be a saved string as well
+    local saved = assert(luabins.save(old))
+    assert(
+        deepequals(
+            assert(luabins.patch(copy(old), assert(luabins.diff(saved, new)))),
+            new
+          ),
+        "diff from string mismatch"
+      )
+    assert(
+        deepequals(assert(luabins.patch(saved, delta)), new),
+        "patched string mismatch"
+      )
+
+    return delta
+  end
+
+  print("---> diff format tests")
+
+  ensure_equals(
+      "diff format",
+      assert(luabins.diff({ a = 1, b = { c = true } }, { b = { c = false } })),
+      "\253" .. "\002\000\000\000"
+        .. "\001\000\000\000" .. "S\001\000\000\000a" .. "-"
+        .. "\002\000\000\000" .. "S\001\000\000\000b"
+          .. "S\001\000\000\000c" .. "0"
+    )
+
+  ensure_equals(
+      "no changes",
+      assert(luabins.diff({ 1, { 2 }, x = "y" }, { 1, { 2 }, x = "y" })),
+      "\253\000\000\000\000"
+    )
+
+  print("---> diff and patch tests")
+
+  check_patch({ }, { })
+  check_patch({ }, { 1, 2, 3, a = { b = { c = "d" } } })
+  check_patch({ 1, 2, 3, a = { b = { c = "d" } } }, { })
+  check_patch({ a = { 1, 2 } }, { a = 42 })
+  check_patch({ a = 42 }, { a = { 1, 2 } })
+  check_patch({ a = { b = { c = 1 } } }, { a = { b = { c = 2 } } })
+  check_patch({ [true] = false, [1.5] = "x" }, { [true] = true, [2.5] = "x" })
+
+  do
+    local old = { }
+    for i = 1, 1000 do
+      old["key" .. i] = { id = i, value = i * 2, tags = { "a", "b" } }
+    end
+
+    local new = copy(old)
+    new.key10.value = -1
+    new.key20 = nil
+    new.key30.tags[3] = "c"
+    new.added = { 1, 2, 3 }
+
+    local delta = check_patch(old, new)
+    assert(#delta < 256, "patch is too large: " .. #delta)
+
+    check_patch(old, new, { packed = true, shapes = true })
+    check_patch(old, new, { compress = true, checksum = true })
+  end
+
+  print("---> bad diff and patch tests")
+
+  do
+    local res, err = luabins.diff(42, { })
+    ensure_equals("diff result", res, nil)
+    ensure_equals("diff error", err, "can't diff: not a table")
+
+    res, err = luabins.diff(assert(luabins.save(1, 2)), { })
+    ensure_equals("diff tuple result", res, nil)
+    ensure_equals("diff tuple error", err, "can't diff: not a table")
+
+    res, err = luabins.diff({ }, { [{ }] = 1 })
+    ensure_equals("diff table key result", res, nil)
+    ensure_equals(
+        "diff table key error",
+        err,
+        "can't save: unsupported type detected"
+      )
+
+    res, err = luabins.patch(42, assert(luabins.diff({ }, { })))
+    ensure_equals("patch result", res, nil)
+    ensure_equals("patch error", err, "can't patch: not a table")
+
+    res, err = luabins.patch({ }, assert(luabins.save({ })))
+    ensure_equals("patch not a patch result", res, nil)
+    ensure_equals("patch not a patch error", err, "can't load: corrupt data")
+
+    local delta = assert(luabins.diff({ a = { b = 1 } }, { a = { b = 2 } }))
+
+    res, err = luabins.patch({ }, delta)
+    ensure_equals("patch path result", res, nil)
+    ensure_equals("patch path error", err, "can't patch: path not found")
+
+    res, err = luabins.patch({ a = 1 }, delta)
+    ensure_equals("patch path result", res, nil)
+    ensure_equals("patch path error", err, "can't patch: path not found")
+
+    res, err = luabins.patch({ a = { } }, delta .. "-")
+    ensure_equals("patch tail result", res, nil)
+    ensure_equals("patch tail error", err, "can't load: extra data at end")
+
+    -- Bad patch leaves table as it was
+    do
+      local target = { a = { b = 1 }, c = 1 }
+      delta = assert(luabins.diff(target, { a = { b = 2 }, c = 2 }))
+
+      res, err = luabins.patch(target, delta:sub(1, -2))
+      ensure_equals("patch truncated result", res, nil)
+      ensure_equals("patch truncated a.b", target.a.b, 1)
+      ensure_equals("patch truncated c", target.c, 1)
+
+      res, err = luabins.patch(target, delta .. "-")
+      ensure_equals("patch bad tail result", res, nil)
+      ensure_equals("patch bad tail a.b", target.a.b, 1)
+      ensure_equals("patch bad tail c", target.c, 1)
+    end
+
+    -- Nil path key
+    res, err = luabins.patch(
+        { },
+        "\253" .. "\001\000\000\000" .. "\001\000\000\000" .. "-" .. "1"
+      )
+    ensure_equals("patch nil key result", res, nil)
+    ensure_equals("patch nil key error", err, "can't load: corrupt data")
+
+    -- Empty path
+    res, err = luabins.patch(
+        { },
+        "\253" .. "\001\000\000\000" .. "\000\000\000\000" .. "1" .. "1"
+      )
+    ensure_equals("patch empty path result", res, nil)
+    ensure_equals(
+        "patch empty path error",
+        err,
+        "can't load: corrupt data, bad size"
+      )
+  end
+end
+
+print("===== DIFF TESTS OK =====")
+
+print("===== BEGIN CUSTOM TYPE TESTS =====")
+
+do
+  -- Decimal number userdata, holding its value as a string
+  local prototype = newproxy(true)
+  local decimal_mt = getmetatable(prototype)
+  local values = setmetatable({ }, { __mode = "k" })
+
+  local decimal = function(value)
+    local result = newproxy(prototype)
+    values[result] = value
+    return result
+  end
+
+  local decimal_equals = function(lhs, rhs)
+    if type(lhs) == "userdata" and type(rhs) == "userdata" then
+      return getmetatable(lhs) == getmetatable(rhs)
+        and values[lhs] == values[rhs]
+    end
+    return deepequals(lhs, rhs)
+  end
+
+  print("---> register_type tests")
+
+  assert(
+      luabins.register_type(
+          "decimal",
+          decimal_mt,
+          function(value) return values[value] end,
+          decimal
+        ) == true
+    )
+
+  ensure_equals(
+      "custom type format",
+      assert(luabins.save(decimal("1.50"))),
+      "\001" .. "X" .. "\007\000\000\000" .. "decimal"
+        .. "\004\000\000\000" .. "1.50"
+    )
+
+  check_fn_ok(decimal_equals, decimal("0"))
+  check_fn_ok(decimal_equals, decimal(""), decimal("-12.345"), 42)
+
+  do
+    local t = { price = decimal("9.99"), { qty = decimal("3") } }
+    local _, loaded = assert(luabins.load(assert(luabins.save(t))))
+    ensure_equals("price", values[loaded.price], "9.99")
+    ensure_equals("qty", values[loaded[1].qty], "3")
+    ensure_equals("metatable", getmetatable(loaded.price), decimal_mt)
+
+    _, loaded = assert(
+        luabins.load(
+            assert(
+                luabins.save_ex(
+                    { shapes = true, compress = true, checksum = true },
+                    t
+                  )
+              )
+          )
+      )
+    ensure_equals("enveloped price", values[loaded.price], "9.99")
+  end
+
+  print("---> bad custom type tests")
+
+  check_fail_save("can't save: unsupported type detected", newproxy(true))
+
+  check_fail_load(
+      "can't load: unknown custom type",
+      "\001" .. "X" .. "\001\000\000\000" .. "z" .. "\000\000\000\000"
+    )
+  check_fail_load(
+      "can't load: corrupt data, bad size",
+      "\001" .. "X" .. "\007\000\000\000" .. "decimal"
+        .. "\004\000\000\000" .. "1.5"
+    )
+
+  do
+    local broken = newproxy(true)
+    assert(
+        luabins.register_type(
+            "broken",
+            getmetatable(broken),
+            function() return nil end,
+            function() error("broken") end
+          )
+      )
+
+    check_fail_save("can't save: custom type encoder failed", broken)
+    check_fail_load(
+        "can't load: custom type decoder failed",
+        "\001" .. "X" .. "\006\000\000\000" .. "broken"
+          .. "\000\000\000\000"
+      )
+  end
+
+  assert(not pcall(luabins.register_type, "", decimal_mt, tostring, tostring))
+  assert(not pcall(luabins.register_type, "x", 42, tostring, tostring))
+  assert(not pcall(luabins.register_type, "x", decimal_mt, tostring))
+
+  -- Registering metatable again replaces old name
+  local saved = assert(luabins.save(decimal("7")))
+  assert(
+      luabins.register_type(
+          "decimal2",
+          decimal_mt,
+          function(value) return values[value] end,
+          decimal
+        )
+    )
+  check_fail_load("can't load: unknown custom type", saved)
+  ensure_equals(
+      "renamed custom type format",
+      assert(luabins.save(decimal("7"))),
+      "\001" .. "X" .. "\008\000\000\000" .. "decimal2"
+        .. "\001\000\000\000" .. "7"
+    )
+end
+
+print("===== CUSTOM TYPE TESTS OK =====")
+
+print("===== BEGIN INTEGER TESTS =====")
+
+do
+  print("---> integer load tests")
+
+  -- Integers load everywhere, as numbers where Lua has no integers
+  check_load_ok("\001".."I".."\042\000\000\000\000\000\000\000", 42)
+  check_load_ok(
+      "\001".."I".."\254\255\255\255\255\255\255\255",
+      -2
+    )
+  check_load_ok(
+      "\001".."T".."\000\000\000\000".."\001\000\000\000"
+      .. "I".."\001\000\000\000\000\000\000\000".."1",
+      { [1] = true }
+    )
+  check_fail_load(
+      "can't load: corrupt data",
+      "\001".."I".."\001\000\000"
+    )
+
+  if has_integers then
+    print("---> integer subtype tests")
+
+    local same_subtype = function(lhs, rhs)
+      return lhs == rhs and math.type(lhs) == math.type(rhs)
+    end
+
+    check_fn_ok(same_subtype, 1, 1.0, -0.5)
+    check_fn_ok(same_subtype, math.maxinteger, math.mininteger)
+    check_fn_ok(same_subtype, 9007199254740993) -- 2^53 + 1
+
+    ensure_equals(
+        "float is a number",
+        assert(luabins.save(1.0)),
+        "\001".."N".."\000\000\000\000\000\000\240\063"
+      )
+
+    ensure_equals(
+        "integer is not a float32",
+        assert(luabins.save_ex({ float32 = true }, 1)),
+        "\001"..SAVED_ONE
+      )
+
+    print("---> packed integer subtype tests")
+
+    local PACKED = { packed = true }
+
+    local check_packed_subtypes = function(msg, packed, values)
+      local saved = assert(luabins.save_ex(PACKED, values))
+      ensure_equals(msg, saved:sub(2, 2) == "P", packed)
+
+      local ok, loaded = luabins.load(saved)
+      ensure_equals("load ok", ok, true)
+      for i = 1, #values do
+        assert(same_subtype(loaded[i], values[i]), msg)
+      end
+    end
+
+    check_packed_subtypes("integers", true, { 1, 300, -100000 })
+    check_packed_subtypes("integral floats", true, { 1.0, 2.0 })
+    check_packed_subtypes("mixed", false, { 1, 2.0 })
+    check_packed_subtypes("large integers", false, { 1, 2147483648 })
+  end
+
+  if jit then
+    print("---> LuaJIT boxed integer tests")
+
+    local ffi = require 'ffi'
+
+    local big = ffi.new("int64_t", 2^62) + 1
+    local saved = assert(luabins.save(big, ffi.new("uint64_t", 5)))
+    ensure_equals(
+        "boxed integers",
+        saved,
+        "\002"
+        .. "I".."\001\000\000\000\000\000\000\064"
+        .. "I".."\005\000\000\000\000\000\000\000"
+      )
+
+    -- Integers which do not fit number exactly load boxed
+    local ok, loaded_big, loaded_small = luabins.load(saved)
+    ensure_equals("load ok", ok, true)
+    ensure_equals("big type", type(loaded_big), "cdata")
+    assert(loaded_big == big, "big value mismatch")
+    ensure_equals("small", loaded_small, 5)
+
+    check_fail_save(
+        "can't save: unsupported type detected",
+        ffi.new("double", 1)
+      )
+  end
+end
+
+print("===== INTEGER TESTS OK =====")
+
+if luabins.channel then
+  print("===== BEGIN CHANNEL TESTS =====")
+
+  local ch = assert(luabins.channel(256))
+
+  ensure_equals("pop empty", ch:pop(), false)
+
+  ensure_equals("push", ch:push(1, "two", { 3 }), true)
+  ensure_equals("push empty tuple", ch:push(), true)
+
+  do
+    local ok, one, two, three = ch:pop()
+    ensure_equals("pop ok", ok, true)
+    ensure_equals("first", one, 1)
+    ensure_equals("second", two, "two")
+    ensure_equals("third", three[1], 3)
+
+    ensure_equals("pop empty tuple", select("#", ch:pop()), 1)
+    ensure_equals("pop empty again", ch:pop(), false)
+  end
+
+  do
+    local res, err = ch:push(function() end)
+    ensure_equals("bad type", res, nil)
+    ensure_equals(
+        "bad type error",
+        err,
+        "can't save: unsupported type detected"
+      )
+
+    res, err = ch:push(("x"):rep(256))
+    ensure_equals("too large", res, nil)
+    ensure_equals("too large error", err, "can't push: message is too large")
+
+    local pushed = 0
+    while ch:push(("x"):rep(50)) do
+      pushed = pushed + 1
+    end
+    assert(pushed > 0, "channel should take some messages")
+
+    res, err = ch:push(("x"):rep(50))
+    ensure_equals("full error", err, "can't push: channel is full")
+
+    for i = 1, pushed do
+      local ok, str = ch:pop()
+      ensure_equals("pop ok", ok, true)
+      ensure_equals("pop message", #str, 50)
+    end
+    ensure_equals("pop drained", ch:pop(), false)
+  end
+
+  do
+    -- Other handle to the same channel, as another state would open it
+    local other = assert(luabins.channel(ch:pointer()))
+    assert(other:push(42))
+    local ok, value = ch:pop()
+    ensure_equals("shared ok", ok, true)
+    ensure_equals("shared value", value, 42)
+  end
+
+  do
+    -- Each open takes own reference, pointer may be opened again
+    local pointer = ch:pointer()
+    local first = assert(luabins.channel(pointer))
+    local second = assert(luabins.channel(pointer))
+    first = nil
+    collectgarbage("collect")
+
+    assert(second:push("twice"))
+    local ok, value = ch:pop()
+    ensure_equals("reopened ok", ok, true)
+    ensure_equals("reopened value", value, "twice")
+
+    second = nil
+    collectgarbage("collect")
+    assert(ch:push(1))
+    ensure_equals("still open", select(2, ch:pop()), 1)
+  end
+
+  print("===== CHANNEL TESTS OK =====")
+end
+
+print("===== BEGIN STAGE TESTS =====")
+
+do
+  local values =
+  {
+    { 1, "two", { 3, { x = true } } };
+    { };
+    { { [1] = "a", [3] = "b", key = { } } };
+  }
+
+  local blobs = { }
+  for i = 1, #values do
+    blobs[i] = assert(luabins.save(unpack(values[i])))
+  end
+  blobs[#blobs + 1] = assert(luabins.save_ex(
+      { compress = true, checksum = true, packed = true },
+      { 1.5, 2.5, 3.5 }
+    ))
+  blobs[#blobs + 1] = blobs[1]:sub(1, -2) -- Truncated
+  local num_blobs = #blobs
+
+  for _, num_threads in ipairs({ 1, 4 }) do
+    local staged = luabins.stage(blobs, num_threads)
+    ensure_equals("staged count", #staged, num_blobs)
+
+    -- Staged strings are kept
+    blobs[1] = nil
+    collectgarbage("collect")
+
+    for i = 1, #values do
+      local n, loaded = pack(staged:load(i))
+      ensure_equals("staged ok", loaded[1], true)
+      ensure_equals("staged num values", n - 1, #values[i])
+      assert(
+          deepequals({ select(2, unpack(loaded, 1, n)) }, values[i]),
+          "staged values mismatch"
+        )
+    end
+
+    do
+      local ok, array = staged:load(#values + 1)
+      ensure_equals("staged compressed ok", ok, true)
+      assert(deepequals(array, { 1.5, 2.5, 3.5 }), "staged array mismatch")
+    end
+
+    do
+      local res, err = staged:load(num_blobs)
+      ensure_equals("staged bad res", res, nil)
+      assert(err:find("can't load: corrupt data", 1, true), err)
+    end
+
+    blobs[1] = assert(luabins.save(unpack(values[1])))
+  end
+
+  ensure_equals("stage empty", #luabins.stage({ }), 0)
+  do
+    local ok, err = pcall(luabins.stage, { 1 })
+    ensure_equals("stage bad blobs", ok, false)
+    assert(err:find("array of strings expected", 1, true), err)
+  end
+end
+
+print("===== STAGE TESTS OK =====")
+
+print("===== BEGIN PARALLEL SAVE TESTS =====")
+
+do
+  local big = { }
+  for i = 1, 50000 do
+    big[i] = (i % 2 == 0) and ("item " .. i) or { i, i / 3, [true] = false }
+  end
+  big.name = "big"
+
+  local tuples =
+  {
+    { n = 0 };
+    { n = 6, nil, true, false, 42, 0.5, "luabins" };
+    { n = 2, { 1, 2, { x = "y" } }, big };
+  }
+
+  for _, num_threads in ipairs({ 1, 4 }) do
+    for i = 1, #tuples do
+      local n = tuples[i].n
+      local options = { threads = num_threads }
+      ensure_equals(
+          "save_parallel " .. i,
+          luabins.save_parallel(options, unpack(tuples[i], 1, n)),
+          luabins.save(unpack(tuples[i], 1, n))
+        )
+
+      options.compress = true
+      options.checksum = true
+      ensure_equals(
+          "save_parallel enveloped " .. i,
+          luabins.save_parallel(options, unpack(tuples[i], 1, n)),
+          luabins.save_ex(options, unpack(tuples[i], 1, n))
+        )
+    end
+  end
+
+  do
+    local res, err = luabins.save_parallel(nil, { 1, { print } })
+    ensure_equals("save_parallel bad res", res, nil)
+    ensure_equals(
+        "save_parallel bad err",
+        err,
+        "can't save: unsupported type detected"
+      )
+
+    res, err = luabins.save_parallel({ packed = true }, { 1, 2, 3 })
+    ensure_equals("save_parallel packed res", res, nil)
+    ensure_equals(
+        "save_parallel packed err",
+        err,
+        "can't save: option not supported by parallel save"
+      )
+  end
+end
+
+print("===== PARALLEL SAVE TESTS OK =====")
+
+print("===== BEGIN BGSAVE TESTS =====")
+
+do
+  local read_file = function(path)
+    local f = assert(io.open(path, "rb"))
+    local data = f:read("*a")
+    f:close()
+    return data
+  end
+
+  local path = os.tmpname()
+  local t = { 1, "two", { three = 3 } }
+  local expected = assert(luabins.save(t, "luabins"))
+
+  local job, err = luabins.bgsave(path, t, "luabins")
+  if not job and err == "can't bgsave: not supported on this platform" then
+    print("bgsave is not supported, skipping")
+  else
+    assert(job, err)
+
+    -- Child saves values as they were at fork
+    t[1] = "changed"
+
+    ensure_equals("bgsave wait", job:wait(), true)
+    ensure_equals("bgsave wait again", job:wait(), true)
+    ensure_equals("bgsave poll after wait", job:poll(), true)
+    ensure_equals("bgsave data", read_file(path), expected)
+
+    job = assert(luabins.bgsave(path))
+    local done = job:poll()
+    while done == false do
+      done = job:poll()
+    end
+    ensure_equals("bgsave poll", done, true)
+    ensure_equals("bgsave empty data", read_file(path), luabins.save())
+
+    -- Failed save keeps old file
+    job = assert(luabins.bgsave(path, { 1, { print } }))
+    local res, err = job:wait()
+    ensure_equals("bgsave bad res", res, nil)
+    ensure_equals(
+        "bgsave bad err",
+        err,
+        "can't save: unsupported type detected"
+      )
+    ensure_equals("bgsave old data", read_file(path), luabins.save())
+
+    job = assert(luabins.bgsave(path .. "/no/such/dir", 42))
+    res, err = job:wait()
+    ensure_equals("bgsave bad path res", res, nil)
+    assert(err:find("can't bgsave: can't open file", 1, true), err)
+  end
+
+  os.remove(path)
+end
+
+print("===== BGSAVE TESTS OK =====")
+
+print("===== BEGIN SAVE ASYNC TESTS =====")
+
+do
+  local read_file = function(path)
+    local f = assert(io.open(path, "rb"))
+    local data = f:read("*a")
+    f:close()
+    return data
+  end
+
+  local path = os.tmpname()
+  local t = { 1, "two", { three = 3 } }
+  local expected = assert(luabins.save(t, "luabins"))
+
+  local handle, err = luabins.save_async(path, t, "luabins")
+  assert(handle, err)
+
+  local res
+  res, err = handle:wait()
+  if res == nil and err:find("is not supported", 1, true) then
+    print("save_async is not supported, skipping")
+  else
+    ensure_equals("save_async wait", res, true)
+    ensure_equals("save_async wait again", handle:wait(), true)
+    ensure_equals("save_async poll after wait", handle:poll(), true)
+    ensure_equals("save_async data", read_file(path), expected)
+
+    handle = assert(luabins.save_async(path))
+    local done = handle:poll()
+    while done == false do
+      done = handle:poll()
+    end
+    ensure_equals("save_async poll", done, true)
+    ensure_equals("save_async empty data", read_file(path), luabins.save())
+
+    -- Save errors are reported right away
+    res, err = luabins.save_async(path, { 1, { print } })
+    ensure_equals("save_async bad res", res, nil)
+    ensure_equals(
+        "save_async bad err",
+        err,
+        "can't save: unsupported type detected"
+      )
+
+    handle = assert(luabins.save_async(path .. "/no/such/dir", 42))
+    res, err = handle:wait()
+    ensure_equals("save_async bad path res", res, nil)
+    assert(err:find("can't write: open failed", 1, true), err)
+  end
+
+  os.remove(path)
+end
+
+print("===== SAVE ASYNC TESTS OK =====")
+
 print("===== BEGIN AUTOCOLLAPSE TESTS =====")
 
 -- Note: those are ad-hoc tests, tuned for old implementation
@@ -527,8 +1960,7 @@ do
         {
           "0" .. "0";
           "1" .. "1";
-           -- Note number is a double
-          "N\000\000\000\000\000\000\240\063" .. "1";
+          SAVED_ONE .. "1";
         },
         ""
       )
@@ -573,8 +2005,8 @@ do
         {
           "0" .. "0";
           "1" .. "1";
-          "N\000\000\000\000\000\000\069\064" .. "1";
-          "N\000\000\000\000\000\000\240\063" .. "1";
+          SAVED_42 .. "1";
+          SAVED_ONE .. "1";
         },
         ""
       )
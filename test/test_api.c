@@ -4,7 +4,9 @@
 * See copyright notice in luabins.h
 */
 
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -19,6 +21,9 @@ extern "C" {
 #endif /* __cplusplus */
 
 #include "luabins.h"
+#include "savebuffer.h"
+#include "iovwrite.h"
+#include "bgsave.h"
 
 #define STACKGUARD "-- stack ends here --"
 
@@ -180,6 +185,48 @@ static void check_testdataset_on_top(lua_State * L)
   }
 }
 
+#define INTMT "test.int"
+
+/* Custom type callbacks for int userdata, ud counts calls */
+static int encode_int(
+    lua_State * L,
+    int index,
+    struct luabins_SaveBuffer * sb,
+    void * ud
+  )
+{
+  ++*(int *)ud;
+  if (*(int *)lua_touserdata(L, index) < 0)
+  {
+    return luaL_error(L, "negative int");
+  }
+  return lbsSB_write(
+      sb,
+      (const unsigned char *)lua_touserdata(L, index),
+      sizeof(int)
+    );
+}
+
+static int decode_int(
+    lua_State * L,
+    const unsigned char * data,
+    size_t len,
+    void * ud
+  )
+{
+  ++*(int *)ud;
+  if (len != sizeof(int))
+  {
+    return 1;
+  }
+
+  memcpy(lua_newuserdata(L, sizeof(int)), data, sizeof(int));
+  luaL_getmetatable(L, INTMT);
+  lua_setmetatable(L, -2);
+
+  return 0;
+}
+
 void test_api()
 {
   int base = 0;
@@ -187,7 +234,7 @@ void test_api()
   const unsigned char * str;
   size_t length = 0;
 
-  lua_State * L = lua_open();
+  lua_State * L = luaL_newstate();
   luaL_openlibs(L);
 
   printf("---> BEGIN test_api\n");
@@ -305,6 +352,339 @@ void test_api()
     /* Assuming further tests are done in test.lua */
   }
 
+  {
+    /* Scatter/gather save must match plain save */
+
+    int num_items = push_testdataset(L);
+    lbs_IovWriter w;
+
+    {
+      void * alloc_ud = NULL;
+      lua_Alloc alloc_fn = lua_getallocf(L, &alloc_ud);
+      lbs_iovwriterInit(&w, 1, alloc_fn, alloc_ud);
+    }
+
+    if (luabins_savev(L, base + 1, base + num_items, &w) != 0)
+    {
+      fprintf(stderr, "%s\n", lua_tostring(L, -1));
+      fatal(L, "test dataset savev failed");
+    }
+
+    check(L, base, num_items);
+
+    if (w.num_refs != 1)
+    {
+      fatal(L, "savev: string reference expected");
+    }
+
+    if (luabins_save(L, base + 1, base + num_items) != 0)
+    {
+      fprintf(stderr, "%s\n", lua_tostring(L, -1));
+      fatal(L, "test dataset save failed");
+    }
+
+    str = (const unsigned char *)lua_tolstring(L, -1, &length);
+
+    {
+      size_t segment = 0;
+      size_t pos = 0;
+      struct iovec iov;
+
+      if (lbs_iovwriterLength(&w) != length)
+      {
+        fatal(L, "savev length mismatch");
+      }
+
+      while (lbs_iovwriterSegments(&w, segment, &iov, 1, &segment) > 0)
+      {
+        if (memcmp(str + pos, iov.iov_base, iov.iov_len) != 0)
+        {
+          fatal(L, "savev data mismatch");
+        }
+        pos += iov.iov_len;
+      }
+    }
+
+    lbs_iovwriterDestroy(&w);
+
+    lua_pop(L, 1 + num_items);
+    check(L, base, 0);
+  }
+
+  {
+    /* Parallel save must match plain save */
+
+    int num_items = push_testdataset(L);
+    const unsigned char * parallel = NULL;
+    size_t parallel_length = 0;
+
+    if (luabins_save(L, base + 1, base + num_items) != 0)
+    {
+      fprintf(stderr, "%s\n", lua_tostring(L, -1));
+      fatal(L, "test dataset save failed");
+    }
+    str = (const unsigned char *)lua_tolstring(L, -1, &length);
+
+    if (luabins_save_parallel(L, base + 1, base + num_items, 0, 2) != 0)
+    {
+      fprintf(stderr, "%s\n", lua_tostring(L, -1));
+      fatal(L, "test dataset parallel save failed");
+    }
+    check(L, base, num_items + 2);
+
+    parallel = (const unsigned char *)lua_tolstring(L, -1, &parallel_length);
+    if (parallel_length != length || memcmp(parallel, str, length) != 0)
+    {
+      fatal(L, "parallel save data mismatch");
+    }
+    lua_pop(L, 2);
+
+    lua_newthread(L);
+    if (luabins_save_parallel(L, base + 1, base + num_items + 1, 0, 2) == 0)
+    {
+      fatal(L, "parallel save should fail");
+    }
+    lua_pushliteral(L, "can't save: unsupported type detected");
+    if (!lua_rawequal(L, -1, -2))
+    {
+      fatal(L, "parallel save error mismatch");
+    }
+    check(L, base, num_items + 3);
+
+    lua_pop(L, num_items + 3);
+    check(L, base, 0);
+  }
+
+#ifndef LUABINS_NOFORK
+  {
+    /* Background save must write the same data as plain save */
+
+    static const char * path = "/tmp/luabins-test-api-bgsave.bin";
+    int num_items = push_testdataset(L);
+    lbs_BgSave job;
+    unsigned char buf[4096];
+    size_t saved_length = 0;
+    FILE * f = NULL;
+
+    if (luabins_save(L, base + 1, base + num_items) != 0)
+    {
+      fprintf(stderr, "%s\n", lua_tostring(L, -1));
+      fatal(L, "test dataset save failed");
+    }
+    str = (const unsigned char *)lua_tolstring(L, -1, &length);
+    if (length > sizeof(buf))
+    {
+      fatal(L, "test dataset is too large");
+    }
+
+    if (luabins_bgsave(L, base + 1, base + num_items, 0, path, &job) != 0)
+    {
+      fprintf(stderr, "%s\n", lua_tostring(L, -1));
+      fatal(L, "test dataset bgsave failed");
+    }
+    check(L, base, num_items + 1);
+
+    lbs_bgsaveFinish(&job, 1);
+    if (job.result != 0)
+    {
+      fprintf(stderr, "%s\n", job.error);
+      fatal(L, "test dataset bgsave job failed");
+    }
+
+    f = fopen(path, "rb");
+    if (f == NULL)
+    {
+      fatal(L, "can't open bgsave file");
+    }
+    saved_length = fread(buf, 1, sizeof(buf), f);
+    fclose(f);
+    remove(path);
+
+    if (saved_length != length || memcmp(buf, str, length) != 0)
+    {
+      fatal(L, "bgsave data mismatch");
+    }
+
+    /* Save errors are reported by the job */
+    lua_newthread(L);
+    if (luabins_bgsave(L, base + 1, base + num_items + 2, 0, path, &job) != 0)
+    {
+      fatal(L, "bgsave should start");
+    }
+    lbs_bgsaveFinish(&job, 1);
+    if (
+        job.result == 0 ||
+        strcmp(job.error, "can't save: unsupported type detected") != 0
+      )
+    {
+      fatal(L, "bgsave error mismatch");
+    }
+
+    lua_pop(L, num_items + 2);
+    check(L, base, 0);
+  }
+#endif /* LUABINS_NOFORK */
+
+  {
+    /* Transfer to other state */
+
+    lua_State * L2 = luaL_newstate();
+    int num_items = push_testdataset(L);
+    luabins_SaveBuffer sb;
+
+    {
+      void * alloc_ud = NULL;
+      lua_Alloc alloc_fn = lua_getallocf(L, &alloc_ud);
+      lbsSB_init(&sb, alloc_fn, alloc_ud);
+    }
+
+    /* Plain values only, copied directly */
+    if (luabins_transfer(L, base + 1, base + num_items - 1, L2, &sb, &count))
+    {
+      fatal(L2, "plain transfer failed");
+    }
+    if (count != num_items - 1 || lua_gettop(L2) != count)
+    {
+      fatal(L2, "wrong plain transfer count");
+    }
+    lua_newtable(L2);
+    check_testdataset_on_top(L2);
+    lua_settop(L2, 0);
+
+    /* With table, saved to the buffer */
+    if (luabins_transfer(L, base + 1, base + num_items, L2, &sb, &count))
+    {
+      fatal(L2, "transfer failed");
+    }
+    if (count != num_items || lua_gettop(L2) != count)
+    {
+      fatal(L2, "wrong transfer count");
+    }
+    check_testdataset_on_top(L2);
+    lua_settop(L2, 0);
+
+    /* Temporary buffer */
+    if (luabins_transfer(L, base + 1, base + num_items, L2, NULL, &count))
+    {
+      fatal(L2, "transfer without buffer failed");
+    }
+    check_testdataset_on_top(L2);
+    lua_settop(L2, 0);
+
+    check(L, base, num_items);
+    lua_pop(L, num_items);
+
+    lua_newthread(L);
+    if (luabins_transfer(L, base + 1, base + 1, L2, &sb, &count) == 0)
+    {
+      fatal(L2, "transfer should fail");
+    }
+    lua_pushliteral(L2, "can't save: unsupported type detected");
+    if (lua_gettop(L2) != 2 || !lua_rawequal(L2, -1, -2))
+    {
+      fatal(L2, "transfer error mismatch");
+    }
+    check(L, base, 1);
+    lua_pop(L, 1);
+
+    lbsSB_destroy(&sb);
+    lua_close(L2);
+  }
+
+  {
+    /* Custom type with C callbacks */
+
+    int num_calls = 0;
+
+    luaL_newmetatable(L, INTMT);
+    if (
+        luabins_register_type(
+            L, "int", 3, -1, encode_int, decode_int, &num_calls
+          ) != 0
+      )
+    {
+      fatal(L, "register_type failed");
+    }
+    lua_pop(L, 1);
+    check(L, base, 0);
+
+    *(int *)lua_newuserdata(L, sizeof(int)) = 42;
+    luaL_getmetatable(L, INTMT);
+    lua_setmetatable(L, -2);
+
+    if (luabins_save(L, base + 1, base + 1) != 0)
+    {
+      fprintf(stderr, "%s\n", lua_tostring(L, -1));
+      fatal(L, "custom type save failed");
+    }
+    check(L, base, 2);
+
+    str = (const unsigned char *)lua_tolstring(L, -1, &length);
+    if (
+        length != 1 + 1 + 4 + 3 + 4 + sizeof(int) ||
+        memcmp(str, "\x01" "X" "\x03\x00\x00\x00" "int", 9) != 0
+      )
+    {
+      fatal(L, "custom type save data mismatch");
+    }
+
+    if (luabins_load(L, str, length, &count) != 0)
+    {
+      fprintf(stderr, "%s\n", lua_tostring(L, -1));
+      fatal(L, "custom type load failed");
+    }
+    check(L, base, 3);
+
+    luaL_getmetatable(L, INTMT);
+    if (
+        count != 1 || num_calls != 2 ||
+        !lua_getmetatable(L, -2) || !lua_rawequal(L, -1, -2) ||
+        *(int *)lua_touserdata(L, -3) != 42
+      )
+    {
+      fatal(L, "custom type load mismatch");
+    }
+    lua_pop(L, 2);
+
+    /* Bad payload */
+    if (luabins_load(L, str, length - 1, &count) == 0)
+    {
+      fatal(L, "custom type load should fail");
+    }
+    lua_pushliteral(L, "can't load: corrupt data, bad size");
+    if (!lua_rawequal(L, -1, -2))
+    {
+      fatal(L, "custom type load error mismatch");
+    }
+    lua_pop(L, 2);
+
+    lua_pop(L, 3);
+    check(L, base, 0);
+
+    /* Lua error in encoder fails the save */
+    *(int *)lua_newuserdata(L, sizeof(int)) = -1;
+    luaL_getmetatable(L, INTMT);
+    lua_setmetatable(L, -2);
+
+    if (luabins_save(L, base + 1, base + 1) == 0)
+    {
+      fatal(L, "custom type save should fail");
+    }
+    lua_pushliteral(L, "can't save: custom type encoder failed");
+    if (lua_gettop(L) != base + 3 || !lua_rawequal(L, -1, -2))
+    {
+      fatal(L, "custom type save error mismatch");
+    }
+    lua_pop(L, 3);
+    check(L, base, 0);
+
+    if (luabins_register_type(L, "", 0, -1, encode_int, decode_int, NULL) == 0)
+    {
+      fatal(L, "register_type should fail");
+    }
+    checkerr(L, base, "can't register type: empty name");
+  }
+
   lua_close(L);
 
   printf("---> OK\n");
@@ -0,0 +1,325 @@
+/*
+* test_asyncwrite_api.c
+* Luabins Lua-less asynchronous write tests
+* See copyright notice in luabins.h
+*/
+
+#ifndef _POSIX_C_SOURCE
+  #define _POSIX_C_SOURCE 200809L /* pipe() */
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Should be included first */
+#include "lualess.h"
+#include "asyncwrite.h"
+
+#ifndef LUABINS_NOASYNC
+  #include <errno.h>
+  #include <unistd.h>
+#endif
+
+#include "test.h"
+#include "util.h"
+
+/******************************************************************************/
+
+#ifndef LUABINS_NOASYNC
+
+static const char DATA[] = "Luabins asynchronous write";
+
+/* Large enough to take some time to write */
+#define LARGE_SIZE (4 * 1024 * 1024)
+
+static void check_finished(
+    lbs_AsyncWriter * w,
+    int expected_result,
+    const char * expected_failed,
+    int expected_error
+  )
+{
+  check_finished_job(
+      "writer",
+      w->state == LUABINS_ASYNCFINISHED,
+      w->result,
+      expected_result
+    );
+
+  if (w->error != expected_error)
+  {
+    fprintf(
+        stderr,
+        "writer error mismatch: got %s: %d, expected %s: %d\n",
+        (w->failed != NULL) ? w->failed : "-",
+        w->error,
+        (expected_failed != NULL) ? expected_failed : "-",
+        expected_error
+      );
+    exit(1);
+  }
+
+  if (
+      expected_failed != NULL &&
+      (w->failed == NULL || strcmp(w->failed, expected_failed) != 0)
+    )
+  {
+    fprintf(stderr, "writer failed call mismatch\n");
+    exit(1);
+  }
+}
+
+/******************************************************************************/
+
+TEST (test_asyncwriterFile,
+{
+  char path[256];
+  lbs_AsyncWriter w;
+
+  make_path(path, "asyncwrite");
+
+  lbs_asyncwriterInit(&w, lbs_simplealloc, NULL);
+
+  /* Not started */
+  if (lbs_asyncwriterFinish(&w, 0) == 0)
+  {
+    fprintf(stderr, "idle writer is not finished\n");
+    exit(1);
+  }
+
+  lbsSB_write(&w.sb, (const unsigned char *)DATA, sizeof(DATA) - 1);
+  if (lbs_asyncwriterStart(&w, path, -1) != LUABINS_ESUCCESS)
+  {
+    fprintf(stderr, "lbs_asyncwriterStart failed\n");
+    exit(1);
+  }
+
+  while (lbs_asyncwriterFinish(&w, 0) == 0)
+  {
+    /* Spin */
+  }
+  check_finished(&w, LUABINS_ESUCCESS, NULL, 0);
+  check_file(path, (const unsigned char *)DATA, sizeof(DATA) - 1);
+
+  /* Writer may be reused, file is truncated */
+  lbsSB_reset(&w.sb);
+  lbsSB_write(&w.sb, (const unsigned char *)DATA, 8);
+  lbs_asyncwriterStart(&w, path, -1);
+  if (lbs_asyncwriterFinish(&w, 1) == 0)
+  {
+    fprintf(stderr, "lbs_asyncwriterFinish did not wait\n");
+    exit(1);
+  }
+  check_finished(&w, LUABINS_ESUCCESS, NULL, 0);
+  check_file(path, (const unsigned char *)DATA, 8);
+
+  /* Large data, destroyed while running */
+  {
+    unsigned char * large = NULL;
+    int i = 0;
+
+    lbsSB_reset(&w.sb);
+    large = lbsSB_reserve(&w.sb, LARGE_SIZE);
+    for (i = 0; i < LARGE_SIZE; ++i)
+    {
+      large[i] = (unsigned char)(i * 7);
+    }
+    lbsSB_commit(&w.sb, LARGE_SIZE);
+
+    lbs_asyncwriterStart(&w, path, -1);
+    lbs_asyncwriterDestroy(&w);
+    check_finished(&w, LUABINS_ESUCCESS, NULL, 0);
+
+    /* Data is freed, check against a copy made the same way */
+    large = (unsigned char *)malloc(LARGE_SIZE);
+    for (i = 0; i < LARGE_SIZE; ++i)
+    {
+      large[i] = (unsigned char)(i * 7);
+    }
+    check_file(path, large, LARGE_SIZE);
+    free(large);
+  }
+
+  remove(path);
+})
+
+TEST (test_asyncwriterFd,
+{
+  char buf[sizeof(DATA)];
+  lbs_AsyncWriter w;
+  int fds[2];
+
+  if (pipe(fds) != 0)
+  {
+    fprintf(stderr, "pipe failed\n");
+    exit(1);
+  }
+
+  lbs_asyncwriterInit(&w, lbs_simplealloc, NULL);
+  lbsSB_write(&w.sb, (const unsigned char *)DATA, sizeof(DATA) - 1);
+
+  /* Pipe can't be synced, it is not an error */
+  lbs_asyncwriterStart(&w, NULL, fds[1]);
+  lbs_asyncwriterFinish(&w, 1);
+  check_finished(&w, LUABINS_ESUCCESS, NULL, 0);
+
+  if (
+      read(fds[0], buf, sizeof(DATA) - 1) != (ssize_t)(sizeof(DATA) - 1) ||
+      memcmp(buf, DATA, sizeof(DATA) - 1) != 0
+    )
+  {
+    fprintf(stderr, "pipe data mismatch\n");
+    exit(1);
+  }
+
+  /* Descriptor is not closed by the writer */
+  if (close(fds[1]) != 0)
+  {
+    fprintf(stderr, "pipe is closed by writer\n");
+    exit(1);
+  }
+  close(fds[0]);
+
+  lbs_asyncwriterDestroy(&w);
+})
+
+TEST (test_asyncwriterFailure,
+{
+  lbs_AsyncWriter w;
+
+  lbs_asyncwriterInit(&w, lbs_simplealloc, NULL);
+  lbsSB_write(&w.sb, (const unsigned char *)DATA, sizeof(DATA) - 1);
+
+  lbs_asyncwriterStart(&w, "/luabins-no-such-dir/asyncwrite.bin", -1);
+  lbs_asyncwriterFinish(&w, 1);
+  check_finished(&w, LUABINS_EWRITE, "open", ENOENT);
+
+  lbs_asyncwriterStart(&w, NULL, -1);
+  lbs_asyncwriterFinish(&w, 1);
+  check_finished(&w, LUABINS_EWRITE, "write", EBADF);
+
+  lbs_asyncwriterDestroy(&w);
+})
+
+#ifndef LUABINS_NOTHREADS
+
+/* Size of data each writer puts into pipe, larger than pipe buffer */
+#define PIPE_DATA_SIZE (256 * 1024)
+
+TEST (test_asyncwriterLimit,
+{
+  lbs_AsyncWriter * writers[LUABINS_MAXASYNCWRITES + 1];
+  lbs_AsyncWriter * extra = NULL;
+  char buf[4096];
+  size_t total = 0;
+  int fds[2];
+  int i = 0;
+
+  if (pipe(fds) != 0)
+  {
+    fprintf(stderr, "pipe failed\n");
+    exit(1);
+  }
+
+  /* Workers block on full pipe until it is read */
+  for (i = 0; i < LUABINS_MAXASYNCWRITES + 1; ++i)
+  {
+    writers[i] = lbs_asyncwriterNew(lbs_simplealloc, NULL);
+    if (writers[i] == NULL)
+    {
+      fprintf(stderr, "lbs_asyncwriterNew failed\n");
+      exit(1);
+    }
+    memset(lbsSB_reserve(&writers[i]->sb, PIPE_DATA_SIZE), 0, PIPE_DATA_SIZE);
+    lbsSB_commit(&writers[i]->sb, PIPE_DATA_SIZE);
+  }
+
+  for (i = 0; i < LUABINS_MAXASYNCWRITES; ++i)
+  {
+    if (lbs_asyncwriterStart(writers[i], NULL, fds[1]) != LUABINS_ESUCCESS)
+    {
+      fprintf(stderr, "lbs_asyncwriterStart failed\n");
+      exit(1);
+    }
+  }
+
+  extra = writers[LUABINS_MAXASYNCWRITES];
+  if (lbs_asyncwriterStart(extra, NULL, fds[1]) != LUABINS_EFULL)
+  {
+    fprintf(stderr, "too many writes are started\n");
+    exit(1);
+  }
+
+  /* Half of writers are closed while running, they are not waited for */
+  for (i = 0; i < LUABINS_MAXASYNCWRITES; i += 2)
+  {
+    lbs_asyncwriterClose(writers[i]);
+  }
+
+  while (total < (size_t)LUABINS_MAXASYNCWRITES * PIPE_DATA_SIZE)
+  {
+    ssize_t count = read(fds[0], buf, sizeof(buf));
+    if (count <= 0)
+    {
+      fprintf(stderr, "pipe read failed\n");
+      exit(1);
+    }
+    total += (size_t)count;
+  }
+
+  for (i = 1; i < LUABINS_MAXASYNCWRITES; i += 2)
+  {
+    lbs_asyncwriterFinish(writers[i], 1);
+    check_finished(writers[i], LUABINS_ESUCCESS, NULL, 0);
+    lbs_asyncwriterClose(writers[i]);
+  }
+
+  /* Closed writers may still be finishing, wait for a free slot */
+  while (lbs_asyncwriterStart(extra, NULL, fds[1]) == LUABINS_EFULL)
+  {
+    /* Spin */
+  }
+
+  total = 0;
+  while (total < PIPE_DATA_SIZE)
+  {
+    ssize_t count = read(fds[0], buf, sizeof(buf));
+    if (count <= 0)
+    {
+      fprintf(stderr, "pipe read failed\n");
+      exit(1);
+    }
+    total += (size_t)count;
+  }
+
+  lbs_asyncwriterFinish(extra, 1);
+  check_finished(extra, LUABINS_ESUCCESS, NULL, 0);
+  lbs_asyncwriterClose(extra);
+
+  close(fds[0]);
+  close(fds[1]);
+})
+
+#endif /* LUABINS_NOTHREADS */
+
+/******************************************************************************/
+
+void test_asyncwrite_api()
+{
+  test_asyncwriterFile();
+  test_asyncwriterFd();
+  test_asyncwriterFailure();
+#ifndef LUABINS_NOTHREADS
+  test_asyncwriterLimit();
+#endif
+}
+
+#else /* LUABINS_NOASYNC */
+
+void test_asyncwrite_api()
+{
+  printf("---> SKIP test_asyncwrite_api: built without asynchronous writes\n");
+}
+
+#endif /* LUABINS_NOASYNC */
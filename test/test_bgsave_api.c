@@ -0,0 +1,156 @@
+/*
+* test_bgsave_api.c
+* Luabins Lua-less background save tests
+* See copyright notice in luabins.h
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Should be included first */
+#include "lualess.h"
+#include "bgsave.h"
+
+#include "test.h"
+#include "util.h"
+
+/******************************************************************************/
+
+#ifndef LUABINS_NOFORK
+
+static const char DATA[] = "Luabins background save";
+
+static const char FAILURE[] = "test failure";
+
+/* Writes DATA, see lbs_BgSaveFn */
+static int write_data(void * ud, int fd, char * error)
+{
+  (void)ud;
+  (void)error;
+
+  return lbs_bgsaveWrite(
+      fd,
+      (const unsigned char *)DATA,
+      sizeof(DATA) - 1
+    );
+}
+
+/* Writes part of DATA and fails, see lbs_BgSaveFn */
+static int write_failure(void * ud, int fd, char * error)
+{
+  (void)ud;
+
+  lbs_bgsaveWrite(fd, (const unsigned char *)DATA, 4);
+  strcpy(error, FAILURE);
+
+  return LUABINS_EFAILURE;
+}
+
+static void check_finished(
+    lbs_BgSave * job,
+    int expected_result,
+    const char * expected_error
+  )
+{
+  check_finished_job(
+      "bgsave job",
+      job->pid == 0 && job->fd == -1,
+      job->result,
+      expected_result
+    );
+
+  if (strncmp(job->error, expected_error, strlen(expected_error)) != 0)
+  {
+    fprintf(
+        stderr,
+        "bgsave error mismatch: got '%s', expected '%s'\n",
+        job->error, expected_error
+      );
+    exit(1);
+  }
+}
+
+/******************************************************************************/
+
+TEST (test_bgsaveSimple,
+{
+  char path[256];
+  lbs_BgSave job;
+
+  make_path(path, "bgsave");
+
+  if (lbs_bgsaveStart(&job, path, write_data, NULL) != LUABINS_ESUCCESS)
+  {
+    fprintf(stderr, "lbs_bgsaveStart failed: %s\n", job.error);
+    exit(1);
+  }
+
+  if (lbs_bgsaveFinish(&job, 1) == 0)
+  {
+    fprintf(stderr, "lbs_bgsaveFinish did not wait\n");
+    exit(1);
+  }
+  check_finished(&job, LUABINS_ESUCCESS, "");
+  check_file(path, (const unsigned char *)DATA, sizeof(DATA) - 1);
+
+  /* Finished job stays finished */
+  if (lbs_bgsaveFinish(&job, 0) == 0)
+  {
+    fprintf(stderr, "lbs_bgsaveFinish lost the result\n");
+    exit(1);
+  }
+  check_finished(&job, LUABINS_ESUCCESS, "");
+
+  /* Poll until done, file is replaced as a whole */
+  lbs_bgsaveStart(&job, path, write_data, NULL);
+  while (lbs_bgsaveFinish(&job, 0) == 0)
+  {
+    /* Spin */
+  }
+  check_finished(&job, LUABINS_ESUCCESS, "");
+  check_file(path, (const unsigned char *)DATA, sizeof(DATA) - 1);
+
+  remove(path);
+})
+
+TEST (test_bgsaveFailure,
+{
+  char path[256];
+  lbs_BgSave job;
+
+  make_path(path, "bgsave-failure");
+
+  lbs_bgsaveStart(&job, path, write_data, NULL);
+  lbs_bgsaveFinish(&job, 1);
+  check_finished(&job, LUABINS_ESUCCESS, "");
+
+  /* Failed save keeps old file */
+  lbs_bgsaveStart(&job, path, write_failure, NULL);
+  lbs_bgsaveFinish(&job, 1);
+  check_finished(&job, LUABINS_EFAILURE, FAILURE);
+  check_file(path, (const unsigned char *)DATA, sizeof(DATA) - 1);
+
+  remove(path);
+
+  lbs_bgsaveStart(&job, "/luabins-no-such-dir/bgsave.bin", write_data, NULL);
+  lbs_bgsaveFinish(&job, 1);
+  check_finished(&job, LUABINS_EFAILURE, "can't bgsave: can't open file");
+})
+
+/******************************************************************************/
+
+void test_bgsave_api()
+{
+  test_bgsaveSimple();
+  test_bgsaveFailure();
+}
+
+#else /* LUABINS_NOFORK */
+
+void test_bgsave_api()
+{
+  printf("---> SKIP test_bgsave_api: built without fork()\n");
+}
+
+#endif /* LUABINS_NOFORK */
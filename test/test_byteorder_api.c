@@ -0,0 +1,223 @@
+/*
+* test_byteorder_api.c
+* Luabins Lua-less byte order conversion tests
+* See copyright notice in luabins.h
+*/
+
+/*
+* WARNING: This suite is format-specific. Change it when format changes.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Should be included first */
+#include "lualess.h"
+#include "byteorder.h"
+
+#include "test.h"
+
+/******************************************************************************/
+
+static void check_bytes(
+    const char * what,
+    const unsigned char * actual,
+    const char * expected,
+    size_t length
+  )
+{
+  if (memcmp(actual, expected, length) != 0)
+  {
+    size_t i = 0;
+
+    fprintf(stderr, "%s: bytes mismatch\n", what);
+    for (i = 0; i < length; ++i)
+    {
+      fprintf(
+          stderr,
+          "%02X %02X\n",
+          actual[i],
+          (unsigned char)expected[i]
+        );
+    }
+    exit(1);
+  }
+}
+
+/******************************************************************************/
+
+TEST (test_storeLittleEndian,
+{
+  unsigned char buf[LUABINS_LNUMBER];
+
+  {
+    int value = 0x04030201;
+    int loaded = 0;
+
+    lbs_storeLE(buf, value, LUABINS_LINT);
+    check_bytes("int", buf, "\x01\x02\x03\x04", LUABINS_LINT);
+
+    lbs_loadLE(loaded, buf, LUABINS_LINT);
+    if (loaded != value)
+    {
+      fprintf(stderr, "int roundtrip mismatch\n");
+      exit(1);
+    }
+  }
+
+  {
+    size_t value = 0x04030201;
+    size_t loaded = 0;
+
+    lbs_storeSize(buf, value);
+    check_bytes("size", buf, "\x01\x02\x03\x04", LUABINS_LSIZET);
+
+    lbs_loadSize(loaded, buf);
+    if (loaded != value)
+    {
+      fprintf(stderr, "size roundtrip mismatch\n");
+      exit(1);
+    }
+  }
+
+  {
+    lua_Number value = 1.0;
+    lua_Number loaded = 0;
+
+    lbs_storeLE(buf, value, LUABINS_LNUMBER);
+    check_bytes("number", buf, "\0\0\0\0\0\0\xF0\x3F", LUABINS_LNUMBER);
+
+    lbs_loadLE(loaded, buf, LUABINS_LNUMBER);
+    if (loaded != value)
+    {
+      fprintf(stderr, "number roundtrip mismatch\n");
+      exit(1);
+    }
+  }
+
+  {
+    float value = -2.0f;
+
+    lbs_storeLE(buf, value, LUABINS_LFLOAT);
+    check_bytes("float", buf, "\0\0\0\xC0", LUABINS_LFLOAT);
+  }
+})
+
+TEST (test_portableSize,
+{
+  unsigned char buf[LUABINS_LSIZET];
+
+  lbs_putSize(buf, 0x04030201);
+  check_bytes("lbs_putSize", buf, "\x01\x02\x03\x04", LUABINS_LSIZET);
+
+  if (lbs_getSize((const unsigned char *)"\xFF\xFE\xFD\x7C") != 0x7CFDFEFFUL)
+  {
+    fprintf(stderr, "lbs_getSize mismatch\n");
+    exit(1);
+  }
+})
+
+TEST (test_portableInteger,
+{
+  unsigned char buf[LUABINS_LINTEGER];
+  lua_Integer value = 0;
+
+  lbs_putInteger(buf, 0x04030201);
+  check_bytes(
+      "lbs_putInteger",
+      buf,
+      "\x01\x02\x03\x04\x00\x00\x00\x00",
+      LUABINS_LINTEGER
+    );
+
+  /* Negative integers are sign-extended */
+  lbs_putInteger(buf, -2);
+  check_bytes(
+      "lbs_putInteger negative",
+      buf,
+      "\xFE\xFF\xFF\xFF\xFF\xFF\xFF\xFF",
+      LUABINS_LINTEGER
+    );
+
+  if (
+      !lbs_getInteger(buf, &value) || value != -2 ||
+      !lbs_getInteger(
+          (const unsigned char *)"\xFF\xFE\xFD\x7C\x00\x00\x00\x00",
+          &value
+        ) ||
+      value != 0x7CFDFEFFL
+    )
+  {
+    fprintf(stderr, "lbs_getInteger mismatch\n");
+    exit(1);
+  }
+
+  /* Only narrow lua_Integer may fail to hold the value */
+  if (
+      lbs_getInteger(
+          (const unsigned char *)"\x00\x00\x00\x00\x00\x00\x00\x01",
+          &value
+        ) != (sizeof(lua_Integer) == LUABINS_LINTEGER)
+    )
+  {
+    fprintf(stderr, "lbs_getInteger range mismatch\n");
+    exit(1);
+  }
+})
+
+TEST (test_swapBytes,
+{
+  unsigned char buf[24];
+
+  lbs_copySwapped(buf, "\x01\x02\x03", 3);
+  check_bytes("lbs_copySwapped", buf, "\x03\x02\x01", 3);
+
+  memcpy(buf, "\x01\x02\x03\x04\x05\x06", 6);
+  lbs_swapBytes(buf, 2, 3);
+  check_bytes("swap 2", buf, "\x02\x01\x04\x03\x06\x05", 6);
+
+  memcpy(buf, "\x01\x02\x03\x04\x05\x06\x07\x08", 8);
+  lbs_swapBytes(buf, 4, 2);
+  check_bytes("swap 4", buf, "\x04\x03\x02\x01\x08\x07\x06\x05", 8);
+
+  memcpy(buf, "\x01\x02\x03\x04\x05\x06\x07\x08" "abcdefgh" "ABCDEFGH", 24);
+  lbs_swapBytes(buf, 8, 3);
+  check_bytes(
+      "swap 8",
+      buf,
+      "\x08\x07\x06\x05\x04\x03\x02\x01" "hgfedcba" "HGFEDCBA",
+      24
+    );
+
+  /* Single bytes and unknown widths are left as is */
+  lbs_swapBytes(buf, 1, 24);
+  lbs_swapBytes(buf, 3, 8);
+  check_bytes(
+      "no swap",
+      buf,
+      "\x08\x07\x06\x05\x04\x03\x02\x01" "hgfedcba" "HGFEDCBA",
+      24
+    );
+
+  /* Conversion is a no-op on little-endian hosts */
+  lbs_fixByteOrder(buf, 8, 3);
+  check_bytes(
+      "lbs_fixByteOrder",
+      buf,
+      LUABINS_BIGENDIAN
+        ? "\x01\x02\x03\x04\x05\x06\x07\x08" "abcdefgh" "ABCDEFGH"
+        : "\x08\x07\x06\x05\x04\x03\x02\x01" "hgfedcba" "HGFEDCBA",
+      24
+    );
+})
+
+/******************************************************************************/
+
+void test_byteorder_api()
+{
+  test_storeLittleEndian();
+  test_portableSize();
+  test_portableInteger();
+  test_swapBytes();
+}
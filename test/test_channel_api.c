@@ -0,0 +1,212 @@
+/*
+* test_channel_api.c
+* Luabins Lua-less lock-free message channel tests
+* See copyright notice in luabins.h
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Should be included first */
+#include "lualess.h"
+#include "channel.h"
+
+#include "test.h"
+#include "util.h"
+
+#ifndef LUABINS_NOCHANNEL
+
+/******************************************************************************/
+
+/* Pops message, checks it is len bytes of given value */
+static void check_pop(lbs_Channel * ch, unsigned char value, size_t len)
+{
+  size_t actual_len = 0;
+  size_t i = 0;
+  const unsigned char * data = lbs_channelPeek(ch, &actual_len);
+
+  if (data == NULL || actual_len != len)
+  {
+    fprintf(
+        stderr,
+        "pop: expected message of %lu bytes, got %s of %lu\n",
+        (unsigned long)len,
+        (data == NULL) ? "none" : "message",
+        (unsigned long)actual_len
+      );
+    exit(1);
+  }
+
+  for (i = 0; i < len; ++i)
+  {
+    if (data[i] != value)
+    {
+      fprintf(stderr, "pop: message data mismatch\n");
+      fprintbuf(stderr, data, len);
+      exit(1);
+    }
+  }
+
+  lbs_channelPop(ch);
+}
+
+static void check_empty(lbs_Channel * ch)
+{
+  size_t len = 0;
+  if (lbs_channelPeek(ch, &len) != NULL)
+  {
+    fprintf(stderr, "channel is not empty\n");
+    exit(1);
+  }
+}
+
+/******************************************************************************/
+
+TEST (test_channelNew,
+{
+  lbs_Channel * ch = lbs_channelNew(0);
+  check_result("min capacity", (int)ch->capacity, LUABINS_MINCHANNEL);
+  check_empty(ch);
+  lbs_channelRelease(ch);
+
+  ch = lbs_channelNew(1000);
+  check_result("rounded capacity", (int)ch->capacity, 1024);
+  check_result(
+      "max message",
+      (int)lbs_channelMaxMessage(ch),
+      512 - LUABINS_LCHANNELHEADER
+    );
+
+  /* Last release frees the channel */
+  lbs_channelRetain(ch);
+  lbs_channelRelease(ch);
+  check_empty(ch);
+  check_result("live channel", lbs_channelCheck(ch), 1);
+  lbs_channelRelease(ch);
+
+  {
+    lbs_Channel fake;
+    memset(&fake, 0, sizeof(fake));
+    check_result("not a channel", lbs_channelCheck(&fake), 0);
+    check_result("NULL channel", lbs_channelCheck((lbs_Channel *)NULL), 0);
+  }
+})
+
+TEST (test_channelOrder,
+{
+  unsigned char buf[64];
+  lbs_Channel * ch = lbs_channelNew(256);
+  int i = 0;
+
+  /* Empty message is a message too */
+  check_result("push empty", lbs_channelPush(ch, buf, 0), LUABINS_ESUCCESS);
+  check_pop(ch, 0, 0);
+  check_empty(ch);
+
+  for (i = 1; i <= 3; ++i)
+  {
+    memset(buf, i, (size_t)i * 10);
+    check_result(
+        "push",
+        lbs_channelPush(ch, buf, (size_t)i * 10),
+        LUABINS_ESUCCESS
+      );
+  }
+
+  for (i = 1; i <= 3; ++i)
+  {
+    check_pop(ch, (unsigned char)i, (size_t)i * 10);
+  }
+  check_empty(ch);
+
+  lbs_channelRelease(ch);
+})
+
+TEST (test_channelFull,
+{
+  unsigned char buf[256];
+  lbs_Channel * ch = lbs_channelNew(256);
+  size_t max_len = lbs_channelMaxMessage(ch);
+
+  memset(buf, 7, sizeof(buf));
+
+  check_result(
+      "too long",
+      lbs_channelPush(ch, buf, max_len + 1),
+      LUABINS_ETOOLONG
+    );
+
+  /* 3 records of 64 bytes */
+  check_result("push 1", lbs_channelPush(ch, buf, 56), LUABINS_ESUCCESS);
+  check_result("push 2", lbs_channelPush(ch, buf, 56), LUABINS_ESUCCESS);
+  check_result("push 3", lbs_channelPush(ch, buf, 56), LUABINS_ESUCCESS);
+  check_result("push full", lbs_channelPush(ch, buf, 64), LUABINS_EFULL);
+  check_result("push last", lbs_channelPush(ch, buf, 50), LUABINS_ESUCCESS);
+  check_result("push more", lbs_channelPush(ch, buf, 0), LUABINS_EFULL);
+
+  check_pop(ch, 7, 56);
+  check_result("push again", lbs_channelPush(ch, buf, 1), LUABINS_ESUCCESS);
+
+  check_pop(ch, 7, 56);
+  check_pop(ch, 7, 56);
+  check_pop(ch, 7, 50);
+  check_pop(ch, 7, 1);
+  check_empty(ch);
+
+  lbs_channelRelease(ch);
+})
+
+TEST (test_channelWrap,
+{
+  unsigned char buf[128];
+  lbs_Channel * ch = lbs_channelNew(256);
+  int i = 0;
+
+  /*
+  * Records of 104 bytes do not divide the ring, so some of them
+  * are preceded by padding. Largest message always fits.
+  */
+  for (i = 0; i < 100; ++i)
+  {
+    size_t len = (i % 3 == 2) ? lbs_channelMaxMessage(ch) : 90;
+
+    memset(buf, i, len);
+    check_result("push", lbs_channelPush(ch, buf, len), LUABINS_ESUCCESS);
+    check_pop(ch, (unsigned char)i, len);
+    check_empty(ch);
+  }
+
+  /* Two in flight, records of 64 bytes */
+  memset(buf, 1, 50);
+  check_result("push 1", lbs_channelPush(ch, buf, 50), LUABINS_ESUCCESS);
+  for (i = 2; i < 100; ++i)
+  {
+    memset(buf, i, 50);
+    check_result("push", lbs_channelPush(ch, buf, 50), LUABINS_ESUCCESS);
+    check_pop(ch, (unsigned char)(i - 1), 50);
+  }
+  check_pop(ch, 99, 50);
+  check_empty(ch);
+
+  lbs_channelRelease(ch);
+})
+
+/******************************************************************************/
+
+void test_channel_api()
+{
+  test_channelNew();
+  test_channelOrder();
+  test_channelFull();
+  test_channelWrap();
+}
+
+#else /* LUABINS_NOCHANNEL */
+
+void test_channel_api()
+{
+  printf("---> SKIP test_channel_api: built without channels\n");
+}
+
+#endif /* LUABINS_NOCHANNEL */
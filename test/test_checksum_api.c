@@ -0,0 +1,147 @@
+/*
+* test_checksum_api.c
+* Luabins Lua-less integrity checksum tests
+* See copyright notice in luabins.h
+*/
+
+/*
+* WARNING: This suite is format-specific. Change it when format changes.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Should be included first */
+#include "lualess.h"
+#include "savebuffer.h"
+#include "checksum.h"
+
+#include "test.h"
+#include "util.h"
+
+/******************************************************************************/
+
+static void check_crc(
+    const char * what,
+    unsigned long actual,
+    unsigned long expected
+  )
+{
+  if (actual != expected)
+  {
+    fprintf(
+        stderr,
+        "%s: crc mismatch: got 0x%08lX, expected 0x%08lX\n",
+        what, actual, expected
+      );
+    exit(1);
+  }
+}
+
+/******************************************************************************/
+
+TEST (test_crc32c,
+{
+  const unsigned char * digits = (const unsigned char *)"123456789";
+  unsigned char data[1000];
+  unsigned long whole = 0;
+  size_t i = 0;
+
+  check_crc("empty", lbs_crc32c(0, digits, 0), 0);
+  check_crc("check value", lbs_crc32c(0, digits, 9), 0xE3069283UL);
+  check_crc(
+      "incremental",
+      lbs_crc32c(lbs_crc32c(0, digits, 4), digits + 4, 5),
+      0xE3069283UL
+    );
+
+  for (i = 0; i < sizeof(data); ++i)
+  {
+    data[i] = (unsigned char)(i * 7 + (i >> 3));
+  }
+  whole = lbs_crc32c(0, data, sizeof(data));
+
+  /* Unaligned starts and tails of every length */
+  for (i = 0; i < 17; ++i)
+  {
+    check_crc(
+        "split",
+        lbs_crc32c(lbs_crc32c(0, data, i), data + i, sizeof(data) - i),
+        whole
+      );
+  }
+})
+
+TEST (test_checksumEnvelope,
+{
+  luabins_SaveBuffer sb;
+  unsigned char * copy = NULL;
+  const unsigned char * buf = NULL;
+  const unsigned char * inner = NULL;
+  size_t len = 0;
+  size_t inner_len = 0;
+
+  lbsSB_init(&sb, lbs_simplealloc, NULL);
+
+  check_result(
+      "lbs_writeChecksummed",
+      lbs_writeChecksummed(&sb, (const unsigned char *)"123456789", 9),
+      LUABINS_ESUCCESS
+    );
+
+  buf = lbsSB_buffer(&sb, &len);
+  check_result("length", (int)len, 1 + 9 + 4);
+  check_result(
+      "data",
+      memcmp(buf, "\xFE" "123456789" "\x83\x92\x06\xE3", len),
+      0
+    );
+
+  check_result(
+      "lbs_verifyChecksum",
+      lbs_verifyChecksum(buf, len, &inner, &inner_len),
+      LUABINS_ESUCCESS
+    );
+  check_result("inner length", (int)inner_len, 9);
+  check_result("inner data", memcmp(inner, "123456789", 9), 0);
+
+  /* Any flipped bit is detected */
+  copy = (unsigned char *)malloc(len);
+  {
+    size_t i = 0;
+    for (i = 0; i < (len - 1) * 8; ++i)
+    {
+      memcpy(copy, buf, len);
+      copy[1 + i / 8] ^= (unsigned char)(1 << (i % 8));
+      check_result(
+          "flipped bit",
+          lbs_verifyChecksum(copy, len, &inner, &inner_len),
+          LUABINS_ECHECKSUM
+        );
+    }
+  }
+  free(copy);
+
+  check_result(
+      "too short",
+      lbs_verifyChecksum(buf, 4, &inner, &inner_len),
+      LUABINS_EBADDATA
+    );
+
+  check_result(
+      "no marker",
+      lbs_verifyChecksum(buf + 1, len - 1, &inner, &inner_len),
+      LUABINS_EBADDATA
+    );
+
+  lbsSB_destroy(&sb);
+})
+
+/******************************************************************************/
+
+void test_checksum_api()
+{
+  test_crc32c();
+  test_checksumEnvelope();
+}
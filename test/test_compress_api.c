@@ -0,0 +1,279 @@
+/*
+* test_compress_api.c
+* Luabins Lua-less block compression tests
+* See copyright notice in luabins.h
+*/
+
+/*
+* WARNING: This suite is format-specific. Change it when format changes.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Should be included first */
+#include "lualess.h"
+#include "savebuffer.h"
+#include "compress.h"
+
+#include "test.h"
+#include "util.h"
+
+/******************************************************************************/
+
+/* Compresses data, checks that it decompresses back unchanged */
+static size_t check_roundtrip(const unsigned char * data, size_t len)
+{
+  luabins_SaveBuffer compressed;
+  luabins_SaveBuffer decompressed;
+  size_t compressed_len = 0;
+  size_t decompressed_len = 0;
+  const unsigned char * buf = NULL;
+
+  lbsSB_init(&compressed, lbs_simplealloc, NULL);
+  lbsSB_init(&decompressed, lbs_simplealloc, NULL);
+
+  check_result(
+      "lbs_writeCompressed",
+      lbs_writeCompressed(&compressed, data, len),
+      LUABINS_ESUCCESS
+    );
+
+  buf = lbsSB_buffer(&compressed, &compressed_len);
+  check_result(
+      "lbs_decompress",
+      lbs_decompress(&decompressed, buf, compressed_len),
+      LUABINS_ESUCCESS
+    );
+
+  buf = lbsSB_buffer(&decompressed, &decompressed_len);
+  if (decompressed_len != len || (len > 0 && memcmp(buf, data, len) != 0))
+  {
+    fprintf(stderr, "roundtrip mismatch for %lu bytes\n", (unsigned long)len);
+    exit(1);
+  }
+
+  lbsSB_destroy(&decompressed);
+  lbsSB_destroy(&compressed);
+
+  return compressed_len;
+}
+
+static void check_decompress(
+    const char * data,
+    size_t len,
+    int expected_result
+  )
+{
+  luabins_SaveBuffer sb;
+  lbsSB_init(&sb, lbs_simplealloc, NULL);
+
+  check_result(
+      "lbs_decompress",
+      lbs_decompress(&sb, (const unsigned char *)data, len),
+      expected_result
+    );
+
+  lbsSB_destroy(&sb);
+}
+
+/* Deterministic pseudo-random bytes */
+static void fill_noise(unsigned char * data, size_t len)
+{
+  unsigned long seed = 42;
+  size_t i = 0;
+  for (i = 0; i < len; ++i)
+  {
+    seed = (seed * 1103515245UL + 12345UL) & 0x7FFFFFFFUL;
+    data[i] = (unsigned char)(seed >> 16);
+  }
+}
+
+/******************************************************************************/
+
+TEST (test_compressFormat,
+{
+  luabins_SaveBuffer sb;
+  lbsSB_init(&sb, lbs_simplealloc, NULL);
+
+  /* Empty data has no blocks */
+  {
+    size_t len = 0;
+    const unsigned char * buf = NULL;
+
+    lbs_writeCompressed(&sb, NULL, 0);
+    buf = lbsSB_buffer(&sb, &len);
+    check_result("empty length", (int)len, 5);
+    check_result("empty data", memcmp(buf, "\xFF\0\0\0\0", len), 0);
+  }
+
+  /* Too short to compress, stored as is */
+  {
+    size_t len = 0;
+    const unsigned char * buf = NULL;
+
+    lbsSB_reset(&sb);
+    lbs_writeCompressed(&sb, (const unsigned char *)"abc", 3);
+    buf = lbsSB_buffer(&sb, &len);
+    check_result("stored length", (int)len, 5 + 8 + 3);
+    check_result(
+        "stored data",
+        memcmp(
+            buf,
+            "\xFF" "\x03\x00\x00\x00"
+            "\x03\x00\x00\x00" "\x03\x00\x00\x00" "abc",
+            len
+          ),
+        0
+      );
+  }
+
+  /* Repeating data */
+  {
+    size_t len = 0;
+    const unsigned char * buf = NULL;
+
+    lbsSB_reset(&sb);
+    lbs_writeCompressed(&sb, (const unsigned char *)"abababababababab", 16);
+    buf = lbsSB_buffer(&sb, &len);
+    check_result("compressed length", (int)len, 5 + 8 + 6);
+    check_result(
+        "compressed data",
+        memcmp(
+            buf,
+            "\xFF" "\x10\x00\x00\x00"
+            "\x10\x00\x00\x00" "\x06\x00\x00\x00"
+            "\x2A" "ab" "\x02\x00" "\x00",
+            len
+          ),
+        0
+      );
+  }
+
+  lbsSB_destroy(&sb);
+})
+
+TEST (test_compressRoundtrip,
+{
+  size_t len = 3 * LUABINS_BLOCKSIZE + 123;
+  unsigned char * data = (unsigned char *)malloc(len);
+  size_t i = 0;
+
+  check_roundtrip(data, 0);
+
+  /* Text-like data compresses well */
+  for (i = 0; i < len; ++i)
+  {
+    data[i] = "luabins saves lua values "[i % 25];
+  }
+  if (check_roundtrip(data, len) > len / 10)
+  {
+    fprintf(stderr, "repeating data does not compress\n");
+    exit(1);
+  }
+
+  /* Noise does not compress, but must not expand much */
+  fill_noise(data, len);
+  if (check_roundtrip(data, len) > len + 5 + 4 * 8)
+  {
+    fprintf(stderr, "noise expanded too much\n");
+    exit(1);
+  }
+
+  /* Mixed data, matches at block ends */
+  for (i = 0; i < len; i += 1000)
+  {
+    memset(data + i, (int)(i % 7), luabins_min(len - i, 500));
+  }
+  check_roundtrip(data, len);
+
+  for (i = 1; i < 40; ++i)
+  {
+    check_roundtrip(data, i);
+  }
+
+  free(data);
+})
+
+TEST (test_decompressBadData,
+{
+  /* Not compressed */
+  check_decompress("\x01" "-", 2, LUABINS_EBADDATA);
+
+  /* Truncated header */
+  check_decompress("\xFF" "\x01\x00", 3, LUABINS_EBADDATA);
+
+  /* Truncated block */
+  check_decompress(
+      "\xFF" "\x03\x00\x00\x00" "\x03\x00\x00\x00" "\x03\x00\x00\x00" "ab",
+      5 + 8 + 2,
+      LUABINS_EBADSIZE
+    );
+
+  /* Block is larger than total */
+  check_decompress(
+      "\xFF" "\x02\x00\x00\x00" "\x03\x00\x00\x00" "\x03\x00\x00\x00" "abc",
+      5 + 8 + 3,
+      LUABINS_EBADSIZE
+    );
+
+  /* Tail left */
+  check_decompress(
+      "\xFF" "\x01\x00\x00\x00" "\x01\x00\x00\x00" "\x01\x00\x00\x00" "ab",
+      5 + 8 + 2,
+      LUABINS_ETAILEFT
+    );
+
+  /* Total is too large for data */
+  check_decompress(
+      "\xFF" "\x00\x00\x00\x01" "\x01\x00\x00\x00" "\x01\x00\x00\x00" "a",
+      5 + 8 + 1,
+      LUABINS_EBADSIZE
+    );
+
+  /* Match before block start */
+  check_decompress(
+      "\xFF" "\x10\x00\x00\x00"
+      "\x10\x00\x00\x00" "\x06\x00\x00\x00"
+      "\x2A" "ab" "\x03\x00" "\x00",
+      5 + 8 + 6,
+      LUABINS_EBADDATA
+    );
+
+  /* Match past block end */
+  check_decompress(
+      "\xFF" "\x0F\x00\x00\x00"
+      "\x0F\x00\x00\x00" "\x06\x00\x00\x00"
+      "\x2A" "ab" "\x02\x00" "\x00",
+      5 + 8 + 6,
+      LUABINS_EBADDATA
+    );
+
+  /* Zero offset */
+  check_decompress(
+      "\xFF" "\x10\x00\x00\x00"
+      "\x10\x00\x00\x00" "\x06\x00\x00\x00"
+      "\x2A" "ab" "\x00\x00" "\x00",
+      5 + 8 + 6,
+      LUABINS_EBADDATA
+    );
+
+  /* Literals overrun */
+  check_decompress(
+      "\xFF" "\x10\x00\x00\x00"
+      "\x10\x00\x00\x00" "\x03\x00\x00\x00"
+      "\xF0" "\xFF" "a",
+      5 + 8 + 3,
+      LUABINS_EBADDATA
+    );
+})
+
+/******************************************************************************/
+
+void test_compress_api()
+{
+  test_compressFormat();
+  test_compressRoundtrip();
+  test_decompressBadData();
+}
@@ -0,0 +1,19 @@
+/*
+* test_cxx.cpp
+* Luabins C++ header test suite
+* See copyright notice in luabins.h
+*/
+
+#include <cstdio>
+
+#include "test.h"
+
+int main()
+{
+  printf("luabins C++ header test\n");
+
+  test_writer();
+  test_view();
+
+  return 0;
+}
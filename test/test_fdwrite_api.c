@@ -0,0 +1,389 @@
+/*
+* test_fdwrite_api.c
+* Luabins Lua-less fdwrite API tests
+* See copyright notice in luabins.h
+*/
+
+/*
+* WARNING: This suite is format-specific. Change it when format changes.
+*/
+
+#ifndef _POSIX_C_SOURCE
+  #define _POSIX_C_SOURCE 200112L /* fileno(), pipe() */
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "lualess.h"
+#include "fdwrite.h"
+
+#include "test.h"
+#include "util.h"
+
+/******************************************************************************/
+
+/*
+* Note it is different from test_savebuffer variant.
+* We're interested in higher level stuff here.
+*/
+static void check_buffer(
+    lbs_FdWriter * w,
+    const char * expected_buf_c,
+    size_t expected_length
+  )
+{
+  const unsigned char * expected_buf = (const unsigned char *)expected_buf_c;
+  unsigned char * actual_buf = NULL;
+  size_t actual_length = 0;
+  ssize_t actually_read = 0;
+  int result = lbs_fdwriterFlush(w);
+
+  if (result != LUABINS_ESUCCESS)
+  {
+    fprintf(stderr, "lbs_fdwriterFlush failed: %d\n", result);
+    exit(1);
+  }
+
+  actual_length = (size_t)lseek(w->fd, 0, SEEK_CUR);
+  lseek(w->fd, 0, SEEK_SET);
+
+  actual_buf = (unsigned char *)malloc(actual_length + 1);
+  actually_read = read(w->fd, actual_buf, actual_length);
+  if (actually_read != (ssize_t)actual_length)
+  {
+    fprintf(
+        stderr,
+        "read count error: got %ld, expected %lu\n",
+        (long)actually_read, (unsigned long)actual_length
+      );
+
+    free(actual_buf);
+    exit(1);
+  }
+
+  if (actual_length != expected_length)
+  {
+    fprintf(
+        stderr,
+        "length mismatch: got %lu, expected %lu\n",
+        (unsigned long)actual_length, (unsigned long)expected_length
+      );
+    fprintf(stderr, "actual:\n");
+    fprintbuf(stderr, actual_buf, actual_length);
+    fprintf(stderr, "expected:\n");
+    fprintbuf(stderr, expected_buf, expected_length);
+
+    free(actual_buf);
+    exit(1);
+  }
+
+  if (memcmp(actual_buf, expected_buf, expected_length) != 0)
+  {
+    fprintf(stderr, "buffer mismatch\n");
+    fprintf(stderr, "actual:\n");
+    fprintbuf(stderr, actual_buf, actual_length);
+    fprintf(stderr, "expected:\n");
+    fprintbuf(stderr, expected_buf, expected_length);
+
+    free(actual_buf);
+    exit(1);
+  }
+
+  free(actual_buf);
+}
+
+/******************************************************************************/
+
+#define CAT(a, b) a ## b
+
+#define TEST_NAME(x) CAT(test_fdwrite, x)
+#define CALL_NAME(x) CAT(lbs_fdwrite, x)
+#define BUFFER_NAME (&w)
+#define INIT_BUFFER \
+  FILE * f = tmpfile(); \
+  lbs_FdWriter w; \
+  lbs_fdwriterInit(BUFFER_NAME, fileno(f), lbs_simplealloc, NULL);
+
+#define DESTROY_BUFFER \
+  lbs_fdwriterDestroy(BUFFER_NAME); \
+  fclose(f);
+
+#define CHECK_BUFFER check_buffer
+
+#include "write_tests.inc"
+
+/******************************************************************************/
+
+TEST (test_fdwriteLargeString,
+{
+  INIT_BUFFER;
+
+  {
+    size_t length = 3 * LUABINS_FDWRITEFLUSH + 1;
+    char * value = (char *)malloc(length);
+    char * expected = (char *)malloc(1 + (1 + 4) + length);
+
+    memset(value, 'x', length);
+
+    expected[0] = '-';
+    expected[1] = LUABINS_CSTRING;
+    memcpy(&expected[2], &length, 4);
+    memcpy(&expected[2 + 4], value, length);
+
+    lbs_fdwriteNil(BUFFER_NAME);
+    lbs_fdwriteString(BUFFER_NAME, value, length);
+    CHECK_BUFFER(BUFFER_NAME, expected, 1 + (1 + 4) + length);
+
+    free(expected);
+    free(value);
+  }
+
+  DESTROY_BUFFER;
+})
+
+TEST (test_fdwriteManyValues,
+{
+  INIT_BUFFER;
+
+  {
+    /* Enough values to trigger several implicit flushes */
+    size_t count = 3 * LUABINS_FDWRITEFLUSH / (1 + 8) + 1;
+    size_t i = 0;
+    unsigned char * expected = (unsigned char *)malloc(count * (1 + 8));
+
+    for (i = 0; i < count; ++i)
+    {
+      lua_Number value = (lua_Number)i;
+      expected[i * (1 + 8)] = LUABINS_CNUMBER;
+      memcpy(&expected[i * (1 + 8) + 1], &value, 8);
+
+      if (lbs_fdwriteNumber(BUFFER_NAME, value) != LUABINS_ESUCCESS)
+      {
+        fprintf(stderr, "lbs_fdwriteNumber failed\n");
+        exit(1);
+      }
+    }
+
+    CHECK_BUFFER(BUFFER_NAME, (const char *)expected, count * (1 + 8));
+
+    free(expected);
+  }
+
+  DESTROY_BUFFER;
+})
+
+TEST (test_fdwriteError,
+{
+  lbs_FdWriter w;
+  lbs_fdwriterInit(&w, -1, lbs_simplealloc, NULL);
+
+  /* Buffered, no error yet */
+  if (lbs_fdwriteNil(&w) != LUABINS_ESUCCESS)
+  {
+    fprintf(stderr, "lbs_fdwriteNil failed\n");
+    exit(1);
+  }
+
+  if (lbs_fdwriterFlush(&w) != LUABINS_EWRITE)
+  {
+    fprintf(stderr, "lbs_fdwriterFlush: error expected\n");
+    exit(1);
+  }
+
+  /* Error is sticky */
+  if (lbs_fdwriteNil(&w) != LUABINS_EWRITE)
+  {
+    fprintf(stderr, "lbs_fdwriteNil: error expected\n");
+    exit(1);
+  }
+
+  if (lbs_fdwriterDestroy(&w) != LUABINS_EWRITE)
+  {
+    fprintf(stderr, "lbs_fdwriterDestroy: error expected\n");
+    exit(1);
+  }
+})
+
+TEST (test_fdwriteTableBeginEnd,
+{
+  INIT_BUFFER;
+
+  {
+    lbs_fdwriteTupleSize(BUFFER_NAME, 1);
+    lbs_fdwriteTableBegin(BUFFER_NAME);
+    lbs_fdwriteNumber(BUFFER_NAME, 1);
+    lbs_fdwriteTableBegin(BUFFER_NAME);
+    lbs_fdwriteTableEnd(BUFFER_NAME, 0, 0);
+    lbs_fdwriteTableEnd(BUFFER_NAME, 1, 0);
+
+    CHECK_BUFFER(
+        BUFFER_NAME,
+        "\x01"
+        "T" "\x01\x00\x00\x00" "\x00\x00\x00\x00"
+        "N" "\x00\x00\x00\x00\x00\x00\xF0\x3F"
+        "T" "\x00\x00\x00\x00" "\x00\x00\x00\x00",
+        1 + 9 + 9 + 9
+      );
+  }
+
+  DESTROY_BUFFER;
+})
+
+TEST (test_fdwriteTableSeekBack,
+{
+  INIT_BUFFER;
+
+  {
+    /* Enough values to get table header flushed before table ends */
+    int count = LUABINS_FDWRITEFLUSH / (1 + 8 + 1) + 1;
+    size_t length = 1 + 9 + count * (1 + 8 + 1);
+    unsigned char * expected = (unsigned char *)malloc(length);
+    unsigned char * pos = expected;
+    int i = 0;
+
+    *pos++ = 0x01;
+    *pos++ = LUABINS_CTABLE;
+    memcpy(pos, &count, 4);
+    pos += 4;
+    memset(pos, 0, 4);
+    pos += 4;
+
+    lbs_fdwriteTupleSize(BUFFER_NAME, 1);
+    lbs_fdwriteTableBegin(BUFFER_NAME);
+    for (i = 0; i < count; ++i)
+    {
+      lua_Number key = (lua_Number)(i + 1);
+
+      *pos++ = LUABINS_CNUMBER;
+      memcpy(pos, &key, 8);
+      pos += 8;
+      *pos++ = LUABINS_CTRUE;
+
+      lbs_fdwriteNumber(BUFFER_NAME, key);
+      lbs_fdwriteBoolean(BUFFER_NAME, 1);
+    }
+
+    if (w.flushed == 0)
+    {
+      fprintf(stderr, "table header was expected to be flushed\n");
+      exit(1);
+    }
+
+    if (lbs_fdwriteTableEnd(BUFFER_NAME, count, 0) != LUABINS_ESUCCESS)
+    {
+      fprintf(stderr, "lbs_fdwriteTableEnd failed\n");
+      exit(1);
+    }
+
+    CHECK_BUFFER(BUFFER_NAME, (const char *)expected, length);
+
+    free(expected);
+  }
+
+  DESTROY_BUFFER;
+})
+
+TEST (test_fdwriteTablePipe,
+{
+  static const char expected[] =
+    "\x01"
+    "T" "\x00\x00\x00\x00" "\x01\x00\x00\x00"
+    "1" "0";
+
+  int fds[2];
+  lbs_FdWriter w;
+  char buf[64];
+  ssize_t actually_read = 0;
+
+  if (pipe(fds) != 0)
+  {
+    fprintf(stderr, "pipe failed\n");
+    exit(1);
+  }
+  fcntl(fds[0], F_SETFL, fcntl(fds[0], F_GETFL) | O_NONBLOCK);
+
+  lbs_fdwriterInit(&w, fds[1], lbs_simplealloc, NULL);
+  if (w.base != -1)
+  {
+    fprintf(stderr, "pipe was expected to be non-seekable\n");
+    exit(1);
+  }
+
+  lbs_fdwriteTupleSize(&w, 1);
+  lbs_fdwriteTableBegin(&w);
+  lbs_fdwriteBoolean(&w, 1);
+  lbs_fdwriteBoolean(&w, 0);
+
+  /* Nothing is written until table is closed */
+  lbs_fdwriterFlush(&w);
+  actually_read = read(fds[0], buf, sizeof(buf));
+  if (actually_read != -1 || errno != EAGAIN)
+  {
+    fprintf(stderr, "no data expected in pipe before table end\n");
+    exit(1);
+  }
+
+  lbs_fdwriteTableEnd(&w, 0, 1);
+  if (lbs_fdwriterDestroy(&w) != LUABINS_ESUCCESS)
+  {
+    fprintf(stderr, "lbs_fdwriterDestroy failed\n");
+    exit(1);
+  }
+
+  actually_read = read(fds[0], buf, sizeof(buf));
+  if (
+      actually_read != (ssize_t)(sizeof(expected) - 1) ||
+      memcmp(buf, expected, sizeof(expected) - 1) != 0
+    )
+  {
+    fprintf(stderr, "pipe data mismatch\n");
+    exit(1);
+  }
+
+  close(fds[0]);
+  close(fds[1]);
+})
+
+TEST (test_fdwriteTableUnbalanced,
+{
+  lbs_FdWriter w;
+  FILE * f = tmpfile();
+
+  lbs_fdwriterInit(&w, fileno(f), lbs_simplealloc, NULL);
+  lbs_fdwriteTableBegin(&w);
+  if (lbs_fdwriterDestroy(&w) != LUABINS_EFAILURE)
+  {
+    fprintf(stderr, "lbs_fdwriterDestroy: error expected\n");
+    exit(1);
+  }
+
+  lbs_fdwriterInit(&w, fileno(f), lbs_simplealloc, NULL);
+  if (lbs_fdwriteTableEnd(&w, 0, 0) != LUABINS_EFAILURE)
+  {
+    fprintf(stderr, "lbs_fdwriteTableEnd: error expected\n");
+    exit(1);
+  }
+  lbs_fdwriterDestroy(&w);
+
+  fclose(f);
+})
+
+/******************************************************************************/
+
+void test_fdwrite_api()
+{
+  RUN_GENERATED_TESTS;
+
+  test_fdwriteLargeString();
+  test_fdwriteManyValues();
+  test_fdwriteError();
+  test_fdwriteTableBeginEnd();
+  test_fdwriteTableSeekBack();
+  test_fdwriteTablePipe();
+  test_fdwriteTableUnbalanced();
+}
@@ -0,0 +1,251 @@
+/*
+* test_iovwrite_api.c
+* Luabins Lua-less scatter/gather write API tests
+* See copyright notice in luabins.h
+*/
+
+/*
+* WARNING: This suite is format-specific. Change it when format changes.
+*/
+
+#ifndef _POSIX_C_SOURCE
+  #define _POSIX_C_SOURCE 200112L /* fileno() */
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "lualess.h"
+#include "iovwrite.h"
+
+#include "test.h"
+#include "util.h"
+
+/******************************************************************************/
+
+/* Small threshold, so string tests exercise references */
+#define TEST_IOVTHRESHOLD (4)
+
+static void check_data(
+    const unsigned char * actual_buf,
+    size_t actual_length,
+    const char * expected_buf_c,
+    size_t expected_length
+  )
+{
+  const unsigned char * expected_buf = (const unsigned char *)expected_buf_c;
+
+  if (actual_length != expected_length)
+  {
+    fprintf(
+        stderr,
+        "length mismatch: got %lu, expected %lu\n",
+        (unsigned long)actual_length, (unsigned long)expected_length
+      );
+    fprintf(stderr, "actual:\n");
+    fprintbuf(stderr, actual_buf, actual_length);
+    fprintf(stderr, "expected:\n");
+    fprintbuf(stderr, expected_buf, expected_length);
+    exit(1);
+  }
+
+  if (memcmp(actual_buf, expected_buf, expected_length) != 0)
+  {
+    fprintf(stderr, "buffer mismatch\n");
+    fprintf(stderr, "actual:\n");
+    fprintbuf(stderr, actual_buf, actual_length);
+    fprintf(stderr, "expected:\n");
+    fprintbuf(stderr, expected_buf, expected_length);
+    exit(1);
+  }
+}
+
+/* Gathers all segments into single buffer, one vector at a time */
+static void check_buffer(
+    lbs_IovWriter * w,
+    const char * expected_buf,
+    size_t expected_length
+  )
+{
+  size_t length = lbs_iovwriterLength(w);
+  unsigned char * actual_buf = (unsigned char *)malloc(length + 1);
+  size_t actual_length = 0;
+  size_t segment = 0;
+  struct iovec iov;
+
+  while (lbs_iovwriterSegments(w, segment, &iov, 1, &segment) > 0)
+  {
+    if (actual_length + iov.iov_len > length)
+    {
+      fprintf(stderr, "segments are longer than reported\n");
+      free(actual_buf);
+      exit(1);
+    }
+
+    memcpy(actual_buf + actual_length, iov.iov_base, iov.iov_len);
+    actual_length += iov.iov_len;
+  }
+
+  check_data(actual_buf, actual_length, expected_buf, expected_length);
+
+  free(actual_buf);
+}
+
+/******************************************************************************/
+
+#define CAT(a, b) a ## b
+
+#define TEST_NAME(x) CAT(test_iovwrite, x)
+#define CALL_NAME(x) CAT(lbs_iovwrite, x)
+#define BUFFER_NAME (&w)
+#define INIT_BUFFER \
+  lbs_IovWriter w; \
+  lbs_iovwriterInit(BUFFER_NAME, TEST_IOVTHRESHOLD, lbs_simplealloc, NULL);
+
+#define DESTROY_BUFFER \
+  lbs_iovwriterDestroy(BUFFER_NAME);
+
+#define CHECK_BUFFER check_buffer
+
+#include "write_tests.inc"
+
+/******************************************************************************/
+
+TEST (test_iovwriteReference,
+{
+  static const char expected[] =
+    "\x03"
+    "S" "\x03\x00\x00\x00" "abc"
+    "S" "\x07\x00\x00\x00" "Luabins"
+    "-";
+
+  char value[] = "Luabins";
+
+  INIT_BUFFER;
+
+  lbs_iovwriteTupleSize(BUFFER_NAME, 3);
+  lbs_iovwriteString(BUFFER_NAME, "abc", 3);
+  lbs_iovwriteString(BUFFER_NAME, value, 7);
+  lbs_iovwriteNil(BUFFER_NAME);
+
+  if (w.num_refs != 1 || lbs_iovwriterNumSegments(&w) != 3)
+  {
+    fprintf(stderr, "one string reference expected\n");
+    exit(1);
+  }
+
+  /* Referenced string must not be copied */
+  {
+    struct iovec iov[3];
+    size_t next = 0;
+    int count = lbs_iovwriterSegments(BUFFER_NAME, 0, iov, 3, &next);
+
+    if (count != 3 || next != 3 || iov[1].iov_base != (void *)value)
+    {
+      fprintf(stderr, "string reference mismatch\n");
+      exit(1);
+    }
+  }
+
+  CHECK_BUFFER(BUFFER_NAME, expected, sizeof(expected) - 1);
+
+  DESTROY_BUFFER;
+})
+
+TEST (test_iovwriteTablePatch,
+{
+  /* Table header may be patched after referenced strings were written */
+  static const char expected[] =
+    "\x01"
+    "T" "\x01\x00\x00\x00" "\x00\x00\x00\x00"
+    "N" "\x00\x00\x00\x00\x00\x00\xF0\x3F"
+    "S" "\x07\x00\x00\x00" "Luabins";
+
+  INIT_BUFFER;
+
+  {
+    size_t header_pos = 0;
+
+    lbs_iovwriteTupleSize(BUFFER_NAME, 1);
+    header_pos = lbsSB_length(&w.sb);
+    lbs_iovwriteTableHeader(BUFFER_NAME, 0, 0);
+    lbs_iovwriteNumber(BUFFER_NAME, 1);
+    lbs_iovwriteString(BUFFER_NAME, "Luabins", 7);
+    lbs_writeTableHeaderAt(&w.sb, header_pos, 1, 0);
+  }
+
+  CHECK_BUFFER(BUFFER_NAME, expected, sizeof(expected) - 1);
+
+  DESTROY_BUFFER;
+})
+
+TEST (test_iovwriteWrite,
+{
+  static const char expected[] =
+    "\x04"
+    "S" "\x07\x00\x00\x00" "Luabins"
+    "S" "\x07\x00\x00\x00" "Luabins"
+    "1"
+    "S" "\x04\x00\x00\x00" "1234";
+
+  INIT_BUFFER;
+
+  lbs_iovwriteTupleSize(BUFFER_NAME, 4);
+  lbs_iovwriteString(BUFFER_NAME, "Luabins", 7);
+  lbs_iovwriteString(BUFFER_NAME, "Luabins", 7);
+  lbs_iovwriteBoolean(BUFFER_NAME, 1);
+  lbs_iovwriteString(BUFFER_NAME, "1234", 4);
+
+  {
+    FILE * f = tmpfile();
+    int fd = fileno(f);
+    size_t length = lbs_iovwriterLength(&w);
+    unsigned char * actual_buf = (unsigned char *)malloc(length + 1);
+    ssize_t actually_read = 0;
+
+    if (lbs_iovwriterWrite(BUFFER_NAME, fd) != LUABINS_ESUCCESS)
+    {
+      fprintf(stderr, "lbs_iovwriterWrite failed\n");
+      exit(1);
+    }
+
+    lseek(fd, 0, SEEK_SET);
+    actually_read = read(fd, actual_buf, length + 1);
+    if (actually_read < 0)
+    {
+      fprintf(stderr, "read failed\n");
+      exit(1);
+    }
+
+    check_data(
+        actual_buf,
+        (size_t)actually_read,
+        expected,
+        sizeof(expected) - 1
+      );
+
+    free(actual_buf);
+    fclose(f);
+  }
+
+  if (lbs_iovwriterWrite(BUFFER_NAME, -1) != LUABINS_EWRITE)
+  {
+    fprintf(stderr, "lbs_iovwriterWrite: error expected\n");
+    exit(1);
+  }
+
+  DESTROY_BUFFER;
+})
+
+/******************************************************************************/
+
+void test_iovwrite_api()
+{
+  RUN_GENERATED_TESTS;
+
+  test_iovwriteReference();
+  test_iovwriteTablePatch();
+  test_iovwriteWrite();
+}
@@ -0,0 +1,513 @@
+/*
+* test_parse_api.c
+* Luabins Lua-less event-based parser tests
+* See copyright notice in luabins.h
+*/
+
+/*
+* WARNING: This suite is format-specific. Change it when format changes.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Should be included first */
+#include "lualess.h"
+#include "parse.h"
+
+#include "test.h"
+#include "util.h"
+
+/******************************************************************************/
+
+/* Collects parser events as text */
+typedef struct EventLog
+{
+  char buf[1024];
+  size_t len;
+  int abort_after; /* Abort on this event number, if positive */
+} EventLog;
+
+static int log_event(void * ud, const char * event)
+{
+  EventLog * log = (EventLog *)ud;
+  size_t len = strlen(event);
+
+  if (log->len + len + 1 > sizeof(log->buf))
+  {
+    fprintf(stderr, "event log overflow\n");
+    exit(1);
+  }
+
+  memcpy(log->buf + log->len, event, len);
+  log->len += len;
+  log->buf[log->len++] = ' ';
+  log->buf[log->len] = '\0';
+
+  if (log->abort_after > 0 && --log->abort_after == 0)
+  {
+    return LUABINS_EFAILURE;
+  }
+
+  return LUABINS_ESUCCESS;
+}
+
+static int on_nil(void * ud)
+{
+  return log_event(ud, "nil");
+}
+
+static int on_boolean(void * ud, int value)
+{
+  return log_event(ud, value ? "true" : "false");
+}
+
+static int on_number(void * ud, lua_Number value)
+{
+  char buf[64];
+  sprintf(buf, "%g", value);
+  return log_event(ud, buf);
+}
+
+static int on_string(void * ud, const char * value, size_t length)
+{
+  char buf[64];
+  if (length + 3 > sizeof(buf))
+  {
+    length = sizeof(buf) - 3;
+  }
+  buf[0] = '"';
+  memcpy(buf + 1, value, length);
+  buf[length + 1] = '"';
+  buf[length + 2] = '\0';
+  return log_event(ud, buf);
+}
+
+static int on_table_begin(void * ud, int array_size, int hash_size)
+{
+  char buf[64];
+  sprintf(buf, "{%d,%d", array_size, hash_size);
+  return log_event(ud, buf);
+}
+
+static int on_key(void * ud)
+{
+  return log_event(ud, "key");
+}
+
+static int on_table_end(void * ud)
+{
+  return log_event(ud, "}");
+}
+
+static int on_extension(
+    void * ud,
+    const char * name,
+    size_t name_length,
+    const unsigned char * data,
+    size_t length
+  )
+{
+  char buf[64];
+  if (name_length + 16 > sizeof(buf))
+  {
+    name_length = sizeof(buf) - 16;
+  }
+  buf[0] = '<';
+  memcpy(buf + 1, name, name_length);
+  sprintf(buf + 1 + name_length, ":%d>", (int)length);
+  (void)data;
+  return log_event(ud, buf);
+}
+
+static int on_integer(void * ud, lua_Integer value)
+{
+  char buf[64];
+  sprintf(buf, "%ldi", (long)value);
+  return log_event(ud, buf);
+}
+
+static const luabins_ParseCallbacks CALLBACKS =
+{
+  on_nil,
+  on_boolean,
+  on_number,
+  on_string,
+  on_table_begin,
+  on_key,
+  on_table_end,
+  on_extension,
+  on_integer
+};
+
+static void check_parse(
+    const char * data,
+    size_t len,
+    int abort_after,
+    int expected_result,
+    const char * expected_log
+  )
+{
+  EventLog log;
+  int result = 0;
+
+  log.len = 0;
+  log.buf[0] = '\0';
+  log.abort_after = abort_after;
+
+  result = luabins_parse(
+      (const unsigned char *)data,
+      len,
+      &CALLBACKS,
+      &log
+    );
+
+  if (result != expected_result)
+  {
+    fprintf(
+        stderr,
+        "luabins_parse result mismatch: got %d, expected %d\n",
+        result, expected_result
+      );
+    fprintbuf(stderr, (const unsigned char *)data, len);
+    exit(1);
+  }
+
+  if (strcmp(log.buf, expected_log) != 0)
+  {
+    fprintf(stderr, "luabins_parse event mismatch\n");
+    fprintf(stderr, "actual:   '%s'\n", log.buf);
+    fprintf(stderr, "expected: '%s'\n", expected_log);
+    exit(1);
+  }
+}
+
+/******************************************************************************/
+
+TEST (test_parseSimple,
+{
+  check_parse("", 0, 0, LUABINS_EBADDATA, "");
+  check_parse("\x00", 1, 0, LUABINS_ESUCCESS, "");
+  check_parse("\x00" "-", 1 + 1, 0, LUABINS_ETAILEFT, "");
+
+  check_parse(
+      "\x05"
+      "-" "0" "1"
+      "N" "\x00\x00\x00\x00\x00\x00\xF0\x3F"
+      "S" "\x07\x00\x00\x00" "Luabins",
+      1 + 3 + 9 + 12,
+      0,
+      LUABINS_ESUCCESS,
+      "nil false true 1 \"Luabins\" "
+    );
+})
+
+TEST (test_parseTable,
+{
+  /* { [true] = { 1 }, "Luabins" } */
+  static const char data[] =
+    "\x01"
+    "T" "\x01\x00\x00\x00" "\x01\x00\x00\x00"
+      "1"
+      "T" "\x01\x00\x00\x00" "\x00\x00\x00\x00"
+        "N" "\x00\x00\x00\x00\x00\x00\xF0\x3F"
+        "N" "\x00\x00\x00\x00\x00\x00\xF0\x3F"
+      "N" "\x00\x00\x00\x00\x00\x00\xF0\x3F"
+      "S" "\x07\x00\x00\x00" "Luabins";
+
+  check_parse(
+      data,
+      sizeof(data) - 1,
+      0,
+      LUABINS_ESUCCESS,
+      "{1,1 key true {1,0 key 1 1 } key 1 \"Luabins\" } "
+    );
+
+  /* Truncated */
+  check_parse(
+      data,
+      sizeof(data) - 2,
+      0,
+      LUABINS_EBADSIZE,
+      "{1,1 key true {1,0 key 1 1 } key 1 "
+    );
+
+  /* Aborted on third event */
+  check_parse(
+      data,
+      sizeof(data) - 1,
+      3,
+      LUABINS_EABORTED,
+      "{1,1 key true "
+    );
+})
+
+TEST (test_parseBadKey,
+{
+  check_parse(
+      "\x01" "T" "\x00\x00\x00\x00" "\x01\x00\x00\x00" "-" "1",
+      1 + 1 + 4 + 4 + 2,
+      0,
+      LUABINS_EBADDATA,
+      "{0,1 key "
+    );
+
+  check_parse(
+      "\x01" "T" "\x00\x00\x00\x00" "\x01\x00\x00\x00"
+      "N" "\x00\x00\x00\x00\x00\x00\xF8\x7F" "1",
+      1 + 1 + 4 + 4 + 9 + 1,
+      0,
+      LUABINS_EBADDATA,
+      "{0,1 key "
+    );
+})
+
+static const luabins_ParseCallbacks NO_CALLBACKS =
+{
+  NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL
+};
+
+TEST (test_parseNoCallbacks,
+{
+  int result = luabins_parse(
+      (const unsigned char *)
+        "\x02" "1" "T" "\x00\x00\x00\x00" "\x00\x00\x00\x00",
+      1 + 1 + 1 + 4 + 4,
+      &NO_CALLBACKS,
+      NULL
+    );
+  if (result != LUABINS_ESUCCESS)
+  {
+    fprintf(stderr, "luabins_parse failed: %d\n", result);
+    exit(1);
+  }
+})
+
+TEST (test_parsePacked,
+{
+  check_parse(
+      "\x01" "P" "b" "\x02\x00\x00\x00" "\x05" "\xFB",
+      1 + 1 + 1 + 4 + 2,
+      0,
+      LUABINS_ESUCCESS,
+      "{2,0 key 1 5 key 2 -5 } "
+    );
+
+  check_parse(
+      "\x01" "P" "d" "\x01\x00\x00\x00" "\x00\x00\x00\x00\x00\x00\xE0\x3F",
+      1 + 1 + 1 + 4 + 8,
+      0,
+      LUABINS_ESUCCESS,
+      "{1,0 key 1 0.5 } "
+    );
+
+  /* Truncated */
+  check_parse(
+      "\x01" "P" "b" "\x02\x00\x00\x00" "\x05",
+      1 + 1 + 1 + 4 + 1,
+      0,
+      LUABINS_EBADSIZE,
+      ""
+    );
+})
+
+TEST (test_parseFloat,
+{
+  check_parse(
+      "\x02" "F" "\x00\x00\x00\x3F" "P" "f" "\x01\x00\x00\x00" "\x00\x00\xC0\xBF",
+      1 + 5 + 6 + 4,
+      0,
+      LUABINS_ESUCCESS,
+      "0.5 {1,0 key 1 -1.5 } "
+    );
+
+  /* NaN key */
+  check_parse(
+      "\x01" "T" "\x00\x00\x00\x00" "\x01\x00\x00\x00"
+      "F" "\x00\x00\xC0\x7F" "1",
+      1 + 1 + 4 + 4 + 5 + 1,
+      0,
+      LUABINS_EBADDATA,
+      "{0,1 key "
+    );
+})
+
+TEST (test_parseBitsetAndSpans,
+{
+  check_parse(
+      "\x01" "B" "\x03\x00\x00\x00" "\x05",
+      1 + 5 + 1,
+      0,
+      LUABINS_ESUCCESS,
+      "{3,0 key 1 true key 2 false key 3 true } "
+    );
+
+  check_parse(
+      "\x01"
+      "R" "\x02\x00\x00\x00" "\x03\x00\x00\x00"
+        "\x01\x00\x00\x00" "\x01\x00\x00\x00" "1"
+        "\x05\x00\x00\x00" "\x02\x00\x00\x00" "1" "0",
+      1 + 9 + 9 + 8 + 2,
+      0,
+      LUABINS_ESUCCESS,
+      "{1,2 key 1 true key 5 true key 6 false } "
+    );
+
+  check_parse(
+      "\x01"
+      "R" "\x01\x00\x00\x00" "\x01\x00\x00\x00"
+        "\x07\x00\x00\x00" "\x01\x00\x00\x00" "-",
+      1 + 9 + 8 + 1,
+      0,
+      LUABINS_EBADDATA,
+      "{0,1 key 7 "
+    );
+
+  check_parse(
+      "\x01" "R" "\x00\x00\x00\x00" "\x00\x00\x00\x00",
+      1 + 9,
+      0,
+      LUABINS_ESUCCESS,
+      "{0,0 } "
+    );
+})
+
+TEST (test_parseShaped,
+{
+  check_parse(
+      "\x02"
+      "D" "\x02\x00\x00\x00"
+        "\x01\x00\x00\x00" "x" "\x01\x00\x00\x00" "y" "1" "0"
+      "K" "\x11\x00\x00\x00" "0" "1",
+      1 + 17 + 7,
+      0,
+      LUABINS_ESUCCESS,
+      "{0,2 key \"x\" true key \"y\" false } "
+      "{0,2 key \"x\" false key \"y\" true } "
+    );
+
+  check_parse(
+      "\x01"
+      "D" "\x01\x00\x00\x00" "\x01\x00\x00\x00" "x" "-",
+      1 + 10 + 1,
+      0,
+      LUABINS_EBADDATA,
+      "{0,1 key \"x\" "
+    );
+})
+
+TEST (test_parseColumns,
+{
+  check_parse(
+      "\x01"
+      "C" "\x02\x00\x00\x00" "\x02\x00\x00\x00"
+        "\x01\x00\x00\x00" "a" "\x08\x00\x00\x00"
+        "\x01\x00\x00\x00" "b" "\x06\x00\x00\x00"
+        "P" "b" "\x02\x00\x00\x00" "\x01\xFF"
+        "B" "\x02\x00\x00\x00" "\x01",
+      1 + 9 + 18 + 14,
+      0,
+      LUABINS_ESUCCESS,
+      "{0,2 key \"a\" {2,0 key 1 1 key 2 -1 } "
+      "key \"b\" {2,0 key 1 true key 2 false } } "
+    );
+
+  check_parse(
+      "\x01"
+      "C" "\x01\x00\x00\x00" "\x01\x00\x00\x00"
+        "\x01\x00\x00\x00" "a" "\x01\x00\x00\x00"
+        "1",
+      1 + 9 + 9 + 1,
+      0,
+      LUABINS_EBADDATA,
+      "{0,1 key \"a\" "
+    );
+})
+
+TEST (test_parseExtension,
+{
+  check_parse(
+      "\x01"
+      "T" "\x00\x00\x00\x00" "\x01\x00\x00\x00"
+        "X" "\x04\x00\x00\x00" "uuid" "\x02\x00\x00\x00" "\x01\x02"
+        "X" "\x01\x00\x00\x00" "d" "\x00\x00\x00\x00",
+      1 + 9 + 15 + 10,
+      0,
+      LUABINS_ESUCCESS,
+      "{0,1 key <uuid:2> <d:0> } "
+    );
+
+  /* Truncated payload */
+  check_parse(
+      "\x01"
+      "X" "\x01\x00\x00\x00" "d" "\x02\x00\x00\x00" "\x01",
+      1 + 10 + 1,
+      0,
+      LUABINS_EBADSIZE,
+      ""
+    );
+})
+
+TEST (test_parseInteger,
+{
+  check_parse(
+      "\x02"
+      "I" "\x2A\x00\x00\x00\x00\x00\x00\x00"
+      "I" "\xFE\xFF\xFF\xFF\xFF\xFF\xFF\xFF",
+      1 + 9 + 9,
+      0,
+      LUABINS_ESUCCESS,
+      "42i -2i "
+    );
+
+  /* Truncated integer */
+  check_parse(
+      "\x01" "I" "\x2A\x00\x00",
+      1 + 1 + 3,
+      0,
+      LUABINS_EBADDATA,
+      ""
+    );
+
+  /* Without on_integer callback, integers are reported as numbers */
+  {
+    luabins_ParseCallbacks callbacks = CALLBACKS;
+    EventLog log;
+    int result = 0;
+
+    callbacks.on_integer = NULL;
+    log.len = 0;
+    log.buf[0] = '\0';
+    log.abort_after = 0;
+
+    result = luabins_parse(
+        (const unsigned char *)"\x01" "I" "\xFE\xFF\xFF\xFF\xFF\xFF\xFF\xFF",
+        1 + 9,
+        &callbacks,
+        &log
+      );
+    if (result != LUABINS_ESUCCESS || strcmp(log.buf, "-2 ") != 0)
+    {
+      fprintf(stderr, "integer as number mismatch: '%s'\n", log.buf);
+      exit(1);
+    }
+  }
+})
+
+/******************************************************************************/
+
+void test_parse_api()
+{
+  test_parseSimple();
+  test_parseTable();
+  test_parseBadKey();
+  test_parseNoCallbacks();
+  test_parsePacked();
+  test_parseFloat();
+  test_parseBitsetAndSpans();
+  test_parseShaped();
+  test_parseColumns();
+  test_parseExtension();
+  test_parseInteger();
+}
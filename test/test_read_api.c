@@ -0,0 +1,1016 @@
+/*
+* test_read_api.c
+* Luabins Lua-less read API tests
+* See copyright notice in luabins.h
+*/
+
+/*
+* WARNING: This suite is format-specific. Change it when format changes.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Should be included first */
+#include "lualess.h"
+#include "savebuffer.h"
+#include "write.h"
+#include "read.h"
+#include "packed.h"
+
+#include "test.h"
+#include "util.h"
+
+/******************************************************************************/
+
+static void check_type(lbs_Reader * r, unsigned char expected)
+{
+  unsigned char type = 0;
+  check_result("lbs_readType", lbs_readType(r, &type), LUABINS_ESUCCESS);
+  if (type != expected)
+  {
+    fprintf(
+        stderr,
+        "lbs_readType mismatch: got 0x%02X, expected 0x%02X\n",
+        type, expected
+      );
+    exit(1);
+  }
+}
+
+static void check_done(lbs_Reader * r)
+{
+  if (lbs_readerUnread(r) != 0)
+  {
+    fprintf(
+        stderr,
+        "lbs_readerUnread mismatch: got %lu, expected 0\n",
+        (unsigned long)lbs_readerUnread(r)
+      );
+    exit(1);
+  }
+}
+
+#define INIT_READER(data, len) \
+  lbs_Reader r; \
+  lbs_readerInit(&r, (const unsigned char *)(data), (len));
+
+/******************************************************************************/
+
+TEST (test_readEmpty,
+{
+  int tuple_size = -1;
+
+  INIT_READER("", 0);
+
+  check_result(
+      "lbs_readTupleSize",
+      lbs_readTupleSize(&r, &tuple_size),
+      LUABINS_EBADDATA
+    );
+})
+
+TEST (test_readTupleSize,
+{
+  int tuple_size = -1;
+
+  {
+    INIT_READER("\x00", 1);
+
+    check_result(
+        "lbs_readTupleSize",
+        lbs_readTupleSize(&r, &tuple_size),
+        LUABINS_ESUCCESS
+      );
+    check_result("tuple_size", tuple_size, 0);
+    check_done(&r);
+  }
+
+  {
+    INIT_READER("\xFF", 1);
+
+    check_result(
+        "lbs_readTupleSize",
+        lbs_readTupleSize(&r, &tuple_size),
+        LUABINS_EBADSIZE
+      );
+  }
+})
+
+TEST (test_readSimpleValues,
+{
+  static const char data[] =
+    "\x05"
+    "-" "0" "1"
+    "N" "\x00\x00\x00\x00\x00\x00\xF0\x3F"
+    "S" "\x0D\x00\x00\x00" "Embedded\0Zero";
+
+  INIT_READER(data, sizeof(data) - 1);
+
+  {
+    int tuple_size = 0;
+    lua_Number number = 0;
+    const char * str = NULL;
+    size_t len = 0;
+
+    check_result(
+        "lbs_readTupleSize",
+        lbs_readTupleSize(&r, &tuple_size),
+        LUABINS_ESUCCESS
+      );
+    check_result("tuple_size", tuple_size, 5);
+
+    check_type(&r, LUABINS_CNIL);
+    check_type(&r, LUABINS_CFALSE);
+    check_type(&r, LUABINS_CTRUE);
+
+    check_type(&r, LUABINS_CNUMBER);
+    check_result(
+        "lbs_readNumber",
+        lbs_readNumber(&r, &number),
+        LUABINS_ESUCCESS
+      );
+    if (number != 1.0)
+    {
+      fprintf(stderr, "lbs_readNumber mismatch: got %f\n", number);
+      exit(1);
+    }
+
+    check_type(&r, LUABINS_CSTRING);
+    check_result(
+        "lbs_readString",
+        lbs_readString(&r, &str, &len),
+        LUABINS_ESUCCESS
+      );
+    /* Zero-copy: string must point inside the buffer */
+    if (len != 13 || str != data + 1 + 3 + 9 + 5)
+    {
+      fprintf(stderr, "lbs_readString mismatch\n");
+      exit(1);
+    }
+
+    check_done(&r);
+  }
+})
+
+TEST (test_readTableHeader,
+{
+  {
+    int array_size = -1;
+    int hash_size = -1;
+
+    INIT_READER("T" "\x01\x00\x00\x00" "\x00\x00\x00\x00" "11", 1 + 4 + 4 + 2);
+
+    check_type(&r, LUABINS_CTABLE);
+    check_result(
+        "lbs_readTableHeader",
+        lbs_readTableHeader(&r, &array_size, &hash_size),
+        LUABINS_ESUCCESS
+      );
+    check_result("array_size", array_size, 1);
+    check_result("hash_size", hash_size, 0);
+  }
+
+  /* Not enough data for declared table size */
+  {
+    int array_size = -1;
+    int hash_size = -1;
+
+    INIT_READER("T" "\x00\x00\x00\x00" "\x02\x00\x00\x00" "11", 1 + 4 + 4 + 2);
+
+    check_type(&r, LUABINS_CTABLE);
+    check_result(
+        "lbs_readTableHeader",
+        lbs_readTableHeader(&r, &array_size, &hash_size),
+        LUABINS_EBADSIZE
+      );
+
+    /* Reader must stay in bad state */
+    check_result("lbs_readerGood", lbs_readerGood(&r), 0);
+  }
+
+  /* Negative size */
+  {
+    int array_size = -1;
+    int hash_size = -1;
+
+    INIT_READER("T" "\xFF\xFF\xFF\xFF" "\x00\x00\x00\x00" "11", 1 + 4 + 4 + 2);
+
+    check_type(&r, LUABINS_CTABLE);
+    check_result(
+        "lbs_readTableHeader",
+        lbs_readTableHeader(&r, &array_size, &hash_size),
+        LUABINS_EBADSIZE
+      );
+  }
+})
+
+TEST (test_readBadData,
+{
+  /* Unknown type byte */
+  {
+    unsigned char type = 0;
+
+    INIT_READER("Z", 1);
+
+    check_result(
+        "lbs_readType",
+        lbs_readType(&r, &type),
+        LUABINS_EBADDATA
+      );
+  }
+
+  /* Truncated number */
+  {
+    lua_Number number = 0;
+
+    INIT_READER("N" "\x00\x00\x00", 1 + 3);
+
+    check_type(&r, LUABINS_CNUMBER);
+    check_result(
+        "lbs_readNumber",
+        lbs_readNumber(&r, &number),
+        LUABINS_EBADDATA
+      );
+  }
+
+  /* Truncated string */
+  {
+    const char * str = NULL;
+    size_t len = 0;
+
+    INIT_READER("S" "\x08\x00\x00\x00" "Luabins", 1 + 4 + 7);
+
+    check_type(&r, LUABINS_CSTRING);
+    check_result(
+        "lbs_readString",
+        lbs_readString(&r, &str, &len),
+        LUABINS_EBADSIZE
+      );
+  }
+})
+
+TEST (test_skipValue,
+{
+  /* { [true] = { 1 }, "Luabins" } followed by nil */
+  static const char data[] =
+    "T" "\x01\x00\x00\x00" "\x01\x00\x00\x00"
+      "1"
+      "T" "\x01\x00\x00\x00" "\x00\x00\x00\x00"
+        "N" "\x00\x00\x00\x00\x00\x00\xF0\x3F"
+        "N" "\x00\x00\x00\x00\x00\x00\xF0\x3F"
+      "N" "\x00\x00\x00\x00\x00\x00\xF0\x3F"
+      "S" "\x07\x00\x00\x00" "Luabins"
+    "-";
+
+  INIT_READER(data, sizeof(data) - 1);
+
+  check_result("lbs_skipValue", lbs_skipValue(&r), LUABINS_ESUCCESS);
+  check_type(&r, LUABINS_CNIL);
+  check_done(&r);
+})
+
+TEST (test_skipValueBadKey,
+{
+  /* nil as key */
+  {
+    INIT_READER(
+        "T" "\x00\x00\x00\x00" "\x01\x00\x00\x00" "-" "1",
+        1 + 4 + 4 + 2
+      );
+
+    check_result("lbs_skipValue", lbs_skipValue(&r), LUABINS_EBADDATA);
+  }
+
+  /* NaN as key */
+  {
+    INIT_READER(
+        "T" "\x00\x00\x00\x00" "\x01\x00\x00\x00"
+        "N" "\x00\x00\x00\x00\x00\x00\xF8\x7F" "1",
+        1 + 4 + 4 + 9 + 1
+      );
+
+    check_result("lbs_skipValue", lbs_skipValue(&r), LUABINS_EBADDATA);
+  }
+})
+
+TEST (test_readWritten,
+{
+  luabins_SaveBuffer sb;
+  lbsSB_init(&sb, lbs_simplealloc, NULL);
+
+  lbs_writeTupleSize(&sb, 2);
+  lbs_writeTableHeader(&sb, 1, 1);
+  lbs_writeNumber(&sb, 1);
+  lbs_writeString(&sb, "one", 3);
+  lbs_writeString(&sb, "two", 3);
+  lbs_writeNumber(&sb, 2);
+  lbs_writeBoolean(&sb, 1);
+
+  {
+    size_t length = 0;
+    const unsigned char * buf = lbsSB_buffer(&sb, &length);
+    int tuple_size = 0;
+    int array_size = 0;
+    int hash_size = 0;
+    lua_Number number = 0;
+    const char * str = NULL;
+    size_t len = 0;
+
+    INIT_READER(buf, length);
+
+    check_result(
+        "lbs_readTupleSize",
+        lbs_readTupleSize(&r, &tuple_size),
+        LUABINS_ESUCCESS
+      );
+    check_result("tuple_size", tuple_size, 2);
+
+    check_type(&r, LUABINS_CTABLE);
+    check_result(
+        "lbs_readTableHeader",
+        lbs_readTableHeader(&r, &array_size, &hash_size),
+        LUABINS_ESUCCESS
+      );
+    check_result("array_size", array_size, 1);
+    check_result("hash_size", hash_size, 1);
+
+    check_type(&r, LUABINS_CNUMBER);
+    check_result(
+        "lbs_readNumber",
+        lbs_readNumber(&r, &number),
+        LUABINS_ESUCCESS
+      );
+
+    check_type(&r, LUABINS_CSTRING);
+    check_result(
+        "lbs_readString",
+        lbs_readString(&r, &str, &len),
+        LUABINS_ESUCCESS
+      );
+    if (len != 3 || memcmp(str, "one", 3) != 0)
+    {
+      fprintf(stderr, "lbs_readString mismatch\n");
+      exit(1);
+    }
+
+    /* Skip second key-value pair */
+    check_result("lbs_skipValue", lbs_skipValue(&r), LUABINS_ESUCCESS);
+    check_result("lbs_skipValue", lbs_skipValue(&r), LUABINS_ESUCCESS);
+
+    check_type(&r, LUABINS_CTRUE);
+    check_done(&r);
+  }
+
+  lbsSB_destroy(&sb);
+})
+
+static const lua_Number PACKED_VALUES[] = { 1, 300, -2 };
+
+TEST (test_readPacked,
+{
+  luabins_SaveBuffer sb;
+
+  lbsSB_init(&sb, lbs_simplealloc, NULL);
+
+  lbs_writeTupleSize(&sb, 2);
+  lbs_writePackedNumbers(&sb, PACKED_VALUES, 3, 0);
+  lbs_writePackedNumbers(&sb, PACKED_VALUES, 3, 0);
+
+  {
+    size_t length = 0;
+    const unsigned char * buf = lbsSB_buffer(&sb, &length);
+    int tuple_size = 0;
+    unsigned char type = 0;
+    int count = 0;
+    const unsigned char * data = NULL;
+    lua_Number unpacked[3];
+
+    INIT_READER(buf, length);
+
+    check_result(
+        "lbs_readTupleSize",
+        lbs_readTupleSize(&r, &tuple_size),
+        LUABINS_ESUCCESS
+      );
+
+    check_type(&r, LUABINS_CPACKED);
+    check_result(
+        "lbs_readPacked",
+        lbs_readPacked(&r, &type, &count, &data),
+        LUABINS_ESUCCESS
+      );
+    check_result("type", type, LUABINS_PINT16);
+    check_result("count", count, 3);
+
+    lbs_packedUnpack(data, type, count, unpacked);
+    if (
+        unpacked[0] != 1 || unpacked[1] != 300 || unpacked[2] != -2 ||
+        lbs_packedGet(data, type, 2) != -2
+      )
+    {
+      fprintf(stderr, "packed values mismatch\n");
+      exit(1);
+    }
+
+    check_result("lbs_skipValue", lbs_skipValue(&r), LUABINS_ESUCCESS);
+    check_done(&r);
+  }
+
+  lbsSB_destroy(&sb);
+})
+
+TEST (test_readPackedBadData,
+{
+  unsigned char type = 0;
+  int count = 0;
+  const unsigned char * data = NULL;
+
+  {
+    INIT_READER("P" "x" "\x00\x00\x00\x00", 1 + 1 + 4);
+    check_type(&r, LUABINS_CPACKED);
+    check_result(
+        "lbs_readPacked",
+        lbs_readPacked(&r, &type, &count, &data),
+        LUABINS_EBADDATA
+      );
+  }
+
+  {
+    INIT_READER("P" "h" "\x02\x00\x00\x00" "\x01\x00\x02", 1 + 1 + 4 + 3);
+    check_type(&r, LUABINS_CPACKED);
+    check_result(
+        "lbs_readPacked",
+        lbs_readPacked(&r, &type, &count, &data),
+        LUABINS_EBADSIZE
+      );
+  }
+
+  {
+    INIT_READER("P" "b" "\xFF\xFF\xFF\xFF", 1 + 1 + 4);
+    check_result("lbs_skipValue", lbs_skipValue(&r), LUABINS_EBADSIZE);
+  }
+})
+
+TEST (test_readBitsetAndSpans,
+{
+  int count = 0;
+  const unsigned char * bits = NULL;
+  int num_spans = 0;
+  int total = 0;
+  int first_key = 0;
+
+  INIT_READER(
+      "B" "\x09\x00\x00\x00" "\x55\x01"
+      "R" "\x02\x00\x00\x00" "\x03\x00\x00\x00"
+        "\x01\x00\x00\x00" "\x01\x00\x00\x00" "1"
+        "\x05\x00\x00\x00" "\x02\x00\x00\x00" "1" "0"
+      "R" "\x02\x00\x00\x00" "\x03\x00\x00\x00"
+        "\x01\x00\x00\x00" "\x01\x00\x00\x00" "1"
+        "\x05\x00\x00\x00" "\x02\x00\x00\x00" "1" "0",
+      (5 + 2) + (9 + 9 + 8 + 2) * 2
+    );
+
+  check_type(&r, LUABINS_CBITSET);
+  check_result(
+      "lbs_readBitset",
+      lbs_readBitset(&r, &count, &bits),
+      LUABINS_ESUCCESS
+    );
+  check_result("count", count, 9);
+  check_result("bit 0", lbs_bitsetGet(bits, 0), 1);
+  check_result("bit 1", lbs_bitsetGet(bits, 1), 0);
+  check_result("bit 8", lbs_bitsetGet(bits, 8), 1);
+
+  check_type(&r, LUABINS_CSPANS);
+  check_result(
+      "lbs_readSpans",
+      lbs_readSpans(&r, &num_spans, &total),
+      LUABINS_ESUCCESS
+    );
+  check_result("num_spans", num_spans, 2);
+  check_result("total", total, 3);
+
+  check_result(
+      "lbs_readSpan",
+      lbs_readSpan(&r, 0, &first_key, &count),
+      LUABINS_ESUCCESS
+    );
+  check_result("first_key", first_key, 1);
+  check_result("count", count, 1);
+  check_type(&r, LUABINS_CTRUE);
+
+  check_result(
+      "lbs_readSpan",
+      lbs_readSpan(&r, 1, &first_key, &count),
+      LUABINS_ESUCCESS
+    );
+  check_result("first_key", first_key, 5);
+  check_result("count", count, 2);
+  check_type(&r, LUABINS_CTRUE);
+  check_type(&r, LUABINS_CFALSE);
+
+  check_result("lbs_skipValue", lbs_skipValue(&r), LUABINS_ESUCCESS);
+  check_done(&r);
+})
+
+TEST (test_readSpansBadData,
+{
+  /* Overlapping spans */
+  {
+    INIT_READER(
+        "R" "\x02\x00\x00\x00" "\x02\x00\x00\x00"
+          "\x02\x00\x00\x00" "\x01\x00\x00\x00" "1"
+          "\x02\x00\x00\x00" "\x01\x00\x00\x00" "1",
+        9 + 9 + 9
+      );
+    check_result("lbs_skipValue", lbs_skipValue(&r), LUABINS_EBADSIZE);
+  }
+
+  /* Counts do not add up to total */
+  {
+    INIT_READER(
+        "R" "\x01\x00\x00\x00" "\x02\x00\x00\x00"
+          "\x01\x00\x00\x00" "\x01\x00\x00\x00" "1" "1",
+        9 + 9 + 1
+      );
+    check_result("lbs_skipValue", lbs_skipValue(&r), LUABINS_EBADSIZE);
+  }
+
+  /* Key overflow */
+  {
+    INIT_READER(
+        "R" "\x01\x00\x00\x00" "\x02\x00\x00\x00"
+          "\xFF\xFF\xFF\x7F" "\x02\x00\x00\x00" "1" "1",
+        9 + 8 + 2
+      );
+    check_result("lbs_skipValue", lbs_skipValue(&r), LUABINS_EBADSIZE);
+  }
+
+  /* Nil value */
+  {
+    INIT_READER(
+        "R" "\x01\x00\x00\x00" "\x01\x00\x00\x00"
+          "\x01\x00\x00\x00" "\x01\x00\x00\x00" "-",
+        9 + 8 + 1
+      );
+    check_result("lbs_skipValue", lbs_skipValue(&r), LUABINS_EBADDATA);
+  }
+
+  /* Truncated bitset */
+  {
+    INIT_READER("B" "\x09\x00\x00\x00" "\x55", 5 + 1);
+    check_result("lbs_skipValue", lbs_skipValue(&r), LUABINS_EBADSIZE);
+  }
+})
+
+static void check_shape_key(lbs_Reader * r, const char * expected)
+{
+  const char * key = NULL;
+  size_t length = 0;
+
+  check_result(
+      "lbs_readShapeKey",
+      lbs_readShapeKey(r, &key, &length),
+      LUABINS_ESUCCESS
+    );
+  if (length != strlen(expected) || memcmp(key, expected, length) != 0)
+  {
+    fprintf(stderr, "shape key mismatch: expected `%s'\n", expected);
+    exit(1);
+  }
+}
+
+TEST (test_readShaped,
+{
+  lbs_Reader keys;
+  int num_keys = 0;
+
+  INIT_READER(
+      "D" "\x02\x00\x00\x00"
+        "\x01\x00\x00\x00" "x" "\x01\x00\x00\x00" "y" "1" "0"
+      "K" "\x11\x00\x00\x00" "0" "1"
+      "K" "\x18\x00\x00\x00" "1" "1",
+      17 + 7 + 7
+    );
+
+  check_type(&r, LUABINS_CSHAPEDEF);
+  check_result(
+      "lbs_readShapeDef",
+      lbs_readShapeDef(&r, &num_keys),
+      LUABINS_ESUCCESS
+    );
+  check_result("num_keys", num_keys, 2);
+  check_shape_key(&r, "x");
+  check_shape_key(&r, "y");
+  check_type(&r, LUABINS_CTRUE);
+  check_type(&r, LUABINS_CFALSE);
+
+  check_type(&r, LUABINS_CSHAPED);
+  check_result(
+      "lbs_readShaped",
+      lbs_readShaped(&r, &keys, &num_keys),
+      LUABINS_ESUCCESS
+    );
+  check_result("num_keys", num_keys, 2);
+  check_shape_key(&keys, "x");
+  check_shape_key(&keys, "y");
+  check_type(&r, LUABINS_CFALSE);
+  check_type(&r, LUABINS_CTRUE);
+
+  check_result("lbs_skipValue", lbs_skipValue(&r), LUABINS_ESUCCESS);
+  check_done(&r);
+})
+
+TEST (test_readShapedBadData,
+{
+  /* No keys */
+  {
+    INIT_READER("D" "\x00\x00\x00\x00" "1", 5 + 1);
+    check_result("lbs_skipValue", lbs_skipValue(&r), LUABINS_EBADSIZE);
+  }
+
+  /* Nil value */
+  {
+    INIT_READER(
+        "D" "\x01\x00\x00\x00" "\x01\x00\x00\x00" "x" "-",
+        5 + 5 + 1
+      );
+    check_result("lbs_skipValue", lbs_skipValue(&r), LUABINS_EBADDATA);
+  }
+
+  /* Distance past data start */
+  {
+    INIT_READER("K" "\x01\x00\x00\x00" "1", 5 + 1);
+    check_result("lbs_skipValue", lbs_skipValue(&r), LUABINS_EBADDATA);
+  }
+
+  /* Zero distance */
+  {
+    INIT_READER("K" "\x00\x00\x00\x00" "1", 5 + 1);
+    check_result("lbs_skipValue", lbs_skipValue(&r), LUABINS_EBADDATA);
+  }
+
+  /* Distance does not point to definition */
+  {
+    INIT_READER(
+        "1" "K" "\x01\x00\x00\x00" "1",
+        1 + 5 + 1
+      );
+    check_type(&r, LUABINS_CTRUE);
+    check_result("lbs_skipValue", lbs_skipValue(&r), LUABINS_EBADDATA);
+  }
+
+  /* Distance points to a string byte, definition overruns shaped table */
+  {
+    INIT_READER(
+        "S" "\x01\x00\x00\x00" "D"
+        "K" "\x01\x00\x00\x00" "1",
+        6 + 5 + 1
+      );
+    check_result("lbs_skipValue", lbs_skipValue(&r), LUABINS_ESUCCESS);
+    check_result("lbs_skipValue", lbs_skipValue(&r), LUABINS_EBADDATA);
+  }
+
+  /*
+  * Whole fake definition inside a string is not detected,
+  * see lbs_readShaped(). luabins_load() rejects such data.
+  */
+  {
+    lbs_Reader keys;
+    int num_keys = 0;
+
+    INIT_READER(
+        "S" "\x0A\x00\x00\x00"
+          "D" "\x01\x00\x00\x00" "\x01\x00\x00\x00" "x"
+        "K" "\x0A\x00\x00\x00" "1",
+        15 + 5 + 1
+      );
+    check_result("lbs_skipValue", lbs_skipValue(&r), LUABINS_ESUCCESS);
+    check_type(&r, LUABINS_CSHAPED);
+    check_result(
+        "lbs_readShaped",
+        lbs_readShaped(&r, &keys, &num_keys),
+        LUABINS_ESUCCESS
+      );
+    check_result("num_keys", num_keys, 1);
+    check_shape_key(&keys, "x");
+    check_type(&r, LUABINS_CTRUE);
+    check_done(&r);
+  }
+})
+
+TEST (test_readColumns,
+{
+  int num_records = 0;
+  int num_columns = 0;
+  const char * name = NULL;
+  size_t length = 0;
+  size_t size = 0;
+
+  INIT_READER(
+      "C" "\x02\x00\x00\x00" "\x02\x00\x00\x00"
+        "\x01\x00\x00\x00" "a" "\x08\x00\x00\x00"
+        "\x01\x00\x00\x00" "b" "\x06\x00\x00\x00"
+        "P" "b" "\x02\x00\x00\x00" "\x01\xFF"
+        "B" "\x02\x00\x00\x00" "\x01"
+      "C" "\x02\x00\x00\x00" "\x02\x00\x00\x00"
+        "\x01\x00\x00\x00" "a" "\x08\x00\x00\x00"
+        "\x01\x00\x00\x00" "b" "\x06\x00\x00\x00"
+        "P" "b" "\x02\x00\x00\x00" "\x01\xFF"
+        "B" "\x02\x00\x00\x00" "\x01",
+      (9 + 18 + 14) * 2
+    );
+
+  check_type(&r, LUABINS_CCOLUMNS);
+  check_result(
+      "lbs_readColumns",
+      lbs_readColumns(&r, &num_records, &num_columns),
+      LUABINS_ESUCCESS
+    );
+  check_result("num_records", num_records, 2);
+  check_result("num_columns", num_columns, 2);
+
+  check_result(
+      "lbs_readColumnEntry",
+      lbs_readColumnEntry(&r, &name, &length, &size),
+      LUABINS_ESUCCESS
+    );
+  check_result("name", (int)length == 1 && name[0] == 'a', 1);
+  check_result("size", (int)size, 8);
+
+  check_result(
+      "lbs_readColumnEntry",
+      lbs_readColumnEntry(&r, &name, &length, &size),
+      LUABINS_ESUCCESS
+    );
+  check_result("name", (int)length == 1 && name[0] == 'b', 1);
+  check_result("size", (int)size, 6);
+
+  /* Columns */
+  check_result("lbs_skipValue", lbs_skipValue(&r), LUABINS_ESUCCESS);
+  check_result("lbs_skipValue", lbs_skipValue(&r), LUABINS_ESUCCESS);
+
+  check_result("lbs_skipValue", lbs_skipValue(&r), LUABINS_ESUCCESS);
+  check_done(&r);
+})
+
+TEST (test_readColumnsBadData,
+{
+  /* Records without columns */
+  {
+    INIT_READER("C" "\x01\x00\x00\x00" "\x00\x00\x00\x00", 9);
+    check_result("lbs_skipValue", lbs_skipValue(&r), LUABINS_EBADSIZE);
+  }
+
+  /* Column size mismatch */
+  {
+    INIT_READER(
+        "C" "\x01\x00\x00\x00" "\x01\x00\x00\x00"
+          "\x01\x00\x00\x00" "a" "\x05\x00\x00\x00"
+          "B" "\x01\x00\x00\x00" "\x01",
+        9 + 9 + 6
+      );
+    check_result("lbs_skipValue", lbs_skipValue(&r), LUABINS_EBADSIZE);
+  }
+
+  /* Column is not a table */
+  {
+    INIT_READER(
+        "C" "\x01\x00\x00\x00" "\x01\x00\x00\x00"
+          "\x01\x00\x00\x00" "a" "\x01\x00\x00\x00"
+          "1",
+        9 + 9 + 1
+      );
+    check_result("lbs_skipValue", lbs_skipValue(&r), LUABINS_EBADDATA);
+  }
+})
+
+TEST (test_readPatch,
+{
+  int num_ops = 0;
+  int path_length = 0;
+
+  INIT_READER(
+      "\xFD" "\x02\x00\x00\x00"
+        "\x01\x00\x00\x00" "S" "\x01\x00\x00\x00" "a" "-"
+        "\x02\x00\x00\x00" "S" "\x01\x00\x00\x00" "b"
+          "S" "\x01\x00\x00\x00" "c" "0",
+      5 + 11 + 17
+    );
+
+  check_result(
+      "lbs_readPatch",
+      lbs_readPatch(&r, &num_ops),
+      LUABINS_ESUCCESS
+    );
+  check_result("num_ops", num_ops, 2);
+
+  check_result(
+      "lbs_readPatchOp",
+      lbs_readPatchOp(&r, &path_length),
+      LUABINS_ESUCCESS
+    );
+  check_result("path_length", path_length, 1);
+  check_result("lbs_skipValue", lbs_skipValue(&r), LUABINS_ESUCCESS);
+  check_type(&r, LUABINS_CNIL);
+
+  check_result(
+      "lbs_readPatchOp",
+      lbs_readPatchOp(&r, &path_length),
+      LUABINS_ESUCCESS
+    );
+  check_result("path_length", path_length, 2);
+  check_result("lbs_skipValue", lbs_skipValue(&r), LUABINS_ESUCCESS);
+  check_result("lbs_skipValue", lbs_skipValue(&r), LUABINS_ESUCCESS);
+  check_type(&r, LUABINS_CFALSE);
+
+  check_done(&r);
+})
+
+TEST (test_readPatchBadData,
+{
+  int num_ops = 0;
+  int path_length = 0;
+
+  /* Not a patch */
+  {
+    INIT_READER("\x01" "-", 2);
+    check_result(
+        "lbs_readPatch",
+        lbs_readPatch(&r, &num_ops),
+        LUABINS_EBADDATA
+      );
+  }
+
+  /* Too many operations for data */
+  {
+    INIT_READER("\xFD" "\x02\x00\x00\x00" "\x01\x00\x00\x00" "1" "1", 11);
+    check_result(
+        "lbs_readPatch",
+        lbs_readPatch(&r, &num_ops),
+        LUABINS_EBADSIZE
+      );
+  }
+
+  /* Empty path */
+  {
+    INIT_READER("\xFD" "\x01\x00\x00\x00" "\x00\x00\x00\x00" "1" "1", 11);
+    check_result(
+        "lbs_readPatch",
+        lbs_readPatch(&r, &num_ops),
+        LUABINS_ESUCCESS
+      );
+    check_result(
+        "lbs_readPatchOp",
+        lbs_readPatchOp(&r, &path_length),
+        LUABINS_EBADSIZE
+      );
+  }
+})
+
+TEST (test_readExtension,
+{
+  int tuple_size = 0;
+  const char * name = NULL;
+  size_t name_length = 0;
+  const unsigned char * data = NULL;
+  size_t length = 0;
+
+  INIT_READER(
+      "\x02"
+      "X" "\x04\x00\x00\x00" "uuid" "\x02\x00\x00\x00" "\x01\x02"
+      "X" "\x01\x00\x00\x00" "d" "\x00\x00\x00\x00",
+      1 + 15 + 10
+    );
+
+  check_result(
+      "lbs_readTupleSize",
+      lbs_readTupleSize(&r, &tuple_size),
+      LUABINS_ESUCCESS
+    );
+  check_result("tuple_size", tuple_size, 2);
+
+  check_type(&r, LUABINS_CEXTENSION);
+  check_result(
+      "lbs_readExtension",
+      lbs_readExtension(&r, &name, &name_length, &data, &length),
+      LUABINS_ESUCCESS
+    );
+  check_result("name_length", (int)name_length, 4);
+  check_result("name", memcmp(name, "uuid", 4), 0);
+  check_result("length", (int)length, 2);
+  check_result("data", memcmp(data, "\x01\x02", 2), 0);
+
+  check_result("lbs_skipValue", lbs_skipValue(&r), LUABINS_ESUCCESS);
+
+  check_done(&r);
+})
+
+TEST (test_readInteger,
+{
+  int tuple_size = 0;
+  lua_Integer value = 0;
+
+  INIT_READER(
+      "\x03"
+      "I" "\x2A\x00\x00\x00\x00\x00\x00\x00"
+      "I" "\xFE\xFF\xFF\xFF\xFF\xFF\xFF\xFF"
+      "I" "\x00\x00\x00\x00\x00\x00\x00\x01",
+      1 + 9 + 9 + 9
+    );
+
+  check_result(
+      "lbs_readTupleSize",
+      lbs_readTupleSize(&r, &tuple_size),
+      LUABINS_ESUCCESS
+    );
+  check_result("tuple_size", tuple_size, 3);
+
+  check_type(&r, LUABINS_CINTEGER);
+  check_result(
+      "lbs_readInteger",
+      lbs_readInteger(&r, &value),
+      LUABINS_ESUCCESS
+    );
+  check_result("value", (int)value, 42);
+
+  check_type(&r, LUABINS_CINTEGER);
+  check_result(
+      "lbs_readInteger",
+      lbs_readInteger(&r, &value),
+      LUABINS_ESUCCESS
+    );
+  check_result("value", (int)value, -2);
+
+  /* Integers are skipped even if they do not fit lua_Integer */
+  check_result("lbs_skipValue", lbs_skipValue(&r), LUABINS_ESUCCESS);
+
+  check_done(&r);
+})
+
+TEST (test_readExtensionBadData,
+{
+  const char * name = NULL;
+  size_t name_length = 0;
+  const unsigned char * data = NULL;
+  size_t length = 0;
+
+  /* Truncated name */
+  {
+    INIT_READER("\x05\x00\x00\x00" "uuid", 8);
+    check_result(
+        "lbs_readExtension",
+        lbs_readExtension(&r, &name, &name_length, &data, &length),
+        LUABINS_EBADSIZE
+      );
+  }
+
+  /* Truncated payload */
+  {
+    INIT_READER("\x01\x00\x00\x00" "d" "\x02\x00\x00\x00" "\x01", 10);
+    check_result(
+        "lbs_readExtension",
+        lbs_readExtension(&r, &name, &name_length, &data, &length),
+        LUABINS_EBADSIZE
+      );
+  }
+
+  /* Missing payload length */
+  {
+    INIT_READER("\x01\x00\x00\x00" "d" "\x02\x00", 7);
+    check_result(
+        "lbs_readExtension",
+        lbs_readExtension(&r, &name, &name_length, &data, &length),
+        LUABINS_EBADDATA
+      );
+  }
+})
+
+/******************************************************************************/
+
+void test_read_api()
+{
+  test_readEmpty();
+  test_readTupleSize();
+  test_readSimpleValues();
+  test_readTableHeader();
+  test_readBadData();
+  test_skipValue();
+  test_skipValueBadKey();
+  test_readWritten();
+  test_readPacked();
+  test_readPackedBadData();
+  test_readBitsetAndSpans();
+  test_readSpansBadData();
+  test_readShaped();
+  test_readShapedBadData();
+  test_readColumns();
+  test_readColumnsBadData();
+  test_readPatch();
+  test_readPatchBadData();
+  test_readExtension();
+  test_readExtensionBadData();
+  test_readInteger();
+}
@@ -0,0 +1,273 @@
+/*
+* test_snapshot_api.c
+* Luabins Lua-less parallel snapshot encoding tests
+* See copyright notice in luabins.h
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Should be included first */
+#include "lualess.h"
+#include "snapshot.h"
+#include "write.h"
+
+#include "test.h"
+#include "util.h"
+
+/******************************************************************************/
+
+static void append(lbs_Snapshot * s, const lbs_SnapshotNode * node)
+{
+  check_result("lbs_snapshotAppend", lbs_snapshotAppend(s, node, NULL), 0);
+}
+
+/* Compares encoded data with expected data */
+static void check_data(
+    const char * what,
+    int num_threads,
+    luabins_SaveBuffer * actual,
+    luabins_SaveBuffer * expected
+  )
+{
+  const unsigned char * actual_buf = NULL;
+  const unsigned char * expected_buf = NULL;
+  size_t actual_len = 0;
+  size_t expected_len = 0;
+
+  actual_buf = lbsSB_buffer(actual, &actual_len);
+  expected_buf = lbsSB_buffer(expected, &expected_len);
+  if (
+      actual_len != expected_len ||
+      memcmp(actual_buf, expected_buf, expected_len) != 0
+    )
+  {
+    fprintf(
+        stderr,
+        "%s: data mismatch with %d threads"
+        " (%lu bytes, expected %lu)\n",
+        what,
+        num_threads,
+        (unsigned long)actual_len,
+        (unsigned long)expected_len
+      );
+    if (expected_len < 256)
+    {
+      fprintbuf(stderr, actual_buf, actual_len);
+      fprintbuf(stderr, expected_buf, expected_len);
+    }
+    exit(1);
+  }
+}
+
+/* Encodes snapshot, compares result with expected data */
+static void check_encode(
+    lbs_Snapshot * s,
+    int num_threads,
+    luabins_SaveBuffer * expected
+  )
+{
+  luabins_SaveBuffer sb;
+  lbsSB_init(&sb, lbs_simplealloc, NULL);
+
+  check_result(
+      "lbs_snapshotEncode",
+      lbs_snapshotEncode(s, &sb, num_threads),
+      LUABINS_ESUCCESS
+    );
+  check_data("lbs_snapshotEncode", num_threads, &sb, expected);
+
+  lbsSB_destroy(&sb);
+}
+
+/* Encodes snapshot chunk by chunk, compares result with expected data */
+static void check_encode_chunks(
+    lbs_Snapshot * s,
+    luabins_SaveBuffer * expected
+  )
+{
+  luabins_SaveBuffer sb;
+  size_t i = 0;
+
+  lbsSB_init(&sb, lbs_simplealloc, NULL);
+
+  lbs_writeTupleSize(&sb, (unsigned char)s->count);
+  for (i = 0; i < lbs_snapshotChunks(s); ++i)
+  {
+    check_result(
+        "lbs_snapshotEncodeChunk",
+        lbs_snapshotEncodeChunk(s, i, &sb),
+        LUABINS_ESUCCESS
+      );
+  }
+  check_data("lbs_snapshotEncodeChunk", 1, &sb, expected);
+
+  lbsSB_destroy(&sb);
+}
+
+/******************************************************************************/
+
+TEST (test_snapshotSimple,
+{
+  lbs_Snapshot s;
+  luabins_SaveBuffer expected;
+  lbs_SnapshotNode node;
+  size_t table_index = 0;
+
+  lbs_snapshotInit(&s, lbs_simplealloc, NULL);
+  lbsSB_init(&expected, lbs_simplealloc, NULL);
+
+  /* Empty tuple */
+  lbs_writeTupleSize(&expected, 0);
+  check_encode(&s, 1, &expected);
+
+  /* nil, { [true] = 1.5, "Luabins", raw extension value } */
+  lbsSB_reset(&expected);
+  lbs_writeTupleSize(&expected, 2);
+  lbs_writeNil(&expected);
+  lbs_writeTableHeader(&expected, 0, 2);
+  lbs_writeBoolean(&expected, 1);
+  lbs_writeNumber(&expected, 1.5);
+  lbs_writeString(&expected, "Luabins", 7);
+  lbsSB_write(&expected, (const unsigned char *)"X-raw-", 6);
+
+  s.count = 2;
+
+  node.type = LUABINS_CNIL;
+  append(&s, &node);
+
+  node.type = LUABINS_CTABLE;
+  check_result(
+      "append table",
+      lbs_snapshotAppend(&s, &node, &table_index),
+      0
+    );
+  check_result("table index", (int)table_index, 1);
+
+  node.type = LUABINS_CTRUE;
+  append(&s, &node);
+
+  node.type = LUABINS_CNUMBER;
+  node.value.number = 1.5;
+  append(&s, &node);
+
+  node.type = LUABINS_CSTRING;
+  node.value.str = "Luabins";
+  node.length = 7;
+  append(&s, &node);
+
+  /* Raw data goes before and after the value */
+  lbsSB_write(&s.raw, (const unsigned char *)"..X-raw-..", 10);
+  node.type = LUABINS_SNAPSHOTRAW;
+  node.value.offset = 2;
+  node.length = 6;
+  append(&s, &node);
+
+  /* Table sizes are known last */
+  lbs_snapshotNode(&s, table_index)->value.table.array_size = 0;
+  lbs_snapshotNode(&s, table_index)->value.table.hash_size = 2;
+
+  check_result(
+      "snapshot size",
+      (int)s.size,
+      (int)lbsSB_length(&expected) - 1 /* Without tuple size */
+    );
+  check_encode(&s, 1, &expected);
+  check_encode(&s, 4, &expected);
+  check_encode_chunks(&s, &expected);
+
+  /* Reset keeps nothing */
+  lbs_snapshotReset(&s);
+  lbsSB_reset(&expected);
+  lbs_writeTupleSize(&expected, 0);
+  check_encode(&s, 4, &expected);
+  check_encode_chunks(&s, &expected);
+
+  lbsSB_destroy(&expected);
+  lbs_snapshotDestroy(&s);
+})
+
+/* Enough values for many chunks */
+#define NUM_VALUES (100000)
+
+TEST (test_snapshotChunks,
+{
+  static const char STR[] = "0123456789abcdefghijklmnopqrstuvwxyz";
+  lbs_Snapshot s;
+  luabins_SaveBuffer expected;
+  lbs_SnapshotNode node;
+  size_t num_chunks = 0;
+  int num_threads = 0;
+  int i = 0;
+
+  lbs_snapshotInit(&s, lbs_simplealloc, NULL);
+  lbsSB_init(&expected, lbs_simplealloc, NULL);
+
+  /* Single array of numbers, integers and strings of various length */
+  s.count = 1;
+  lbs_writeTupleSize(&expected, 1);
+
+  node.type = LUABINS_CTABLE;
+  node.value.table.array_size = NUM_VALUES;
+  node.value.table.hash_size = 0;
+  append(&s, &node);
+  lbs_writeTableHeader(&expected, NUM_VALUES, 0);
+
+  for (i = 0; i < NUM_VALUES; ++i)
+  {
+    node.type = LUABINS_CINTEGER;
+    node.value.integer = i + 1;
+    append(&s, &node);
+    lbs_writeLuaInteger(&expected, i + 1);
+
+    switch (i % 3)
+    {
+    case 0:
+      node.type = LUABINS_CNUMBER;
+      node.value.number = i / 3.0;
+      append(&s, &node);
+      lbs_writeNumber(&expected, i / 3.0);
+      break;
+
+    case 1:
+      node.type = LUABINS_CSTRING;
+      node.value.str = STR;
+      node.length = i % (sizeof(STR) - 1);
+      append(&s, &node);
+      lbs_writeString(&expected, STR, i % (sizeof(STR) - 1));
+      break;
+
+    default:
+      node.type = (i % 2) ? LUABINS_CTRUE : LUABINS_CFALSE;
+      append(&s, &node);
+      lbs_writeBoolean(&expected, i % 2);
+      break;
+    }
+  }
+
+  num_chunks = lbs_snapshotChunks(&s);
+  if (num_chunks < 4)
+  {
+    fprintf(stderr, "too few chunks: %lu\n", (unsigned long)num_chunks);
+    exit(1);
+  }
+
+  for (num_threads = 1; num_threads <= 16; num_threads *= 2)
+  {
+    check_encode(&s, num_threads, &expected);
+  }
+  check_encode(&s, 0, &expected);
+  check_encode_chunks(&s, &expected);
+
+  lbsSB_destroy(&expected);
+  lbs_snapshotDestroy(&s);
+})
+
+/******************************************************************************/
+
+void test_snapshot_api()
+{
+  test_snapshotSimple();
+  test_snapshotChunks();
+}
@@ -0,0 +1,350 @@
+/*
+* test_stage_api.c
+* Luabins Lua-less off-thread load staging tests
+* See copyright notice in luabins.h
+*/
+
+/*
+* WARNING: This suite is format-specific. Change it when format changes.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Should be included first */
+#include "lualess.h"
+#include "stage.h"
+#include "compress.h"
+#include "checksum.h"
+
+#include "test.h"
+#include "util.h"
+
+/******************************************************************************/
+
+/* { [true] = { 1 }, "Luabins" } */
+static const char TABLE_DATA[] =
+  "\x01"
+  "T" "\x01\x00\x00\x00" "\x01\x00\x00\x00"
+    "1"
+    "T" "\x01\x00\x00\x00" "\x00\x00\x00\x00"
+      "N" "\x00\x00\x00\x00\x00\x00\xF0\x3F"
+      "N" "\x00\x00\x00\x00\x00\x00\xF0\x3F"
+    "N" "\x00\x00\x00\x00\x00\x00\xF0\x3F"
+    "S" "\x07\x00\x00\x00" "Luabins";
+
+static const char TABLE_NODES[] =
+  "{1,1 true {1,0 1 1 } 1 \"Luabins\" } ";
+
+/* Writes staged nodes as text to buf */
+static void dump_nodes(lbs_Stage * s, char * buf, size_t size)
+{
+  size_t num_nodes = 0;
+  size_t len = 0;
+  size_t i = 0;
+  const lbs_StageNode * nodes = lbs_stageNodes(s, &num_nodes);
+
+  buf[0] = '\0';
+  for (i = 0; i < num_nodes; ++i)
+  {
+    char node[64];
+    const lbs_StageNode * n = &nodes[i];
+    size_t node_len = 0;
+
+    switch (n->type)
+    {
+    case LUABINS_CNIL:
+      strcpy(node, "nil");
+      break;
+
+    case LUABINS_CFALSE:
+      strcpy(node, "false");
+      break;
+
+    case LUABINS_CTRUE:
+      strcpy(node, "true");
+      break;
+
+    case LUABINS_CNUMBER:
+      sprintf(node, "%g", n->value.number);
+      break;
+
+    case LUABINS_CINTEGER:
+      sprintf(node, "%ldi", (long)n->value.integer);
+      break;
+
+    case LUABINS_CSTRING:
+      node_len = (n->length + 3 > sizeof(node))
+        ? sizeof(node) - 3
+        : n->length;
+      node[0] = '"';
+      memcpy(node + 1, n->str, node_len);
+      node[node_len + 1] = '"';
+      node[node_len + 2] = '\0';
+      break;
+
+    case LUABINS_CTABLE:
+      sprintf(node, "{%d,%d", (int)n->length, n->value.hash_size);
+      break;
+
+    case LUABINS_CEXTENSION:
+      sprintf(node, "<%d:%d>", (int)n->length, (int)n->value.payload_length);
+      break;
+
+    case LUABINS_STAGEEND:
+      strcpy(node, "}");
+      break;
+
+    default:
+      strcpy(node, "?");
+      break;
+    }
+
+    node_len = strlen(node);
+    if (len + node_len + 2 > size)
+    {
+      fprintf(stderr, "node dump overflow\n");
+      exit(1);
+    }
+
+    memcpy(buf + len, node, node_len);
+    len += node_len;
+    buf[len++] = ' ';
+    buf[len] = '\0';
+  }
+}
+
+static void check_stage(
+    lbs_Stage * s,
+    int expected_result,
+    int expected_count,
+    const char * expected_nodes
+  )
+{
+  char buf[1024];
+
+  if (s->result != expected_result)
+  {
+    fprintf(
+        stderr,
+        "lbs_stage result mismatch: got %d, expected %d\n",
+        s->result, expected_result
+      );
+    exit(1);
+  }
+
+  if (expected_result != LUABINS_ESUCCESS)
+  {
+    return;
+  }
+
+  if (s->count != expected_count)
+  {
+    fprintf(
+        stderr,
+        "lbs_stage count mismatch: got %d, expected %d\n",
+        s->count, expected_count
+      );
+    exit(1);
+  }
+
+  dump_nodes(s, buf, sizeof(buf));
+  if (strcmp(buf, expected_nodes) != 0)
+  {
+    fprintf(stderr, "lbs_stage node mismatch\n");
+    fprintf(stderr, "actual:   '%s'\n", buf);
+    fprintf(stderr, "expected: '%s'\n", expected_nodes);
+    exit(1);
+  }
+}
+
+/******************************************************************************/
+
+TEST (test_stageSimple,
+{
+  lbs_Stage s;
+  lbs_stageInit(&s, lbs_simplealloc, NULL);
+
+  lbs_stage(&s, (const unsigned char *)"\x00", 1);
+  check_stage(&s, LUABINS_ESUCCESS, 0, "");
+
+  lbs_stage(
+      &s,
+      (const unsigned char *)
+      "\x06"
+      "-" "0" "1"
+      "N" "\x00\x00\x00\x00\x00\x00\xF0\x3F"
+      "I" "\xFE\xFF\xFF\xFF\xFF\xFF\xFF\xFF"
+      "S" "\x07\x00\x00\x00" "Luabins",
+      1 + 3 + 9 + 9 + 12
+    );
+  check_stage(&s, LUABINS_ESUCCESS, 6, "nil false true 1 -2i \"Luabins\" ");
+
+  lbs_stage(&s, (const unsigned char *)TABLE_DATA, sizeof(TABLE_DATA) - 1);
+  check_stage(&s, LUABINS_ESUCCESS, 1, TABLE_NODES);
+
+  lbs_stageDestroy(&s);
+})
+
+TEST (test_stageEnvelopes,
+{
+  luabins_SaveBuffer compressed;
+  luabins_SaveBuffer checksummed;
+  const unsigned char * data = NULL;
+  size_t len = 0;
+  lbs_Stage s;
+
+  lbsSB_init(&compressed, lbs_simplealloc, NULL);
+  lbsSB_init(&checksummed, lbs_simplealloc, NULL);
+  lbs_stageInit(&s, lbs_simplealloc, NULL);
+
+  lbs_writeCompressed(
+      &compressed,
+      (const unsigned char *)TABLE_DATA,
+      sizeof(TABLE_DATA) - 1
+    );
+  data = lbsSB_buffer(&compressed, &len);
+  lbs_stage(&s, data, len);
+  check_stage(&s, LUABINS_ESUCCESS, 1, TABLE_NODES);
+
+  lbs_writeChecksummed(&checksummed, data, len);
+  data = lbsSB_buffer(&checksummed, &len);
+  lbs_stage(&s, data, len);
+  check_stage(&s, LUABINS_ESUCCESS, 1, TABLE_NODES);
+
+  /* Strings point to decompressed data, it is kept with the stage */
+  lbsSB_destroy(&checksummed);
+  lbsSB_destroy(&compressed);
+  check_stage(&s, LUABINS_ESUCCESS, 1, TABLE_NODES);
+
+  lbs_stageDestroy(&s);
+})
+
+TEST (test_stageBadData,
+{
+  luabins_SaveBuffer sb;
+  unsigned char * data = NULL;
+  size_t len = 0;
+  lbs_Stage s;
+
+  lbsSB_init(&sb, lbs_simplealloc, NULL);
+  lbs_stageInit(&s, lbs_simplealloc, NULL);
+
+  /* Nothing staged yet */
+  check_stage(&s, LUABINS_EFAILURE, 0, "");
+
+  lbs_stage(&s, (const unsigned char *)"", 0);
+  check_stage(&s, LUABINS_EBADDATA, 0, "");
+
+  lbs_stage(&s, (const unsigned char *)TABLE_DATA, sizeof(TABLE_DATA) - 2);
+  check_stage(&s, LUABINS_EBADSIZE, 0, "");
+
+  /* Nil key */
+  lbs_stage(
+      &s,
+      (const unsigned char *)
+      "\x01" "T" "\x00\x00\x00\x00" "\x01\x00\x00\x00" "-" "1",
+      1 + 1 + 4 + 4 + 2
+    );
+  check_stage(&s, LUABINS_EBADDATA, 0, "");
+
+  lbs_writeChecksummed(
+      &sb,
+      (const unsigned char *)TABLE_DATA,
+      sizeof(TABLE_DATA) - 1
+    );
+  data = (unsigned char *)lbsSB_buffer(&sb, &len);
+  data[len / 2] ^= 1;
+  lbs_stage(&s, data, len);
+  check_stage(&s, LUABINS_ECHECKSUM, 0, "");
+
+  /* Failure does not stick */
+  lbs_stage(&s, (const unsigned char *)TABLE_DATA, sizeof(TABLE_DATA) - 1);
+  check_stage(&s, LUABINS_ESUCCESS, 1, TABLE_NODES);
+
+  lbs_stageDestroy(&s);
+  lbsSB_destroy(&sb);
+})
+
+#define NUM_BLOBS (100)
+
+TEST (test_stageBatch,
+{
+  luabins_SaveBuffer compressed;
+  lbs_Stage stages[NUM_BLOBS];
+  const unsigned char * data[NUM_BLOBS];
+  size_t lengths[NUM_BLOBS];
+  int num_threads = 0;
+  int i = 0;
+
+  lbsSB_init(&compressed, lbs_simplealloc, NULL);
+  lbs_writeCompressed(
+      &compressed,
+      (const unsigned char *)TABLE_DATA,
+      sizeof(TABLE_DATA) - 1
+    );
+
+  for (i = 0; i < NUM_BLOBS; ++i)
+  {
+    lbs_stageInit(&stages[i], lbs_simplealloc, NULL);
+
+    /* Plain, compressed and bad blobs in turn */
+    switch (i % 3)
+    {
+    case 0:
+      data[i] = (const unsigned char *)TABLE_DATA;
+      lengths[i] = sizeof(TABLE_DATA) - 1;
+      break;
+
+    case 1:
+      data[i] = lbsSB_buffer(&compressed, &lengths[i]);
+      break;
+
+    default:
+      data[i] = (const unsigned char *)TABLE_DATA;
+      lengths[i] = sizeof(TABLE_DATA) - 2;
+      break;
+    }
+  }
+
+  /* Serial, more threads than blobs would take, and default */
+  for (num_threads = 1; num_threads <= 200; num_threads *= 4)
+  {
+    lbs_stageBatch(stages, data, lengths, NUM_BLOBS, num_threads);
+
+    for (i = 0; i < NUM_BLOBS; ++i)
+    {
+      if (i % 3 == 2)
+      {
+        check_stage(&stages[i], LUABINS_EBADSIZE, 0, "");
+      }
+      else
+      {
+        check_stage(&stages[i], LUABINS_ESUCCESS, 1, TABLE_NODES);
+      }
+    }
+  }
+
+  lbs_stageBatch(stages, data, lengths, NUM_BLOBS, 0);
+  check_stage(&stages[NUM_BLOBS - 1], LUABINS_ESUCCESS, 1, TABLE_NODES);
+
+  /* Empty batch */
+  lbs_stageBatch(stages, data, lengths, 0, 4);
+
+  for (i = 0; i < NUM_BLOBS; ++i)
+  {
+    lbs_stageDestroy(&stages[i]);
+  }
+  lbsSB_destroy(&compressed);
+})
+
+/******************************************************************************/
+
+void test_stage_api()
+{
+  test_stageSimple();
+  test_stageEnvelopes();
+  test_stageBadData();
+  test_stageBatch();
+}
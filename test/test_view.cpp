@@ -0,0 +1,581 @@
+/*
+* test_view.cpp
+* Luabins header-only C++ zero-copy reader tests
+* See copyright notice in luabins.h
+*/
+
+/*
+* WARNING: This suite is format-specific. Change it when format changes.
+*/
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "writer.hpp"
+#include "view.hpp"
+
+#include "test.h"
+
+/******************************************************************************/
+
+typedef std::map<std::string, std::vector<int> > Config;
+
+static void check_result(const char * what, int actual, int expected)
+{
+  if (actual != expected)
+  {
+    fprintf(
+        stderr,
+        "%s: result mismatch: got %d, expected %d\n",
+        what, actual, expected
+      );
+    exit(1);
+  }
+}
+
+static void check_true(const char * what, bool value)
+{
+  if (!value)
+  {
+    fprintf(stderr, "%s: check failed\n", what);
+    exit(1);
+  }
+}
+
+static int open_tuple(luabins::Tuple & tuple, const char * data, size_t len)
+{
+  return tuple.open(reinterpret_cast<const unsigned char *>(data), len);
+}
+
+/******************************************************************************/
+
+TEST (test_viewSimple,
+{
+  static const char data[] =
+    "\x05"
+    "-" "0" "1"
+    "N" "\x00\x00\x00\x00\x00\x00\xF0\x3F"
+    "S" "\x0D\x00\x00\x00" "Embedded\0Zero";
+
+  luabins::Tuple tuple;
+
+  check_result(
+      "open",
+      open_tuple(tuple, data, sizeof(data) - 1),
+      LUABINS_ESUCCESS
+    );
+  check_true("size", tuple.size() == 5);
+
+  check_true("nil", tuple[0].is_nil());
+  check_true("false", tuple[1].is_boolean() && !tuple[1].as_boolean(true));
+  check_true("true", tuple[2].as_boolean());
+  check_true("number", tuple[3].as_number() == 1.0);
+
+  /* Zero-copy: string must point inside the buffer */
+  check_true(
+      "string",
+      tuple[4].string_length() == 13 &&
+      tuple[4].string_data() == data + 1 + 3 + 9 + 5 &&
+      tuple[4].as_string_view() == std::string_view("Embedded\0Zero", 13)
+    );
+
+  /* Out of range and type mismatch give none and defaults */
+  check_true("none", tuple[5].is_none() && !tuple[5].is_nil());
+  check_true("default", tuple[4].as_number(42) == 42);
+  check_true("not a table", tuple[3].find("x").is_none());
+})
+
+TEST (test_viewTable,
+{
+  Config config;
+  std::string data;
+  luabins::Tuple tuple;
+
+  config["hosts"].push_back(1);
+  config["hosts"].push_back(2);
+  config["ports"].push_back(80);
+
+  check_result(
+      "save",
+      luabins::save(data, config, "tail"),
+      LUABINS_ESUCCESS
+    );
+  check_result(
+      "open",
+      open_tuple(tuple, data.data(), data.size()),
+      LUABINS_ESUCCESS
+    );
+
+  {
+    luabins::View root = tuple[0];
+    luabins::View ports = root.find("ports");
+    luabins::View hosts = root.find(std::string("hosts"));
+    double sum = 0;
+
+    check_true("root", root.is_table() && root.hash_size() == 2);
+    check_true("ports", ports.table_size() == 1);
+    check_true("ports[1]", ports.find(1).as_number() == 80);
+    check_true("missing", root.find("missing").is_none());
+
+    for (luabins::View::Entry e : hosts)
+    {
+      sum += e.key.as_number() * e.value.as_number();
+    }
+    check_true("hosts", sum == 1 * 1 + 2 * 2);
+
+    /* Subtree is skipped to get to the next value */
+    check_true("tail", tuple[1].as_string() == "tail");
+    check_true(
+        "size",
+        root.size() + tuple[1].size() + 1 == data.size()
+      );
+  }
+})
+
+TEST (test_viewIterate,
+{
+  std::string data;
+  luabins::Tuple tuple;
+  int count = 0;
+
+  check_result(
+      "save",
+      luabins::save(data, 1, 2, 3),
+      LUABINS_ESUCCESS
+    );
+  check_result(
+      "open",
+      open_tuple(tuple, data.data(), data.size()),
+      LUABINS_ESUCCESS
+    );
+
+  for (luabins::View v : tuple)
+  {
+    check_true("value", v.as_number() == ++count);
+  }
+  check_true("count", count == 3);
+})
+
+TEST (test_viewBadData,
+{
+  luabins::Tuple tuple;
+
+  check_result("empty", open_tuple(tuple, "", 0), LUABINS_EBADDATA);
+  check_result("tuple size", open_tuple(tuple, "\xFF", 1), LUABINS_EBADSIZE);
+  check_result("tail", open_tuple(tuple, "\x00" "-", 2), LUABINS_ETAILEFT);
+  check_result("type", open_tuple(tuple, "\x01" "Z", 2), LUABINS_EBADDATA);
+
+  check_result(
+      "number",
+      open_tuple(tuple, "\x01" "N" "\x00\x00\x00", 1 + 1 + 3),
+      LUABINS_EBADDATA
+    );
+
+  check_result(
+      "string",
+      open_tuple(tuple, "\x01" "S" "\x08\x00\x00\x00" "Luabins", 1 + 5 + 7),
+      LUABINS_EBADSIZE
+    );
+
+  check_result(
+      "table size",
+      open_tuple(
+          tuple,
+          "\x01" "T" "\x00\x00\x00\x00" "\x02\x00\x00\x00" "11",
+          1 + 9 + 2
+        ),
+      LUABINS_EBADSIZE
+    );
+
+  check_result(
+      "negative size",
+      open_tuple(
+          tuple,
+          "\x01" "T" "\xFF\xFF\xFF\xFF" "\x00\x00\x00\x00",
+          1 + 9
+        ),
+      LUABINS_EBADSIZE
+    );
+
+  check_result(
+      "nil key",
+      open_tuple(
+          tuple,
+          "\x01" "T" "\x00\x00\x00\x00" "\x01\x00\x00\x00" "-" "1",
+          1 + 9 + 2
+        ),
+      LUABINS_EBADDATA
+    );
+
+  check_result(
+      "NaN key",
+      open_tuple(
+          tuple,
+          "\x01" "T" "\x00\x00\x00\x00" "\x01\x00\x00\x00"
+          "N" "\x00\x00\x00\x00\x00\x00\xF8\x7F" "1",
+          1 + 9 + 9 + 1
+        ),
+      LUABINS_EBADDATA
+    );
+
+  /* Failed tuple is empty */
+  check_true("empty", tuple.size() == 0 && tuple[0].is_none());
+})
+
+TEST (test_viewTooDeep,
+{
+  /* Tables nested one level deeper than allowed */
+  const size_t depth = luabins::MaxTableNesting + 1;
+  std::string data(1, '\x01');
+  luabins::Tuple tuple;
+  size_t i = 0;
+
+  for (i = 0; i < depth; ++i)
+  {
+    static const char table[] =
+      "T" "\x01\x00\x00\x00" "\x00\x00\x00\x00"
+      "N" "\x00\x00\x00\x00\x00\x00\xF0\x3F";
+
+    data.append(table, sizeof(table) - 1);
+  }
+  data.append(1, '1');
+  check_result(
+      "too deep",
+      open_tuple(tuple, data.data(), data.size()),
+      LUABINS_ETOODEEP
+    );
+})
+
+TEST (test_viewPacked,
+{
+  static const char data[] =
+    "\x03"
+    "P" "h" "\x03\x00\x00\x00" "\x01\x00" "\x2C\x01" "\xFE\xFF"
+    "P" "d" "\x01\x00\x00\x00" "\x00\x00\x00\x00\x00\x00\xE0\x3F"
+    "1";
+
+  luabins::Tuple tuple;
+
+  check_result(
+      "open",
+      open_tuple(tuple, data, sizeof(data) - 1),
+      LUABINS_ESUCCESS
+    );
+  check_true("size", tuple.size() == 3);
+
+  check_true(
+      "int16",
+      tuple[0].is_packed() &&
+      !tuple[0].is_table() &&
+      tuple[0].packed_type() == LUABINS_PINT16 &&
+      tuple[0].packed_size() == 3 &&
+      tuple[0].packed_at(0) == 1 &&
+      tuple[0].packed_at(1) == 300 &&
+      tuple[0].packed_at(2) == -2 &&
+      tuple[0].packed_at(3, 42) == 42 &&
+      tuple[0].size() == 6 + 3 * 2
+    );
+
+  check_true("double", tuple[1].packed_at(0) == 0.5);
+  check_true("after packed", tuple[2].as_boolean());
+  check_true("not packed", tuple[2].packed_size() == 0);
+
+  /* Truncated */
+  check_result(
+      "truncated",
+      open_tuple(tuple, data, 1 + 6 + 5),
+      LUABINS_EBADSIZE
+    );
+
+  /* Unknown element type */
+  check_result(
+      "bad type",
+      open_tuple(tuple, "\x01" "P" "x" "\x00\x00\x00\x00", 1 + 6),
+      LUABINS_EBADDATA
+    );
+})
+
+TEST (test_viewFloat,
+{
+  static const char data[] =
+    "\x02"
+    "F" "\x00\x00\x00\x3F"
+    "T" "\x00\x00\x00\x00" "\x01\x00\x00\x00"
+      "F" "\x00\x00\xC0\xBF" "1";
+
+  luabins::Tuple tuple;
+
+  check_result(
+      "open",
+      open_tuple(tuple, data, sizeof(data) - 1),
+      LUABINS_ESUCCESS
+    );
+
+  check_true(
+      "scalar",
+      tuple[0].is_number() && tuple[0].as_number() == 0.5 &&
+      tuple[0].size() == 5
+    );
+  check_true("key", tuple[1].find(-1.5).as_boolean());
+
+  /* NaN key */
+  check_result(
+      "nan key",
+      open_tuple(
+          tuple,
+          "\x01" "T" "\x00\x00\x00\x00" "\x01\x00\x00\x00"
+          "F" "\x00\x00\xC0\x7F" "1",
+          1 + 9 + 5 + 1
+        ),
+      LUABINS_EBADDATA
+    );
+})
+
+TEST (test_viewBitsetAndSpans,
+{
+  static const char data[] =
+    "\x02"
+    "B" "\x09\x00\x00\x00" "\x55\x01"
+    "R" "\x02\x00\x00\x00" "\x03\x00\x00\x00"
+      "\x01\x00\x00\x00" "\x01\x00\x00\x00" "1"
+      "\x05\x00\x00\x00" "\x02\x00\x00\x00"
+        "S" "\x04\x00\x00\x00" "five" "0";
+
+  luabins::Tuple tuple;
+
+  check_result(
+      "open",
+      open_tuple(tuple, data, sizeof(data) - 1),
+      LUABINS_ESUCCESS
+    );
+
+  check_true(
+      "bitset",
+      tuple[0].is_bitset() &&
+      tuple[0].bitset_size() == 9 &&
+      tuple[0].bitset_at(0) &&
+      !tuple[0].bitset_at(1) &&
+      tuple[0].bitset_at(8) &&
+      tuple[0].bitset_at(9, true) &&
+      tuple[0].size() == 5 + 2
+    );
+
+  check_true("spans", tuple[1].is_spans() && !tuple[1].is_table());
+  check_true("key 1", tuple[1].find(1).as_boolean());
+  check_true("key 5", tuple[1].find(5).as_string() == "five");
+  check_true("key 6", tuple[1].find(6).is_boolean());
+  check_true("key 2", tuple[1].find(2).is_none());
+  check_true("key 5.5", tuple[1].find(5.5).is_none());
+  check_true("key 7", tuple[1].find(7).is_none());
+
+  /* Nil value */
+  check_result(
+      "nil in span",
+      open_tuple(
+          tuple,
+          "\x01"
+          "R" "\x01\x00\x00\x00" "\x01\x00\x00\x00"
+            "\x01\x00\x00\x00" "\x01\x00\x00\x00" "-",
+          1 + 9 + 8 + 1
+        ),
+      LUABINS_EBADDATA
+    );
+})
+
+TEST (test_viewShaped,
+{
+  static const char data[] =
+    "\x03"
+    "D" "\x02\x00\x00\x00"
+      "\x01\x00\x00\x00" "x" "\x01\x00\x00\x00" "y"
+      "S" "\x04\x00\x00\x00" "five" "1"
+    "K" "\x19\x00\x00\x00" "0" "N" "\x00\x00\x00\x00\x00\x00\xF0\x3F"
+    "K" "\x28\x00\x00\x00" "1" "1";
+
+  luabins::Tuple tuple;
+
+  check_result(
+      "open",
+      open_tuple(tuple, data, sizeof(data) - 1),
+      LUABINS_ESUCCESS
+    );
+
+  check_true(
+      "definition",
+      tuple[0].is_shaped() && !tuple[0].is_table() &&
+      tuple[0].shaped_size() == 2 &&
+      tuple[0].find("x").as_string() == "five" &&
+      tuple[0].find("y").as_boolean() &&
+      tuple[0].find("z").is_none() &&
+      tuple[0].size() == 25
+    );
+
+  check_true(
+      "shaped",
+      tuple[1].is_shaped() &&
+      tuple[1].shaped_size() == 2 &&
+      tuple[1].find("x").is_boolean() &&
+      !tuple[1].find("x").as_boolean(true) &&
+      tuple[1].find("y").as_number() == 1 &&
+      tuple[1].size() == 15
+    );
+
+  check_true("shaped again", tuple[2].find("y").as_boolean());
+
+  /* Definition keys overrun shaped table */
+  check_result(
+      "bad shape",
+      open_tuple(
+          tuple,
+          "\x02" "S" "\x01\x00\x00\x00" "D" "K" "\x01\x00\x00\x00" "1",
+          1 + 6 + 5 + 1
+        ),
+      LUABINS_EBADDATA
+    );
+
+  /* Nil value */
+  check_result(
+      "nil in shaped",
+      open_tuple(
+          tuple,
+          "\x01"
+          "D" "\x01\x00\x00\x00" "\x01\x00\x00\x00" "x" "-",
+          1 + 10 + 1
+        ),
+      LUABINS_EBADDATA
+    );
+})
+
+TEST (test_viewColumns,
+{
+  static const char data[] =
+    "\x01"
+    "C" "\x02\x00\x00\x00" "\x02\x00\x00\x00"
+      "\x01\x00\x00\x00" "a" "\x08\x00\x00\x00"
+      "\x01\x00\x00\x00" "b" "\x06\x00\x00\x00"
+      "P" "b" "\x02\x00\x00\x00" "\x01\xFF"
+      "B" "\x02\x00\x00\x00" "\x01";
+
+  luabins::Tuple tuple;
+
+  check_result(
+      "open",
+      open_tuple(tuple, data, sizeof(data) - 1),
+      LUABINS_ESUCCESS
+    );
+
+  check_true(
+      "columns",
+      tuple[0].is_columns() && !tuple[0].is_table() &&
+      tuple[0].columns_records() == 2 &&
+      tuple[0].size() == 9 + 18 + 14
+    );
+  check_true("column a", tuple[0].find("a").packed_at(1) == -1);
+  check_true("column b", tuple[0].find("b").bitset_at(0));
+  check_true("column c", tuple[0].find("c").is_none());
+
+  /* Column size mismatch */
+  check_result(
+      "bad size",
+      open_tuple(
+          tuple,
+          "\x01"
+          "C" "\x01\x00\x00\x00" "\x01\x00\x00\x00"
+            "\x01\x00\x00\x00" "a" "\x05\x00\x00\x00"
+            "B" "\x01\x00\x00\x00" "\x01",
+          1 + 9 + 9 + 6
+        ),
+      LUABINS_EBADSIZE
+    );
+})
+
+TEST (test_viewExtension,
+{
+  static const char data[] =
+    "\x02"
+    "X" "\x04\x00\x00\x00" "uuid" "\x02\x00\x00\x00" "\x01\x02"
+    "N" "\x00\x00\x00\x00\x00\x00\xF0\x3F";
+
+  luabins::Tuple tuple;
+
+  check_result(
+      "open",
+      open_tuple(tuple, data, sizeof(data) - 1),
+      LUABINS_ESUCCESS
+    );
+
+  check_true(
+      "extension",
+      tuple[0].is_extension() && !tuple[0].is_string() &&
+      tuple[0].size() == 15 &&
+      tuple[0].extension_name_length() == 4 &&
+      std::memcmp(tuple[0].extension_name(), "uuid", 4) == 0 &&
+      tuple[0].extension_size() == 2 &&
+      std::memcmp(tuple[0].extension_data(), "\x01\x02", 2) == 0
+    );
+  check_true("after extension", tuple[1].as_number() == 1);
+  check_true("not extension", tuple[1].extension_data() == NULL);
+
+  /* Truncated payload */
+  check_result(
+      "bad size",
+      open_tuple(
+          tuple,
+          "\x01"
+          "X" "\x01\x00\x00\x00" "d" "\x02\x00\x00\x00" "\x01",
+          1 + 10 + 1
+        ),
+      LUABINS_EBADSIZE
+    );
+})
+
+TEST (test_viewInteger,
+{
+  static const char data[] =
+    "\x02"
+    "I" "\x00\x00\x00\x00\x00\x00\x00\x80"
+    "T" "\x00\x00\x00\x00" "\x01\x00\x00\x00"
+      "I" "\xFE\xFF\xFF\xFF\xFF\xFF\xFF\xFF" "1";
+
+  luabins::Tuple tuple;
+
+  check_result(
+      "open",
+      open_tuple(tuple, data, sizeof(data) - 1),
+      LUABINS_ESUCCESS
+    );
+
+  check_true(
+      "scalar",
+      tuple[0].is_integer() && tuple[0].is_number() &&
+      tuple[0].as_integer() == INT64_MIN && tuple[0].size() == 9
+    );
+  check_true("key", tuple[1].find(-2).as_boolean());
+  check_true("not integer", tuple[1].as_integer(7) == 7);
+
+  /* Truncated integer */
+  check_result(
+      "bad data",
+      open_tuple(tuple, "\x01" "I" "\x2A\x00\x00", 1 + 1 + 3),
+      LUABINS_EBADDATA
+    );
+})
+
+/******************************************************************************/
+
+void test_view()
+{
+  test_viewSimple();
+  test_viewTable();
+  test_viewIterate();
+  test_viewBadData();
+  test_viewTooDeep();
+  test_viewPacked();
+  test_viewFloat();
+  test_viewBitsetAndSpans();
+  test_viewShaped();
+  test_viewColumns();
+  test_viewExtension();
+  test_viewInteger();
+}
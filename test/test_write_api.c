@@ -15,6 +15,7 @@
 /* Should be included first */
 #include "lualess.h"
 #include "write.h"
+#include "packed.h"
 
 #include "test.h"
 #include "util.h"
@@ -120,6 +121,289 @@ TEST (test_writeTableHeaderAt,
   DESTROY_BUFFER;
 })
 
+static const lua_Number INT8S[] = { 1, -1, 127, -128 };
+static const lua_Number INT16S[] = { 1, 128, -32768 };
+static const lua_Number INT32S[] = { 32768, -2147483648.0 };
+
+TEST (test_writePackedNumbers,
+{
+  INIT_BUFFER;
+
+  {
+    lbs_writePackedNumbers(BUFFER_NAME, INT8S, 4, 0);
+    lbs_writePackedNumbers(BUFFER_NAME, INT16S, 3, 0);
+    lbs_writePackedNumbers(BUFFER_NAME, INT32S, 2, 0);
+
+    CHECK_BUFFER(
+        BUFFER_NAME,
+        "P" "b" "\x04\x00\x00\x00" "\x01" "\xFF" "\x7F" "\x80"
+        "P" "h" "\x03\x00\x00\x00" "\x01\x00" "\x80\x00" "\x00\x80"
+        "P" "i" "\x02\x00\x00\x00" "\x00\x80\x00\x00" "\x00\x00\x00\x80",
+        (6 + 4) + (6 + 6) + (6 + 8)
+      );
+  }
+
+  DESTROY_BUFFER;
+})
+
+TEST (test_writePackedDoubles,
+{
+  INIT_BUFFER;
+
+  {
+    /* None of these fits into integer element type */
+    lua_Number doubles[3];
+    doubles[0] = 0.5;
+    doubles[1] = 2147483648.0;
+    doubles[2] = -0.0;
+
+    lbs_writePackedNumbers(BUFFER_NAME, doubles, 1, 0);
+    lbs_writePackedNumbers(BUFFER_NAME, doubles + 1, 1, 0);
+    lbs_writePackedNumbers(BUFFER_NAME, doubles + 2, 1, 0);
+    lbs_writePackedNumbers(BUFFER_NAME, doubles, 0, 0);
+
+    CHECK_BUFFER(
+        BUFFER_NAME,
+        "P" "d" "\x01\x00\x00\x00" "\x00\x00\x00\x00\x00\x00\xE0\x3F"
+        "P" "d" "\x01\x00\x00\x00" "\x00\x00\x00\x00\x00\x00\xE0\x41"
+        "P" "d" "\x01\x00\x00\x00" "\x00\x00\x00\x00\x00\x00\x00\x80"
+        "P" "b" "\x00\x00\x00\x00",
+        (6 + 8) * 3 + 6
+      );
+  }
+
+  DESTROY_BUFFER;
+})
+
+TEST (test_writeFloat,
+{
+  INIT_BUFFER;
+
+  {
+    /* 0.5 and 2^31 fit float, 0.1 does not */
+    lua_Number values[3];
+    values[0] = 0.5;
+    values[1] = 2147483648.0;
+    values[2] = 0.1;
+
+    lbs_writeFloat(BUFFER_NAME, values[0]);
+    lbs_writePackedNumbers(BUFFER_NAME, values, 2, 1);
+    lbs_writePackedNumbers(BUFFER_NAME, values, 3, 1);
+
+    CHECK_BUFFER(
+        BUFFER_NAME,
+        "F" "\x00\x00\x00\x3F"
+        "P" "f" "\x02\x00\x00\x00" "\x00\x00\x00\x3F" "\x00\x00\x00\x4F"
+        "P" "d" "\x03\x00\x00\x00"
+          "\x00\x00\x00\x00\x00\x00\xE0\x3F"
+          "\x00\x00\x00\x00\x00\x00\xE0\x41"
+          "\x9A\x99\x99\x99\x99\x99\xB9\x3F",
+        5 + (6 + 8) + (6 + 24)
+      );
+  }
+
+  DESTROY_BUFFER;
+})
+
+TEST (test_fitsFloat,
+{
+  lua_Number zero = 0;
+
+  if (
+      !lbs_fitsFloat(0.5) ||
+      !lbs_fitsFloat(-16777216.0) ||
+      !lbs_fitsFloat(3.4028234663852886e38) ||
+      lbs_fitsFloat(16777217.0) ||
+      lbs_fitsFloat(0.1) ||
+      lbs_fitsFloat(1e300) ||
+      lbs_fitsFloat(zero / zero)
+    )
+  {
+    fprintf(stderr, "lbs_fitsFloat mismatch\n");
+    exit(1);
+  }
+})
+
+TEST (test_writeFloatPrefersIntegers,
+{
+  INIT_BUFFER;
+
+  lbs_writePackedNumbers(BUFFER_NAME, INT8S, 4, 1);
+  lbs_writePackedNumbers(BUFFER_NAME, INT32S, 2, 1);
+
+  CHECK_BUFFER(
+      BUFFER_NAME,
+      "P" "b" "\x04\x00\x00\x00" "\x01" "\xFF" "\x7F" "\x80"
+      "P" "i" "\x02\x00\x00\x00" "\x00\x80\x00\x00" "\x00\x00\x00\x80",
+      (6 + 4) + (6 + 8)
+    );
+
+  DESTROY_BUFFER;
+})
+
+/* true, false, true, ... (nine values) */
+static const unsigned char BITS[] = { 0x55, 0x01 };
+
+TEST (test_writeBitsetAndSpans,
+{
+  INIT_BUFFER;
+
+  {
+    lbs_writeBitset(BUFFER_NAME, BITS, 9);
+
+    /* { [1] = true, [5] = 1, [6] = false } */
+    lbs_writeSpansHeader(BUFFER_NAME, 2, 3);
+    lbs_writeSpanHeader(BUFFER_NAME, 1, 1);
+    lbs_writeBoolean(BUFFER_NAME, 1);
+    lbs_writeSpanHeader(BUFFER_NAME, 5, 2);
+    lbs_writeNumber(BUFFER_NAME, 1);
+    lbs_writeBoolean(BUFFER_NAME, 0);
+
+    CHECK_BUFFER(
+        BUFFER_NAME,
+        "B" "\x09\x00\x00\x00" "\x55\x01"
+        "R" "\x02\x00\x00\x00" "\x03\x00\x00\x00"
+          "\x01\x00\x00\x00" "\x01\x00\x00\x00" "1"
+          "\x05\x00\x00\x00" "\x02\x00\x00\x00"
+            "N" "\x00\x00\x00\x00\x00\x00\xF0\x3F" "0",
+        (5 + 2) + (9 + 8 + 1 + 8 + 9 + 1)
+      );
+  }
+
+  DESTROY_BUFFER;
+})
+
+TEST (test_writeShaped,
+{
+  INIT_BUFFER;
+
+  {
+    /* { x = true, y = false }, { x = false, y = true } */
+    lbs_writeShapeDefHeader(BUFFER_NAME, 2);
+    lbs_writeShapeKey(BUFFER_NAME, "x", 1);
+    lbs_writeShapeKey(BUFFER_NAME, "y", 1);
+    lbs_writeBoolean(BUFFER_NAME, 1);
+    lbs_writeBoolean(BUFFER_NAME, 0);
+    lbs_writeShapedHeader(BUFFER_NAME, 17);
+    lbs_writeBoolean(BUFFER_NAME, 0);
+    lbs_writeBoolean(BUFFER_NAME, 1);
+
+    CHECK_BUFFER(
+        BUFFER_NAME,
+        "D" "\x02\x00\x00\x00"
+          "\x01\x00\x00\x00" "x" "\x01\x00\x00\x00" "y" "1" "0"
+        "K" "\x11\x00\x00\x00" "0" "1",
+        (5 + 10 + 2) + (5 + 2)
+      );
+  }
+
+  DESTROY_BUFFER;
+})
+
+/* true, false */
+static const unsigned char TRUE_FALSE[] = { 0x01 };
+
+TEST (test_writeColumns,
+{
+  INIT_BUFFER;
+
+  {
+    /* { { a = 1, b = true }, { a = -1, b = false } } */
+    lbs_writeColumnsHeader(BUFFER_NAME, 2, 2);
+    lbs_writeColumnEntry(BUFFER_NAME, "a", 1, 0);
+    lbs_writeColumnEntry(BUFFER_NAME, "b", 1, 0);
+    lbs_writePackedNumbers(BUFFER_NAME, INT8S, 2, 0);
+    lbs_writeBitset(BUFFER_NAME, TRUE_FALSE, 2);
+    lbs_writeColumnSizeAt(BUFFER_NAME, 9 + 5, 8);
+    lbs_writeColumnSizeAt(BUFFER_NAME, 9 + 9 + 5, 6);
+
+    CHECK_BUFFER(
+        BUFFER_NAME,
+        "C" "\x02\x00\x00\x00" "\x02\x00\x00\x00"
+          "\x01\x00\x00\x00" "a" "\x08\x00\x00\x00"
+          "\x01\x00\x00\x00" "b" "\x06\x00\x00\x00"
+          "P" "b" "\x02\x00\x00\x00" "\x01\xFF"
+          "B" "\x02\x00\x00\x00" "\x01",
+        9 + 9 + 9 + 8 + 6
+      );
+  }
+
+  DESTROY_BUFFER;
+})
+
+TEST (test_writePatch,
+{
+  INIT_BUFFER;
+
+  {
+    /* From { a = 1, b = { c = true } } to { b = { c = false } } */
+    lbs_writePatchHeader(BUFFER_NAME, 0);
+    lbs_writePatchOp(BUFFER_NAME, 1);
+    lbs_writeString(BUFFER_NAME, "a", 1);
+    lbs_writeNil(BUFFER_NAME);
+    lbs_writePatchOp(BUFFER_NAME, 2);
+    lbs_writeString(BUFFER_NAME, "b", 1);
+    lbs_writeString(BUFFER_NAME, "c", 1);
+    lbs_writeBoolean(BUFFER_NAME, 0);
+    lbs_writePatchSizeAt(BUFFER_NAME, 0, 2);
+
+    CHECK_BUFFER(
+        BUFFER_NAME,
+        "\xFD" "\x02\x00\x00\x00"
+          "\x01\x00\x00\x00" "S" "\x01\x00\x00\x00" "a" "-"
+          "\x02\x00\x00\x00" "S" "\x01\x00\x00\x00" "b"
+            "S" "\x01\x00\x00\x00" "c" "0",
+        5 + 11 + 17
+      );
+  }
+
+  DESTROY_BUFFER;
+})
+
+TEST (test_writeExtension,
+{
+  INIT_BUFFER;
+
+  {
+    /* Payload size known in advance */
+    lbs_writeExtensionHeader(BUFFER_NAME, "uuid", 4, 2);
+    lbsSB_write(BUFFER_NAME, (const unsigned char *)"\x01\x02", 2);
+
+    /* Payload size fixed afterwards */
+    lbs_writeExtensionHeader(BUFFER_NAME, "d", 1, 0);
+    lbsSB_write(BUFFER_NAME, (const unsigned char *)"abc", 3);
+    lbs_writeExtensionSizeAt(BUFFER_NAME, 15 + 1 + 4 + 1, 3);
+
+    CHECK_BUFFER(
+        BUFFER_NAME,
+        "X" "\x04\x00\x00\x00" "uuid" "\x02\x00\x00\x00" "\x01\x02"
+        "X" "\x01\x00\x00\x00" "d" "\x03\x00\x00\x00" "abc",
+        15 + 13
+      );
+  }
+
+  DESTROY_BUFFER;
+})
+
+TEST (test_writeLuaInteger,
+{
+  INIT_BUFFER;
+
+  {
+    lbs_writeLuaInteger(BUFFER_NAME, 42);
+    lbs_writeLuaInteger(BUFFER_NAME, -2);
+
+    CHECK_BUFFER(
+        BUFFER_NAME,
+        "I" "\x2A\x00\x00\x00\x00\x00\x00\x00"
+        "I" "\xFE\xFF\xFF\xFF\xFF\xFF\xFF\xFF",
+        9 + 9
+      );
+  }
+
+  DESTROY_BUFFER;
+})
+
 /******************************************************************************/
 
 void test_write_api()
@@ -127,4 +411,15 @@ void test_write_api()
   RUN_GENERATED_TESTS;
 
   test_writeTableHeaderAt();
+  test_writePackedNumbers();
+  test_writePackedDoubles();
+  test_writeFloat();
+  test_fitsFloat();
+  test_writeFloatPrefersIntegers();
+  test_writeBitsetAndSpans();
+  test_writeShaped();
+  test_writeColumns();
+  test_writePatch();
+  test_writeExtension();
+  test_writeLuaInteger();
 }
@@ -0,0 +1,311 @@
+/*
+* test_writer.cpp
+* Luabins header-only C++ writer tests
+* See copyright notice in luabins.h
+*/
+
+/*
+* WARNING: This suite is format-specific. Change it when format changes.
+*/
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "writer.hpp"
+
+#include "test.h"
+#include "util.h"
+
+/******************************************************************************/
+
+struct Point
+{
+  double x;
+  double y;
+  std::optional<std::string> name;
+};
+
+struct Node
+{
+  std::vector<Node> children;
+};
+
+namespace luabins
+{
+  template <>
+  struct Fields<Point>
+  {
+    template <typename Visitor>
+    static void visit(Visitor & v, const Point & p)
+    {
+      v("x", p.x);
+      v("y", p.y);
+      v("name", p.name);
+    }
+  };
+
+  template <>
+  struct Fields<Node>
+  {
+    template <typename Visitor>
+    static void visit(Visitor & v, const Node & n)
+    {
+      v("children", n.children);
+    }
+  };
+}
+
+typedef std::map<std::string, int> StringIntMap;
+typedef std::unordered_map<int, bool> IntBoolMap;
+typedef std::map<double, int> DoubleIntMap;
+typedef std::array<std::vector<int>, 1> NestedArray;
+
+static void check_data(
+    const std::string & actual,
+    const char * expected,
+    size_t expected_length
+  )
+{
+  if (
+      actual.size() != expected_length ||
+      std::memcmp(actual.data(), expected, expected_length) != 0
+    )
+  {
+    fprintf(stderr, "buffer mismatch\n");
+    fprintf(stderr, "actual:\n");
+    fprintbuf(
+        stderr,
+        reinterpret_cast<const unsigned char *>(actual.data()),
+        actual.size()
+      );
+    fprintf(stderr, "expected:\n");
+    fprintbuf(
+        stderr,
+        reinterpret_cast<const unsigned char *>(expected),
+        expected_length
+      );
+    exit(1);
+  }
+}
+
+static void check_result(int actual, int expected)
+{
+  if (actual != expected)
+  {
+    fprintf(
+        stderr,
+        "result mismatch: got %d, expected %d\n",
+        actual, expected
+      );
+    exit(1);
+  }
+}
+
+/******************************************************************************/
+
+TEST (test_writerSimple,
+{
+  static const char expected[] =
+    "\x06"
+    "-" "0" "1"
+    "N" "\x00\x00\x00\x00\x00\x00\x45\x40"
+    "S" "\x07\x00\x00\x00" "Luabins"
+    "S" "\x03\x00\x00\x00" "str";
+
+  std::string data;
+
+  check_result(
+      luabins::save(
+          data,
+          nullptr, false, true, 42, "Luabins", std::string("str")
+        ),
+      LUABINS_ESUCCESS
+    );
+  check_data(data, expected, sizeof(expected) - 1);
+})
+
+TEST (test_writerEmpty,
+{
+  std::string data;
+
+  check_result(luabins::save(data), LUABINS_ESUCCESS);
+  check_data(data, "\x00", 1);
+})
+
+TEST (test_writerAppend,
+{
+  std::vector<unsigned char> data;
+  luabins::VectorSink sink(data);
+  luabins::Writer<luabins::VectorSink> writer(sink);
+
+  check_result(writer.tuple(true), LUABINS_ESUCCESS);
+  check_result(writer.tuple_size(2), LUABINS_ESUCCESS);
+  check_result(writer.value(false), LUABINS_ESUCCESS);
+  check_result(writer.value(1.0), LUABINS_ESUCCESS);
+
+  check_data(
+      std::string(data.begin(), data.end()),
+      "\x01" "1" "\x02" "0" "N" "\x00\x00\x00\x00\x00\x00\xF0\x3F",
+      2 + 2 + 9
+    );
+})
+
+TEST (test_writerSequence,
+{
+  static const char expected[] =
+    "\x02"
+    "T" "\x02\x00\x00\x00" "\x00\x00\x00\x00"
+      "N" "\x00\x00\x00\x00\x00\x00\xF0\x3F" "1"
+      "N" "\x00\x00\x00\x00\x00\x00\x00\x40" "0"
+    "T" "\x01\x00\x00\x00" "\x00\x00\x00\x00"
+      "N" "\x00\x00\x00\x00\x00\x00\xF0\x3F"
+      "T" "\x00\x00\x00\x00" "\x00\x00\x00\x00";
+
+  std::vector<bool> flags;
+  NestedArray nested;
+  std::string data;
+
+  flags.push_back(true);
+  flags.push_back(false);
+
+  check_result(luabins::save(data, flags, nested), LUABINS_ESUCCESS);
+  check_data(data, expected, sizeof(expected) - 1);
+})
+
+TEST (test_writerMap,
+{
+  static const char expected[] =
+    "\x01"
+    "T" "\x00\x00\x00\x00" "\x02\x00\x00\x00"
+      "S" "\x01\x00\x00\x00" "a" "N" "\x00\x00\x00\x00\x00\x00\xF0\x3F"
+      "S" "\x01\x00\x00\x00" "b" "N" "\x00\x00\x00\x00\x00\x00\x00\x40";
+
+  StringIntMap values;
+  IntBoolMap hashed;
+  std::string data;
+
+  values["b"] = 2;
+  values["a"] = 1;
+
+  check_result(luabins::save(data, values), LUABINS_ESUCCESS);
+  check_data(data, expected, sizeof(expected) - 1);
+
+  hashed[1] = true;
+  data.clear();
+  check_result(luabins::save(data, hashed), LUABINS_ESUCCESS);
+  check_data(
+      data,
+      "\x01"
+      "T" "\x00\x00\x00\x00" "\x01\x00\x00\x00"
+        "N" "\x00\x00\x00\x00\x00\x00\xF0\x3F" "1",
+      1 + 9 + 9 + 1
+    );
+})
+
+TEST (test_writerStruct,
+{
+  static const char expected[] =
+    "\x01"
+    "T" "\x00\x00\x00\x00" "\x02\x00\x00\x00"
+      "S" "\x01\x00\x00\x00" "x" "N" "\x00\x00\x00\x00\x00\x00\xF0\x3F"
+      "S" "\x01\x00\x00\x00" "y" "N" "\x00\x00\x00\x00\x00\x00\x00\x40";
+
+  Point p;
+  std::string data;
+
+  p.x = 1;
+  p.y = 2;
+
+  /* Empty optional field is omitted */
+  check_result(luabins::save(data, p), LUABINS_ESUCCESS);
+  check_data(data, expected, sizeof(expected) - 1);
+
+  p.name = "pt";
+  data.clear();
+  check_result(
+      luabins::save(data, p, std::string_view("sv")),
+      LUABINS_ESUCCESS
+    );
+  check_data(
+      data,
+      "\x02"
+      "T" "\x00\x00\x00\x00" "\x03\x00\x00\x00"
+        "S" "\x01\x00\x00\x00" "x" "N" "\x00\x00\x00\x00\x00\x00\xF0\x3F"
+        "S" "\x01\x00\x00\x00" "y" "N" "\x00\x00\x00\x00\x00\x00\x00\x40"
+        "S" "\x04\x00\x00\x00" "name" "S" "\x02\x00\x00\x00" "pt"
+      "S" "\x02\x00\x00\x00" "sv",
+      1 + 9 + 2 * (6 + 9) + 9 + 7 + 7
+    );
+})
+
+TEST (test_writerOptional,
+{
+  /* Holes in sequences are skipped, top level empty optional is nil */
+  static const char expected[] =
+    "\x02"
+    "T" "\x01\x00\x00\x00" "\x00\x00\x00\x00"
+      "N" "\x00\x00\x00\x00\x00\x00\x00\x40" "1"
+    "-";
+
+  std::vector<std::optional<bool> > values(2);
+  std::string data;
+
+  values[1] = true;
+
+  check_result(
+      luabins::save(data, values, std::optional<int>()),
+      LUABINS_ESUCCESS
+    );
+  check_data(data, expected, sizeof(expected) - 1);
+})
+
+TEST (test_writerErrors,
+{
+  std::string data;
+
+  /* Table key can't be NaN */
+  {
+    DoubleIntMap values;
+    values[std::sqrt(-1.0)] = 1;
+
+    check_result(luabins::save(data, values), LUABINS_EBADDATA);
+    check_data(data, "", 0);
+  }
+
+  /* Nesting is too deep */
+  {
+    Node root;
+    Node * node = &root;
+    int i = 0;
+
+    /* Each node is two tables: the node itself and its children */
+    for (i = 1; i < luabins::MaxTableNesting / 2; ++i)
+    {
+      node->children.resize(1);
+      node = &node->children[0];
+    }
+
+    check_result(luabins::save(data, root), LUABINS_ESUCCESS);
+
+    data.clear();
+    node->children.resize(1);
+    check_result(luabins::save(data, root), LUABINS_ETOODEEP);
+    check_data(data, "", 0);
+  }
+})
+
+/******************************************************************************/
+
+void test_writer()
+{
+  test_writerSimple();
+  test_writerEmpty();
+  test_writerAppend();
+  test_writerSequence();
+  test_writerMap();
+  test_writerStruct();
+  test_writerOptional();
+  test_writerErrors();
+}
@@ -4,6 +4,20 @@
 * See copyright notice in luabins.h
 */
 
+#ifndef _POSIX_C_SOURCE
+  #define _POSIX_C_SOURCE 200809L /* getpid() */
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__unix__) || (defined(__APPLE__) && defined(__MACH__))
+  #include <unistd.h>
+  #define lbsT_pid() ((long)getpid())
+#else
+  #define lbsT_pid() (0L)
+#endif
+
 #include "util.h"
 
 void fprintbuf(FILE * out, const unsigned char * b, size_t len)
@@ -15,3 +29,76 @@ void fprintbuf(FILE * out, const unsigned char * b, size_t len)
   }
   fprintf(out, "\n");
 }
+
+void check_result(const char * what, int actual, int expected)
+{
+  if (actual != expected)
+  {
+    fprintf(
+        stderr,
+        "%s: result mismatch: got %d, expected %d\n",
+        what, actual, expected
+      );
+    exit(1);
+  }
+}
+
+void make_path(char * buf, const char * name)
+{
+  const char * dir = getenv("TMPDIR");
+  if (dir == NULL || strlen(dir) > 200)
+  {
+    dir = "/tmp";
+  }
+
+  sprintf(buf, "%s/luabins-%s-%ld.bin", dir, name, lbsT_pid());
+}
+
+void check_file(
+    const char * path,
+    const unsigned char * expected,
+    size_t expected_len
+  )
+{
+  unsigned char * buf = (unsigned char *)malloc(expected_len + 1);
+  size_t len = 0;
+  FILE * f = fopen(path, "rb");
+  if (buf == NULL || f == NULL)
+  {
+    fprintf(stderr, "can't read %s\n", path);
+    exit(1);
+  }
+
+  len = fread(buf, 1, expected_len + 1, f);
+  fclose(f);
+
+  if (len != expected_len || memcmp(buf, expected, expected_len) != 0)
+  {
+    fprintf(
+        stderr,
+        "%s: data mismatch (%lu bytes, expected %lu)\n",
+        path,
+        (unsigned long)len,
+        (unsigned long)expected_len
+      );
+    exit(1);
+  }
+
+  free(buf);
+}
+
+void check_finished_job(
+    const char * what,
+    int finished,
+    int result,
+    int expected_result
+  )
+{
+  if (!finished)
+  {
+    fprintf(stderr, "%s is not finished\n", what);
+    exit(1);
+  }
+
+  check_result(what, result, expected_result);
+}
@@ -11,4 +11,28 @@
 
 void fprintbuf(FILE * out, const unsigned char * b, size_t len);
 
+/* Exits with error message if actual result is not expected */
+void check_result(const char * what, int actual, int expected);
+
+/* Fills buf with unique file path in temporary directory */
+void make_path(char * buf, const char * name);
+
+/* Exits with error message if file at path does not hold expected data */
+void check_file(
+    const char * path,
+    const unsigned char * expected,
+    size_t expected_len
+  );
+
+/*
+* Exits with error message if background job (see bgsave.h
+* and asyncwrite.h) is not finished, or finished with other result.
+*/
+void check_finished_job(
+    const char * what,
+    int finished,
+    int result,
+    int expected_result
+  );
+
 #endif /* LUABINS_TEST_UTIL_H_INCLUDED_ */